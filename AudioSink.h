@@ -0,0 +1,46 @@
+/**
+ *  AudioSink.h
+ *  ===========================================================================
+ *  The decoder side of AudioStream, as an interface.
+ *       - VS1053 implements it on the board; anything that paces itself
+ *         with a data request line and takes 32 byte bursts can stand in,
+ *         e.g. a simulated decoder draining at a fixed byte rate.
+ *       - Only the calls the feeder thread makes are here, so the stream
+ *         never depends on SCI registers; recover() is the one way it
+ *         can reset the chip, after a send that DREQ never allowed.
+ *       - One of four hardware seams, with SongVolume (storage),
+ *         DisplayLink (the uLCD's serial line) and Controls (inputs);
+ *         host/ builds the player code against stand-ins for all four.
+ */
+
+#ifndef AUDIO_SINK_H_
+#define AUDIO_SINK_H_
+
+#include "mbed.h"
+
+/** Class AudioSink. Flow controlled destination for compressed audio. */
+class AudioSink {
+public:
+    virtual ~AudioSink() {}
+
+    /** @return Non-zero when at least 32 more bytes can be sent without blocking. */
+    virtual bool readyForData() = 0;
+
+    /** Sleep until the sink wants data or the timeout expires.
+     *  @return Non-zero when the sink is ready on return.
+     */
+    virtual bool waitForData(Kernel::Clock::duration_u32 timeout) = 0;
+
+    /** Send one burst of at most 32 bytes.
+     *  @return Data length successfully sent, short when the sink stopped
+     *          asking for data partway.
+     */
+    virtual size_t sendDataBlock(char* data, size_t length) = 0;
+
+    /** Reset a sink that stopped asking for data, after a short send.
+     *  @return Zero when it didn't come back.
+     */
+    virtual bool recover() = 0;
+};
+
+#endif
@@ -0,0 +1,477 @@
+/**
+ *  AudioStream.cpp
+ *  ===========================================================================
+ *  Producer/consumer pipeline between the SD card and the VS1053.
+ */
+
+#include "mbed.h"
+#include "AudioStream.h"
+#include "Stats.h"
+#include <cstring>
+
+// DREQ low this long with data waiting means the decoder has stopped, not that its
+// FIFO is full: 32 bytes drain in well under this at any bitrate the chip plays
+static const auto DECODER_STALL = 250ms;
+
+// The ring lives in the first AHB SRAM bank so it doesn't eat into the 32 KB
+// of main SRAM that the heap, the track list and the thread stacks share.
+static char ringPool[AudioStream::BLOCK_COUNT][AudioStream::BLOCK_SIZE]
+    __attribute__((section("AHBSRAM0"), aligned(4)));
+
+/** Constructor of class AudioStream. */
+AudioStream::AudioStream()
+:
+    sink(nullptr),
+    fs(nullptr),
+    // Audio above storage above the UI thread, so a redraw never delays the decoder
+    reader(osPriorityAboveNormal, OS_STACK_SIZE, nullptr, "sd-reader"),
+    // Highest priority, but it sleeps on DREQ almost all of the time
+    feeder(osPriorityHigh, 1024, nullptr, "vs-feeder"),
+    changed(lock),
+    head(0),
+    tail(0),
+    count(0),
+    drained(0),
+    file(nullptr),
+    size(0),
+    readSize(0),
+    readOffset(0),
+    readTrack(0),
+    playTrack(0),
+    advances(0),
+    hasNext(false),
+    reading(false),
+    feeding(false),
+    paused(false),
+    endOfFile(false),
+    starved(true),
+    minCount(BLOCK_COUNT),
+    underrunCount(0),
+    resetCount(0)
+{
+    for (size_t i = 0; i < BLOCK_COUNT; i++) {
+        blocks[i].data = ringPool[i];
+        blocks[i].length = 0;
+        blocks[i].offset = 0;
+        blocks[i].track = 0;
+    }
+    nextPath[0] = '\0';
+    nextOffset = 0;
+}
+
+/** Destructor of class AudioStream. */
+AudioStream::~AudioStream() {
+    close();
+}
+
+/** Launch the SD reader and decoder feeder threads.
+ *  Call once the file system is mounted and the sink (VS1053) is initialized.
+ *  Songs are read sector by sector from fileSystem's device, or through stdio
+ *  when it is null.
+ */
+void AudioStream::start(AudioSink& output, SongVolume* fileSystem) {
+    sink = &output;
+    fs = fileSystem;
+    reader.start(callback(this, &AudioStream::readerTask));
+    feeder.start(callback(this, &AudioStream::feederTask));
+}
+
+/** Open a song and start buffering it from the given byte offset.
+ *  @return Zero at failure, non-zero at success.
+ */
+bool AudioStream::open(const char* path, uint32_t offset) {
+    close();
+
+    // Nothing refers to the files while none is open
+    StreamFile* f = &files[0];
+    if (!f->open(fs, path, offset)) {
+        return false;
+    }
+
+    lock.lock();
+    file = f;
+    size = readSize = f->size();
+    readOffset = offset;
+    playTrack = ++readTrack;
+    advances = 0;
+    endOfFile = false;
+    paused = false;
+    starved = true;  // the ring is still priming, not underrunning
+    minCount = BLOCK_COUNT;
+    underrunCount = 0;
+    changed.notify_all();
+    lock.unlock();
+    return true;
+}
+
+/** Stop buffering and close the current song. Buffered data is dropped. */
+void AudioStream::close() {
+    lock.lock();
+    // Wait for an in-flight fread() or SDI burst before resetting the ring
+    while (reading || feeding) {
+        changed.wait();
+    }
+    StreamFile* f = file;
+    file = nullptr;
+    head = tail = count = drained = 0;
+    endOfFile = false;
+    hasNext = false;
+    lock.unlock();
+
+    if (f) {
+        f->close();
+    }
+}
+
+/** Restart the open song at offset, dropping whatever is buffered.
+ *  Pause first and flush the decoder before resuming, so no stale data
+ *  reaches VS1053 after the jump.
+ *  @return Zero when the reader has already moved on to the queued song
+ *          or offset is past the end, non-zero at success.
+ */
+bool AudioStream::seek(uint32_t offset) {
+    lock.lock();
+    while (reading || feeding) {
+        changed.wait();
+    }
+    bool ok = file && readTrack == playTrack && offset < size && file->seek(offset);
+    if (ok) {
+        head = tail = count = drained = 0;
+        readOffset = offset;
+        endOfFile = false;
+        starved = true;  // priming again, not an underrun
+        changed.notify_all();
+    }
+    lock.unlock();
+    return ok;
+}
+
+/** Have listener called whenever the feeder crosses into the queued song or
+ *  the open song runs out. It is called from the stream threads with the
+ *  stream locked, so it must only post an event and return.
+ */
+void AudioStream::attach(Callback<void()> listener) {
+    lock.lock();
+    this->listener = listener;
+    lock.unlock();
+}
+
+/** Tell the listener when the last block of the song has been fed. Called with the lock held. */
+void AudioStream::notifyIfDone() {
+    if (endOfFile && count == 0 && listener) {
+        listener();
+    }
+}
+
+/** Stop or resume handing data to VS1053. Buffering continues while paused. */
+void AudioStream::setPaused(bool pause) {
+    lock.lock();
+    paused = pause;
+    changed.notify_all();
+    lock.unlock();
+}
+
+/** Queue the song that follows the open one. The reader opens it and starts
+ *  buffering as soon as the current file is fully read, and the feeder runs
+ *  straight on into it without a decoder reset, from offset onwards.
+ *  @return Zero at failure (nothing open, or path too long), non-zero at success.
+ */
+bool AudioStream::queueNext(const char* path, uint32_t offset) {
+    if (strlen(path) >= MAX_PATH) {
+        return false;
+    }
+    lock.lock();
+    bool ok = file != nullptr;
+    if (ok) {
+        strcpy(nextPath, path);
+        nextOffset = offset;
+        hasNext = true;
+        // The reader may already be parked at the end of the current file
+        endOfFile = false;
+        changed.notify_all();
+    }
+    lock.unlock();
+    return ok;
+}
+
+/** Report that the feeder has crossed into the queued song.
+ *  position() and fileSize() describe the new song from then on.
+ *  @return Non-zero once per crossed track boundary.
+ */
+bool AudioStream::trackAdvanced() {
+    lock.lock();
+    bool advanced = advances > 0;
+    if (advanced) {
+        advances--;
+    }
+    lock.unlock();
+    return advanced;
+}
+
+/** Push buffered data into VS1053 for as long as DREQ stays high.
+ *  @return Number of bytes sent.
+ */
+size_t AudioStream::feed() {
+    size_t sent = 0;
+
+    while (sink->readyForData()) {
+        lock.lock();
+        if (!file || paused || count == 0) {
+            // A pause holds DREQ high on purpose, only an empty ring mid-song is an underrun
+            if (file && count == 0 && !paused && !endOfFile && !starved) {
+                underrunCount++;
+                starved = true;
+            }
+            lock.unlock();
+            break;
+        }
+        // Filled blocks are never touched by the reader, so send unlocked
+        Block& block = blocks[tail];
+        if (block.track != playTrack) {
+            // First bytes of the queued song, which is the one being read
+            playTrack = block.track;
+            size = readSize;
+            advances++;
+            if (listener) {
+                listener();
+            }
+        }
+        size_t done = drained;
+        feeding = true;
+        lock.unlock();
+
+        bool stalled = false;
+        while (done < block.length && sink->readyForData()) {
+            size_t n = block.length - done < 32 ? block.length - done : 32;
+            size_t put = sink->sendDataBlock(block.data + done, n);
+            done += put;
+            sent += put;
+            if (put < n) {
+                stalled = true;  // DREQ never rose, the decoder has stopped taking data
+                break;
+            }
+        }
+        if (stalled) {
+            // Still marked as feeding, so close() and seek() wait for the reset
+            recoverSink();
+        }
+
+        lock.lock();
+        feeding = false;
+        starved = false;
+        drained = done;
+        if (drained == block.length) {
+            tail = (tail + 1) % BLOCK_COUNT;
+            count--;
+            drained = 0;
+            if (count < minCount && !endOfFile) {  // running out at the end is no shortfall
+                minCount = count;
+            }
+            notifyIfDone();
+        }
+        changed.notify_all();
+        lock.unlock();
+    }
+    return sent;
+}
+
+/** Reset a decoder that stopped taking data. Called from the feeder thread
+ *  with the lock released and feeding set, so nothing else touches the ring.
+ */
+void AudioStream::recoverSink() {
+    STATS_COUNT(DECODER_RESET);
+    sink->recover();
+    lock.lock();
+    resetCount++;
+    lock.unlock();
+}
+
+/** @return Non-zero once the whole file, and no queued song after it,
+ *  has been handed to VS1053.
+ */
+bool AudioStream::finished() {
+    lock.lock();
+    bool done = endOfFile && count == 0;
+    lock.unlock();
+    return done;
+}
+
+/** @return File offset of the next byte VS1053 will receive. */
+uint32_t AudioStream::position() {
+    lock.lock();
+    uint32_t pos;
+    if (count && blocks[tail].track == playTrack) {
+        pos = blocks[tail].offset + drained;
+    } else if (readTrack == playTrack) {
+        pos = readOffset;
+    } else {
+        // Everything of the playing song is sent, the ring holds the next one
+        pos = size;
+    }
+    lock.unlock();
+    return pos;
+}
+
+/** @return Size of the current song in bytes. */
+uint32_t AudioStream::fileSize() {
+    return size;
+}
+
+/** @return Number of filled blocks waiting in the ring. */
+size_t AudioStream::bufferedBlocks() {
+    lock.lock();
+    size_t n = count;
+    lock.unlock();
+    return n;
+}
+
+/** @return Lowest ring depth seen since the current song was opened, before its last block was read. */
+size_t AudioStream::minBufferedBlocks() {
+    return minCount;
+}
+
+/** @return Times the decoder asked for data while the ring was empty. */
+uint32_t AudioStream::underruns() {
+    return underrunCount;
+}
+
+/** @return Times the feeder had to reset a decoder that stopped taking data. */
+uint32_t AudioStream::decoderResets() {
+    return resetCount;
+}
+
+/** Reader thread body. Refills free blocks whenever a song is open. */
+void AudioStream::readerTask() {
+    while (true) {
+        lock.lock();
+        while (!file || endOfFile || count == BLOCK_COUNT) {
+            changed.wait();
+        }
+        Block& block = blocks[head];
+        StreamFile* f = file;
+        block.offset = readOffset;
+        block.track = readTrack;
+        reading = true;
+        lock.unlock();
+
+        // The slot is outside [tail, tail + count), so feed() won't read it
+        STATS_BEGIN(readStart);
+        size_t n = f->read(block.data, BLOCK_SIZE);
+        STATS_END(SD_READ, readStart);
+
+        lock.lock();
+        if (n == 0 && hasNext) {
+            // Swap to the queued song while the feeder drains the rest of this one
+            char path[MAX_PATH];
+            strcpy(path, nextPath);
+            uint32_t start = nextOffset;
+            hasNext = false;
+            lock.unlock();
+
+            // The file not being read is free; open() falls back to 0 past the end
+            StreamFile* next = f == &files[0] ? &files[1] : &files[0];
+            bool opened = next->open(fs, path, start);
+            if (opened && start >= next->size()) {
+                start = 0;
+            }
+            // Close the old file while still marked as reading, so close() and open()
+            // on the UI thread can't reuse its slot underneath us
+            if (opened) {
+                f->close();
+            }
+
+            lock.lock();
+            reading = false;
+            if (opened) {
+                file = next;
+                readSize = next->size();
+                readOffset = start;
+                readTrack++;
+            } else {
+                // Let the current song end normally, the player moves on by itself
+                endOfFile = true;
+                notifyIfDone();
+            }
+            changed.notify_all();
+            lock.unlock();
+            continue;
+        }
+        reading = false;
+        if (n == 0) {
+            endOfFile = true;
+            notifyIfDone();
+        } else {
+            block.length = n;
+            readOffset += n;
+            head = (head + 1) % BLOCK_COUNT;
+            count++;
+        }
+        changed.notify_all();
+        lock.unlock();
+    }
+}
+
+/** @return True when the feeder has nothing to send: no song, paused, played
+ *          out, or the ring still priming. A first block on its own would all go
+ *          into the decoder's FIFO and leave the ring empty while the next one
+ *          is read. Called with the lock held.
+ */
+bool AudioStream::idle() {
+    if (!file || paused) {
+        return true;
+    }
+    if (endOfFile) {
+        return count == 0;
+    }
+    return starved && count < PRIME_COUNT;
+}
+
+/** Feeder thread body. Sleeps until there is both data and room for it,
+ *  and resets a decoder that holds DREQ low for DECODER_STALL with data waiting.
+ */
+void AudioStream::feederTask() {
+    Timer lowFor;  // DREQ low with data waiting, since the last time it was high
+    while (true) {
+        lock.lock();
+        if (idle()) {
+            // Not asking for data, so DREQ being low says nothing about the decoder
+            lowFor.stop();
+            lowFor.reset();
+        }
+        while (idle()) {
+            changed.wait();
+        }
+        lock.unlock();
+
+        // Sleep on the DREQ interrupt rather than spinning while the FIFO is full
+        if (sink->waitForData(10ms)) {
+            lowFor.stop();
+            lowFor.reset();
+            if (feed() == 0) {
+                // Ring ran dry with DREQ high, wait for the reader's next block
+                lock.lock();
+                while (file && !paused && count == 0 && !endOfFile) {
+                    changed.wait();
+                }
+                lock.unlock();
+            }
+        } else {
+            lowFor.start();
+            if (lowFor.elapsed_time() >= DECODER_STALL) {
+                lowFor.stop();
+                lowFor.reset();
+                lock.lock();
+                bool waiting = file && !paused && count > 0;
+                feeding = waiting;
+                lock.unlock();
+                if (waiting) {
+                    recoverSink();
+                    lock.lock();
+                    feeding = false;
+                    changed.notify_all();
+                    lock.unlock();
+                }
+            }
+        }
+    }
+}
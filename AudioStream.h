@@ -0,0 +1,98 @@
+/**
+ *  AudioStream.h
+ *  ===========================================================================
+ *  Producer/consumer pipeline between the SD card and the VS1053.
+ *       - A reader thread keeps a ring of large blocks filled from the file,
+ *         read as whole sectors straight from the card (see StreamFile).
+ *       - A feeder thread sleeps until DREQ rises and then drains the ring
+ *         into the decoder, so a slow SD read or LCD redraw no longer
+ *         stalls the FIFO and the UI thread never waits on VS1053.
+ *       - A queued next song is opened and buffered as soon as the current
+ *         file has been read, so songs follow each other without a gap.
+ *       - A decoder that stops raising DREQ, mid-burst or while data waits,
+ *         is reset through AudioSink::recover() and fed on from the next byte.
+ */
+
+#ifndef AUDIO_STREAM_H_
+#define AUDIO_STREAM_H_
+
+#include "mbed.h"
+#include "AudioSink.h"
+#include "StreamFile.h"
+#include <cstdio>
+
+/** Class AudioStream. Buffers a song file ahead of the decoder. */
+class AudioStream {
+public:
+    static const size_t BLOCK_SIZE  = 2048;
+    static const size_t BLOCK_COUNT = 6;
+    static const size_t PRIME_COUNT = BLOCK_COUNT / 2;  // blocks read before feeding starts or resumes
+    static const size_t MAX_PATH    = 128;
+
+    AudioStream();
+    ~AudioStream();
+    void start(AudioSink& output, SongVolume* fileSystem = nullptr);
+    bool open(const char* path, uint32_t offset = 0);
+    void close();
+    bool seek(uint32_t offset);
+    void setPaused(bool paused);
+    void attach(Callback<void()> listener);
+    bool queueNext(const char* path, uint32_t offset = 0);
+    bool trackAdvanced();
+    bool finished();
+    uint32_t position();
+    uint32_t fileSize();
+    size_t bufferedBlocks();
+    size_t minBufferedBlocks();
+    uint32_t underruns();
+    uint32_t decoderResets();
+
+private:
+    struct Block {
+        char*    data;
+        size_t   length;
+        uint32_t offset;  // file offset of data[0]
+        uint32_t track;   // which opened file the data came from
+    };
+
+    size_t feed();
+    void recoverSink();
+    void notifyIfDone();
+    bool idle();
+    void readerTask();
+    void feederTask();
+
+    AudioSink*        sink;
+    SongVolume*       fs;
+    Callback<void()>  listener;  // told when trackAdvanced() or finished() may have changed
+    Thread            reader;
+    Thread            feeder;
+    Mutex             lock;
+    ConditionVariable changed;
+    Block             blocks[BLOCK_COUNT];
+    size_t            head;      // next block the reader fills
+    size_t            tail;      // next block feed() drains
+    size_t            count;     // filled blocks waiting in the ring
+    size_t            drained;   // bytes of blocks[tail] already sent
+    StreamFile        files[2];  // the song being read and the queued one
+    StreamFile*       file;      // one of files, null when nothing is open
+    uint32_t          size;       // of the song being fed
+    uint32_t          readSize;   // of the song being read
+    uint32_t          readOffset;
+    uint32_t          readTrack;  // track tag of the file being read
+    uint32_t          playTrack;  // track tag of the data being fed
+    uint32_t          advances;   // track boundaries fed but not yet reported
+    char              nextPath[MAX_PATH];
+    uint32_t          nextOffset;
+    bool              hasNext;
+    bool              reading;   // reader is inside fread() on a free block
+    bool              feeding;   // feeder is sending blocks[tail] unlocked
+    bool              paused;
+    bool              endOfFile;
+    bool              starved;
+    size_t            minCount;
+    uint32_t          underrunCount;
+    uint32_t          resetCount;
+};
+
+#endif
@@ -0,0 +1,168 @@
+/**
+ *  Benchmark.cpp
+ *  ===========================================================================
+ *  Boot time measurements of the links the player depends on.
+ */
+
+#include "mbed.h"
+#include "Benchmark.h"
+#include "AudioStream.h"
+#include "StreamFile.h"
+#include <cstdio>
+
+// Enough of a song to get past the first FAT cluster lookups
+static const uint32_t SD_BYTES = 256 * 1024;
+// The highest MP3 bitrate the player has to sustain
+static const uint32_t SONG_BITS = 320000;
+
+static char readBuffer[AudioStream::BLOCK_SIZE];
+
+static uint32_t elapsedUs(Timer& timer) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(timer.elapsed_time()).count();
+}
+
+/** Constructor of class Benchmark. */
+Benchmark::Benchmark(VS1053& audio, uLCD_4DGL& lcd, SongVolume* fs)
+:
+    audio(audio),
+    lcd(lcd),
+    fs(fs)
+{
+}
+
+/** Read the start of a file in chunk sized freads.
+ *  @return Sustained rate in bytes per second, 0 when the file can't be read.
+ */
+uint32_t Benchmark::sdRead(const char* path, size_t chunk, uint32_t& worstUs) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        return 0;
+    }
+    Timer total, one;
+    uint32_t bytes = 0;
+    worstUs = 0;
+    total.start();
+    while (bytes < SD_BYTES) {
+        one.reset();
+        one.start();
+        size_t n = fread(readBuffer, 1, chunk, f);
+        one.stop();
+        if (n == 0) {
+            break;
+        }
+        bytes += n;
+        if (elapsedUs(one) > worstUs) {
+            worstUs = elapsedUs(one);
+        }
+    }
+    total.stop();
+    fclose(f);
+    uint32_t us = elapsedUs(total);
+    return us ? (uint64_t)bytes * 1000000 / us : 0;
+}
+
+/** Read the start of a file in ring block sized StreamFile reads, from an
+ *  unaligned offset as after an ID3 tag, so the bounced first sector counts.
+ *  @return Sustained rate in bytes per second, 0 when the file can't be mapped.
+ */
+uint32_t Benchmark::sdDirect(const char* path, uint32_t& worstUs) {
+    StreamFile file;
+    worstUs = 0;
+    if (!file.open(fs, path, 1000) || !file.isDirect()) {
+        return 0;
+    }
+    Timer total, one;
+    uint32_t bytes = 0;
+    total.start();
+    while (bytes < SD_BYTES) {
+        one.reset();
+        one.start();
+        size_t n = file.read(readBuffer, AudioStream::BLOCK_SIZE);
+        one.stop();
+        if (n == 0) {
+            break;
+        }
+        bytes += n;
+        if (elapsedUs(one) > worstUs) {
+            worstUs = elapsedUs(one);
+        }
+    }
+    total.stop();
+    uint32_t us = elapsedUs(total);
+    return us ? (uint64_t)bytes * 1000000 / us : 0;
+}
+
+/** Time one UI drawing action until the screen has acknowledged all of it. */
+void Benchmark::lcdAction(const char* name, LcdAction action) {
+    Timer timer;
+    lcd.wait_idle();
+    int bytes = lcd.bytes;
+    int commands = lcd.commands;
+    timer.start();
+    switch (action) {
+    case CLEAR:
+        lcd.cls();
+        break;
+    case TEXT_LINE:
+        lcd.locate(0, 6);
+        lcd.color(WHITE);
+        lcd.printf("%-17s", "0123456789abcdefg");
+        break;
+    case PROGRESS_BAR:
+        lcd.filled_rectangle(0, 68, 127, 72, GREEN);
+        break;
+    case ONE_CHAR:
+        // Only one character differs, so the text shadow sends a single putc
+        lcd.locate(0, 6);
+        lcd.printf("%-17s", "0123456789abcdefX");
+        break;
+    }
+    lcd.wait_idle();
+    timer.stop();
+    printf("  %-16s %6lu us %4d bytes %3d commands\r\n", name, (unsigned long)elapsedUs(timer),
+           lcd.bytes - bytes, lcd.commands - commands);
+}
+
+/** Run every measurement and print a report. songPath is read, never changed. */
+void Benchmark::run(const char* songPath) {
+    printf("Benchmark: %s\r\n", songPath);
+    runStorage(songPath);
+    runDisplay();
+}
+
+/** SD read rates against the SDI rate, and the headroom the slower leaves a 320 kbit/s song. */
+void Benchmark::runStorage(const char* songPath) {
+    uint32_t worstSmall, worstBlock;
+    uint32_t small = sdRead(songPath, 32, worstSmall);
+    uint32_t block = sdRead(songPath, AudioStream::BLOCK_SIZE, worstBlock);
+    uint32_t worstDirect;
+    uint32_t direct = sdDirect(songPath, worstDirect);
+    // The audio reader uses the direct path whenever the song could be mapped
+    uint32_t sd = direct ? direct : block;
+    uint32_t worstSd = direct ? worstDirect : worstBlock;
+    uint32_t sdi = audio.dataRate() / 8;
+    uint32_t link = sd < sdi ? sd : sdi;
+    // Playing time held by a full ring, against the slowest block the card delivered
+    uint32_t ringMs = (uint64_t)AudioStream::BLOCK_SIZE * AudioStream::BLOCK_COUNT * 8 * 1000 / SONG_BITS;
+
+    printf("  SD fread 32 B    %7lu B/s, worst %lu us\r\n", (unsigned long)small, (unsigned long)worstSmall);
+    printf("  SD fread %-4u    %7lu B/s, worst %lu us\r\n", (unsigned)AudioStream::BLOCK_SIZE,
+           (unsigned long)block, (unsigned long)worstBlock);
+    printf("  SD direct %-4u   %7lu B/s, worst %lu us\r\n", (unsigned)AudioStream::BLOCK_SIZE,
+           (unsigned long)direct, (unsigned long)worstDirect);
+    printf("  VS1053 SDI       %7lu B/s\r\n", (unsigned long)sdi);
+    printf("  Headroom at %lu kbit/s: %lu.%02lux, ring %lu ms vs worst read %lu ms\r\n",
+           (unsigned long)(SONG_BITS / 1000), (unsigned long)(link * 8 / SONG_BITS),
+           (unsigned long)(link * 8 % SONG_BITS * 100 / SONG_BITS), (unsigned long)ringMs,
+           (unsigned long)(worstSd / 1000));
+}
+
+/** Time and bytes of the UI's common drawing actions at the link's current rate. */
+void Benchmark::runDisplay() {
+    printf("  uLCD at %d baud\r\n", lcd.current_baudrate());
+    lcdAction("clear screen", CLEAR);
+    lcdAction("text line", TEXT_LINE);
+    lcdAction("progress bar", PROGRESS_BAR);
+    lcdAction("one char change", ONE_CHAR);
+    lcd.cls();
+}
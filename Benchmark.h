@@ -0,0 +1,46 @@
+/**
+ *  Benchmark.h
+ *  ===========================================================================
+ *  Boot time measurements of the links the player depends on.
+ *       - SD: sustained fread rate at the old 32 byte and the ring block
+ *         size, the direct sector read rate, and the slowest block read.
+ *       - Headroom: the slower of SD and SDI against a 320 kbit/s song,
+ *         and how long the ring lasts against the slowest block read.
+ *       - uLCD: time and bytes for the UI's common drawing actions.
+ *       - Built on the board only when mbed_app.json sets "benchmark" to 1,
+ *         so numbers come from the real drivers instead of trial and error.
+ *       - Runs during boot before the scanner and the audio reader start,
+ *         so the SD figures are for a card with no other user.
+ *       - host/bench runs the same measurements against the simulated
+ *         card, decoder and screen, and adds the audio feed under load.
+ */
+
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+#include "mbed.h"
+#include "VS1053.h"
+#include "uLCD_4DGL.h"
+#include "SongVolume.h"
+
+/** Class Benchmark. Prints its results on the USB serial console. */
+class Benchmark {
+public:
+    Benchmark(VS1053& audio, uLCD_4DGL& lcd, SongVolume* fs = nullptr);
+    void run(const char* songPath);
+    void runStorage(const char* songPath);
+    void runDisplay();
+
+private:
+    enum LcdAction { CLEAR, TEXT_LINE, PROGRESS_BAR, ONE_CHAR };
+
+    uint32_t sdRead(const char* path, size_t chunk, uint32_t& worstUs);
+    uint32_t sdDirect(const char* path, uint32_t& worstUs);
+    void lcdAction(const char* name, LcdAction action);
+
+    VS1053&           audio;
+    uLCD_4DGL&        lcd;
+    SongVolume*       fs;
+};
+
+#endif
@@ -0,0 +1,306 @@
+/**
+ *  BlockCache.cpp
+ *  ===========================================================================
+ *  Sector cache with read-ahead, wrapped around the SD block device.
+ */
+
+#include "mbed.h"
+#include "BlockCache.h"
+#include <cstring>
+
+// The audio ring has AHBSRAM0; this bank is otherwise unused without Ethernet
+static char pool[BlockCache::SLOTS][BlockCache::SECTOR]
+    __attribute__((section("AHBSRAM1"), aligned(4)));
+
+/** Constructor of class BlockCache. device is the card, e.g. an SDBlockDevice. */
+BlockCache::BlockCache(BlockDevice* device)
+:
+    device(device),
+    useClock(0),
+    nextSector(0),
+    hitCount(0),
+    missCount(0),
+    prefetchCount(0),
+    bypassCount(0),
+    songs(*this)
+{
+    memset(slots, 0, sizeof(slots));
+}
+
+/** Initialize the card and start with an empty cache. @return 0 on success. */
+int BlockCache::init() {
+    lock.lock();
+    memset(slots, 0, sizeof(slots));
+    useClock = 0;
+    lock.unlock();
+    return device->init();
+}
+
+/** Deinitialize the card. @return 0 on success. */
+int BlockCache::deinit() {
+    lock.lock();
+    memset(slots, 0, sizeof(slots));
+    lock.unlock();
+    return device->deinit();
+}
+
+/** @return Slot holding sector, or -1. Called with the lock held. */
+int BlockCache::find(uint32_t sector) {
+    for (size_t i = 0; i < SLOTS; i++) {
+        if (slots[i].lastUse && slots[i].sector == sector) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/** @return The empty or least recently used slot. Called with the lock held. */
+size_t BlockCache::oldestSlot() {
+    size_t oldest = 0;
+    for (size_t i = 1; i < SLOTS && slots[oldest].lastUse; i++) {
+        if (slots[i].lastUse < slots[oldest].lastUse) {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+/** @return First slot of the READ_AHEAD aligned run whose newest sector is
+ *          the oldest of all runs. Called with the lock held.
+ */
+size_t BlockCache::oldestRun() {
+    size_t best = 0;
+    uint32_t bestNewest = 0xffffffff;
+    for (size_t run = 0; run < SLOTS; run += READ_AHEAD) {
+        uint32_t newest = 0;
+        for (size_t i = run; i < run + READ_AHEAD; i++) {
+            newest = slots[i].lastUse > newest ? slots[i].lastUse : newest;
+        }
+        if (newest < bestNewest) {
+            bestNewest = newest;
+            best = run;
+        }
+    }
+    return best;
+}
+
+/** Copy one sector out of the cache, filling it from the card on a miss.
+ *  Called with the lock held. @return 0 on success, the card's error otherwise.
+ */
+int BlockCache::readSector(char* buffer, uint32_t sector) {
+    int slot = find(sector);
+    bool sequential = sector == nextSector;
+    nextSector = sector + 1;
+    if (slot >= 0) {
+        hitCount++;
+        slots[slot].lastUse = ++useClock;
+        memcpy(buffer, pool[slot], SECTOR);
+        return 0;
+    }
+    missCount++;
+
+    uint32_t last = size() / SECTOR;
+    if (sequential && sector + READ_AHEAD <= last) {
+        // Looks like a walk through a directory, the FAT or a small file: fetch ahead
+        size_t run = oldestRun();
+        for (size_t i = 0; i < READ_AHEAD; i++) {
+            int copy = find(sector + i);
+            if (copy >= 0) {
+                slots[copy].lastUse = 0;  // keep a single copy of every sector
+            }
+        }
+        int err = device->read(pool[run], (bd_addr_t)sector * SECTOR, READ_AHEAD * SECTOR);
+        if (err) {
+            for (size_t i = run; i < run + READ_AHEAD; i++) {
+                slots[i].lastUse = 0;
+            }
+            return err;
+        }
+        for (size_t i = 0; i < READ_AHEAD; i++) {
+            slots[run + i].sector = sector + i;
+            slots[run + i].lastUse = ++useClock;
+        }
+        prefetchCount += READ_AHEAD - 1;
+        memcpy(buffer, pool[run], SECTOR);
+        return 0;
+    }
+
+    size_t victim = oldestSlot();
+    slots[victim].lastUse = 0;
+    int err = device->read(pool[victim], (bd_addr_t)sector * SECTOR, SECTOR);
+    if (err) {
+        return err;
+    }
+    slots[victim].sector = sector;
+    slots[victim].lastUse = ++useClock;
+    memcpy(buffer, pool[victim], SECTOR);
+    return 0;
+}
+
+/** Read whole sectors; single sectors through the cache, longer reads straight from the card.
+ *  @return 0 on success, the card's error otherwise.
+ */
+int BlockCache::read(void* buffer, bd_addr_t addr, bd_size_t size) {
+    if (size > SECTOR) {
+        return bypass(buffer, addr, size);
+    }
+    lock.lock();
+    int err = readSector(static_cast<char*>(buffer), addr / SECTOR);
+    lock.unlock();
+    return err;
+}
+
+/** Read straight from the card. Nothing in the cache is touched, so the lock is only
+ *  held for the count and a FatFs lookup can be served from the cache meanwhile.
+ *  @return 0 on success, the card's error otherwise.
+ */
+int BlockCache::bypass(void* buffer, bd_addr_t addr, bd_size_t size) {
+    lock.lock();
+    bypassCount++;
+    lock.unlock();
+    return device->read(buffer, addr, size);
+}
+
+/** @return The card with every read bypassing the cache, for song data. */
+BlockDevice* BlockCache::uncached() {
+    return &songs;
+}
+
+/** Forget every cached sector in a range. Called with the lock held. */
+void BlockCache::invalidate(bd_addr_t addr, bd_size_t size) {
+    uint32_t first = addr / SECTOR;
+    uint32_t end = (addr + size + SECTOR - 1) / SECTOR;
+    for (size_t i = 0; i < SLOTS; i++) {
+        if (slots[i].lastUse && slots[i].sector >= first && slots[i].sector < end) {
+            slots[i].lastUse = 0;
+        }
+    }
+}
+
+/** Write through to the card. @return 0 on success, the card's error otherwise. */
+int BlockCache::program(const void* buffer, bd_addr_t addr, bd_size_t size) {
+    lock.lock();
+    invalidate(addr, size);
+    int err = device->program(buffer, addr, size);
+    lock.unlock();
+    return err;
+}
+
+/** Erase on the card. @return 0 on success, the card's error otherwise. */
+int BlockCache::erase(bd_addr_t addr, bd_size_t size) {
+    lock.lock();
+    invalidate(addr, size);
+    int err = device->erase(addr, size);
+    lock.unlock();
+    return err;
+}
+
+/** Trim on the card. @return 0 on success, the card's error otherwise. */
+int BlockCache::trim(bd_addr_t addr, bd_size_t size) {
+    lock.lock();
+    invalidate(addr, size);
+    int err = device->trim(addr, size);
+    lock.unlock();
+    return err;
+}
+
+/** Nothing is held back, writes are already on the card. */
+int BlockCache::sync() {
+    return device->sync();
+}
+
+bd_size_t BlockCache::get_read_size() const {
+    return device->get_read_size();
+}
+
+bd_size_t BlockCache::get_program_size() const {
+    return device->get_program_size();
+}
+
+bd_size_t BlockCache::get_erase_size() const {
+    return device->get_erase_size();
+}
+
+bd_size_t BlockCache::get_erase_size(bd_addr_t addr) const {
+    return device->get_erase_size(addr);
+}
+
+int BlockCache::get_erase_value() const {
+    return device->get_erase_value();
+}
+
+bd_size_t BlockCache::size() const {
+    return device->size();
+}
+
+const char* BlockCache::get_type() const {
+    return device->get_type();
+}
+
+/** Constructor of class Uncached. owner is the cache it reads past. */
+BlockCache::Uncached::Uncached(BlockCache& owner)
+:
+    owner(owner)
+{
+}
+
+/** The card belongs to the cache, which initializes it. @return 0. */
+int BlockCache::Uncached::init() {
+    return 0;
+}
+
+/** @return 0, the cache deinitializes the card. */
+int BlockCache::Uncached::deinit() {
+    return 0;
+}
+
+/** Read past the cache, whatever the size. @return 0 on success, the card's error otherwise. */
+int BlockCache::Uncached::read(void* buffer, bd_addr_t addr, bd_size_t size) {
+    return owner.bypass(buffer, addr, size);
+}
+
+/** Write through the cache, so it drops what the write covers. @return 0 on success. */
+int BlockCache::Uncached::program(const void* buffer, bd_addr_t addr, bd_size_t size) {
+    return owner.program(buffer, addr, size);
+}
+
+bd_size_t BlockCache::Uncached::get_read_size() const {
+    return owner.get_read_size();
+}
+
+bd_size_t BlockCache::Uncached::get_program_size() const {
+    return owner.get_program_size();
+}
+
+bd_size_t BlockCache::Uncached::size() const {
+    return owner.size();
+}
+
+const char* BlockCache::Uncached::get_type() const {
+    return owner.get_type();
+}
+
+/** @return Single sector reads served from the cache. */
+uint32_t BlockCache::hits() {
+    return hitCount;
+}
+
+/** @return Single sector reads that had to go to the card. */
+uint32_t BlockCache::misses() {
+    return missCount;
+}
+
+/** @return Sectors fetched ahead of being asked for. */
+uint32_t BlockCache::prefetched() {
+    return prefetchCount;
+}
+
+/** @return Reads passed straight to the card: multi sector ones and all of uncached()'s. */
+uint32_t BlockCache::bypassed() {
+    return bypassCount;
+}
+
+/** Zero the counters, e.g. before timing a library scan. */
+void BlockCache::resetCounters() {
+    hitCount = missCount = prefetchCount = bypassCount = 0;
+}
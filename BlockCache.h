@@ -0,0 +1,100 @@
+/**
+ *  BlockCache.h
+ *  ===========================================================================
+ *  Sector cache with read-ahead, wrapped around the SD block device.
+ *       - FatFs reads metadata (FAT, directories) and small file reads one
+ *         sector at a time; those go through 32 cached sectors kept in the
+ *         second AHB SRAM bank, evicting the least recently used.
+ *       - A miss right after the previous single sector read is taken as a
+ *         sequential walk and fetches READ_AHEAD sectors in one multi block
+ *         read, into a run of slots that were used least recently.
+ *       - Multi sector reads (song data, straight into a caller's buffer)
+ *         bypass the cache so they don't flush it, and don't hold the cache
+ *         lock while the card works; the card has its own.
+ *       - uncached() is the same card with every read bypassing, for the
+ *         audio reader, whose part sector reads would otherwise be taken
+ *         as a walk and fetch ahead sectors no one asks for again.
+ *       - Writes go through to the card and drop the sectors they cover.
+ */
+
+#ifndef BLOCK_CACHE_H_
+#define BLOCK_CACHE_H_
+
+#include "mbed.h"
+#include "BlockDevice.h"
+
+/** Class BlockCache. Read caching BlockDevice wrapper for 512 byte sectors. */
+class BlockCache : public BlockDevice {
+public:
+    static const size_t SECTOR     = 512;
+    static const size_t SLOTS      = 32;  // 16 KB, all of AHBSRAM1
+    static const size_t READ_AHEAD = 8;   // sectors per sequential fetch, divides SLOTS
+
+    BlockCache(BlockDevice* device);
+
+    virtual int init();
+    virtual int deinit();
+    virtual int read(void* buffer, bd_addr_t addr, bd_size_t size);
+    virtual int program(const void* buffer, bd_addr_t addr, bd_size_t size);
+    virtual int erase(bd_addr_t addr, bd_size_t size);
+    virtual int trim(bd_addr_t addr, bd_size_t size);
+    virtual int sync();
+    virtual bd_size_t get_read_size() const;
+    virtual bd_size_t get_program_size() const;
+    virtual bd_size_t get_erase_size() const;
+    virtual bd_size_t get_erase_size(bd_addr_t addr) const;
+    virtual int get_erase_value() const;
+    virtual bd_size_t size() const;
+    virtual const char* get_type() const;
+
+    BlockDevice* uncached();
+
+    uint32_t hits();
+    uint32_t misses();
+    uint32_t prefetched();
+    uint32_t bypassed();
+    void resetCounters();
+
+private:
+    /** The cached card seen past its cache: reads bypass, writes still invalidate. */
+    class Uncached : public BlockDevice {
+    public:
+        Uncached(BlockCache& owner);
+        virtual int init();
+        virtual int deinit();
+        virtual int read(void* buffer, bd_addr_t addr, bd_size_t size);
+        virtual int program(const void* buffer, bd_addr_t addr, bd_size_t size);
+        virtual bd_size_t get_read_size() const;
+        virtual bd_size_t get_program_size() const;
+        virtual bd_size_t size() const;
+        virtual const char* get_type() const;
+
+    private:
+        BlockCache& owner;
+    };
+
+    struct Slot {
+        uint32_t sector;
+        uint32_t lastUse;  // useClock value of the last hit or fill, 0 when empty
+    };
+
+    int readSector(char* buffer, uint32_t sector);
+    int bypass(void* buffer, bd_addr_t addr, bd_size_t size);
+    int find(uint32_t sector);
+    size_t oldestSlot();
+    size_t oldestRun();
+    void invalidate(bd_addr_t addr, bd_size_t size);
+
+    BlockDevice* device;
+    Mutex        lock;       // FatFs and the audio reader use the card from different threads
+    Slot         slots[SLOTS];
+    uint32_t     useClock;
+    uint32_t     nextSector;  // sector after the last single sector read
+    uint32_t     hitCount;
+    uint32_t     missCount;
+    uint32_t     prefetchCount;
+    uint32_t     bypassCount;
+    Uncached     songs;
+};
+
+#endif
@@ -0,0 +1,94 @@
+/**
+ *  Buttons.cpp
+ *  ===========================================================================
+ *  Navigation switch, menu button and volume knob, as the player's Controls.
+ *
+ *  Everything except attach() runs in interrupt context: pin edges and
+ *  timeouts only touch the switch state and call the handler, so a held
+ *  button never delays the audio threads the way sleep-polling the pins did.
+ */
+
+#include "mbed.h"
+#include "Buttons.h"
+
+constexpr std::chrono::milliseconds Buttons::DEBOUNCE;
+constexpr std::chrono::milliseconds Buttons::HOLD_TIME;
+constexpr std::chrono::milliseconds Buttons::REPEAT_TIME;
+
+/** Constructor of class Buttons. Key pins are switches to ground, knob is the potentiometer's wiper. */
+Buttons::Buttons(PinName up, PinName down, PinName left, PinName right, PinName center, PinName menu,
+                 PinName knob)
+:
+    switches{ { up, *this, NAV_UP }, { down, *this, NAV_DOWN }, { left, *this, NAV_LEFT },
+              { right, *this, NAV_RIGHT }, { center, *this, NAV_CENTER }, { menu, *this, MENU_BUTTON } },
+    knob(knob)
+{
+}
+
+/** Hand an event to the attached handler. Interrupt context. */
+void Buttons::post(Key key, Action action, bool held) {
+    Event event;
+    event.key = key;
+    event.action = action;
+    event.held = held;
+    if (handler) {
+        handler(event);
+    }
+}
+
+/** Deliver events to handler as they happen.
+ *  handler runs in interrupt context, so it must not block.
+ */
+void Buttons::attach(Callback<void(const Event&)> handler) {
+    this->handler = handler;
+}
+
+/** @return Knob position, 0.0 (full volume) to 1.0. */
+float Buttons::volume() {
+    return knob.read();
+}
+
+/** Constructor of class Switch. Starts listening on both edges. */
+Buttons::Switch::Switch(PinName pin, Buttons& owner, Key key)
+:
+    input(pin, PullUp),
+    owner(owner),
+    key(key),
+    down(false),
+    wasHeld(false)
+{
+    input.rise(callback(this, &Switch::edge));
+    input.fall(callback(this, &Switch::edge));
+}
+
+/** Either edge: wait for the contacts to stop bouncing before looking. */
+void Buttons::Switch::edge() {
+    debounce.attach(callback(this, &Switch::settle), DEBOUNCE);
+}
+
+/** The pin has been quiet for DEBOUNCE, act on a real change of level. */
+void Buttons::Switch::settle() {
+    bool closed = input.read() == 0;
+    if (closed == down) {
+        return;  // a glitch shorter than the debounce time
+    }
+    down = closed;
+    if (closed) {
+        wasHeld = false;
+        repeat.attach(callback(this, &Switch::held), HOLD_TIME);
+        owner.post(key, PRESS);
+    } else {
+        repeat.detach();
+        owner.post(key, RELEASE, wasHeld);
+    }
+}
+
+/** Hold and repeat timer: HOLD once, then REPEAT until released. */
+void Buttons::Switch::held() {
+    if (!down) {
+        return;
+    }
+    repeat.attach(callback(this, &Switch::held), REPEAT_TIME);
+    owner.post(key, wasHeld ? REPEAT : HOLD);
+    wasHeld = true;
+}
@@ -0,0 +1,61 @@
+/**
+ *  Buttons.h
+ *  ===========================================================================
+ *  Navigation switch, menu button and volume knob, as the player's Controls.
+ *       - Each switch has an InterruptIn; an edge only (re)arms a short
+ *         timeout, and the level is trusted once it has been stable for
+ *         DEBOUNCE, so contact bounce produces a single press.
+ *       - A switch held for HOLD_TIME sends HOLD, then REPEAT every
+ *         REPEAT_TIME until it is released.
+ *       - Events go to the attached handler from interrupt context, so
+ *         nothing ever sleeps or spins on a pin; the player queues them
+ *         for its UI thread. Events before attach() are dropped.
+ *       - The knob is a potentiometer on an analog pin, read on demand.
+ */
+
+#ifndef BUTTONS_H_
+#define BUTTONS_H_
+
+#include "mbed.h"
+#include "Controls.h"
+
+/** Class Buttons. Debounced, interrupt driven switch events. */
+class Buttons : public Controls {
+public:
+    static constexpr std::chrono::milliseconds DEBOUNCE    = 20ms;
+    static constexpr std::chrono::milliseconds HOLD_TIME   = 400ms;
+    static constexpr std::chrono::milliseconds REPEAT_TIME = 150ms;
+
+    Buttons(PinName up, PinName down, PinName left, PinName right, PinName center, PinName menu,
+            PinName knob);
+    virtual void attach(Callback<void(const Event&)> handler);
+    virtual float volume();
+
+private:
+    /** One switch to ground with the internal pull-up, closed reads 0. */
+    class Switch {
+    public:
+        Switch(PinName pin, Buttons& owner, Key key);
+
+    private:
+        void edge();
+        void settle();
+        void held();
+
+        InterruptIn input;
+        Timeout     debounce;
+        Timeout     repeat;
+        Buttons&    owner;
+        Key         key;
+        volatile bool down;
+        volatile bool wasHeld;
+    };
+
+    void post(Key key, Action action, bool held = false);
+
+    Callback<void(const Event&)> handler;
+    Switch                       switches[KEY_COUNT];
+    AnalogIn                     knob;
+};
+
+#endif
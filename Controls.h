@@ -0,0 +1,43 @@
+/**
+ *  Controls.h
+ *  ===========================================================================
+ *  The player's inputs, as an interface.
+ *       - Buttons implements it on the board: the navigation switch and
+ *         menu button as events, and the volume knob on an analog pin.
+ *       - A script of events and knob positions can stand in on a host.
+ */
+
+#ifndef CONTROLS_H_
+#define CONTROLS_H_
+
+#include "mbed.h"
+
+/** Class Controls. Key events and the volume setting. */
+class Controls {
+public:
+    enum Key { NAV_UP, NAV_DOWN, NAV_LEFT, NAV_RIGHT, NAV_CENTER, MENU_BUTTON, KEY_COUNT };
+    enum Action {
+        PRESS,    // debounced closing edge
+        HOLD,     // still closed after the hold time
+        REPEAT,   // every repeat time after HOLD
+        RELEASE   // debounced opening edge
+    };
+
+    struct Event {
+        uint8_t key;
+        uint8_t action;
+        bool    held;  // RELEASE only: HOLD was sent for this press
+    };
+
+    virtual ~Controls() {}
+
+    /** Deliver events to handler as they happen. handler may be called
+     *  from interrupt context, so it must not block. Events before attach() are dropped.
+     */
+    virtual void attach(Callback<void(const Event&)> handler) = 0;
+
+    /** @return Volume knob position, 0.0 (full volume) to 1.0. */
+    virtual float volume() = 0;
+};
+
+#endif
@@ -0,0 +1,49 @@
+/**
+ *  DisplayLink.h
+ *  ===========================================================================
+ *  The serial line under uLCD_4DGL, as an interface.
+ *       - UartLink implements it on the board with a BufferedSerial and the
+ *         screen's reset pin; a 4DGL emulator can stand in on a host.
+ *       - The calls are the BufferedSerial ones the driver always used,
+ *         so its pacing and ACK window work the same against either.
+ */
+
+#ifndef DISPLAY_LINK_H_
+#define DISPLAY_LINK_H_
+
+#include "mbed.h"
+
+/** Class DisplayLink. Byte link to a 4DGL screen, plus its reset line. */
+class DisplayLink {
+public:
+    virtual ~DisplayLink() {}
+
+    /** Queue bytes for the screen, blocking only while the transmit buffer is full.
+     *  @return Bytes queued.
+     */
+    virtual ssize_t write(const void* data, size_t length) = 0;
+
+    /** Read answers from the screen, blocking until at least one byte is there.
+     *  @return Bytes read.
+     */
+    virtual ssize_t read(void* data, size_t length) = 0;
+
+    /** @return Non-zero when an answer byte can be read without blocking. */
+    virtual bool readable() = 0;
+
+    /** Have func called, from the receive interrupt on the board, when answer
+     *  bytes come in; like BufferedSerial's, it may also come for no new byte.
+     */
+    virtual void sigio(Callback<void()> func) = 0;
+
+    /** Change the line rate on this side only. */
+    virtual void set_baud(int baud) = 0;
+
+    /** Block until every queued byte has left for the screen. @return 0. */
+    virtual int sync() = 0;
+
+    /** Drive the screen's reset line, 0 holds it in reset. */
+    virtual void reset_line(int level) = 0;
+};
+
+#endif
@@ -0,0 +1,385 @@
+/**
+ *  Library.cpp
+ *  ===========================================================================
+ *  In-memory music library: a folder tree with the playable tracks in it.
+ *
+ *  Memory per track is one 12 byte record plus the file name and its
+ *  terminator in the pool. Pool chunks and record tables are charged against
+ *  one budget shared by every Library, sized at boot from the free heap, so
+ *  a long card can't take the heap the threads and open files need.
+ */
+
+#include "mbed.h"
+#include "Library.h"
+#include <cstring>
+
+// Bytes all libraries hold in pool chunks and record tables, at most budgetBytes
+static uint32_t reservedBytes;
+static uint32_t budgetBytes;
+
+/** Set the heap all libraries together may use. Call at boot, before the first add. */
+void Library::setBudget(size_t bytes) {
+    budgetBytes = bytes;
+}
+
+/** @return The heap all libraries together may use. */
+size_t Library::budget() {
+    return budgetBytes;
+}
+
+/** Constructor of class Library. */
+Library::Library(const char* rootPath)
+:
+    root(rootPath),
+    poolUsed(POOL_CHUNK),
+    held(0),
+    isFull(false),
+    tooLong(0)
+{
+    clear();
+}
+
+/** Destructor of class Library. */
+Library::~Library() {
+    for (size_t i = 0; i < pool.size(); i++) {
+        delete[] pool[i];
+    }
+    core_util_atomic_decr_u32(&reservedBytes, held);
+}
+
+/** Drop every track and folder except the root.
+ *  Names returned earlier by trackName() and folderName() become invalid.
+ */
+void Library::clear() {
+    lock.lock();
+    for (size_t i = 0; i < pool.size(); i++) {
+        delete[] pool[i];
+    }
+    std::vector<char*>().swap(pool);
+    std::vector<Folder>().swap(folders);
+    std::vector<Track>().swap(tracks);
+    poolUsed = POOL_CHUNK;
+    core_util_atomic_decr_u32(&reservedBytes, held);
+    held = 0;
+    isFull = false;
+    tooLong = 0;
+
+    // The root has no name, so it needs no pool chunk
+    Folder top;
+    top.offset = 0;
+    top.length = 0;
+    top.parent = ROOT;
+    folders.push_back(top);
+    lock.unlock();
+}
+
+/** Charge bytes against the budget all libraries share. Called with the lock held.
+ *  transient more must fit for the moment, e.g. the old table while a vector grows.
+ *  @return Zero when they don't fit, which also marks the library full.
+ */
+bool Library::reserve(size_t bytes, size_t transient) {
+    uint32_t used = core_util_atomic_load_u32(&reservedBytes);
+    do {
+        if (used + bytes + transient > budgetBytes) {
+            isFull = true;
+            return false;
+        }
+    } while (!core_util_atomic_cas_u32(&reservedBytes, &used, used + bytes));
+    held += bytes;
+    return true;
+}
+
+/** Make sure one more record fits, growing the table RECORD_STEP at a time.
+ *  Called with the lock held. @return Zero when the budget is used up.
+ */
+template <typename T>
+bool Library::makeRoom(std::vector<T>& records) {
+    if (records.size() < records.capacity()) {
+        return true;
+    }
+    // Growing copies the table, so the old one has to fit next to the new one
+    if (!reserve(RECORD_STEP * sizeof(T), records.capacity() * sizeof(T))) {
+        return false;
+    }
+    records.reserve(records.capacity() + RECORD_STEP);
+    return true;
+}
+
+/** Copy a name into the pool, starting a new chunk when it doesn't fit.
+ *  Called with the lock held, length is below MAX_PATH.
+ *  @return Zero when a new chunk is over budget, otherwise offset is set to
+ *          the pool position of the stored, NUL terminated name.
+ */
+bool Library::storeName(const char* name, size_t length, uint32_t& offset) {
+    if (poolUsed + length + 1 > POOL_CHUNK) {
+        if (!reserve(POOL_CHUNK)) {
+            return false;
+        }
+        pool.push_back(new char[POOL_CHUNK]);
+        poolUsed = 0;
+    }
+    offset = (pool.size() - 1) * POOL_CHUNK + poolUsed;
+    char* dest = pool.back() + poolUsed;
+    memcpy(dest, name, length);
+    dest[length] = '\0';
+    poolUsed += length + 1;
+    return true;
+}
+
+/** @return Name stored at a pool offset. Called with the lock held. */
+const char* Library::name(uint32_t offset) {
+    return pool[offset / POOL_CHUNK] + offset % POOL_CHUNK;
+}
+
+/** @return Length of a folder's path below the music root, a "/" after
+ *          every name. Called with the lock held.
+ */
+size_t Library::pathLength(uint16_t folder) {
+    size_t length = 0;
+    for (; folder != ROOT; folder = folders[folder].parent) {
+        length += folders[folder].length + 1;
+    }
+    return length;
+}
+
+/** Add a sub folder below parent.
+ *  @return Id of the new folder, NO_FOLDER when its path is too long or the
+ *          library is full.
+ */
+uint16_t Library::addFolder(const char* name, uint16_t parent) {
+    size_t length = strlen(name);
+    uint32_t offset;
+    Folder folder;
+    folder.parent = parent;
+
+    lock.lock();
+    uint16_t id = NO_FOLDER;
+    if (root.size() + 1 + pathLength(parent) + length >= MAX_PATH || folders.size() >= NO_FOLDER) {
+        tooLong++;
+    } else if (makeRoom(folders) && storeName(name, length, offset)) {
+        folder.offset = offset;
+        folder.length = length;
+        folders.push_back(folder);
+        id = folders.size() - 1;
+    }
+    lock.unlock();
+    return id;
+}
+
+/** Append a track to the end of the list. Existing indices never move.
+ *  @return Zero when its path is too long or the library is full.
+ */
+bool Library::addTrack(const char* name, uint16_t folder, uint32_t size, uint32_t duration) {
+    size_t length = strlen(name);
+    uint32_t offset;
+    Track track;
+    track.folder = folder;
+    track.size = size;
+    track.duration = duration > 0xffff ? 0xffff : duration;
+
+    lock.lock();
+    bool added = false;
+    if (root.size() + 1 + pathLength(folder) + length >= MAX_PATH) {
+        tooLong++;
+    } else if (makeRoom(tracks) && storeName(name, length, offset)) {
+        track.offset = offset;
+        track.length = length;
+        tracks.push_back(track);
+        added = true;
+    }
+    lock.unlock();
+    return added;
+}
+
+/** @return Non-zero once an add was refused because the budget was used up. */
+bool Library::full() {
+    return isFull;
+}
+
+/** @return Folders and tracks left out because their path exceeds MAX_PATH. */
+size_t Library::skipped() {
+    return tooLong;
+}
+
+/** @return Number of tracks found so far. */
+size_t Library::trackCount() {
+    lock.lock();
+    size_t n = tracks.size();
+    lock.unlock();
+    return n;
+}
+
+/** Prepend the folders from folder up to the root, each followed by "/".
+ *  Called with the lock held.
+ */
+void Library::appendPath(std::string& path, uint16_t folder) {
+    if (folder == ROOT) {
+        return;
+    }
+    appendPath(path, folders[folder].parent);
+    path.append(name(folders[folder].offset), folders[folder].length);
+    path += '/';
+}
+
+/** @return Full path of track i, ready for fopen(). */
+std::string Library::trackPath(size_t i) {
+    lock.lock();
+    std::string path = root + "/";
+    appendPath(path, tracks[i].folder);
+    path.append(name(tracks[i].offset), tracks[i].length);
+    lock.unlock();
+    return path;
+}
+
+/** @return File name of track i without its folders. The text stays valid
+ *          until the library is cleared or swapped.
+ */
+const char* Library::trackName(size_t i) {
+    lock.lock();
+    const char* s = name(tracks[i].offset);
+    lock.unlock();
+    return s;
+}
+
+/** @return Folder that holds track i. */
+uint16_t Library::trackFolder(size_t i) {
+    lock.lock();
+    uint16_t folder = tracks[i].folder;
+    lock.unlock();
+    return folder;
+}
+
+/** @return Size of track i in bytes. */
+uint32_t Library::trackSize(size_t i) {
+    lock.lock();
+    uint32_t size = tracks[i].size;
+    lock.unlock();
+    return size;
+}
+
+/** @return Estimated length of track i in seconds, 0 if unknown. */
+uint32_t Library::trackDuration(size_t i) {
+    lock.lock();
+    uint32_t duration = tracks[i].duration;
+    lock.unlock();
+    return duration;
+}
+
+/** @return Path of track i below the music root, e.g. "Artist/Album/x.mp3". */
+std::string Library::trackRelativePath(size_t i) {
+    std::string path;
+    lock.lock();
+    appendPath(path, tracks[i].folder);
+    path.append(name(tracks[i].offset), tracks[i].length);
+    lock.unlock();
+    return path;
+}
+
+/** Look a track up by its path below the music root.
+ *  @return Track index, or -1 when it isn't in the library.
+ */
+int Library::findTrack(const std::string& path) {
+    int found = -1;
+    std::string candidate;
+    lock.lock();
+    for (size_t i = 0; i < tracks.size() && found < 0; i++) {
+        // Cheap reject on the file name before building the whole path
+        const Track& t = tracks[i];
+        if (t.length > path.size() ||
+            path.compare(path.size() - t.length, t.length, name(t.offset), t.length) != 0) {
+            continue;
+        }
+        candidate.clear();
+        appendPath(candidate, t.folder);
+        candidate.append(name(t.offset), t.length);
+        if (candidate == path) {
+            found = i;
+        }
+    }
+    lock.unlock();
+    return found;
+}
+
+/** @return Number of folders, including the root. */
+size_t Library::folderCount() {
+    lock.lock();
+    size_t n = folders.size();
+    lock.unlock();
+    return n;
+}
+
+/** @return Name of a folder, empty for the root. The text stays valid
+ *          until the library is cleared or swapped.
+ */
+const char* Library::folderName(uint16_t folder) {
+    if (folder == ROOT) {
+        return "";
+    }
+    lock.lock();
+    const char* s = name(folders[folder].offset);
+    lock.unlock();
+    return s;
+}
+
+/** @return Parent of a folder, the root is its own parent. */
+uint16_t Library::folderParent(uint16_t folder) {
+    lock.lock();
+    uint16_t parent = folders[folder].parent;
+    lock.unlock();
+    return parent;
+}
+
+/** @return Path of a folder below the music root, empty for the root. */
+std::string Library::folderPath(uint16_t folder) {
+    std::string path;
+    lock.lock();
+    appendPath(path, folder);
+    lock.unlock();
+    if (!path.empty()) {
+        path.resize(path.size() - 1);
+    }
+    return path;
+}
+
+/** FNV-1a hash over every track's relative path, in list order.
+ *  Two scans of an unchanged card give the same value.
+ */
+uint32_t Library::listingHash() {
+    uint32_t hash = 2166136261u;
+    std::string path;
+    lock.lock();
+    for (size_t i = 0; i < tracks.size(); i++) {
+        path.clear();
+        appendPath(path, tracks[i].folder);
+        path.append(name(tracks[i].offset), tracks[i].length);
+        // Include the terminator so entry boundaries are part of the hash
+        for (size_t c = 0; c <= path.size(); c++) {
+            hash ^= (uint8_t)path.c_str()[c];
+            hash *= 16777619u;
+        }
+    }
+    lock.unlock();
+    return hash;
+}
+
+/** @return FNV-1a hash of track i's relative path, a key that survives reordering. */
+uint32_t Library::trackHash(size_t i) {
+    uint32_t hash = 2166136261u;
+    std::string path = trackRelativePath(i);
+    for (size_t c = 0; c < path.size(); c++) {
+        hash ^= (uint8_t)path[c];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/** @return Bytes held by the track table: records plus the string pool. */
+size_t Library::memoryUsage() {
+    lock.lock();
+    size_t bytes = tracks.capacity() * sizeof(Track) +
+                   folders.capacity() * sizeof(Folder) +
+                   pool.capacity() * sizeof(char*) +
+                   pool.size() * POOL_CHUNK;
+    lock.unlock();
+    return bytes;
+}
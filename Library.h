@@ -0,0 +1,95 @@
+/**
+ *  Library.h
+ *  ===========================================================================
+ *  In-memory music library: a folder tree with the playable tracks in it.
+ *       - Folder 0 is the music root, every other folder names its parent.
+ *       - Names live once in a string pool; tracks and folders are small
+ *         fixed-size records pointing into it, so thousands of songs cost
+ *         a handful of large allocations instead of one per file name.
+ *       - Append-only while a scan runs and internally locked, so the menu
+ *         can page through it while the scanner thread is still adding.
+ *       - Every Library together stays under budget() bytes of heap, set
+ *         at boot from what is free; adds past that are refused and full()
+ *         says so.
+ *       - Names whose full path wouldn't fit MAX_PATH are refused rather
+ *         than cut short, since a shortened name opens nothing.
+ */
+
+#ifndef LIBRARY_H_
+#define LIBRARY_H_
+
+#include "mbed.h"
+#include <string>
+#include <vector>
+
+/** Class Library. Folder tree and track table shared between threads. */
+class Library {
+public:
+    static const uint16_t ROOT        = 0;
+    static const uint16_t NO_FOLDER   = 0xffff;
+    static const size_t   POOL_CHUNK  = 2048;       // names never straddle a chunk
+    static const size_t   RECORD_STEP = 32;         // records allocated at a time
+    static const size_t   MAX_PATH    = 128;        // full path, as AudioStream takes it
+
+    static void setBudget(size_t bytes);
+    static size_t budget();
+
+    Library(const char* rootPath);
+    ~Library();
+    void clear();
+    uint16_t addFolder(const char* name, uint16_t parent);
+    bool addTrack(const char* name, uint16_t folder, uint32_t size, uint32_t duration);
+    bool full();
+    size_t skipped();
+
+    size_t trackCount();
+    std::string trackPath(size_t i);
+    const char* trackName(size_t i);
+    uint16_t trackFolder(size_t i);
+    uint32_t trackSize(size_t i);
+    uint32_t trackDuration(size_t i);
+    std::string trackRelativePath(size_t i);
+    int findTrack(const std::string& path);
+    uint32_t listingHash();
+    uint32_t trackHash(size_t i);
+
+    size_t folderCount();
+    const char* folderName(uint16_t folder);
+    uint16_t folderParent(uint16_t folder);
+    std::string folderPath(uint16_t folder);
+
+    size_t memoryUsage();
+
+private:
+    struct Folder {
+        uint32_t offset : 24;  // name position in the pool
+        uint32_t length : 8;
+        uint16_t parent;
+    };
+    struct Track {
+        uint32_t offset : 24;  // name position in the pool
+        uint32_t length : 8;
+        uint32_t size;         // bytes
+        uint16_t folder;
+        uint16_t duration;     // seconds, from the WAV header or first MP3 frame, 0 if unknown
+    };
+
+    bool reserve(size_t bytes, size_t transient = 0);
+    template <typename T> bool makeRoom(std::vector<T>& records);
+    bool storeName(const char* name, size_t length, uint32_t& offset);
+    const char* name(uint32_t offset);
+    size_t pathLength(uint16_t folder);
+    void appendPath(std::string& path, uint16_t folder);
+
+    std::string         root;
+    Mutex               lock;
+    std::vector<char*>  pool;      // POOL_CHUNK sized blocks, never moved
+    size_t              poolUsed;  // bytes used in the last block
+    std::vector<Folder> folders;
+    std::vector<Track>  tracks;
+    size_t              held;      // bytes charged to the shared budget
+    bool                isFull;    // an add was refused for lack of memory
+    size_t              tooLong;   // names refused for their path length
+};
+
+#endif
@@ -0,0 +1,303 @@
+/**
+ *  LibraryScanner.cpp
+ *  ===========================================================================
+ *  Walks the card's Artist/Album folders and fills a Library.
+ */
+
+#include "mbed.h"
+#include "LibraryScanner.h"
+#include "SeekTable.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <dirent.h>
+#include <string>
+
+// Everything VS1053b decodes without a plugin in the mode the player sets;
+// FLAC needs VLSI's patch loaded and MP1/MP2 need SM_LAYER12, neither of which is done
+static const char* const TRACK_EXTENSIONS[] = {
+    "mp3", "ogg", "aac", "m4a", "wma", "wav", "mid", "midi"
+};
+
+/** Constructor of class LibraryScanner. */
+LibraryScanner::LibraryScanner(const char* rootPath)
+:
+    root(rootPath),
+    busy(false),
+    probes(0)
+{
+}
+
+/** @return Non-zero while scan() is running on some thread. */
+bool LibraryScanner::scanning() {
+    return busy;
+}
+
+// Lower case extension of name into ext, which holds 5. @return Zero when it has none that fits.
+static bool extension(const char* name, char* ext) {
+    const char* dot = strrchr(name, '.');
+    if (!dot || dot == name || strlen(dot + 1) > 4) {
+        return false;
+    }
+    size_t n = 0;
+    for (const char* c = dot + 1; *c; c++) {
+        ext[n++] = tolower((unsigned char)*c);
+    }
+    ext[n] = '\0';
+    return true;
+}
+
+// Little endian 32 bit value at p
+static uint32_t le32(const uint8_t* p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/** Check a file name against the formats VS1053 can play, ignoring case. */
+bool LibraryScanner::isTrackFile(const char* name) {
+    char ext[5];
+    if (!extension(name, ext)) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(TRACK_EXTENSIONS) / sizeof(TRACK_EXTENSIONS[0]); i++) {
+        if (strcmp(ext, TRACK_EXTENSIONS[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Estimate a song's length from what its format keeps up front: the RIFF
+ *  header of a WAV file, the first frame header of an MP3 (ID3 tagged or
+ *  named .mp3). Other formats aren't looked into, they would only be
+ *  searched for MPEG sync words that aren't there, or worse, that are.
+ *  @return Duration in seconds, or 0 when unknown.
+ */
+uint32_t LibraryScanner::probeDuration(FILE* file, uint32_t size, const char* name) {
+    uint8_t head[12];
+    fseek(file, 0, SEEK_SET);
+    if (fread(head, 1, sizeof(head), file) != sizeof(head)) {
+        return 0;
+    }
+    if (memcmp(head, "RIFF", 4) == 0 && memcmp(head + 8, "WAVE", 4) == 0) {
+        return wavDuration(file, size);
+    }
+    char ext[5];
+    if (memcmp(head, "ID3", 3) == 0 || (extension(name, ext) && strcmp(ext, "mp3") == 0)) {
+        return mpegDuration(file, size);
+    }
+    return 0;
+}
+
+/** Length of a WAV file from its fmt chunk's byte rate and its data chunk's size.
+ *  Walks at most 16 chunk headers past the RIFF header.
+ *  @return Duration in seconds, or 0 when either chunk is missing.
+ */
+uint32_t LibraryScanner::wavDuration(FILE* file, uint32_t size) {
+    uint8_t  chunk[16];
+    uint32_t byteRate = 0;
+    uint32_t pos = 12;
+    for (int i = 0; i < 16 && pos + 8 <= size; i++) {
+        fseek(file, pos, SEEK_SET);
+        if (fread(chunk, 1, 8, file) != 8) {
+            break;
+        }
+        uint32_t length = le32(chunk + 4);
+        if (memcmp(chunk, "fmt ", 4) == 0 && length >= 16 && fread(chunk, 1, 16, file) == 16) {
+            byteRate = le32(chunk + 8);  // after format, channels and sample rate
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            // A recorder that never came back to fill it in leaves the length too long
+            uint32_t data = std::min(length, size - pos - 8);
+            return byteRate ? data / byteRate : 0;
+        }
+        pos += 8 + length + (length & 1);  // chunks are padded to an even length
+    }
+    return 0;
+}
+
+/** Estimate a song's length from its first MPEG frame header.
+ *  Reads the ID3v2 header and at most 4 KB after it, never the whole file.
+ *  @return Duration in seconds, or 0 when no layer III frame was found.
+ */
+uint32_t LibraryScanner::mpegDuration(FILE* file, uint32_t size) {
+    uint8_t  buf[512];
+    uint32_t start = 0;
+
+    fseek(file, 0, SEEK_SET);
+    if (fread(buf, 1, 10, file) == 10 && memcmp(buf, "ID3", 3) == 0) {
+        // Tag size is a 28 bit syncsafe integer and excludes the 10 byte header
+        start = 10 + ((buf[6] & 0x7f) << 21 | (buf[7] & 0x7f) << 14 |
+                      (buf[8] & 0x7f) << 7 | (buf[9] & 0x7f));
+    }
+
+    for (uint32_t pos = start; pos < start + 4096 && pos < size; pos += sizeof(buf) - 3) {
+        fseek(file, pos, SEEK_SET);
+        size_t n = fread(buf, 1, sizeof(buf), file);
+        for (size_t i = 0; i + 3 < n; i++) {
+            SeekTable::Frame frame;
+            if (!SeekTable::parseHeader(buf + i, frame)) {
+                continue;
+            }
+            // Exact for CBR, a first-frame guess for VBR
+            return (size - (pos + i)) / (frame.kbps * 125);
+        }
+    }
+    return 0;
+}
+
+/** Walk the music root and append every playable file to library.
+ *  Folders deeper than MAX_DEPTH or with too long a path are skipped, and the
+ *  walk ends early once the library is full. With index, the one the library
+ *  is saved to next, each song's modification stamp is recorded for it, and
+ *  unchanged songs keep the duration the index was loaded with.
+ *  @return Number of tracks added.
+ */
+size_t LibraryScanner::scan(Library& library, TrackIndex* index) {
+    uint32_t hash;
+    bool reusing = index && index->beginReuse();  // zero on a cold boot, or with no readable index
+    size_t added = walk(&library, index, reusing, hash, 0);
+    if (reusing) {
+        index->endReuse();
+    }
+    return added;
+}
+
+/** @return Songs the last scan() opened to estimate their duration. */
+size_t LibraryScanner::probed() {
+    return probes;
+}
+
+/** Walk the music root like scan() does, but only hash what it would add.
+ *  hash covers the relative paths of the first limit tracks the same way
+ *  Library::listingHash() does, so an unchanged card gives the stored value.
+ *  @return Number of tracks scan() would add with memory to spare.
+ */
+size_t LibraryScanner::listing(uint32_t& hash, size_t limit) {
+    return walk(nullptr, nullptr, false, hash, limit);
+}
+
+/** Depth-first walk behind scan() and listing(). Without a library, names
+ *  are held to MAX_PATH here and no song is opened.
+ *  @return Number of tracks taken.
+ */
+size_t LibraryScanner::walk(Library* library, TrackIndex* index, bool reusing, uint32_t& hash, size_t limit) {
+    struct Level {
+        DIR*     dir;
+        uint16_t folder;
+        size_t   pathLength;  // length of path while inside this folder
+    };
+    Level  stack[MAX_DEPTH];
+    int    depth = 0;
+    size_t added = 0;
+    size_t rootLength = strlen(root);
+
+    hash = 2166136261u;
+    busy = true;
+    if (library) {
+        probes = 0;
+    }
+    std::string path = root;
+    stack[0].dir = opendir(root);
+    stack[0].folder = Library::ROOT;
+    stack[0].pathLength = path.size();
+    if (!stack[0].dir) {
+        busy = false;
+        return 0;
+    }
+
+    while (depth >= 0) {
+        Level& level = stack[depth];
+        struct dirent* ent = readdir(level.dir);
+        if (!ent) {
+            closedir(level.dir);
+            depth--;
+            continue;
+        }
+        // Skip ".", "..", our own index files and hidden system folders
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+        path.resize(level.pathLength);
+        path += "/";
+        path += ent->d_name;
+
+        if (ent->d_type == DT_DIR) {
+            if (depth + 1 >= MAX_DEPTH || (!library && path.size() >= Library::MAX_PATH)) {
+                continue;
+            }
+            DIR* sub = opendir(path.c_str());
+            if (!sub) {
+                continue;
+            }
+            uint16_t folder = library ? library->addFolder(ent->d_name, level.folder) : Library::ROOT;
+            if (folder == Library::NO_FOLDER) {
+                closedir(sub);
+                if (library->full()) {
+                    break;
+                }
+                continue;
+            }
+            depth++;
+            stack[depth].dir = sub;
+            stack[depth].folder = folder;
+            stack[depth].pathLength = path.size();
+            continue;
+        }
+        if (!isTrackFile(ent->d_name)) {
+            continue;
+        }
+
+        if (!library) {
+            if (path.size() >= Library::MAX_PATH) {
+                continue;
+            }
+            // Relative path and its terminator, as Library::listingHash() sees it
+            if (added < limit) {
+                for (size_t c = rootLength + 1; c <= path.size(); c++) {
+                    hash ^= (uint8_t)path.c_str()[c];
+                    hash *= 16777619u;
+                }
+            }
+            added++;
+            continue;
+        }
+
+        uint32_t size = 0, modified = 0, duration = 0;
+        bool known = false;
+        bool stamped = index && TrackIndex::stamp(path.c_str(), size, modified);
+        if (stamped && reusing) {
+            // Keyed as Library::trackHash() keys the relative path
+            uint32_t key = 2166136261u;
+            for (size_t c = rootLength + 1; c < path.size(); c++) {
+                key ^= (uint8_t)path[c];
+                key *= 16777619u;
+            }
+            known = index->reuse(key, size, modified, duration);
+        }
+        FILE* f = known ? nullptr : fopen(path.c_str(), "rb");
+        if (f) {
+            fseek(f, 0, SEEK_END);
+            long length = ftell(f);
+            if (stamped && (uint32_t)length != size) {
+                modified = 0;  // written to since the stamp, the next rebuild probes it again
+            }
+            size = length > 0 ? length : 0;
+            duration = probeDuration(f, size, ent->d_name);
+            fclose(f);
+            probes++;
+        }
+        if (library->addTrack(ent->d_name, level.folder, size, duration)) {
+            if (index) {
+                index->record(modified);
+            }
+            added++;
+        } else if (library->full()) {
+            break;
+        }
+    }
+    // Out of library memory, leave the folders still open behind
+    for (; depth >= 0; depth--) {
+        closedir(stack[depth].dir);
+    }
+    busy = false;
+    return added;
+}
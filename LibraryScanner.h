@@ -0,0 +1,52 @@
+/**
+ *  LibraryScanner.h
+ *  ===========================================================================
+ *  Walks the card's Artist/Album folders and fills a Library.
+ *       - Iterative depth-first walk with a fixed stack of open directories,
+ *         so deep or looping trees can't run the thread out of stack.
+ *       - Tracks are appended as they are found, so a menu can show the
+ *         first songs while the rest of the card is still being read.
+ *       - listing() walks the same way without storing anything, so a warm
+ *         boot can check the index against the card without a second copy
+ *         of the library.
+ *       - Durations come from the WAV header or the first MP3 frame; other
+ *         formats are added with theirs unknown rather than guessed.
+ *       - Given the index, scan() stamps each song for it as the walk
+ *         passes, takes the durations of songs whose size and stamp haven't
+ *         changed from the old index and only opens new or changed files.
+ */
+
+#ifndef LIBRARY_SCANNER_H_
+#define LIBRARY_SCANNER_H_
+
+#include "mbed.h"
+#include "Library.h"
+#include "TrackIndex.h"
+#include <cstdio>
+
+/** Class LibraryScanner. Recursive, bounded-depth directory walker. */
+class LibraryScanner {
+public:
+    static const int MAX_DEPTH = 8;  // music root counts as depth 0
+
+    LibraryScanner(const char* rootPath);
+    size_t scan(Library& library, TrackIndex* index = nullptr);
+    size_t listing(uint32_t& hash, size_t limit);
+    bool scanning();
+    size_t probed();
+
+    static bool isTrackFile(const char* name);
+    static uint32_t probeDuration(FILE* file, uint32_t size, const char* name);
+
+private:
+    static uint32_t wavDuration(FILE* file, uint32_t size);
+    static uint32_t mpegDuration(FILE* file, uint32_t size);
+
+    size_t walk(Library* library, TrackIndex* index, bool reusing, uint32_t& hash, size_t limit);
+
+    const char*   root;
+    volatile bool busy;
+    size_t        probes;  // songs the last scan() opened for their duration
+};
+
+#endif
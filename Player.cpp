@@ -0,0 +1,715 @@
+/**
+ *  Player.cpp
+ *  ===========================================================================
+ *  The player's screens and what the controls do on them, as a state machine.
+ */
+
+#include "mbed.h"
+#include "Player.h"
+#include "Stats.h"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+const int  Player::SEEK_STEP;
+const bool Player::AUTO_ADVANCE;
+
+// Constants for progress bar and song menu pages
+// change these for ulcd debugging
+static const int BAR_WIDTH = 128;
+static const int BAR_HEIGHT = 4;
+static const int BAR_Y = 72;
+static const int ITEMS_PER_PAGE = 10;  // number of songs per page in menu
+// Progress bar and volume refresh period while a song plays
+static const auto UI_TICK = 200ms;
+static const int TIME_ROW = 10;
+static const int VOLUME_ROW = 11;
+static const int VOLUME_STEP = 5;  // percent, hides potentiometer jitter
+static const int TEXT_COLUMNS = 18;  // of the 7x8 font across the glass
+static const int ARTIST_COLUMNS = 17;
+// Songs in a row that may fail to open before the player gives up and shows the menu
+static const int OPEN_TRIES = 3;
+static const uint32_t WAKE_FLAG = 1;
+
+/** Constructor of class Player. Nothing is drawn or attached until start(). */
+Player::Player(Controls& controls, VS1053& audio, uLCD_4DGL& lcd, AudioStream& stream, Library& library,
+               TrackTags& tags)
+:
+    controls(controls),
+    audio(audio),
+    uLCD(lcd),
+    stream(stream),
+    library(library),
+    trackTags(tags),
+    tickPending(false),
+    streamPending(false),
+    tagsPending(false),
+    libraryStale(false),
+    ready(false),
+    libraryCleared(0),
+    playerState(MENU),
+    scrubFrom(PLAYING),
+    track(0),
+    totalBytes(0),
+    lastVol(0xff),
+    formatShown(false),
+    titleTagged(false),
+    scrubTarget(-1),
+    selected(0),
+    shownCount(0),
+    shownReady(false),
+    menuTicks(0),
+    barFilled(0),
+    barWraps(0),
+    shownVolume(-1),
+    shownElapsed(-1),
+    shownRemaining(-1)
+{
+}
+
+/** Hook up the controls, the stream and the UI ticker, and show the song menu.
+ *  From here on everything happens in response to an event.
+ */
+void Player::start() {
+    controls.attach(callback(this, &Player::onButton));
+    stream.attach(callback(this, &Player::onStreamEvent));
+    trackTags.attach(callback(this, &Player::onTags));
+    uiTicker.attach(callback(this, &Player::onTick), UI_TICK);
+    enterMenu();
+}
+
+/** Handle events for good. */
+void Player::run() {
+    while (true) {
+        step(Kernel::wait_for_u32_forever);
+    }
+}
+
+/** Wait up to timeout for the next event and hand it to the current state.
+ *  @return Zero when no event came.
+ */
+bool Player::step(Kernel::Clock::duration_u32 timeout) {
+    Event event;
+    while (!events.pop(event)) {
+        if (wake.wait_any_for(WAKE_FLAG, timeout) & osFlagsError) {
+            return false;
+        }
+    }
+    if (event.type == EVENT_TICK) {
+        tickPending = false;
+        if (tickHandler) {
+            tickHandler();
+        }
+    } else if (event.type == EVENT_STREAM) {
+        streamPending = false;
+    } else if (event.type == EVENT_TAGS) {
+        tagsPending = false;
+    }
+    STATS_BEGIN(eventStart);
+    if (playerState == MENU) {
+        onMenuEvent(event);
+    } else {
+        onPlaybackEvent(event);
+    }
+    STATS_END(UI_EVENT, eventStart);
+    return true;
+}
+
+/** Call handler on the event thread every UI_TICK, e.g. to poll a console. */
+void Player::attachTick(Callback<void()> handler) {
+    tickHandler = handler;
+}
+
+/** Whether the library holds every song on the card, or more are still being found. */
+void Player::setLibraryReady(bool ready) {
+    this->ready = ready;
+}
+
+/** @return Non-zero once the library holds every song on the card. */
+bool Player::libraryReady() {
+    return ready;
+}
+
+/** The card no longer matches the library: have the menu drop the list once nothing
+ *  plays from it. Blocks until it has, the caller then fills it again.
+ *  Never call it from the event thread.
+ */
+void Player::replaceLibrary() {
+    libraryStale = true;
+    Event event;
+    event.type = EVENT_LIBRARY;
+    postEvent(event);
+    libraryCleared.acquire();
+}
+
+/** @return The screen the player is on. */
+Player::State Player::state() {
+    return playerState;
+}
+
+/** @return The song playing or paused, or the last one played in the menu. */
+int Player::currentTrack() {
+    return track;
+}
+
+/** @return The song highlighted in the menu. */
+int Player::selection() {
+    return selected;
+}
+
+// Queue an event for the event thread, safe from interrupts and any thread
+void Player::postEvent(const Event& event) {
+    if (events.full()) {
+        STATS_COUNT(EVENTS_DROPPED);
+        return;  // the event thread is far behind, drop rather than overwrite the oldest
+    }
+    events.push(event);
+    wake.set(WAKE_FLAG);
+}
+
+// Called from the button interrupts
+void Player::onButton(const Controls::Event& button) {
+    Event event;
+    event.type = EVENT_BUTTON;
+    event.button = button;
+    postEvent(event);
+}
+
+// Called from the stream threads with the stream locked, only queue the event here
+void Player::onStreamEvent() {
+    if (!streamPending) {
+        streamPending = true;
+        Event event;
+        event.type = EVENT_STREAM;
+        postEvent(event);
+    }
+}
+
+// Called from the tag reader's thread with a song's tags read; one redraw catches up on several
+void Player::onTags() {
+    if (!tagsPending) {
+        tagsPending = true;
+        Event event;
+        event.type = EVENT_TAGS;
+        postEvent(event);
+    }
+}
+
+// Called from the ticker interrupt every UI_TICK; a tick still queued isn't queued again
+void Player::onTick() {
+    if (!tickPending) {
+        tickPending = true;
+        Event event;
+        event.type = EVENT_TICK;
+        postEvent(event);
+    }
+}
+
+// Repeatedly called progress bar function
+// Only the sliver that changed since the last call is drawn, usually one column or none
+void Player::drawProgressBar(float percent) {
+    int filled = std::min(std::max(static_cast<int>(percent * BAR_WIDTH), 0), BAR_WIDTH);
+    if (uLCD.wraps != barWraps) {
+        // Text ran past the right edge and may have landed on the bar, repaint all of it
+        barWraps = uLCD.wraps;
+        uLCD.filled_rectangle(0, BAR_Y - BAR_HEIGHT, BAR_WIDTH - 1, BAR_Y, BLACK);
+        barFilled = 0;
+    }
+    if (filled > barFilled) {
+        uLCD.filled_rectangle(barFilled, BAR_Y - BAR_HEIGHT, filled - 1, BAR_Y, GREEN);
+    } else if (filled < barFilled) {
+        // Went backwards (resume from an earlier spot), blank the part we passed
+        uLCD.filled_rectangle(filled, BAR_Y - BAR_HEIGHT, barFilled - 1, BAR_Y, BLACK);
+    }
+    barFilled = filled;
+}
+
+// Elapsed time on the left and time left on the right, under the progress bar
+void Player::drawPlayTime(int elapsed, int remaining) {
+    if (elapsed == shownElapsed && remaining == shownRemaining) {
+        return;
+    }
+    shownElapsed = elapsed;
+    shownRemaining = remaining;
+    uLCD.locate(0, TIME_ROW);
+    uLCD.color(WHITE);
+    uLCD.printf("%2d:%02d      -%2d:%02d", elapsed / 60, elapsed % 60, remaining / 60, remaining % 60);
+}
+
+// Volume as a percentage under the progress bar, text only changes when the knob moves a step
+void Player::drawVolume(float knob) {
+    int volume = static_cast<int>(knob * 100 / VOLUME_STEP + 0.5f) * VOLUME_STEP;
+    if (volume == shownVolume) {
+        return;
+    }
+    shownVolume = volume;
+    uLCD.locate(0, VOLUME_ROW);
+    uLCD.color(WHITE);
+    uLCD.printf("Vol %3d%%", volume);
+}
+
+// Call when user scrolls through songs
+void Player::updateTrackCountDisplay() {
+    uLCD.locate(0, 0);
+    uLCD.color(WHITE);
+    uLCD.printf("Song %d/%d", track + 1, library.trackCount());
+}
+
+// Simple text for play/pause in top right of lcd
+void Player::updatePlayPauseStatus() {
+    uLCD.locate(11, 0);
+    uLCD.color(WHITE);
+    if (playerState == PAUSED || (playerState == SCRUBBING && scrubFrom == PAUSED)) {
+        uLCD.printf("Paused ");
+    } else {
+        uLCD.printf("Playing");
+    }
+}
+
+// Tag title of a song, or its file name when it has none or it hasn't been read yet
+const char* Player::trackTitle(size_t track) {
+    trackTags.find(library, track, titleTags);
+    return titleTags.title[0] ? titleTags.title : library.trackName(track);
+}
+
+// Where a song's audio starts after its ID3 tag, or the top while the tag hasn't been read
+uint32_t Player::audioStart(size_t track) {
+    TrackTags::Tags tags;
+    trackTags.find(library, track, tags);
+    return tags.audioStart;
+}
+
+// Find the song title and display it
+void Player::displayTrackTitle(size_t track) {
+    uLCD.cls();
+    barFilled = 0;
+    shownVolume = -1;
+    shownElapsed = -1;
+    shownRemaining = -1;
+    // Title from the tag, or the bare file name until EVENT_TAGS; show as much as fits on one line
+    TrackTags::Tags tags;
+    titleTagged = trackTags.find(library, track, tags);
+    const char* title = tags.title[0] ? tags.title : library.trackName(track);
+    int length = std::min(static_cast<int>(strlen(title)), TEXT_COLUMNS);
+    // fit the song title on the center of the screen
+    uLCD.locate((TEXT_COLUMNS - length) / 2, 6);
+    uLCD.color(WHITE);
+    uLCD.printf("%.*s", length, title);
+    // and the artist just above it when the tag names one
+    if (tags.artist[0]) {
+        length = std::min(static_cast<int>(strlen(tags.artist)), ARTIST_COLUMNS);
+        uLCD.locate((TEXT_COLUMNS - length) / 2, 4);
+        uLCD.color(LGREY);
+        uLCD.printf("%.*s", length, tags.artist);
+    }
+
+    // track info when new song plays
+    drawVolume(controls.volume());
+    updateTrackCountDisplay();
+    updatePlayPauseStatus();
+    // The bar's rows are still blank from cls() whatever that text did, nothing to repaint
+    barWraps = uLCD.wraps;
+    drawProgressBar(0.0f);
+}
+
+// Song menu with control for multiple pages
+// Theres 10 songs in a page, which fits well on the lcd
+// Every line is padded to a fixed width so it fully overwrites the last draw,
+// the LCD driver then only sends the characters that actually changed
+void Player::displayMenu(int selectedIndex, bool full) {
+    int count = library.trackCount();
+
+    if (full) {
+        uLCD.cls();
+    }
+    uLCD.color(WHITE);
+    uLCD.locate(1, 0);
+    // Show which album folder the highlighted song lives in, if it isn't at the top of the card
+    uint16_t folder = count ? library.trackFolder(selectedIndex) : Library::ROOT;
+    if (folder == Library::ROOT) {
+        uLCD.printf("%-17s", "Select a song:");
+    } else {
+        uLCD.printf("%-17.17s", library.folderName(folder));
+    }
+
+    int page = selectedIndex / ITEMS_PER_PAGE;
+    int start = page * ITEMS_PER_PAGE;
+    int end = std::min(start + ITEMS_PER_PAGE, count);
+
+    for (int i = start; i < start + ITEMS_PER_PAGE; i++) {
+        int row = (i - start) + 2;  // first entry at row 2
+        uLCD.locate(1, row);
+        // Highlight the selected song in green, every other song in white
+        if (i >= end) {
+            uLCD.printf("%14s", "");  // blank out rows past the last song
+        } else if (i == selectedIndex) {
+            uLCD.color(GREEN);
+            uLCD.printf("> %-12.12s", trackTitle(i));
+        } else {
+            uLCD.color(WHITE);
+            uLCD.printf("  %-12.12s", trackTitle(i));
+        }
+    }
+
+    // Track which page we're on in the bottom left of the screen
+    // More songs are still being found on the card while " ..." shows,
+    // " full" once library memory ran out and songs on the card were left out
+    int totalPages = (count + ITEMS_PER_PAGE - 1) / ITEMS_PER_PAGE;
+    char footer[32];
+    snprintf(footer, sizeof(footer), "Page %d/%d%s", page + 1, totalPages,
+             !ready ? " ..." : library.full() ? " full" : "");
+    uLCD.locate(0, 15);
+    uLCD.color(WHITE);
+    uLCD.printf("%-17s", footer);
+}
+
+// Let the stream run straight on into the next song, starting after its ID3 tag
+void Player::queueFollowingTrack() {
+    size_t next = (track + 1) % library.trackCount();
+    stream.queueNext(library.trackPath(next).c_str(), audioStart(next));
+}
+
+// Length of the playing song in seconds, from its Xing/VBRI header or first frame
+int Player::currentTrackSeconds() {
+    std::string path = library.trackPath(track);
+    if (path != seekPath) {
+        seekTable.load(path.c_str());
+        seekPath = path;
+    }
+    return seekTable.duration() / 1000;
+}
+
+// Restart the playing song at a frame near the given second, still paused if it was
+// The decoder is cancelled rather than reset, so only the ring has to refill
+bool Player::seekCurrentTrack(int seconds) {
+#if MBED_CONF_APP_BENCHMARK
+    Timer seekTimer;
+    seekTimer.start();
+#endif
+    currentTrackSeconds();  // makes sure seekTable describes this song
+    uint32_t offset;
+    if (!seekTable.offsetFor(seekPath.c_str(), seconds * 1000u, offset)) {
+        return false;
+    }
+
+    stream.setPaused(true);
+    if (stream.seek(offset)) {
+        audio.cancelPlayback();
+        audio.setDecodeTime(seconds);
+        stream.setPaused(playerState == PAUSED);
+    } else {
+        // The reader already moved on to the queued song, reopen this one at the new spot
+        stream.close();
+        audio.cancelPlayback();
+        audio.setDecodeTime(seconds);
+        if (!stream.open(seekPath.c_str(), offset)) {
+            return false;
+        }
+        stream.setPaused(playerState == PAUSED);
+        if (AUTO_ADVANCE) {
+            queueFollowingTrack();
+        }
+    }
+#if MBED_CONF_APP_BENCHMARK
+    seekTimer.stop();
+    printf("Seek to %d:%02d (%s): %lu ms\r\n", seconds / 60, seconds % 60, seekTable.hasToc() ? "TOC" : "CBR",
+           (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(seekTimer.elapsed_time()).count());
+#endif
+    return true;
+}
+
+// Move the seek target shown on the time line by one hold/repeat step of a left/right switch
+// target is -1 before the first step, which starts from where the decoder is
+int Player::scrubStep(int target, int step) {
+    int total = currentTrackSeconds();
+    if (target < 0) {
+        target = audio.decodeTime();
+    }
+    target = std::min(std::max(target + step, 0), std::max(total - 1, 0));
+    drawPlayTime(target, total - target);
+    if (total > 0) {
+        drawProgressBar(static_cast<float>(target) / total);
+    }
+    return target;
+}
+
+// Open a song from the top and show its screen
+// The decoder is cancelled rather than reset; the old reset + modeSwitch + clockUp path
+// cost ~300 ms of silence per skip. Pass finished when finishPlayback() already closed
+// out the last song, so the decoder isn't flushed a second time
+// A song that won't open is skipped for the one after it, up to OPEN_TRIES songs;
+// then the menu comes back with the error rather than a playing screen with nothing playing
+void Player::startTrack(int next, bool finished) {
+    track = next;
+#if MBED_CONF_APP_BENCHMARK
+    Timer switchTimer;
+    switchTimer.start();
+#endif
+    if (!finished && !audio.cancelPlayback()) {
+        printf("VS1053 cancel failed, soft reset\r\n");
+    }
+#if MBED_CONF_APP_BENCHMARK
+    switchTimer.stop();
+    printf("Track switch: %lu ms\r\n", (unsigned long)
+           std::chrono::duration_cast<std::chrono::milliseconds>(switchTimer.elapsed_time()).count());
+#endif
+
+    /* The stream opens the file after its ID3 tag once the tag has been read, so embedded artwork
+    never goes through the ring or the decoder, and its reader thread starts filling the ring buffer
+    in the background.
+    */
+#if MBED_CONF_APP_BENCHMARK
+    Timer openTimer;
+    openTimer.start();
+#endif
+    int count = library.trackCount();
+    for (int tries = 1; !stream.open(library.trackPath(track).c_str(),
+                                     audioStart(track)); tries++) {
+        printf("Track %d: open failed\r\n", track + 1);
+        if (tries >= std::min(count, OPEN_TRIES)) {
+            selected = track;
+            enterMenu();
+            uLCD.locate(0, 15);
+            uLCD.color(RED);
+            uLCD.printf("%-17s", "Can't open song");
+            return;
+        }
+        track = (track + 1) % count;
+    }
+#if MBED_CONF_APP_BENCHMARK
+    openTimer.stop();
+    printf("Track open: %lu ms\r\n", (unsigned long)
+           std::chrono::duration_cast<std::chrono::milliseconds>(openTimer.elapsed_time()).count());
+#endif
+
+    playerState = PLAYING;
+    scrubTarget = -1;
+    formatShown = false;
+    lastVol = 0xff;
+    displayTrackTitle(track);
+    totalBytes = stream.fileSize();
+    // The decoder counts whole seconds from here
+    audio.setDecodeTime(0);
+    // Let the stream open and buffer the following song before this one runs out
+    if (AUTO_ADVANCE) {
+        queueFollowingTrack();
+    }
+}
+
+// Close the playing song; stats builds report how close the ring buffer came to running dry
+void Player::stopTrack() {
+#if PLAYER_STATS
+    printf("Track %d: %lu underruns, min buffer %u/%u blocks\r\n", track + 1,
+           (unsigned long)stream.underruns(), (unsigned)stream.minBufferedBlocks(),
+           (unsigned)AudioStream::BLOCK_COUNT);
+#endif
+    stream.close();
+}
+
+// Check potentiometer and, unless scrubbing, update progress every UI_TICK
+/* The bar costs one small rectangle when it grows and nothing otherwise,
+which leaves enough of the serial link to show volume without hurting audio.
+*/
+void Player::updatePlayback() {
+    float knob = controls.volume();
+    uint8_t vol = static_cast<uint8_t>(255 * (1.0f - knob));
+    if (vol != lastVol) {
+        audio.setVolume(vol);
+        lastVol = vol;
+    }
+    drawVolume(knob);
+    if (playerState != PLAYING) {
+        return;  // paused, or the time line shows the seek target until release
+    }
+
+    // Progress comes from the decoder's own clock, so ID3 tags, album art and VBR
+    // don't skew it; time left is the unplayed bytes at the measured byte rate
+    int elapsed = audio.decodeTime();
+    uint16_t rate = audio.byteRate();
+    int remaining = rate ? (totalBytes - stream.position()) / rate
+                         : std::max((int)library.trackDuration(track) - elapsed, 0);
+    drawPlayTime(elapsed, remaining);
+#if PLAYER_STATS
+    if (rate && !formatShown) {
+        printf("Track %d: %u kbit/s, %u Hz\r\n", track + 1, audio.bitRate(), audio.sampleRate());
+        formatShown = true;
+    }
+#endif
+    if (elapsed + remaining > 0) {
+        drawProgressBar(static_cast<float>(elapsed) / (elapsed + remaining));
+    }
+}
+
+// The stream reported a track boundary or the end of the song
+void Player::onStreamChange() {
+    // The feeder thread hands the VS1053 data on its own, we only follow what it did
+    // The stream went straight on into the queued song, catch the UI up
+    if (stream.trackAdvanced()) {
+        track = (track + 1) % library.trackCount();
+        totalBytes = stream.fileSize();
+        // Gapless splice keeps the decoder running, restart its clock for the new song
+        audio.setDecodeTime(0);
+        formatShown = false;
+        if (playerState == SCRUBBING) {
+            playerState = PLAYING;  // the target belonged to the song that just ended
+            scrubTarget = -1;
+        }
+        displayTrackTitle(track);
+        queueFollowingTrack();
+    }
+    if (stream.finished()) {
+        // Flush the last frames out of the decoder so the next song needs no reset
+        if (!audio.finishPlayback()) {
+            printf("VS1053 finish failed, soft reset\r\n");
+        }
+        stopTrack();
+        // Move on to the next song rather than replaying this one, the decoder is already idle
+        startTrack((track + 1) % library.trackCount(), true);
+    }
+}
+
+// Draw the song list, dropping a stale one first
+// Background rescans only ever clear the list here, never under a playing song
+void Player::enterMenu() {
+    playerState = MENU;
+    if (libraryStale) {
+        libraryStale = false;
+        ready = false;
+        library.clear();
+        selected = 0;
+        libraryCleared.release();  // the scan thread fills it again from here
+    }
+    selected = std::max(0, std::min(selected, (int)library.trackCount() - 1));
+    shownCount = library.trackCount();
+    shownReady = ready;
+    menuTicks = 0;
+
+#if MBED_CONF_APP_BENCHMARK
+    // Full menu draw doubles as an LCD throughput check on the serial console
+    Timer drawTimer;
+    int sent = uLCD.commands;
+    int sentBytes = uLCD.bytes;
+    drawTimer.start();
+    displayMenu(selected, true);
+    drawTimer.stop();
+    unsigned long drawUs = std::chrono::duration_cast<std::chrono::microseconds>(drawTimer.elapsed_time()).count();
+    printf("LCD: %d commands, %d bytes in %lu ms, %lu commands/s\r\n", uLCD.commands - sent,
+           uLCD.bytes - sentBytes, drawUs / 1000,
+           drawUs ? (unsigned long)(uLCD.commands - sent) * 1000000UL / drawUs : 0UL);
+#else
+    displayMenu(selected, true);
+#endif
+}
+
+// Menu state: up/down scroll the list, center starts the highlighted song
+void Player::onMenuEvent(const Event& event) {
+    if (event.type == EVENT_LIBRARY) {
+        enterMenu();
+        return;
+    }
+    // Titles read since the last draw replace their file names, the rest of the page is unchanged
+    if (event.type == EVENT_TAGS) {
+        displayMenu(selected);
+        return;
+    }
+    // Redraw at most once a second while a cold boot scan keeps adding songs
+    if (event.type == EVENT_TICK) {
+        if (++menuTicks % 5 == 0 && (library.trackCount() != shownCount || ready != shownReady)) {
+            shownCount = library.trackCount();
+            shownReady = ready;
+            displayMenu(selected);
+        }
+        return;
+    }
+    if (event.type != EVENT_BUTTON) {
+        return;
+    }
+
+    const Controls::Event& button = event.button;
+    int count = library.trackCount();
+    if (count == 0) {
+        return;  // a rebuild hasn't found the first song yet
+    }
+    // Up and down move once per press and keep moving while held
+    bool moves = button.action == Controls::PRESS || button.action == Controls::HOLD ||
+                 button.action == Controls::REPEAT;
+    if (moves && (button.key == Controls::NAV_UP || button.key == Controls::NAV_DOWN)) {
+        int step = button.key == Controls::NAV_UP ? -1 : 1;
+        selected = (selected + step + count) % count;
+#if MBED_CONF_APP_BENCHMARK
+        int sentBytes = uLCD.bytes;
+        displayMenu(selected);
+        printf("Menu move: %d bytes\r\n", uLCD.bytes - sentBytes);
+#else
+        displayMenu(selected);
+#endif
+    }
+    if (button.key == Controls::NAV_CENTER && button.action == Controls::PRESS) {
+        startTrack(selected);
+    }
+}
+
+// Playing, paused and scrubbing states
+// Center toggles pause, menu goes back to the list,
+// left/right skip on a tap and scrub through the song while held
+void Player::onPlaybackEvent(const Event& event) {
+    if (event.type == EVENT_TICK) {
+        updatePlayback();
+        return;
+    }
+    if (event.type == EVENT_STREAM) {
+        onStreamChange();
+        return;
+    }
+    if (event.type == EVENT_TAGS) {
+        // The song screen went up with the file name, redraw it once the tag names something
+        TrackTags::Tags tags;
+        if (!titleTagged && trackTags.find(library, track, tags)) {
+            titleTagged = true;
+            if (tags.title[0] || tags.artist[0]) {
+                displayTrackTitle(track);
+            }
+        }
+        return;
+    }
+    if (event.type != EVENT_BUTTON) {
+        return;  // a new library waits until the menu is opened
+    }
+
+    const Controls::Event& button = event.button;
+    if (button.key == Controls::MENU_BUTTON && button.action == Controls::PRESS) {
+        stopTrack();
+        selected = 0;
+        enterMenu();
+        return;
+    }
+
+    // Pause/Resume, the stream keeps its place and goes on buffering
+    if (button.key == Controls::NAV_CENTER && button.action == Controls::PRESS && playerState != SCRUBBING) {
+        playerState = playerState == PAUSED ? PLAYING : PAUSED;
+        stream.setPaused(playerState == PAUSED);
+        updatePlayPauseStatus();
+        return;
+    }
+
+    if (button.key != Controls::NAV_LEFT && button.key != Controls::NAV_RIGHT) {
+        return;
+    }
+    bool forward = button.key == Controls::NAV_RIGHT;
+    if (button.action == Controls::HOLD || button.action == Controls::REPEAT) {
+        if (playerState != SCRUBBING) {
+            scrubFrom = playerState;
+            playerState = SCRUBBING;
+        }
+        scrubTarget = scrubStep(scrubTarget, forward ? SEEK_STEP : -SEEK_STEP);
+    } else if (button.action == Controls::RELEASE && playerState == SCRUBBING) {
+        playerState = scrubFrom;
+        seekCurrentTrack(scrubTarget);
+        scrubTarget = -1;
+        updatePlayback();  // redraw the real position straight away
+    } else if (button.action == Controls::RELEASE && !button.held && playerState == PLAYING) {
+        int count = library.trackCount();
+        stopTrack();
+        startTrack(forward ? (track + 1) % count : (track - 1 + count) % count);
+    }
+}
@@ -0,0 +1,146 @@
+/**
+ *  Player.h
+ *  ===========================================================================
+ *  The player's screens and what the controls do on them, as a state machine.
+ *       - Buttons, the UI ticker, the stream, the library scan and the tag
+ *         reader post events from interrupts and their own threads; one
+ *         thread takes them in order, so the player state is only ever
+ *         touched from there.
+ *       - Menu: up/down scroll the song list, center starts a song.
+ *       - Playing/paused: center toggles pause, menu goes back to the list,
+ *         left/right skip on a tap and scrub through the song while held,
+ *         seeking on release and returning to play or pause as before.
+ *       - Works on the hardware seams and the real drivers over them, so
+ *         the same code runs on the board and against host/'s stand-ins.
+ */
+
+#ifndef PLAYER_H_
+#define PLAYER_H_
+
+#include "mbed.h"
+#include "Controls.h"
+#include "VS1053.h"
+#include "uLCD_4DGL.h"
+#include "AudioStream.h"
+#include "Library.h"
+#include "SeekTable.h"
+#include "TrackTags.h"
+#include <string>
+
+/** Class Player. Song menu and playback screens, driven by queued events. */
+class Player {
+public:
+    enum State {
+        MENU,       // song list
+        PLAYING,
+        PAUSED,     // stream open but not fed
+        SCRUBBING   // left/right held, the time line shows a seek target
+    };
+
+    static const int  SEEK_STEP    = 5;   // seconds per hold or repeat event
+    static const bool AUTO_ADVANCE = true;
+
+    Player(Controls& controls, VS1053& audio, uLCD_4DGL& lcd, AudioStream& stream, Library& library,
+           TrackTags& tags);
+    void start();
+    void run();
+    bool step(Kernel::Clock::duration_u32 timeout);
+    void attachTick(Callback<void()> handler);
+
+    void setLibraryReady(bool ready);
+    bool libraryReady();
+    void replaceLibrary();
+
+    State state();
+    int currentTrack();
+    int selection();
+
+private:
+    enum EventType {
+        EVENT_BUTTON,   // debounced switch event
+        EVENT_TICK,     // UI_TICK passed
+        EVENT_STREAM,   // the stream crossed into the queued song or ran out
+        EVENT_LIBRARY,  // a rescan found the song list changed
+        EVENT_TAGS      // a song's tags were read, the screen may show its file name instead
+    };
+
+    struct Event {
+        uint8_t         type;
+        Controls::Event button;  // EVENT_BUTTON only
+    };
+
+    void postEvent(const Event& event);
+    void onButton(const Controls::Event& button);
+    void onStreamEvent();
+    void onTags();
+    void onTick();
+
+    void drawProgressBar(float percent);
+    void drawPlayTime(int elapsed, int remaining);
+    void drawVolume(float knob);
+    void updateTrackCountDisplay();
+    void updatePlayPauseStatus();
+    const char* trackTitle(size_t track);
+    uint32_t audioStart(size_t track);
+    void displayTrackTitle(size_t track);
+    void displayMenu(int selectedIndex, bool full = false);
+
+    void queueFollowingTrack();
+    int currentTrackSeconds();
+    bool seekCurrentTrack(int seconds);
+    int scrubStep(int target, int step);
+    void startTrack(int next, bool finished = false);
+    void stopTrack();
+    void updatePlayback();
+    void onStreamChange();
+    void enterMenu();
+    void onMenuEvent(const Event& event);
+    void onPlaybackEvent(const Event& event);
+
+    Controls&    controls;
+    VS1053&      audio;
+    uLCD_4DGL&   uLCD;
+    AudioStream& stream;
+    Library&     library;
+    TrackTags&   trackTags;
+
+    // Filled from interrupts and the stream and scan threads, drained by step() alone
+    CircularBuffer<Event, 32> events;
+    EventFlags                wake;
+    Ticker                    uiTicker;
+    Callback<void()>          tickHandler;
+    volatile bool             tickPending;    // coalesce ticks and stream changes the UI
+    volatile bool             streamPending;  // hasn't got to yet
+    volatile bool             tagsPending;
+    volatile bool             libraryStale;   // the card no longer matches the index
+    volatile bool             ready;          // first full pass over the card is done
+    Semaphore                 libraryCleared; // the menu let go of a stale library
+
+    // Time to byte offset table of the playing song, read on the first seek
+    SeekTable   seekTable;
+    std::string seekPath;
+    // Tags of the menu line being drawn, trackTitle() points into them
+    TrackTags::Tags titleTags;
+
+    State    playerState;
+    State    scrubFrom;    // PLAYING or PAUSED, where a scrub goes back to on release
+    int      track;
+    uint32_t totalBytes;
+    uint8_t  lastVol;
+    bool     formatShown;  // bit rate and sample rate printed, PLAYER_STATS builds only
+    bool     titleTagged;  // the song screen shows the tag, not the file name while it's read
+    int      scrubTarget;  // second shown while left/right is held, -1 when not scrubbing
+    // Menu selection and what the last menu draw knew about the library
+    int      selected;
+    size_t   shownCount;
+    bool     shownReady;
+    int      menuTicks;
+    // Columns of the bar already green on the glass, and the volume shown below it
+    int      barFilled;
+    int      barWraps;     // uLCD.wraps when the bar was last known to be intact
+    int      shownVolume;
+    int      shownElapsed;
+    int      shownRemaining;
+};
+
+#endif
@@ -0,0 +1,159 @@
+/**
+ *  SdClock.cpp
+ *  ===========================================================================
+ *  Finds the fastest SPI clock the inserted SD card reads reliably at.
+ *
+ *  Result file layout: magic u32, card id u32, clock in Hz u32.
+ *
+ *  Reads during the climb are CRC checked when the player's handle asked the
+ *  card for CRCs (crc_on, with sd.CRC_ENABLED). The card only turns them on at
+ *  initialization and the driver has no call to change that afterwards, so
+ *  the handle keeps them on for playback too, and a bit flipped on the bus at
+ *  the trained clock is an error rather than a click in the song.
+ */
+
+#include "mbed.h"
+#include "SdClock.h"
+#include <cstdio>
+
+// Steps tried in order; SPI mode SD is specified up to 25 MHz
+// At 96 MHz these are the SSP dividers 8, 6, 4, 3 and 2 exactly
+static const uint32_t STEPS[] = {
+    6000000, 8000000, 12000000, 16000000, 24000000
+};
+
+/** @return The clock the SSP really runs at when asked for hz: the LPC1768
+ *          SPI driver rounds PCLK / 2 / hz to the nearest divider.
+ */
+static uint32_t spiClockFor(uint32_t hz) {
+    uint32_t base = SystemCoreClock / 2;  // smallest SSP prescaler
+    uint32_t divider = (base + hz / 2) / hz;
+    return base / (divider ? divider : 1);
+}
+
+/** Constructor of class SdClock. The card must be initialized (mounted). */
+SdClock::SdClock(SDBlockDevice& sd, const char* savePath)
+:
+    sd(sd),
+    savePath(savePath),
+    buffer(nullptr),
+    trained(false)
+{
+    probes[0] = 0;
+    probes[1] = 0;
+}
+
+/** Read PROBE_BYTES at address and hash them (FNV-1a).
+ *  @return Zero when the card reported an error.
+ */
+bool SdClock::probe(uint64_t address, uint32_t& hash) {
+    if (sd.read(buffer, address, PROBE_BYTES) != 0) {
+        return false;
+    }
+    hash = 2166136261u;
+    for (size_t i = 0; i < PROBE_BYTES; i++) {
+        hash ^= (uint8_t)buffer[i];
+        hash *= 16777619u;
+    }
+    return true;
+}
+
+/** Switch to hz and re-read every probe tries times.
+ *  @return Non-zero when every read succeeded and matched reference.
+ */
+bool SdClock::stable(uint32_t hz, const uint32_t* reference, int tries) {
+    uint32_t hash;
+    if (sd.frequency(hz) != 0) {
+        return false;
+    }
+    for (int i = 0; i < tries; i++) {
+        for (int p = 0; p < 2; p++) {
+            if (!probe(probes[p], hash) || hash != reference[p]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/** @return Identity of the card from its size and first sector (MBR or boot
+ *          sector, which holds the volume serial). Call at the safe clock.
+ */
+uint32_t SdClock::cardId() {
+    uint32_t hash = 0;
+    probe(0, hash);
+    uint64_t size = sd.size();
+    return hash ^ (uint32_t)size ^ (uint32_t)(size >> 32);
+}
+
+/** Climb from best until the first step that fails.
+ *  @return The last step that read cleanly, as the rate the bus really runs at.
+ */
+uint32_t SdClock::climb(uint32_t best, const uint32_t* reference) {
+    for (size_t i = 0; i < sizeof(STEPS) / sizeof(STEPS[0]); i++) {
+        uint32_t hz = spiClockFor(STEPS[i]);
+        if (hz <= best) {
+            continue;
+        }
+        if (!stable(hz, reference, TRIES)) {
+            break;
+        }
+        best = hz;
+    }
+    return best;
+}
+
+/** Find and set the fastest stable clock, starting from safeHz, which the
+ *  card must already be running at. A saved result for this card is only
+ *  checked, not searched for again.
+ *  @return The clock the card is left at, after the SSP divider rounding.
+ */
+uint32_t SdClock::tune(uint32_t safeHz) {
+    uint32_t reference[2];
+    uint32_t best = spiClockFor(safeHz);
+
+    trained = false;
+    buffer = new char[PROBE_BYTES];
+    // Sectors at the start and in the middle of the card, on a sector boundary
+    probes[0] = 0;
+    probes[1] = sd.size() / 2 / 512 * 512;
+    uint32_t id = cardId();
+    if (!probe(probes[0], reference[0]) || !probe(probes[1], reference[1])) {
+        delete[] buffer;
+        buffer = nullptr;
+        return best;
+    }
+
+    uint32_t saved[3] = { 0, 0, 0 };
+    FILE* f = fopen(savePath, "rb");
+    if (f) {
+        if (fread(saved, sizeof(uint32_t), 3, f) != 3) {
+            saved[0] = 0;
+        }
+        fclose(f);
+    }
+    if (saved[0] == MAGIC && saved[1] == id && spiClockFor(saved[2]) >= best &&
+        stable(spiClockFor(saved[2]), reference, 2)) {
+        best = spiClockFor(saved[2]);
+    } else {
+        trained = true;
+        best = climb(best, reference);
+        sd.frequency(best);  // back from a failed step before writing
+        saved[0] = MAGIC;
+        saved[1] = id;
+        saved[2] = best;
+        f = fopen(savePath, "wb");
+        if (f) {
+            fwrite(saved, sizeof(uint32_t), 3, f);
+            fclose(f);
+        }
+    }
+    delete[] buffer;
+    buffer = nullptr;
+    return best;
+}
+
+/** @return Non-zero when the last tune() searched instead of using a saved clock. */
+bool SdClock::wasTrained() {
+    return trained;
+}
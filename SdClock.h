@@ -0,0 +1,45 @@
+/**
+ *  SdClock.h
+ *  ===========================================================================
+ *  Finds the fastest SPI clock the inserted SD card reads reliably at.
+ *       - Reference sectors are read at the safe mount clock, then re-read
+ *         at each faster step; a read error or a single differing byte
+ *         ends the climb and the last clean step is kept.
+ *       - Steps are the rates the SSP divider really gives, and reads are
+ *         CRC checked when the card's handle was built with CRCs on.
+ *       - The result is saved on the card together with an identity of
+ *         the card (its size and boot sector), so the next boot with the
+ *         same card starts at that clock after one quick check.
+ */
+
+#ifndef SD_CLOCK_H_
+#define SD_CLOCK_H_
+
+#include "mbed.h"
+#include "SDBlockDevice.h"
+
+/** Class SdClock. SD bus speed training with a per-card result file. */
+class SdClock {
+public:
+    SdClock(SDBlockDevice& sd, const char* savePath);
+    uint32_t tune(uint32_t safeHz);
+    bool wasTrained();
+
+private:
+    static const uint32_t MAGIC = 0x4b4c4353;  // "SCLK"
+    static const size_t   PROBE_BYTES = 1024;  // two sectors, so multi block reads are tried too
+    static const int      TRIES = 8;
+
+    bool probe(uint64_t address, uint32_t& hash);
+    bool stable(uint32_t hz, const uint32_t* reference, int tries);
+    uint32_t climb(uint32_t best, const uint32_t* reference);
+    uint32_t cardId();
+
+    SDBlockDevice& sd;
+    const char*    savePath;
+    char*          buffer;
+    uint64_t       probes[2];  // card addresses read at every step
+    bool           trained;
+};
+
+#endif
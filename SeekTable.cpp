@@ -0,0 +1,279 @@
+/**
+ *  SeekTable.cpp
+ *  ===========================================================================
+ *  Maps a play time to a byte offset inside an MP3 file.
+ */
+
+#include "mbed.h"
+#include "SeekTable.h"
+#include <cstring>
+
+// MPEG audio layer III bitrates in kbps, indexed by the header's bitrate field
+static const uint16_t MPEG1_L3_KBPS[16] = {
+    0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0
+};
+static const uint16_t MPEG2_L3_KBPS[16] = {
+    0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0
+};
+// Sample rates for MPEG1, then halved for MPEG2 and quartered for MPEG2.5
+static const uint32_t MPEG1_RATES[3] = { 44100, 48000, 32000 };
+
+// How far past a guessed offset to look for a frame sync
+static const uint32_t SYNC_WINDOW = 4096;
+// Longest layer III frame: 320 kbit/s at 32 kHz, padded
+static const uint32_t MAX_FRAME = 1441;
+
+static uint32_t get32be(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint16_t get16be(const uint8_t* p) {
+    return (p[0] << 8) | p[1];
+}
+
+/** Constructor of class SeekTable. */
+SeekTable::SeekTable()
+:
+    dataStart(0),
+    dataBytes(0),
+    totalMs(0),
+    fileSize(0),
+    valid(false),
+    kind(NONE),
+    vbriEntries(0)
+{
+}
+
+/** Decode a 4 byte layer III frame header.
+ *  @return Zero when h isn't a valid layer III header, non-zero otherwise.
+ */
+bool SeekTable::parseHeader(const uint8_t* h, Frame& frame) {
+    if (h[0] != 0xff || (h[1] & 0xe0) != 0xe0) {
+        return false;
+    }
+    uint8_t version = (h[1] >> 3) & 3;  // 3 = MPEG1, 2 = MPEG2, 0 = MPEG2.5
+    uint8_t layer   = (h[1] >> 1) & 3;  // 1 = layer III
+    uint8_t index   = h[2] >> 4;
+    uint8_t rate    = (h[2] >> 2) & 3;
+    if (version == 1 || layer != 1 || rate == 3) {
+        return false;
+    }
+    frame.version = version;
+    frame.kbps = version == 3 ? MPEG1_L3_KBPS[index] : MPEG2_L3_KBPS[index];
+    if (frame.kbps == 0) {
+        return false;
+    }
+    frame.sampleRate = MPEG1_RATES[rate] >> (version == 3 ? 0 : version == 2 ? 1 : 2);
+    frame.samples = version == 3 ? 1152 : 576;
+    frame.length = (version == 3 ? 144000 : 72000) * frame.kbps / frame.sampleRate + ((h[2] >> 1) & 1);
+    frame.mono = (h[3] >> 6) == 3;
+    return true;
+}
+
+/** Read the ID3v2 size, the first frame and its Xing/Info or VBRI table.
+ *  @return Zero when no layer III frame was found, non-zero otherwise.
+ */
+bool SeekTable::load(const char* path) {
+    uint8_t buf[512];
+
+    valid = false;
+    kind = NONE;
+    totalMs = 0;
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fileSize = length > 0 ? length : 0;
+
+    dataStart = 0;
+    fseek(f, 0, SEEK_SET);
+    if (fread(buf, 1, 10, f) == 10 && memcmp(buf, "ID3", 3) == 0) {
+        // Tag size is a 28 bit syncsafe integer and excludes the 10 byte header
+        dataStart = 10 + ((buf[6] & 0x7f) << 21 | (buf[7] & 0x7f) << 14 |
+                          (buf[8] & 0x7f) << 7 | (buf[9] & 0x7f));
+    }
+    alignToFrame(f, dataStart);
+
+    fseek(f, dataStart, SEEK_SET);
+    size_t n = fread(buf, 1, sizeof(buf), f);
+    if (n >= 4 && parseHeader(buf, first)) {
+        valid = true;
+        dataBytes = fileSize - dataStart;
+
+        // Xing/Info sits right after the side information
+        size_t xing = 4 + (first.version == 3 ? (first.mono ? 17 : 32) : (first.mono ? 9 : 17));
+        if (xing + 8 <= n && (memcmp(buf + xing, "Xing", 4) == 0 || memcmp(buf + xing, "Info", 4) == 0)) {
+            uint32_t flags = get32be(buf + xing + 4);
+            size_t   p = xing + 8;
+            uint32_t frames = 0;
+            if ((flags & 1) && p + 4 <= n) {
+                frames = get32be(buf + p);
+                p += 4;
+            }
+            if ((flags & 2) && p + 4 <= n) {
+                dataBytes = get32be(buf + p);
+                p += 4;
+            }
+            if ((flags & 4) && p + TOC_SIZE <= n) {
+                memcpy(xingToc, buf + p, TOC_SIZE);
+                kind = XING;
+            }
+            if (frames) {
+                totalMs = (uint64_t)frames * first.samples * 1000 / first.sampleRate;
+            }
+        } else if (36 + 26 <= n && memcmp(buf + 36, "VBRI", 4) == 0) {
+            // VBRI always sits 32 bytes after the header
+            const uint8_t* v = buf + 36;
+            uint32_t frames  = get32be(v + 14);
+            uint16_t entries = get16be(v + 18);
+            uint16_t scale   = get16be(v + 20);
+            uint16_t width   = get16be(v + 22);
+            dataBytes = get32be(v + 10);
+            totalMs = (uint64_t)frames * first.samples * 1000 / first.sampleRate;
+
+            // Fold long tables into at most TOC_SIZE slices of equal time
+            uint16_t group = (entries + TOC_SIZE - 1) / TOC_SIZE;
+            const uint8_t* e = v + 26;
+            vbriEntries = 0;
+            for (uint16_t i = 0; group && i < entries && width >= 1 && width <= 4; i++, e += width) {
+                if (e + width > buf + n) {
+                    break;
+                }
+                uint32_t value = 0;
+                for (uint16_t b = 0; b < width; b++) {
+                    value = (value << 8) | e[b];
+                }
+                if (i % group == 0) {
+                    vbriToc[vbriEntries++] = 0;
+                }
+                vbriToc[vbriEntries - 1] += value * scale;
+            }
+            if (group && vbriEntries == (entries + group - 1) / group && totalMs) {
+                kind = VBRI;
+            }
+        }
+        if (totalMs == 0) {
+            // No header to tell us, so it's CBR at the first frame's rate
+            totalMs = (uint64_t)dataBytes * 8 / first.kbps;
+        }
+    }
+    fclose(f);
+    return valid;
+}
+
+/** @return Length of the loaded song in milliseconds, 0 if unknown. */
+uint32_t SeekTable::duration() {
+    return totalMs;
+}
+
+/** @return Non-zero when the song carries a Xing or VBRI table of contents. */
+bool SeekTable::hasToc() {
+    return kind != NONE;
+}
+
+/** Unaligned byte offset for a play time before the end, from the TOC or as CBR. */
+uint32_t SeekTable::estimate(uint32_t ms) {
+    if (kind == XING) {
+        // Interpolate between the two percent marks around ms
+        uint32_t scaled = (uint64_t)ms * TOC_SIZE * 256 / totalMs;  // percent, 8 fraction bits
+        uint32_t pct = scaled >> 8;
+        uint32_t lo = xingToc[pct];
+        uint32_t hi = pct + 1 < TOC_SIZE ? xingToc[pct + 1] : 256;
+        uint32_t mark = lo * 256 + (hi - lo) * (scaled & 0xff);  // offset/256, 8 fraction bits
+        return dataStart + (uint64_t)mark * dataBytes / (256 * 256);
+    }
+    if (kind == VBRI) {
+        // Each slice covers the same share of the duration
+        uint32_t sliceMs = totalMs / vbriEntries;
+        uint32_t offset = dataStart;
+        uint16_t i = 0;
+        for (; i < vbriEntries && ms >= sliceMs; i++, ms -= sliceMs) {
+            offset += vbriToc[i];
+        }
+        if (i < vbriEntries && sliceMs) {
+            offset += (uint64_t)vbriToc[i] * ms / sliceMs;
+        }
+        return offset;
+    }
+    return dataStart + (uint64_t)ms * first.kbps / 8;
+}
+
+/** Move offset forward onto a frame header that is followed by another
+ *  matching one, so a stray 0xFF in the audio data isn't taken for a sync.
+ *  @return Zero, with offset unchanged, when there is none within SYNC_WINDOW.
+ */
+bool SeekTable::alignToFrame(FILE* f, uint32_t& offset) {
+    uint8_t buf[512];
+    uint8_t next[4];
+    Frame   frame, check;
+
+    for (uint32_t pos = offset; pos < offset + SYNC_WINDOW && pos < fileSize; pos += sizeof(buf) - 3) {
+        fseek(f, pos, SEEK_SET);
+        size_t n = fread(buf, 1, sizeof(buf), f);
+        for (size_t i = 0; i + 3 < n; i++) {
+            if (!parseHeader(buf + i, frame) ||
+                (valid && (frame.version != first.version || frame.sampleRate != first.sampleRate))) {
+                continue;
+            }
+            uint32_t following = pos + i + frame.length;
+            fseek(f, following, SEEK_SET);
+            if (following + 4 > fileSize ||  // last frame of the file
+                (fread(next, 1, 4, f) == 4 && parseHeader(next, check) &&
+                 check.version == frame.version && check.sampleRate == frame.sampleRate)) {
+                offset = pos + i;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/** Find the last whole frame: sync a few frames before the end and walk
+ *  the chain from there, stopping at an ID3v1 tag or a cut off frame.
+ *  @return Zero when no frame was found near the end.
+ */
+bool SeekTable::lastFrame(FILE* f, uint32_t& offset) {
+    uint32_t pos = fileSize > dataStart + 4 * MAX_FRAME ? fileSize - 4 * MAX_FRAME : dataStart;
+    if (!alignToFrame(f, pos)) {
+        return false;
+    }
+    uint8_t h[4];
+    Frame   frame;
+    offset = pos;
+    for (;;) {
+        fseek(f, pos, SEEK_SET);
+        if (fread(h, 1, 4, f) != 4 || !parseHeader(h, frame) || pos + frame.length > fileSize) {
+            return true;
+        }
+        offset = pos;
+        pos += frame.length;
+    }
+}
+
+/** Find where to restart decoding to play from ms into the song.
+ *  load() must have been called for the same path. offset is set to the byte
+ *  offset of a frame header, which is 0 for the start of an untagged file,
+ *  and the last frame's for a time at or past the end.
+ *  @return Zero when the song isn't seekable or no frame was found there.
+ */
+bool SeekTable::offsetFor(const char* path, uint32_t ms, uint32_t& offset) {
+    if (!valid) {
+        return false;
+    }
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    uint32_t guess = ms < totalMs ? estimate(ms) : fileSize;
+    bool found = guess < fileSize && alignToFrame(f, guess);
+    if (found) {
+        offset = guess;
+    } else {
+        // Past the end, or past the last sync: the end of the song is the closest there is
+        found = lastFrame(f, offset);
+    }
+    fclose(f);
+    return found;
+}
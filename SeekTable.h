@@ -0,0 +1,61 @@
+/**
+ *  SeekTable.h
+ *  ===========================================================================
+ *  Maps a play time to a byte offset inside an MP3 file.
+ *       - Uses the Xing/Info or VBRI table of contents that encoders put in
+ *         the first frame, so VBR files seek without reading the whole song.
+ *       - Files without one are treated as CBR at the first frame's bitrate.
+ *       - Every result is moved onto a verified frame sync, so the decoder
+ *         never starts in the middle of a frame; a time at or past the end
+ *         gives the last frame, and no sync at all gives no offset.
+ */
+
+#ifndef SEEK_TABLE_H_
+#define SEEK_TABLE_H_
+
+#include "mbed.h"
+#include <cstdio>
+
+/** Class SeekTable. Time to offset lookup for one MPEG layer III file. */
+class SeekTable {
+public:
+    /** Fields of a layer III frame header. */
+    struct Frame {
+        uint8_t  version;     // 3 = MPEG1, 2 = MPEG2, 0 = MPEG2.5
+        uint16_t kbps;
+        uint32_t sampleRate;
+        uint16_t samples;     // per frame
+        uint16_t length;      // bytes, header included
+        bool     mono;
+    };
+
+    static const size_t TOC_SIZE = 100;
+
+    SeekTable();
+    bool load(const char* path);
+    bool offsetFor(const char* path, uint32_t ms, uint32_t& offset);
+    uint32_t duration();
+    bool hasToc();
+
+    static bool parseHeader(const uint8_t* h, Frame& frame);
+
+private:
+    uint32_t estimate(uint32_t ms);
+    bool alignToFrame(FILE* f, uint32_t& offset);
+    bool lastFrame(FILE* f, uint32_t& offset);
+
+    uint32_t dataStart;   // first audio frame, after the ID3v2 tag
+    uint32_t dataBytes;   // audio bytes the TOC spans
+    uint32_t totalMs;
+    uint32_t fileSize;
+    Frame    first;
+    bool     valid;
+    // Xing: 100 entries of offset/256 at each percent of the duration
+    // VBRI: bytes per tocEntries equal slices of the duration
+    enum { NONE, XING, VBRI } kind;
+    uint8_t  xingToc[TOC_SIZE];
+    uint32_t vbriToc[TOC_SIZE];
+    uint16_t vbriEntries;
+};
+
+#endif
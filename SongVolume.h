@@ -0,0 +1,40 @@
+/**
+ *  SongVolume.h
+ *  ===========================================================================
+ *  The storage side of StreamFile, as an interface.
+ *       - StreamFileSystem implements it on the board over FatFs; a host
+ *         directory behind a simulated card can stand in for it.
+ *       - A volume maps a file to runs of consecutive sectors once and
+ *         hands out the block device they are on; songs are then read
+ *         sector by sector without going back to the file system.
+ */
+
+#ifndef SONG_VOLUME_H_
+#define SONG_VOLUME_H_
+
+#include "mbed.h"
+#include "BlockDevice.h"
+
+/** Class SongVolume. Files that can be read straight from their sectors. */
+class SongVolume {
+public:
+    /** Consecutive sectors holding one piece of a file. */
+    struct Extent {
+        uint32_t sector;   // first sector on the block device
+        uint32_t sectors;
+    };
+
+    virtual ~SongVolume() {}
+
+    /** Find the sectors holding a file, path as given to fopen().
+     *  @return Number of extents filled in, 0 when the file can't be opened
+     *          or is in more than max pieces.
+     */
+    virtual size_t mapFile(const char* path, Extent* extents, size_t max, uint32_t& size,
+                           uint32_t& sectorSize) = 0;
+
+    /** @return Block device the extents are on, null when there is none. */
+    virtual BlockDevice* device() = 0;
+};
+
+#endif
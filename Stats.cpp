@@ -0,0 +1,76 @@
+/**
+ *  Stats.cpp
+ *  ===========================================================================
+ *  Timing probes and event counters for the playback hot paths.
+ *
+ *  Each probe is only written from one thread, so updates take no lock; a dump
+ *  racing an update can be one sample off. Counters are bumped from interrupts
+ *  and several threads (postEvent runs in all of them), so they count atomically.
+ */
+
+#include "mbed.h"
+#include "Stats.h"
+#include <cstring>
+
+#if PLAYER_STATS
+
+static const char* const PROBE_NAMES[Stats::PROBE_COUNT] = {
+    "sd read", "sdi send", "dreq wait", "lcd command", "ui event"
+};
+static const char* const COUNTER_NAMES[Stats::COUNTER_COUNT] = {
+    "dreq high on arrival", "events dropped", "dreq timeout", "decoder reset"
+};
+
+Stats::Timing Stats::timings[PROBE_COUNT];
+uint32_t      Stats::counters[COUNTER_COUNT];
+
+/** Start the DWT cycle counter. Call once at boot, before any probe runs. */
+void Stats::begin() {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/** Add one timed run of a probe. */
+void Stats::record(Probe probe, uint32_t cycles) {
+    Timing& t = timings[probe];
+    t.count++;
+    t.total += cycles;
+    if (cycles > t.max) {
+        t.max = cycles;
+    }
+    if (cycles > t.worst) {
+        t.worst = cycles;
+    }
+}
+
+/** Add one occurrence of an event. */
+void Stats::count(Counter counter) {
+    core_util_atomic_incr_u32(&counters[counter], 1);
+}
+
+/** Print every probe in microseconds, then every counter.
+ *  The per-dump maximum starts over, so consecutive dumps give a rolling worst case.
+ */
+void Stats::dump() {
+    uint32_t perUs = SystemCoreClock / 1000000;
+    printf("%-12s %9s %8s %8s %8s\r\n", "probe", "count", "avg us", "max us", "worst us");
+    for (int i = 0; i < PROBE_COUNT; i++) {
+        Timing& t = timings[i];
+        printf("%-12s %9lu %8lu %8lu %8lu\r\n", PROBE_NAMES[i], (unsigned long)t.count,
+               (unsigned long)(t.count ? t.total / t.count / perUs : 0),
+               (unsigned long)(t.max / perUs), (unsigned long)(t.worst / perUs));
+        t.max = 0;
+    }
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        printf("%-21s %lu\r\n", COUNTER_NAMES[i], (unsigned long)counters[i]);
+    }
+}
+
+/** Zero every probe and counter. */
+void Stats::reset() {
+    memset(timings, 0, sizeof(timings));
+    memset(counters, 0, sizeof(counters));
+}
+
+#endif
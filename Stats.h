@@ -0,0 +1,80 @@
+/**
+ *  Stats.h
+ *  ===========================================================================
+ *  Timing probes and event counters for the playback hot paths.
+ *       - Probes time a section in CPU cycles with the Cortex-M3 DWT cycle
+ *         counter: count, total, worst since the last dump and worst ever.
+ *       - Counters tally events that hint at starvation, e.g. the feeder
+ *         finding DREQ already high when it came to wait for it.
+ *       - Stats::dump() prints everything on the USB serial console.
+ *       - Release builds (NDEBUG) compile every STATS_ macro to nothing.
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include "mbed.h"
+
+#ifndef PLAYER_STATS
+#ifdef NDEBUG
+#define PLAYER_STATS 0
+#else
+#define PLAYER_STATS 1
+#endif
+#endif
+
+/** Class Stats. Global probe and counter tables. Each probe has one writer thread,
+ *  counters may be bumped from any thread or interrupt.
+ */
+class Stats {
+public:
+    enum Probe {
+        SD_READ,      // fread of one ring block
+        SDI_SEND,     // one 32 byte burst to VS1053
+        DREQ_WAIT,    // feeder sleeping on DREQ
+        LCD_COMMAND,  // posting one uLCD command, window waits included
+        UI_EVENT,     // handling one player event, the UI loop latency
+        PROBE_COUNT
+    };
+    enum Counter {
+        DREQ_HIGH_ON_ARRIVAL,  // decoder was already waiting for data
+        EVENTS_DROPPED,        // player event queue full
+        DREQ_TIMEOUT,          // DREQ stayed low past VS1053's timeout
+        DECODER_RESET,         // feeder reset a decoder that stopped taking data
+        COUNTER_COUNT
+    };
+
+    static void begin();
+    static void record(Probe probe, uint32_t cycles);
+    static void count(Counter counter);
+    static void dump();
+    static void reset();
+
+    /** @return The free running CPU cycle counter. */
+    static uint32_t now() {
+        return DWT->CYCCNT;
+    }
+
+private:
+    struct Timing {
+        uint32_t count;
+        uint64_t total;
+        uint32_t max;    // since the last dump
+        uint32_t worst;  // since boot or reset()
+    };
+
+    static Timing   timings[PROBE_COUNT];
+    static uint32_t counters[COUNTER_COUNT];
+};
+
+#if PLAYER_STATS
+#define STATS_BEGIN(start)        uint32_t start = Stats::now()
+#define STATS_END(probe, start)   Stats::record(Stats::probe, Stats::now() - (start))
+#define STATS_COUNT(counter)      Stats::count(Stats::counter)
+#else
+#define STATS_BEGIN(start)
+#define STATS_END(probe, start)
+#define STATS_COUNT(counter)
+#endif
+
+#endif
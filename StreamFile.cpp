@@ -0,0 +1,179 @@
+/**
+ *  StreamFile.cpp
+ *  ===========================================================================
+ *  Sequential song reads straight from the SD card's sectors.
+ */
+
+#include "mbed.h"
+#include "StreamFile.h"
+#include <cstring>
+
+// Partial sectors at the start (seek, ID3 skip) and end of a song
+// Only the audio reader thread reads, so one buffer serves every StreamFile
+// SD cards always have 512 byte sectors; anything larger goes through stdio
+static const uint32_t BOUNCE_SIZE = 512;
+static const uint32_t NO_SECTOR = 0xffffffff;
+static char bounce[BOUNCE_SIZE] __attribute__((aligned(4)));
+// What bounce holds, so the sector a ring block ends in isn't read again for the next block
+static BlockDevice* bounceDevice = nullptr;
+static uint32_t bounceSector = NO_SECTOR;
+
+/** Constructor of class StreamFile. */
+StreamFile::StreamFile()
+:
+    device(nullptr),
+    extentCount(0),
+    sectorSize(512),
+    fileSize(0),
+    position(0),
+    fallback(nullptr)
+{
+}
+
+/** Destructor of class StreamFile. */
+StreamFile::~StreamFile() {
+    close();
+}
+
+/** Open a song for reading from offset. fs may be null to always use stdio.
+ *  @return Zero at failure, non-zero at success.
+ */
+bool StreamFile::open(SongVolume* fs, const char* path, uint32_t offset) {
+    close();
+    bounceSector = NO_SECTOR;  // the file may have been rewritten in the same sectors
+    if (fs && fs->device()) {
+        extentCount = fs->mapFile(path, extents, MAX_EXTENTS, fileSize, sectorSize);
+    }
+    if (extentCount > 0 && sectorSize <= BOUNCE_SIZE) {
+        device = fs->device();
+    } else {
+        extentCount = 0;
+        fallback = fopen(path, "rb");
+        if (!fallback) {
+            return false;
+        }
+        fseek(fallback, 0, SEEK_END);
+        long total = ftell(fallback);
+        fileSize = total > 0 ? total : 0;
+    }
+    if (!seek(offset < fileSize ? offset : 0)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+/** Forget the open song. */
+void StreamFile::close() {
+    if (fallback) {
+        fclose(fallback);
+        fallback = nullptr;
+    }
+    device = nullptr;
+    extentCount = 0;
+    fileSize = 0;
+    position = 0;
+}
+
+/** Move the read position. @return Zero when offset is past the end. */
+bool StreamFile::seek(uint32_t offset) {
+    if (offset > fileSize) {
+        return false;
+    }
+    if (fallback && fseek(fallback, offset, SEEK_SET) != 0) {
+        return false;
+    }
+    position = offset;
+    return true;
+}
+
+/** @return Length of the open song in bytes. */
+uint32_t StreamFile::size() {
+    return fileSize;
+}
+
+/** @return Non-zero when reads go straight to the block device. */
+bool StreamFile::isDirect() {
+    return device != nullptr;
+}
+
+/** Find the sector under position and how many sectors follow it in the same extent.
+ *  @return Zero when position is past the mapped sectors.
+ */
+bool StreamFile::locate(uint32_t& sector, uint32_t& run) {
+    uint32_t index = position / sectorSize;
+    for (size_t i = 0; i < extentCount; i++) {
+        if (index < extents[i].sectors) {
+            sector = extents[i].sector + index;
+            run = extents[i].sectors - index;
+            return true;
+        }
+        index -= extents[i].sectors;
+    }
+    return false;
+}
+
+/** Read one piece at the current position: whole sectors up to the end
+ *  of the extent straight into buffer, or part of one sector via bounce.
+ *  @return Bytes read, 0 at the end of the file or on a card error.
+ */
+size_t StreamFile::readPiece(char* buffer, size_t length) {
+    uint32_t sector, run;
+    if (position >= fileSize || length == 0 || !locate(sector, run)) {
+        return 0;
+    }
+    uint32_t within = position % sectorSize;
+    uint32_t left = fileSize - position;
+    size_t n;
+
+    if (within == 0 && length >= sectorSize && left >= sectorSize) {
+        // Whole sectors, one multi block read into the caller's buffer
+        uint32_t sectors = length / sectorSize;
+        sectors = sectors < run ? sectors : run;
+        sectors = sectors < left / sectorSize ? sectors : left / sectorSize;
+        n = sectors * sectorSize;
+        if (device->read(buffer, (uint64_t)sector * sectorSize, n) != 0) {
+            return 0;
+        }
+    } else {
+        // Part of one sector: read it whole, unless it is still there from the last
+        // read, and copy out what was asked for
+        if (bounceDevice != device || bounceSector != sector) {
+            bounceSector = NO_SECTOR;
+            if (device->read(bounce, (uint64_t)sector * sectorSize, sectorSize) != 0) {
+                return 0;
+            }
+            bounceDevice = device;
+            bounceSector = sector;
+        }
+        n = sectorSize - within;
+        n = n < length ? n : length;
+        n = n < left ? n : left;
+        memcpy(buffer, bounce + within, n);
+    }
+    position += n;
+    return n;
+}
+
+/** Read up to length bytes at the current position, like fread().
+ *  Whole sectors go straight into buffer; from an unaligned position only
+ *  the sectors a read starts and ends in are copied, each read from the
+ *  card once, as the next read starts in the sector the last one ended in.
+ *  @return Bytes read, less than length only at the end of the file or on a card error.
+ */
+size_t StreamFile::read(char* buffer, size_t length) {
+    if (fallback) {
+        size_t n = fread(buffer, 1, length, fallback);
+        position += n;
+        return n;
+    }
+    size_t done = 0;
+    while (device && done < length) {
+        size_t n = readPiece(buffer + done, length - done);
+        if (n == 0) {
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
@@ -0,0 +1,49 @@
+/**
+ *  StreamFile.h
+ *  ===========================================================================
+ *  Sequential song reads straight from the SD card's sectors.
+ *       - The SongVolume (StreamFileSystem on the board) maps the file to
+ *         a few runs of consecutive sectors when it is opened.
+ *       - StreamFile then reads whole sectors with BlockDevice::read right
+ *         into the caller's buffer, a multi block (CMD18) read per run,
+ *         with no stdio buffer, FAT lookup or copy in between.
+ *       - Only a read starting or ending inside a sector goes through a
+ *         one sector bounce buffer. Files in too many pieces, or when no
+ *         volume is given, fall back to plain stdio.
+ */
+
+#ifndef STREAM_FILE_H_
+#define STREAM_FILE_H_
+
+#include "mbed.h"
+#include "SongVolume.h"
+#include <cstdio>
+
+/** Class StreamFile. Read-only song file for the audio reader thread. */
+class StreamFile {
+public:
+    static const size_t MAX_EXTENTS = 16;
+
+    StreamFile();
+    ~StreamFile();
+    bool open(SongVolume* fs, const char* path, uint32_t offset = 0);
+    void close();
+    bool seek(uint32_t offset);
+    size_t read(char* buffer, size_t length);
+    uint32_t size();
+    bool isDirect();
+
+private:
+    bool locate(uint32_t& sector, uint32_t& run);
+    size_t readPiece(char* buffer, size_t length);
+
+    BlockDevice*             device;
+    SongVolume::Extent       extents[MAX_EXTENTS];
+    size_t                   extentCount;
+    uint32_t                 sectorSize;
+    uint32_t                 fileSize;
+    uint32_t                 position;
+    FILE*                    fallback;  // stdio when the file couldn't be mapped
+};
+
+#endif
@@ -0,0 +1,123 @@
+/**
+ *  StreamFileSystem.cpp
+ *  ===========================================================================
+ *  The FAT file system on the SD card, as the player's SongVolume.
+ *
+ *  The cluster chain is read through FatFs itself (a seek into every
+ *  cluster, under the file system's lock), so long names, FAT16/32 and
+ *  the partition offset are handled exactly as for any other open file.
+ */
+
+#include "mbed.h"
+#include "StreamFileSystem.h"
+#include <cstring>
+
+/** Constructor of class StreamFileSystem. */
+StreamFileSystem::StreamFileSystem(const char* name)
+:
+    FATFileSystem(name),
+    bd(nullptr)
+{
+}
+
+/** Mount the file system and remember its block device for direct reads.
+ *  @return 0 on success, negative error code on failure.
+ */
+int StreamFileSystem::mount(BlockDevice* device) {
+    return mount(device, device);
+}
+
+/** Mount the file system on device, direct song reads going to songs instead:
+ *  the same card, e.g. BlockCache::uncached() of the cache FatFs reads through.
+ *  @return 0 on success, negative error code on failure.
+ */
+int StreamFileSystem::mount(BlockDevice* device, BlockDevice* songs) {
+    int err = FATFileSystem::mount(device);
+    bd = err ? nullptr : songs;
+    return err;
+}
+
+/** Unmount the file system. @return 0 on success, negative error code on failure. */
+int StreamFileSystem::unmount() {
+    bd = nullptr;
+    return FATFileSystem::unmount();
+}
+
+/** FATFileSystem::stat() plus the file's FAT date and time in st_mtime, packed
+ *  as date << 16 | time: equal for an unchanged file, but not a time_t.
+ *  @return 0 on success, negative error code on failure.
+ */
+int StreamFileSystem::stat(const char* path, struct stat* st) {
+    int err = FATFileSystem::stat(path, st);
+    st->st_mtime = 0;
+    if (err || !S_ISREG(st->st_mode)) {
+        return err;
+    }
+    // f_open leaves the file's directory entry in the volume window, held under
+    // the file system lock so no other call moves the window before it is read
+    fs_file_t handle;
+    lock();
+    if (file_open(&handle, path, O_RDONLY) == 0) {
+        const BYTE* entry = static_cast<FIL*>(handle)->dir_ptr;
+        uint16_t date = entry[24] | entry[25] << 8;  // DIR_ModDate
+        uint16_t time = entry[22] | entry[23] << 8;  // DIR_ModTime
+        st->st_mtime = (uint32_t)date << 16 | time;
+        file_close(handle);
+    }
+    unlock();
+    return 0;
+}
+
+/** @return Block device song sectors are read from, null when unmounted. */
+BlockDevice* StreamFileSystem::device() {
+    return bd;
+}
+
+/** Find the sectors holding a file. path is the full path, e.g. "/sd/a.mp3".
+ *  @return Number of extents filled in, 0 when the file can't be opened
+ *          or is in more than max pieces.
+ */
+size_t StreamFileSystem::mapFile(const char* path, Extent* extents, size_t max, uint32_t& size,
+                                 uint32_t& sectorSize) {
+    // Skip the mount point, FatFs paths are relative to the volume
+    size_t nameLength = strlen(getName());
+    if (path[0] == '/' && strncmp(path + 1, getName(), nameLength) == 0 && path[nameLength + 1] == '/') {
+        path += nameLength + 1;
+    }
+
+    fs_file_t handle;
+    if (!bd || file_open(&handle, path, O_RDONLY) != 0) {
+        return 0;
+    }
+    FIL* fil = static_cast<FIL*>(handle);
+    FATFS* fat = fil->obj.fs;
+#if FF_MAX_SS != FF_MIN_SS
+    sectorSize = fat->ssize;
+#else
+    sectorSize = FF_MAX_SS;
+#endif
+    size = f_size(fil);
+    uint32_t clusterBytes = fat->csize * sectorSize;
+
+    size_t count = 0;
+    for (uint32_t offset = 0; offset < size; offset += clusterBytes) {
+        // One byte into the cluster, FatFs leaves clust on the previous one at a boundary
+        if (file_seek(handle, offset + 1, SEEK_SET) < 0) {
+            count = 0;
+            break;
+        }
+        uint32_t sector = fat->database + (fil->clust - 2) * fat->csize;
+        if (count > 0 && extents[count - 1].sector + extents[count - 1].sectors == sector) {
+            extents[count - 1].sectors += fat->csize;
+        } else if (count == max) {
+            count = 0;  // too fragmented to be worth it
+            break;
+        } else {
+            extents[count].sector = sector;
+            extents[count].sectors = fat->csize;
+            count++;
+        }
+    }
+    file_close(handle);
+    return count;
+}
@@ -0,0 +1,36 @@
+/**
+ *  StreamFileSystem.h
+ *  ===========================================================================
+ *  The FAT file system on the SD card, as the player's SongVolume.
+ *       - FATFileSystem with one extra call that walks a file's cluster
+ *         chain once and returns it as a few runs of consecutive sectors.
+ *       - Song sectors can be read from another view of the card than
+ *         FatFs's, e.g. one past the sector cache.
+ *       - stat() also fills in st_mtime, which FATFileSystem leaves out,
+ *         so the track index can tell a changed song from an unchanged one.
+ */
+
+#ifndef STREAM_FILE_SYSTEM_H_
+#define STREAM_FILE_SYSTEM_H_
+
+#include "mbed.h"
+#include "FATFileSystem.h"
+#include "SongVolume.h"
+
+/** Class StreamFileSystem. FATFileSystem that can map a file to its sectors. */
+class StreamFileSystem : public FATFileSystem, public SongVolume {
+public:
+    StreamFileSystem(const char* name);
+    virtual int mount(BlockDevice* bd);
+    int mount(BlockDevice* bd, BlockDevice* songs);
+    virtual int unmount();
+    virtual int stat(const char* path, struct stat* st);
+    virtual size_t mapFile(const char* path, Extent* extents, size_t max, uint32_t& size,
+                           uint32_t& sectorSize);
+    virtual BlockDevice* device();
+
+private:
+    BlockDevice* bd;
+};
+
+#endif
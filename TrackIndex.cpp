@@ -0,0 +1,329 @@
+/**
+ *  TrackIndex.cpp
+ *  ===========================================================================
+ *  Persistent library cache stored on the SD card next to the music.
+ *
+ *  File layout (little endian):
+ *      header  magic u32, version u16, flags u16, track count u32,
+ *              listing hash u32, folder count u32
+ *      folder  parent u16, name length u8, name bytes   (root not stored)
+ *      track   size u32, duration u32, modified u32, folder u16,
+ *              name length u8, name bytes
+ *
+ *  modified is whatever stat() reports as st_mtime, only ever compared for
+ *  equality; a file system that doesn't keep it gives 0 and size alone counts.
+ */
+
+#include "mbed.h"
+#include "TrackIndex.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+static const size_t TRACK_RECORD = 14;
+
+// FNV-1a, as Library::trackHash() keys a track by its path below the music root
+static uint32_t hashName(uint32_t hash, const char* name) {
+    for (const char* c = name; *c; c++) {
+        hash ^= (uint8_t)*c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void put16(uint8_t* p, uint16_t v) {
+    p[0] = v; p[1] = v >> 8;
+}
+
+static void put32(uint8_t* p, uint32_t v) {
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static uint16_t get16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Length-prefixed name, at most 255 bytes (FAT long names fit)
+static bool writeName(FILE* f, const char* name) {
+    size_t n = strlen(name);
+    uint8_t len = n > 255 ? 255 : n;
+    return fwrite(&len, 1, 1, f) == 1 && fwrite(name, 1, len, f) == len;
+}
+
+static bool readName(FILE* f, char* name) {
+    uint8_t len;
+    if (fread(&len, 1, 1, f) != 1 || fread(name, 1, len, f) != len) {
+        return false;
+    }
+    name[len] = '\0';
+    return true;
+}
+
+/** Constructor of class TrackIndex. */
+TrackIndex::TrackIndex(const char* indexPath)
+:
+    indexPath(indexPath),
+    storedCount(0),
+    storedHash(0),
+    storedFull(false),
+    previous(nullptr),
+    previousLeft(0)
+{
+}
+
+/** Destructor of class TrackIndex. */
+TrackIndex::~TrackIndex() {
+    endReuse();
+}
+
+/** Load the library from the index file, without touching the directories.
+ *  A save cut short by power loss can leave only the backup of the old index
+ *  or the finished temporary file, so those are tried next.
+ *  @return Zero when there is no usable index (cold boot), non-zero otherwise.
+ */
+bool TrackIndex::load(Library& library) {
+    return loadFile(indexPath, library) ||
+           loadFile(indexPath + ".bak", library) ||
+           loadFile(indexPath + ".tmp", library);
+}
+
+/** Load the library from one index file. A partly written file fails the checks.
+ *  @return Zero when the file is missing or unusable, non-zero otherwise.
+ */
+bool TrackIndex::loadFile(const std::string& path, Library& library) {
+    uint8_t header[20];
+    uint8_t record[TRACK_RECORD];
+    char    name[256];
+    bool    ok;
+
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        return false;
+    }
+    ok = fread(header, 1, sizeof(header), f) == sizeof(header) &&
+         get32(header) == MAGIC && get16(header + 4) == VERSION;
+    uint32_t tracks = ok ? get32(header + 8) : 0;
+    uint32_t folders = ok ? get32(header + 16) : 0;
+
+    library.clear();
+    for (uint32_t i = 0; ok && i < folders; i++) {
+        ok = fread(record, 1, 2, f) == 2 && readName(f, name) &&
+             get16(record) < library.folderCount();
+        if (ok) {
+            ok = library.addFolder(name, get16(record)) != Library::NO_FOLDER;
+        }
+    }
+    for (uint32_t i = 0; ok && i < tracks; i++) {
+        ok = fread(record, 1, TRACK_RECORD, f) == TRACK_RECORD && readName(f, name) &&
+             get16(record + 12) < library.folderCount();
+        if (ok) {
+            ok = library.addTrack(name, get16(record + 12), get32(record), get32(record + 4));
+        }
+    }
+    fclose(f);
+
+    if (!ok) {
+        library.clear();
+        return false;
+    }
+    storedCount = tracks;
+    storedHash = get32(header + 12);
+    storedFull = get16(header + 6) & FULL;
+    loadedPath = path;
+    return true;
+}
+
+/** Write the library out as the new index, with the modification stamps the
+ *  scan record()ed; tracks it didn't stamp get 0 and are probed again by the
+ *  next rebuild.
+ *  @return Zero at failure, non-zero at success.
+ */
+bool TrackIndex::save(Library& library) {
+    uint8_t header[20];
+    uint8_t record[TRACK_RECORD];
+    bool    ok;
+
+    endReuse();  // the old index is about to be replaced
+
+    size_t   tracks = library.trackCount();
+    size_t   folders = library.folderCount();
+    uint32_t hash = library.listingHash();
+
+    put32(header, MAGIC);
+    put16(header + 4, VERSION);
+    put16(header + 6, library.full() ? FULL : 0);
+    put32(header + 8, tracks);
+    put32(header + 12, hash);
+    put32(header + 16, folders - 1);
+
+    // Write next to the old index and swap at the end, so a pulled card
+    // leaves either the old or the new index but never half of one
+    std::string tmpPath = indexPath + ".tmp";
+    std::string bakPath = indexPath + ".bak";
+    FILE* f = fopen(tmpPath.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    ok = fwrite(header, 1, sizeof(header), f) == sizeof(header);
+    for (size_t i = 1; ok && i < folders; i++) {
+        put16(record, library.folderParent(i));
+        ok = fwrite(record, 1, 2, f) == 2 && writeName(f, library.folderName(i));
+    }
+    for (size_t i = 0; ok && i < tracks; i++) {
+        put32(record, library.trackSize(i));
+        put32(record + 4, library.trackDuration(i));
+        put32(record + 8, i < stamps.size() ? stamps[i] : 0);
+        put16(record + 12, library.trackFolder(i));
+        ok = fwrite(record, 1, TRACK_RECORD, f) == TRACK_RECORD && writeName(f, library.trackName(i));
+    }
+    ok = fclose(f) == 0 && ok;
+    std::vector<uint32_t>().swap(stamps);
+
+    if (ok) {
+        // FatFs won't rename onto an existing file, so move the old index aside
+        // rather than deleting it; it only goes once the new one has its name
+        remove(bakPath.c_str());
+        bool backedUp = rename(indexPath.c_str(), bakPath.c_str()) == 0;
+        ok = rename(tmpPath.c_str(), indexPath.c_str()) == 0;
+        if (ok) {
+            remove(bakPath.c_str());
+        } else if (backedUp) {
+            rename(bakPath.c_str(), indexPath.c_str());
+        }
+    }
+    if (ok) {
+        storedCount = tracks;
+        storedHash = hash;
+        storedFull = library.full();
+        loadedPath = indexPath;
+    } else {
+        remove(tmpPath.c_str());
+    }
+    return ok;
+}
+
+/** Compare a walk of the card against the index. hash covers the first
+ *  hashLimit() tracks of the walk, tracks counts all of them.
+ *  @return Non-zero when the card still lists what the index holds; past a
+ *          full library's last track it may hold more, which wouldn't fit.
+ */
+bool TrackIndex::matches(size_t tracks, uint32_t hash) {
+    if (hash != storedHash) {
+        return false;
+    }
+    return storedFull ? tracks >= storedCount : tracks == storedCount;
+}
+
+/** @return How many tracks of a walk the listing hash should cover. */
+size_t TrackIndex::hashLimit() {
+    return storedFull ? storedCount : SIZE_MAX;
+}
+
+/** Start a scan for the next save(): forget earlier record()s and open the
+ *  index the library was loaded from for reuse() by a rebuild, e.g. after
+ *  the menu dropped a stale library. Only the old folder paths are held, as
+ *  one hash state each; track records are read as the walk asks.
+ *  @return Zero when there is no old index to read.
+ */
+bool TrackIndex::beginReuse() {
+    uint8_t header[20];
+    uint8_t record[2];
+    char    name[256];
+
+    endReuse();
+    stamps.clear();
+    if (loadedPath.empty()) {
+        return false;
+    }
+    previous = fopen(loadedPath.c_str(), "rb");
+    if (!previous) {
+        return false;
+    }
+    bool ok = fread(header, 1, sizeof(header), previous) == sizeof(header) &&
+              get32(header) == MAGIC && get16(header + 4) == VERSION;
+    uint32_t folders = ok ? get32(header + 16) : 0;
+    folderKeys.assign(1, 2166136261u);
+    for (uint32_t i = 0; ok && i < folders; i++) {
+        ok = fread(record, 1, 2, previous) == 2 && readName(previous, name) &&
+             get16(record) < folderKeys.size();
+        if (ok) {
+            folderKeys.push_back(hashName(hashName(folderKeys[get16(record)], name), "/"));
+        }
+    }
+    if (!ok) {
+        endReuse();
+        return false;
+    }
+    previousLeft = get32(header + 8);
+    return true;
+}
+
+/** Look a walked track up in the old index. Walks find the files in the
+ *  order the index lists them, so the search starts after the last match
+ *  and gives up after REUSE_WINDOW records; tracks before a match are gone.
+ *  pathHash is Library::trackHash() of the track's path below the root.
+ *  @return Non-zero, with duration filled in, when the old index has the
+ *          track with the same size and modification stamp.
+ */
+bool TrackIndex::reuse(uint32_t pathHash, uint32_t size, uint32_t modified, uint32_t& duration) {
+    uint8_t record[TRACK_RECORD];
+    char    name[256];
+
+    if (!previous) {
+        return false;
+    }
+    long start = ftell(previous);
+    for (size_t k = 0; k < REUSE_WINDOW && k < previousLeft; k++) {
+        if (fread(record, 1, TRACK_RECORD, previous) != TRACK_RECORD || !readName(previous, name) ||
+            get16(record + 12) >= folderKeys.size()) {
+            endReuse();
+            return false;
+        }
+        if (hashName(folderKeys[get16(record + 12)], name) != pathHash) {
+            continue;
+        }
+        previousLeft -= k + 1;
+        if (get32(record) != size || get32(record + 8) != modified) {
+            return false;  // same name, different file
+        }
+        duration = get32(record + 4);
+        return true;
+    }
+    // A new file, the next walked track is looked for from the same place
+    fseek(previous, start, SEEK_SET);
+    return false;
+}
+
+/** Close the old index after a rebuild. */
+void TrackIndex::endReuse() {
+    if (previous) {
+        fclose(previous);
+        previous = nullptr;
+    }
+    std::vector<uint32_t>().swap(folderKeys);
+    previousLeft = 0;
+}
+
+/** Note the modification stamp of the track a scan just added to the library. */
+void TrackIndex::record(uint32_t modified) {
+    stamps.push_back(modified);
+}
+
+/** Size and modification stamp of a file, as the index records them.
+ *  @return Zero when the file can't be looked up.
+ */
+bool TrackIndex::stamp(const char* path, uint32_t& size, uint32_t& modified) {
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    if (stat(path, &st) != 0) {
+        return false;
+    }
+    size = st.st_size;
+    modified = (uint32_t)st.st_mtime;
+    return true;
+}
@@ -0,0 +1,67 @@
+/**
+ *  TrackIndex.h
+ *  ===========================================================================
+ *  Persistent library cache stored on the SD card next to the music.
+ *       - Holds the folder tree plus file names, sizes and estimated
+ *         durations in one small binary file, so a warm boot reads a few
+ *         sectors instead of walking the card and probing every song.
+ *       - Stamped with the track count and a hash of the listing; a
+ *         background walk of the card compares against it with matches().
+ *         An index of a library that ran out of memory only vouches for
+ *         the tracks it holds, hashLimit() says how many.
+ *       - Each track keeps its size and modification stamp, so a rebuild
+ *         after the card changed reads the durations of untouched songs
+ *         back from the old index (reuse()) and only probes the rest. The
+ *         stamps come from the scan's walk (record()), save() looks up no
+ *         song again.
+ *       - Rewritten through a temporary file, with the old index kept as
+ *         a backup until the new one is in place; load() falls back to
+ *         either if power was lost in between.
+ */
+
+#ifndef TRACK_INDEX_H_
+#define TRACK_INDEX_H_
+
+#include "mbed.h"
+#include "Library.h"
+#include <string>
+#include <vector>
+
+/** Class TrackIndex. Loads, validates and rewrites the on-card library index. */
+class TrackIndex {
+public:
+    static const uint32_t MAGIC   = 0x58444954;  // "TIDX"
+    static const uint16_t VERSION = 3;
+    static const uint16_t FULL    = 0x0001;      // header flag: the library was cut short
+    static const size_t   REUSE_WINDOW = 16;     // old records looked ahead for a walked track
+
+    TrackIndex(const char* indexPath);
+    ~TrackIndex();
+    bool load(Library& library);
+    bool save(Library& library);
+    bool matches(size_t tracks, uint32_t hash);
+    size_t hashLimit();
+
+    bool beginReuse();
+    bool reuse(uint32_t pathHash, uint32_t size, uint32_t modified, uint32_t& duration);
+    void endReuse();
+    void record(uint32_t modified);
+
+    static bool stamp(const char* path, uint32_t& size, uint32_t& modified);
+
+private:
+    bool loadFile(const std::string& path, Library& library);
+
+    std::string indexPath;
+    std::string loadedPath;  // the file load() took the library from, empty before
+    uint32_t    storedCount;
+    uint32_t    storedHash;
+    bool        storedFull;
+    // The old index while a rebuild reads it, see beginReuse()
+    FILE*                 previous;
+    std::vector<uint32_t> folderKeys;    // path hash state after each old folder's path
+    uint32_t              previousLeft;  // track records not yet read
+    std::vector<uint32_t> stamps;        // modification stamps of the scan's tracks, for save()
+};
+
+#endif
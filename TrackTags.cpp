@@ -0,0 +1,392 @@
+/**
+ *  TrackTags.cpp
+ *  ===========================================================================
+ *  Artist and title of each song, read from its ID3 tags as they are asked for.
+ *
+ *  Cache file layout: magic u32, record size u32, then a table of BUCKETS
+ *  records (path hash u32, file size u32, audio start u32, title, artist).
+ *  The table is written out blank when the file is created, so storing a
+ *  record never grows the file while the player is running. A file's
+ *  record sits within PROBES buckets of hash % BUCKETS. A file whose size
+ *  changed is parsed again and replaces its old record, and a full probe
+ *  run evicts the home bucket.
+ */
+
+#include "mbed.h"
+#include "TrackTags.h"
+#include <cstring>
+#include <string>
+
+// Longest frame body read for a text frame, enough for TITLE_LEN characters in UTF-16
+static const size_t TEXT_MAX = 2 + 2 * TrackTags::TITLE_LEN + 2;
+static const uint32_t REQUEST_FLAG = 1;
+
+static uint32_t syncsafe(const uint8_t* p) {
+    return (p[0] & 0x7f) << 21 | (p[1] & 0x7f) << 14 | (p[2] & 0x7f) << 7 | (p[3] & 0x7f);
+}
+
+// Decode an ID3v2 text frame body into plain ASCII, the LCD font has nothing else
+static void decodeText(const uint8_t* body, size_t n, char* out, size_t max) {
+    size_t len = 0;
+    if (n == 0) {
+        out[0] = '\0';
+        return;
+    }
+    uint8_t encoding = body[0];
+    const uint8_t* p = body + 1;
+    const uint8_t* end = body + n;
+
+    if (encoding == 1 || encoding == 2) {
+        // UTF-16 with a byte order mark, or UTF-16BE without one
+        bool big = encoding == 2;
+        if (encoding == 1 && p + 2 <= end) {
+            big = p[0] == 0xfe && p[1] == 0xff;
+            p += 2;
+        }
+        for (; p + 2 <= end && len < max; p += 2) {
+            uint16_t unit = big ? (p[0] << 8 | p[1]) : (p[1] << 8 | p[0]);
+            if (unit == 0) {
+                break;
+            }
+            if (unit >= 0xdc00 && unit < 0xe000) {
+                continue;  // second half of a surrogate pair, already shown as '?'
+            }
+            out[len++] = unit < 0x80 ? unit : '?';
+        }
+    } else {
+        // ISO-8859-1 or UTF-8, anything outside ASCII becomes one '?'
+        for (; p < end && *p && len < max; p++) {
+            if (*p < 0x80) {
+                out[len++] = *p;
+            } else if (encoding != 3 || *p >= 0xc0) {
+                out[len++] = '?';
+            }
+        }
+    }
+    while (len > 0 && out[len - 1] == ' ') {
+        len--;
+    }
+    out[len] = '\0';
+}
+
+// Copy a fixed width ID3v1 field, dropping the space or NUL padding
+static void copyField(const uint8_t* field, size_t width, char* out, size_t max) {
+    size_t len = 0;
+    for (size_t i = 0; i < width && field[i] && len < max; i++) {
+        out[len++] = field[i] < 0x80 ? field[i] : '?';
+    }
+    while (len > 0 && out[len - 1] == ' ') {
+        len--;
+    }
+    out[len] = '\0';
+}
+
+/** Constructor of class TrackTags. */
+TrackTags::TrackTags(const char* cachePath)
+:
+    cachePath(cachePath),
+    cache(nullptr),
+    ready(false),
+    useClock(0),
+    requested(0)
+{
+    memset(slots, 0, sizeof(slots));
+}
+
+/** Destructor of class TrackTags. */
+TrackTags::~TrackTags() {
+    if (cache) {
+        fclose(cache);
+    }
+}
+
+/** Read title, artist and the audio start of one file.
+ *  Reads the 10 byte ID3v2 header, then frame headers until both texts are
+ *  found, seeking over every other frame; ID3v1 fills in what is missing.
+ *  @return Zero when the file can't be opened, non-zero otherwise.
+ */
+bool TrackTags::parse(const char* path, Tags& tags) {
+    uint8_t h[10];
+    uint8_t body[TEXT_MAX];
+
+    tags.audioStart = 0;
+    tags.title[0] = tags.artist[0] = '\0';
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+
+    if (fread(h, 1, 10, f) == 10 && memcmp(h, "ID3", 3) == 0 && h[3] >= 2 && h[3] <= 4) {
+        uint8_t  major = h[3];
+        uint8_t  flags = h[5];
+        uint32_t end = 10 + syncsafe(h + 6);
+        uint32_t pos = 10;
+        size_t   frameHeader = major == 2 ? 6 : 10;
+        tags.audioStart = end + ((flags & 0x10) ? 10 : 0);  // v2.4 footer
+
+        if ((flags & 0x40) && major >= 3 && fread(h, 1, 4, f) == 4) {
+            // Extended header: v2.3 size excludes itself, v2.4 size is syncsafe and includes itself
+            pos += major == 3 ? 4 + (h[0] << 24 | h[1] << 16 | h[2] << 8 | h[3]) : syncsafe(h);
+        }
+        // A tag unsynchronised as a whole (pre v2.4) can't be read frame by frame
+        bool readable = !((flags & 0x80) && major < 4);
+
+        while (readable && pos + frameHeader <= end && (!tags.title[0] || !tags.artist[0])) {
+            fseek(f, pos, SEEK_SET);
+            if (fread(h, 1, frameHeader, f) != frameHeader || h[0] == 0) {
+                break;  // padding
+            }
+            uint32_t size;
+            uint16_t frameFlags = 0;
+            bool     isTitle, isArtist;
+            if (major == 2) {
+                size = h[3] << 16 | h[4] << 8 | h[5];
+                isTitle = memcmp(h, "TT2", 3) == 0;
+                isArtist = memcmp(h, "TP1", 3) == 0;
+            } else {
+                size = major == 4 ? syncsafe(h + 4) : (uint32_t)(h[4] << 24 | h[5] << 16 | h[6] << 8 | h[7]);
+                frameFlags = h[8] << 8 | h[9];
+                isTitle = memcmp(h, "TIT2", 4) == 0;
+                isArtist = memcmp(h, "TPE1", 4) == 0;
+            }
+            pos += frameHeader + size;
+            if (pos > end) {
+                break;
+            }
+            // Compressed or encrypted frames aren't worth the code
+            bool packed = major == 3 ? (frameFlags & 0x00c0) : (frameFlags & 0x000c);
+            if ((!isTitle && !isArtist) || packed) {
+                continue;
+            }
+            if (major == 4 && (frameFlags & 0x0001) && size >= 4) {
+                fseek(f, 4, SEEK_CUR);  // data length indicator
+                size -= 4;
+            }
+            size_t n = fread(body, 1, size < sizeof(body) ? size : sizeof(body), f);
+            if (isTitle) {
+                decodeText(body, n, tags.title, TITLE_LEN);
+            } else {
+                decodeText(body, n, tags.artist, ARTIST_LEN);
+            }
+        }
+    }
+
+    if (!tags.title[0] || !tags.artist[0]) {
+        uint8_t v1[128];
+        if (fseek(f, -128, SEEK_END) == 0 && fread(v1, 1, 128, f) == 128 && memcmp(v1, "TAG", 3) == 0) {
+            if (!tags.title[0]) {
+                copyField(v1 + 3, 30, tags.title, TITLE_LEN);
+            }
+            if (!tags.artist[0]) {
+                copyField(v1 + 33, 30, tags.artist, ARTIST_LEN);
+            }
+        }
+    }
+    // A damaged tag size must not make playback start past the end
+    fseek(f, 0, SEEK_END);
+    if ((long)tags.audioStart >= ftell(f)) {
+        tags.audioStart = 0;
+    }
+    fclose(f);
+    return true;
+}
+
+/** Make sure the card cache exists with its whole table, writing a blank one
+ *  when it is missing, short or from an older layout. Slow the first time,
+ *  so call it from the scan thread; get() only uses the card once it's done.
+ *  @return Zero when the card can't hold a cache.
+ */
+bool TrackTags::prepare() {
+    uint32_t header[2];
+    long     full = HEADER + BUCKETS * sizeof(Record);
+
+    if (ready) {
+        return true;
+    }
+    FILE* f = fopen(cachePath, "rb");
+    if (f) {
+        bool valid = fread(header, 1, HEADER, f) == HEADER && header[0] == MAGIC &&
+                     header[1] == sizeof(Record) && fseek(f, 0, SEEK_END) == 0 && ftell(f) == full;
+        fclose(f);
+        if (valid) {
+            ready = true;
+            return true;
+        }
+    }
+
+    // Build it under another name, so the UI thread never sees half a table
+    std::string tmpPath = std::string(cachePath) + ".tmp";
+    f = fopen(tmpPath.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    Record blank;
+    memset(&blank, 0, sizeof(blank));
+    header[0] = MAGIC;
+    header[1] = sizeof(Record);
+    bool ok = fwrite(header, 1, HEADER, f) == HEADER;
+    for (size_t i = 0; ok && i < BUCKETS; i++) {
+        ok = fwrite(&blank, 1, sizeof(Record), f) == sizeof(Record);
+    }
+    ok = fclose(f) == 0 && ok;
+    remove(cachePath);
+    if (!ok || rename(tmpPath.c_str(), cachePath) != 0) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    ready = true;
+    return true;
+}
+
+/** Open the card cache once prepare() has built it.
+ *  @return Zero while there is no usable cache.
+ */
+bool TrackTags::openCache() {
+    if (!cache && ready) {
+        cache = fopen(cachePath, "r+b");
+    }
+    return cache != nullptr;
+}
+
+/** Look a file up in the card cache, probing from its home bucket.
+ *  @return Non-zero with record filled in when found; otherwise bucket is
+ *          set to where a new record for the file should go.
+ */
+bool TrackTags::findRecord(uint32_t hash, uint32_t size, Record& record, size_t& bucket) {
+    bucket = hash % BUCKETS;
+    if (!openCache()) {
+        return false;
+    }
+    for (size_t i = 0; i < PROBES; i++) {
+        size_t probe = (hash + i) % BUCKETS;
+        fseek(cache, HEADER + probe * sizeof(Record), SEEK_SET);
+        bool empty = fread(&record, 1, sizeof(Record), cache) != sizeof(Record) ||
+                     (record.hash == 0 && record.size == 0);
+        if (!empty && record.hash == hash && record.size == size) {
+            return true;
+        }
+        if (empty || record.hash == hash) {
+            bucket = probe;  // free, or this file before it changed
+            return false;
+        }
+    }
+    return false;
+}
+
+/** Store a record in a bucket of the preallocated table. */
+void TrackTags::writeRecord(size_t bucket, const Record& record) {
+    if (!openCache()) {
+        return;
+    }
+    fseek(cache, HEADER + bucket * sizeof(Record), SEEK_SET);
+    fwrite(&record, 1, sizeof(Record), cache);
+    fflush(cache);
+}
+
+/** @return An unused RAM slot, or the least recently used one. */
+TrackTags::Slot& TrackTags::oldestSlot() {
+    Slot* oldest = &slots[0];
+    for (size_t i = 0; i < RAM_SLOTS; i++) {
+        if (!slots[i].used) {
+            return slots[i];
+        }
+        if (slots[i].lastUse < oldest->lastUse) {
+            oldest = &slots[i];
+        }
+    }
+    return *oldest;
+}
+
+/** Tags of a library track, from RAM only. A miss is queued for serve(),
+ *  and attach()'s callback says when it has been read.
+ *  @return Zero, with title and artist empty, while the tags aren't in RAM.
+ */
+bool TrackTags::find(Library& library, size_t track, Tags& tags) {
+    uint32_t hash = library.trackHash(track);
+    uint32_t size = library.trackSize(track);
+
+    lock.lock();
+    for (size_t i = 0; i < RAM_SLOTS; i++) {
+        if (slots[i].used && slots[i].record.hash == hash && slots[i].record.size == size) {
+            slots[i].lastUse = ++useClock;
+            tags = slots[i].record.tags;
+            lock.unlock();
+            return true;
+        }
+    }
+    memset(&tags, 0, sizeof(tags));
+    bool queued = false;
+    for (size_t i = 0; i < requested; i++) {
+        queued = queued || (requests[i].hash == hash && requests[i].size == size);
+    }
+    if (!queued) {
+        // A menu scrolled past the oldest request no longer shows it
+        if (requested == RAM_SLOTS) {
+            memmove(requests, requests + 1, --requested * sizeof(Request));
+        }
+        requests[requested].track = track;
+        requests[requested].hash = hash;
+        requests[requested].size = size;
+        requested++;
+    }
+    lock.unlock();
+    wanted.set(REQUEST_FLAG);
+    return false;
+}
+
+/** Call func on serve()'s thread each time it has put a song's tags in RAM. */
+void TrackTags::attach(Callback<void()> func) {
+    arrived = func;
+}
+
+/** Read the tags find() asks for, for good. Runs on the scan thread once
+ *  the library is up to date, so no parse or card cache access happens on
+ *  the UI thread.
+ */
+void TrackTags::serve(Library& library) {
+    while (true) {
+        wanted.wait_any(REQUEST_FLAG);
+        while (true) {
+            lock.lock();
+            if (requested == 0) {
+                lock.unlock();
+                break;
+            }
+            Request request = requests[0];
+            memmove(requests, requests + 1, --requested * sizeof(Request));
+            lock.unlock();
+            fill(library, request);
+        }
+    }
+}
+
+/** Tags of a requested song into RAM: from the card cache, else the file itself.
+ *  A file that can't be read is left out, find() asks for it again next time.
+ */
+void TrackTags::fill(Library& library, const Request& request) {
+    Record record;
+    size_t bucket;
+
+    // Only the same file as when it was asked for, the library may have been rebuilt since
+    if (request.track >= library.trackCount() || library.trackHash(request.track) != request.hash ||
+        library.trackSize(request.track) != request.size) {
+        return;
+    }
+    if (!findRecord(request.hash, request.size, record, bucket)) {
+        record.hash = request.hash;
+        record.size = request.size;
+        if (!parse(library.trackPath(request.track).c_str(), record.tags)) {
+            return;
+        }
+        writeRecord(bucket, record);
+    }
+    lock.lock();
+    Slot& slot = oldestSlot();
+    slot.used = true;
+    slot.lastUse = ++useClock;
+    slot.record = record;
+    lock.unlock();
+    if (arrived) {
+        arrived();
+    }
+}
@@ -0,0 +1,97 @@
+/**
+ *  TrackTags.h
+ *  ===========================================================================
+ *  Artist and title of each song, read from its ID3 tags as they are asked for.
+ *       - Only the ID3v2 header and the frame headers are read; frame
+ *         bodies other than title and artist (artwork, lyrics) are skipped
+ *         with a seek. ID3v1 at the end of the file is the fallback.
+ *       - Results go to a small least recently used RAM cache and to a
+ *         fixed-record file on the card, so each song is parsed once, not
+ *         once per boot. Both are keyed by the file's path hash and size,
+ *         never its track index, so a rescan that renumbers the library
+ *         still finds them. A file that can't be opened isn't cached.
+ *       - The card file is created at its full size by prepare() on the
+ *         scan thread; until then tags are only kept in RAM.
+ *       - find() only looks in RAM, so the UI thread never waits on the
+ *         card. A miss is queued for serve(), which the scan thread runs
+ *         once the library is up to date; it reads the card cache or the
+ *         file and calls back, so the screen shows the file name until
+ *         the tag arrives.
+ *       - The tag size gives where the audio starts, so playback can skip
+ *         embedded artwork instead of streaming it to the decoder; a song
+ *         started before its tag was read is streamed from the top.
+ */
+
+#ifndef TRACK_TAGS_H_
+#define TRACK_TAGS_H_
+
+#include "mbed.h"
+#include "Library.h"
+#include <cstdio>
+
+/** Class TrackTags. ID3 parser on a background thread, with a RAM and an on-card cache. */
+class TrackTags {
+public:
+    static const size_t TITLE_LEN  = 23;
+    static const size_t ARTIST_LEN = 19;
+    static const size_t RAM_SLOTS  = 16;  // a menu page, the playing song and the next one
+
+    struct Tags {
+        uint32_t audioStart;  // first byte after the ID3v2 tag, 0 without one
+        char     title[TITLE_LEN + 1];
+        char     artist[ARTIST_LEN + 1];
+    };
+
+    TrackTags(const char* cachePath);
+    ~TrackTags();
+    bool find(Library& library, size_t track, Tags& tags);
+    void attach(Callback<void()> func);
+    void serve(Library& library);
+    bool prepare();
+
+    static bool parse(const char* path, Tags& tags);
+
+private:
+    // One record per file in the cache file's hash table, keyed by path hash and size
+    struct Record {
+        uint32_t hash;   // 0 with size 0 is an empty bucket
+        uint32_t size;
+        Tags     tags;
+    };
+    struct Slot {
+        bool     used;
+        uint32_t lastUse;  // useClock at the last hit, the smallest goes first
+        Record   record;
+    };
+    // A song find() missed, identified as it was then in case the library is rebuilt
+    struct Request {
+        size_t   track;
+        uint32_t hash;
+        uint32_t size;
+    };
+
+    static const uint32_t MAGIC   = 0x32474154;  // "TAG2"
+    static const size_t   HEADER  = 8;            // magic u32, record size u32
+    static const size_t   BUCKETS = 1024;         // well above what the library budget can list
+    static const size_t   PROBES  = 8;            // records tried from the home bucket
+
+    bool openCache();
+    bool findRecord(uint32_t hash, uint32_t size, Record& record, size_t& bucket);
+    void writeRecord(size_t bucket, const Record& record);
+    Slot& oldestSlot();
+    void fill(Library& library, const Request& request);
+
+    const char*      cachePath;
+    FILE*            cache;     // serve()'s thread only
+    volatile bool    ready;     // the card file exists at its full size
+    // RAM cache and requests, shared between find() and serve()
+    Mutex            lock;
+    Slot             slots[RAM_SLOTS];
+    uint32_t         useClock;
+    Request          requests[RAM_SLOTS];  // oldest first, the oldest goes when full
+    size_t           requested;
+    EventFlags       wanted;
+    Callback<void()> arrived;   // called on serve()'s thread with a new entry in RAM
+};
+
+#endif
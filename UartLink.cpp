@@ -0,0 +1,51 @@
+/**
+ *  UartLink.cpp
+ *  ===========================================================================
+ *  The uLCD-144-G2's serial port and reset pin on the board.
+ */
+
+#include "mbed.h"
+#include "UartLink.h"
+
+/** Constructor of class UartLink. The screen powers up at 9600 baud. */
+UartLink::UartLink(PinName tx, PinName rx, PinName rst)
+:
+    serial(tx, rx, 9600),
+    rst(rst, 1)
+{
+}
+
+/** Queue bytes on the UART. @return Bytes queued. */
+ssize_t UartLink::write(const void* data, size_t length) {
+    return serial.write(data, length);
+}
+
+/** Read received bytes, blocking until there is one. @return Bytes read. */
+ssize_t UartLink::read(void* data, size_t length) {
+    return serial.read(data, length);
+}
+
+/** @return Non-zero when a received byte is waiting. */
+bool UartLink::readable() {
+    return serial.readable();
+}
+
+/** Call func on the UART's receive (and transmit) events, from its interrupt. */
+void UartLink::sigio(Callback<void()> func) {
+    serial.sigio(func);
+}
+
+/** Change the UART's rate. */
+void UartLink::set_baud(int baud) {
+    serial.set_baud(baud);
+}
+
+/** Wait for the transmit buffer to empty. @return 0. */
+int UartLink::sync() {
+    return serial.sync();
+}
+
+/** Drive the reset pin. */
+void UartLink::reset_line(int level) {
+    rst = level;
+}
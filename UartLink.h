@@ -0,0 +1,30 @@
+/**
+ *  UartLink.h
+ *  ===========================================================================
+ *  The uLCD-144-G2's serial port and reset pin on the board.
+ */
+
+#ifndef UART_LINK_H_
+#define UART_LINK_H_
+
+#include "mbed.h"
+#include "DisplayLink.h"
+
+/** Class UartLink. DisplayLink over a BufferedSerial. */
+class UartLink : public DisplayLink {
+public:
+    UartLink(PinName tx, PinName rx, PinName rst);
+    virtual ssize_t write(const void* data, size_t length);
+    virtual ssize_t read(void* data, size_t length);
+    virtual bool readable();
+    virtual void sigio(Callback<void()> func);
+    virtual void set_baud(int baud);
+    virtual int sync();
+    virtual void reset_line(int level);
+
+private:
+    BufferedSerial serial;
+    DigitalOut     rst;
+};
+
+#endif
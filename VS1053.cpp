@@ -13,6 +13,20 @@
 
 #include "mbed.h"
 #include "VS1053.h"
+#include "Stats.h"
+
+// CLKI as a multiple of XTALI for each SC_MULT setting (CLOCKF bits 15:13), in halves
+static const uint8_t CLOCK_MULT_HALVES[8] = { 2, 4, 5, 6, 7, 8, 9, 10 };  // 1.0x ... 5.0x
+
+/** @return Fastest SPI clock at or below limitHz that the LPC1768's SSP can make.
+ *  spi.frequency() rounds to the nearest divider of PCLK/2, which can land above
+ *  the requested rate, so ask for an exact divider output instead.
+ */
+static uint32_t spiClockAtMost(uint32_t limitHz) {
+    uint32_t base = SystemCoreClock / 2;  // smallest SSP prescaler
+    uint32_t divider = (base + limitHz - 1) / limitHz;
+    return base / divider;
+}
 
 /** Constructor of class VS1053. */
 VS1053::VS1053(PinName mosiPin, PinName misoPin, PinName sckPin,
@@ -23,15 +37,26 @@ VS1053::VS1053(PinName mosiPin, PinName misoPin, PinName sckPin,
     cs(csPin),
     bsync(bsyncPin), //dcs pin
     dreq(dreqPin),
-    rst(rstPin)
+    rst(rstPin),
+    bulkTransfer(true),
+    slowFrequency(spiFrequency),
+    writeFrequency(spiFrequency),
+    readFrequency(spiFrequency),
+    measuredRate(0),
+    volume(0),
+    timeouts(0)
 {
-    //spi.format(8, 0);
-    //spi.frequency(spiFrequency);
+    // Start slow: until clockUp() CLKI is only XTALI, so reads top out near 1.75 MHz
+    spi.format(8, 0);
+    spi.frequency(spiFrequency);
 
     // Initialize outputs
     cs = 1;
     bsync = 1;
     rst = 1;
+
+    // DREQ goes high whenever the FIFO has room for another 32 bytes
+    dreq.rise(callback(this, &VS1053::onDreqRise));
 }
 
 /** Destructor of class VS1053. */
@@ -40,6 +65,8 @@ VS1053::~VS1053() {
 
 /** Make a hardware reset by hitting VS1053's RESET pin. */
 void VS1053::hardwareReset() {
+    // The PLL setting is lost on reset, so drop back to the slow SCI rate
+    setBusFrequency(slowFrequency, slowFrequency);
     rst = 0;
     wait_us(50000);
     rst = 1;
@@ -60,15 +87,100 @@ void VS1053::modeSwitch(void)
     wait_us(50000);
 }
 
-/** Send a data byte to VS1053. */
-void VS1053::sendDataByte(uint8_t data) {
-    while (!dreq);
+constexpr std::chrono::milliseconds VS1053::DREQ_TIMEOUT;
+
+/** DREQ rising edge interrupt. Wakes whichever thread is waiting on it. */
+void VS1053::onDreqRise() {
+    dreqEvent.set(DREQ_FLAG);
+}
+
+/** Sleep the calling thread until DREQ is high instead of spinning on it,
+ *  for at most timeout, so a chip that never comes back can't hang the caller.
+ *  Must not be called from interrupt context.
+ *  @return Zero when the timeout passed with DREQ still low.
+ */
+bool VS1053::waitForDreq(Kernel::Clock::duration_u32 timeout) {
+    Timer waited;
+    waited.start();
+    // Clear first so an edge between the clear and the check can't be lost
+    dreqEvent.clear(DREQ_FLAG);
+    while (!dreq) {
+        if (waited.elapsed_time() >= timeout) {
+            timeouts++;
+            STATS_COUNT(DREQ_TIMEOUT);
+            return false;
+        }
+        // The timeout only guards against a missed edge; normally the ISR wakes us
+        dreqEvent.wait_any_for(DREQ_FLAG, 5ms);
+    }
+    return true;
+}
+
+/** SPI asynchronous transfer completion callback (interrupt context). */
+void VS1053::onTransferDone(int /*event*/) {
+    dreqEvent.set(SPI_DONE_FLAG);
+}
+
+/** Clock one DREQ window (up to 32 bytes) out on SDI.
+ *  Caller must hold spiLock and have seen DREQ high.
+ */
+void VS1053::sendSdiChunk(const char* data, size_t n) {
+    bsync = 0;
+    if (bulkTransfer) {
+#if DEVICE_SPI_ASYNCH
+        // Whole window as one DMA/interrupt driven transfer, sleep until it completes
+        dreqEvent.clear(SPI_DONE_FLAG);
+        if (spi.transfer(data, n, (char*)nullptr, 0,
+                         callback(this, &VS1053::onTransferDone), SPI_EVENT_COMPLETE) == 0) {
+            dreqEvent.wait_any(SPI_DONE_FLAG);
+        } else {
+            spi.write(data, n, nullptr, 0);
+        }
+#else
+        // No async SPI on this target (LPC1768), use the blocking block write
+        spi.write(data, n, nullptr, 0);
+#endif
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            spi.write(*data++);
+        }
+    }
+    bsync = 1;
+}
+
+/** Sleep until VS1053 asks for more data or the timeout expires.
+ *  @return Non-zero when DREQ is high on return.
+ */
+bool VS1053::waitForData(Kernel::Clock::duration_u32 timeout) {
+    dreqEvent.clear(DREQ_FLAG);
+    if (!dreq) {
+        STATS_BEGIN(waitStart);
+        dreqEvent.wait_any_for(DREQ_FLAG, timeout);
+        STATS_END(DREQ_WAIT, waitStart);
+    } else {
+        STATS_COUNT(DREQ_HIGH_ON_ARRIVAL);  // the decoder had room before we came to look
+    }
+    return dreq;
+}
+
+/** Send a data byte to VS1053.
+ *  @return Zero when DREQ never rose and the byte wasn't sent.
+ */
+bool VS1053::sendDataByte(uint8_t data) {
+    spiLock.lock();
+    if (!waitForDreq()) {
+        spiLock.unlock();
+        return false;
+    }
     bsync = 0;
     spi.write(data);
     bsync = 1;
+    spiLock.unlock();
+    return true;
 }
 
 /** Send a data block specified as a pointer to VS1053.
+ *  Stops at the first window DREQ doesn't rise for, see recover().
  *  @return Data length successfully sent.
  */
 size_t VS1053::sendDataBlock(char* data, size_t length) {
@@ -77,22 +189,58 @@ size_t VS1053::sendDataBlock(char* data, size_t length) {
     if (!data || !length) return 0;
     while (length) {
         n = length < 32 ? length : 32;
-        while (!dreq);
-        bsync = 0;
-        for (uint32_t i = 0; i < n; i++) {
-            spi.write(*data++);
-            sizeSent++; length--;
+        STATS_BEGIN(sendStart);
+        spiLock.lock();
+        if (!waitForDreq()) {
+            spiLock.unlock();
+            break;
         }
-        bsync = 1;
+        sendSdiChunk(data, n);
+        spiLock.unlock();
+        STATS_END(SDI_SEND, sendStart);
+        data += n;
+        sizeSent += n; length -= n;
     }
     return sizeSent;
 }
 
-/** Change VS1053's PLL setting for speedup. */
-void VS1053::clockUp() {
+/** Bring back a decoder that stopped asking for data: a soft reset, or the
+ *  reset pin when even that gets no answer. Whatever was in its FIFO is lost.
+ *  @return Zero when the decoder didn't come back.
+ */
+bool VS1053::recover() {
+    return softReset();
+}
+
+/** Check the DREQ line without blocking.
+ *  @return Non-zero when VS1053 can accept at least 32 more bytes of SDI data.
+ */
+bool VS1053::readyForData() {
+    return dreq;
+}
+
+/** Change VS1053's PLL setting for speedup, then raise the SPI clock to match.
+ *  The new rate is checked by reading CLOCKF back; on a mismatch the bus
+ *  stays at the slow rate.
+ *  @return Zero when the fast rate could not be verified, non-zero otherwise.
+ */
+bool VS1053::clockUp() {
     // Set CLKI to 43.0-55.3 MHz
-    writeReg(SCI_CLOCKF, 0x8800);  // SC_MULT=4 (3.5x), SC_ADD=1 (+1.0x)
+    writeReg(SCI_CLOCKF, CLOCKF_VALUE);  // SC_MULT=4 (3.5x), SC_ADD=1 (+1.0x)
     wait_us(10000);
+
+    // SC_ADD only raises CLKI further when the decoder asks, so the limits follow SC_MULT alone
+    uint32_t clki = XTALI / 2 * CLOCK_MULT_HALVES[CLOCKF_VALUE >> 13];
+    setBusFrequency(spiClockAtMost(clki / 4), spiClockAtMost(clki / 7));
+
+    if (readReg(SCI_CLOCKF) != CLOCKF_VALUE ||
+        !(readReg(SCI_MODE) & (1 << SM_SDINEW))) {
+        setBusFrequency(slowFrequency, slowFrequency);
+        measuredRate = measureDataRate();
+        return false;
+    }
+    measuredRate = measureDataRate();
+    return true;
 }
 
 /** Send cancel request to VS1053.
@@ -101,13 +249,18 @@ void VS1053::clockUp() {
 bool VS1053::sendCancel() {
     uint16_t reg;
     
+    // Read-modify-write of SCI_MODE must not interleave with another thread
+    spiLock.lock();
+
     // Set SM_CANCEL bit
     reg = readReg(SCI_MODE);
     if (reg & 0x0008) {
         // Abort if SM_CANCEL is still set
+        spiLock.unlock();
         return false;
     }
     writeReg(SCI_MODE, reg | 0x0008);
+    spiLock.unlock();
     return true;
 }
 
@@ -117,34 +270,140 @@ bool VS1053::sendCancel() {
  */
 bool VS1053::stop() {
     uint16_t reg;
-    uint8_t  endFillByte;
-    size_t   n, length;
+    bool     cleared;
     
+    // Keep the feeder thread off the bus for the whole end-fill sequence
+    spiLock.lock();
+
     // If SM_CANCEL is still set, do nothing
     reg = readReg(SCI_MODE);
     if (reg & 0x0008) {
+        spiLock.unlock();
         return false;
     }
     
+    // Send lower 8 bits of endFillByte 2,052 times, then check if both HDAT0 and HDAT1 are cleared
+    cleared = sendEndFill(2052) && readReg(SCI_HDAT0) == 0x0000 && readReg(SCI_HDAT1) == 0x0000;
+    spiLock.unlock();
+    return cleared;
+}
+
+/** Abandon the current stream mid-song without resetting the chip
+ *  (datasheet "Cancelling Playback"). The caller must have stopped feeding.
+ *  Falls back to softReset() if SM_CANCEL or HDAT0/HDAT1 don't clear.
+ *  @return Zero when a soft reset was needed, non-zero otherwise.
+ */
+bool VS1053::cancelPlayback() {
+    bool clean = false;
+
+    spiLock.lock();
+    if (sendCancel() && waitCancelCleared()) {
+        clean = stop();
+    }
+    if (!clean) {
+        softReset();
+    }
+    spiLock.unlock();
+    return clean;
+}
+
+/** Close out a stream that was fed to its last byte, so the final frames
+ *  are decoded and the next file can follow without a reset
+ *  (datasheet "Playing a Whole File").
+ *  @return Zero when a soft reset was needed, non-zero otherwise.
+ */
+bool VS1053::finishPlayback() {
+    bool clean;
+
+    spiLock.lock();
+    clean = sendEndFill(2052) && sendCancel() && waitCancelCleared();
+    if (!clean) {
+        softReset();
+    }
+    spiLock.unlock();
+    return clean;
+}
+
+/** Software reset through SM_RESET. Much cheaper than hardwareReset():
+ *  no fixed delays, only a wait for DREQ to fall and rise again, and CLOCKF
+ *  is restored afterwards. A chip that doesn't raise DREQ again, e.g. after
+ *  a brown-out, gets the reset pin and its boot setup instead.
+ *  @return Zero when the decoder didn't come back even from the reset pin.
+ */
+bool VS1053::softReset() {
+    uint32_t writeHz, readHz;
+
+    spiLock.lock();
+    // CLKI may fall back to XTALI during the reset, so go slow until CLOCKF is back
+    writeHz = writeFrequency;
+    readHz = readFrequency;
+    setBusFrequency(slowFrequency, slowFrequency);
+    writeReg(SCI_MODE, (1<<SM_SDINEW) | (1<<SM_RESET));
+    // DREQ only drops a moment after SM_RESET is written, so see it fall before
+    // waiting for it to rise, or the wait can end before the reset has begun
+    Timer fall;
+    fall.start();
+    while (dreq && fall.elapsed_time() < 100us) {
+    }
+    bool up = waitForDreq();
+    if (!up) {
+        hardwareReset();
+        up = waitForDreq();
+        if (up) {
+            modeSwitch();
+            up = waitForDreq();
+        }
+        if (up) {
+            writeReg(SCI_VOL, volume);
+        }
+    }
+    if (up) {
+        up = writeReg(SCI_CLOCKF, CLOCKF_VALUE);
+        setBusFrequency(writeHz, readHz);
+    }
+    spiLock.unlock();
+    return up;
+}
+
+/** Send endFillByte (read from XRAM) length times. Caller holds spiLock.
+ *  @return Zero when DREQ stopped rising before all of it was sent.
+ */
+bool VS1053::sendEndFill(size_t length) {
+    char     endFill[32];
+    size_t   n;
+    uint16_t word;
+
     // Read endFillByte from XRAM <1E06h>
-    writeReg(SCI_WRAMADDR, 0x1e06);
-    reg = readReg(SCI_WRAM);
-    
-    // Send lower 8 bits of endFillByte 2,052 times
-    endFillByte = reg & 0xff;
-    length = 2052;
+    if (!writeReg(SCI_WRAMADDR, 0x1e06) || !readReg(SCI_WRAM, word)) {
+        return false;
+    }
+    memset(endFill, word & 0xff, sizeof(endFill));
+
     while (length) {
         n = length < 32 ? length : 32;
-        while (!dreq);
-        bsync = 0;
-        for (uint32_t i = 0; i < n; i++) {
-            spi.write(endFillByte);
-            length--;
+        if (!waitForDreq()) {
+            return false;
         }
-        bsync = 1;
+        sendSdiChunk(endFill, n);
+        length -= n;
     }
-    // Check if both HDAT0 and HDAT1 are cleared
-    return readReg(SCI_HDAT0) == 0x0000 && readReg(SCI_HDAT1) == 0x0000;
+    return true;
+}
+
+/** Keep the decoder fed with endFillByte until it acknowledges SM_CANCEL.
+ *  The datasheet allows up to 2048 bytes before giving up.
+ *  @return Non-zero when SM_CANCEL cleared in time.
+ */
+bool VS1053::waitCancelCleared() {
+    for (size_t sent = 0; sent < 2048; sent += 32) {
+        if (!(readReg(SCI_MODE) & (1 << SM_CANCEL))) {
+            return true;
+        }
+        if (!sendEndFill(32)) {
+            return false;
+        }
+    }
+    return !(readReg(SCI_MODE) & (1 << SM_CANCEL));
 }
 
 /**
@@ -157,48 +416,182 @@ void VS1053::setVolume(uint8_t vol)
   value <<= 8;
   value |= vol;
 
+  volume = value;
   writeReg(SCI_VOL,value); // VOL
 }
 
-/** Write to an SCI (Serial Control Interface) register entry. */
-void VS1053::writeReg(uint8_t addr, uint16_t word) {
+/** @return Seconds of audio decoded since the counter was last set (SCI_DECODE_TIME),
+ *  0 when the decoder doesn't answer.
+ */
+uint16_t VS1053::decodeTime() {
+    uint16_t seconds;
+    return readReg(SCI_DECODE_TIME, seconds) ? seconds : 0;
+}
+
+/** Set the decode time counter, e.g. to 0 when a new song starts.
+ *  Written twice, as the datasheet asks, so the decoder can't overwrite it halfway.
+ */
+void VS1053::setDecodeTime(uint16_t seconds) {
+    spiLock.lock();
+    writeReg(SCI_DECODE_TIME, seconds);
+    writeReg(SCI_DECODE_TIME, seconds);
+    spiLock.unlock();
+}
+
+/** @return Average byte rate of the stream being decoded, 0 before the first frame.
+ *  Read from the byteRate parameter in XRAM, so it works for every format and VBR.
+ */
+uint16_t VS1053::byteRate() {
+    uint16_t rate;
+
+    spiLock.lock();
+    if (!writeReg(SCI_WRAMADDR, PARA_BYTERATE) || !readReg(SCI_WRAM, rate)) {
+        rate = 0;
+    }
+    spiLock.unlock();
+    return rate;
+}
+
+/** @return Average bit rate of the stream in kbit/s, 0 before the first frame. */
+uint16_t VS1053::bitRate() {
+    return (uint32_t)byteRate() * 8 / 1000;
+}
+
+/** @return Sample rate of the decoded audio in Hz (SCI_AUDATA without the stereo bit),
+ *  0 when the decoder doesn't answer.
+ */
+uint16_t VS1053::sampleRate() {
+    uint16_t audata;
+    return readReg(SCI_AUDATA, audata) ? audata & 0xfffe : 0;
+}
+
+/** @return Times DREQ stayed low past DREQ_TIMEOUT since power up. */
+uint32_t VS1053::dreqTimeouts() {
+    return timeouts;
+}
+
+/** Write to an SCI (Serial Control Interface) register entry.
+ *  Nothing is clocked out when DREQ doesn't rise for the instruction.
+ *  @return Zero when DREQ stayed low before or after the write.
+ */
+bool VS1053::writeReg(uint8_t addr, uint16_t word) {
     // If addr is out-of-range, do nothing
     if (addr > 0x0f) {
-        return;
+        return false;
     }
 
-    while (!dreq);
+    spiLock.lock();
+    if (!waitForDreq()) {
+        spiLock.unlock();
+        return false;
+    }
     cs = 0;
     spi.write(0x02);         // Send a "Write SCI" instruction (02h),
     spi.write(addr);         // target address,
     spi.write(word >> 8);    // high byte,
     spi.write(word & 0xff);  // then low byte
-    while (!dreq);
+    bool done = waitForDreq();
     cs = 1;
+    spiLock.unlock();
+    return done;
 }
 
 /** Read an SCI (Serial Control Interface) register entry.
- *  @return Register value or 0000h when invalid address was specified.
+ *  @return Register value, 0000h when invalid address was specified,
+ *          or FFFFh (an idle MISO line) when the decoder doesn't answer.
  */
 uint16_t VS1053::readReg(uint8_t addr) {
     uint16_t word;
-    
+    readReg(addr, word);
+    return word;
+}
+
+/** Read an SCI register entry into word, as readReg(addr) returns it.
+ *  Nothing is clocked out when DREQ doesn't rise for the instruction.
+ *  @return Zero when DREQ stayed low before or after the read.
+ */
+bool VS1053::readReg(uint8_t addr, uint16_t& word) {
     // If addr is out-of-range, return 0000h
     if (addr > 0x0f) {
-        return 0x0000;
+        word = 0x0000;
+        return false;
     }
 
-    while (!dreq);
+    spiLock.lock();
+    if (!waitForDreq()) {
+        spiLock.unlock();
+        word = 0xffff;
+        return false;
+    }
+    if (readFrequency != writeFrequency) {
+        spi.frequency(readFrequency);
+    }
     cs = 0;
     spi.write(0x03);              // Send a "Read SCI" instruction (03h)
     spi.write(addr);              // and target address
     word = spi.write(0xff) << 8;  // Receive high byte with dummy data FFh
     word |= spi.write(0xff);      // Receive low byte
-    while (!dreq);
+    bool done = waitForDreq();
     cs = 1;
-    return word;
+    if (readFrequency != writeFrequency) {
+        spi.frequency(writeFrequency);
+    }
+    spiLock.unlock();
+    return done;
 }
 
+/** Force one SPI rate for every transaction, overriding the clockUp() rates. */
 void VS1053::setSPIFrequency(int hz) {
-    spi.frequency(hz);
-}
\ No newline at end of file
+    setBusFrequency(hz, hz);
+    measuredRate = measureDataRate();
+}
+
+/** Set the rates used for writes (SCI + SDI) and for SCI reads. */
+void VS1053::setBusFrequency(uint32_t writeHz, uint32_t readHz) {
+    spiLock.lock();
+    writeFrequency = writeHz;
+    readFrequency = readHz;
+    spi.frequency(writeHz);
+    spiLock.unlock();
+}
+
+/** Time a few zero-filled SDI windows to find the bus rate actually achieved,
+ *  including per-call overhead. Zeros are skipped by the decoder between frames.
+ *  @return Effective SDI rate in bits per second.
+ */
+uint32_t VS1053::measureDataRate() {
+    char zeros[32];
+    Timer timer;
+    const int windows = 8;
+
+    memset(zeros, 0, sizeof(zeros));
+    spiLock.lock();
+    int sent = 0;
+    while (sent < windows && waitForDreq()) {
+        // Only the transfers are timed, not the wait for FIFO room
+        timer.start();
+        sendSdiChunk(zeros, sizeof(zeros));
+        timer.stop();
+        sent++;
+    }
+    spiLock.unlock();
+
+    uint32_t us = timer.elapsed_time().count();
+    return us ? (uint32_t)((uint64_t)sent * sizeof(zeros) * 8 * 1000000 / us) : 0;
+}
+
+/** @return Effective SDI bus rate in bits per second, measured after the
+ *  last clock change. Compare against the stream bitrate for headroom.
+ */
+uint32_t VS1053::dataRate() {
+    return measuredRate;
+}
+
+/** Choose between whole-window SDI transfers (default) and the original
+ *  byte-at-a-time writes, e.g. to rule the bulk path out while debugging.
+ */
+void VS1053::setBulkTransfer(bool enable) {
+    spiLock.lock();
+    bulkTransfer = enable;
+    spiLock.unlock();
+}
\ No newline at end of file
@@ -14,14 +14,25 @@
 #ifndef KAYX_VS1053_H_
 #define KAYX_VS1053_H_
 
+#include "AudioSink.h"
+
 /** Class VS1053. Drives VLSI's mp3/midi codec chip. */
-class VS1053 {
+class VS1053 : public AudioSink {
 private:
     SPI        spi;
     DigitalOut cs;
     DigitalOut bsync; //dcs pin
-    DigitalIn  dreq;
+    InterruptIn dreq;
     DigitalOut rst;
+    EventFlags dreqEvent;  // set from the DREQ rising edge
+    Mutex      spiLock;    // SCI and SDI share the bus between threads
+    bool       bulkTransfer;
+    uint32_t   slowFrequency;   // safe for SCI before the PLL is up
+    uint32_t   writeFrequency;  // SCI writes and SDI data, CLKI/4 max
+    uint32_t   readFrequency;   // SCI reads, CLKI/7 max
+    uint32_t   measuredRate;    // effective SDI bits per second
+    uint16_t   volume;          // last SCI_VOL, restored after a hardware reset
+    uint32_t   timeouts;        // DREQ waits that ran out
 
 public:
     static const uint8_t SCI_MODE        = 0x00;
@@ -42,7 +53,12 @@ public:
     static const uint8_t SCI_AICTRL3     = 0x0f;
     
     static const uint8_t SM_RESET        = 2;
+    static const uint8_t SM_CANCEL       = 3;
     static const uint8_t SM_SDINEW       = 11;
+
+    static const uint32_t XTALI          = 12288000;  // crystal on the breakout
+    static const uint16_t CLOCKF_VALUE   = 0x8800;    // written by clockUp()
+    static const uint16_t PARA_BYTERATE  = 0x1e05;    // XRAM, average stream byte rate
     
     VS1053(PinName mosiPin, PinName misoPin, PinName sckPin,
            PinName csPin, PinName bsyncPin, PinName dreqPin, PinName rstPin,
@@ -50,17 +66,45 @@ public:
     ~VS1053();
     void hardwareReset();
     void modeSwitch(void);
-    void sendDataByte(uint8_t data);
+    bool sendDataByte(uint8_t data);
     size_t sendDataBlock(char* data, size_t length);
-    void clockUp();
+    bool readyForData();
+    bool waitForData(Kernel::Clock::duration_u32 timeout);
+    bool recover();
+    bool clockUp();
     bool sendCancel();
     bool stop();
+    bool cancelPlayback();
+    bool finishPlayback();
+    bool softReset();
     void setVolume(uint8_t vol);
     void setSPIFrequency(int hz);
+    void setBulkTransfer(bool enable);
+    uint32_t dataRate();
+    uint16_t decodeTime();
+    void setDecodeTime(uint16_t seconds);
+    uint16_t byteRate();
+    uint16_t bitRate();
+    uint16_t sampleRate();
+    uint32_t dreqTimeouts();
     
 private:
-    void writeReg(uint8_t, uint16_t);
+    static const uint32_t DREQ_FLAG = 1;
+    static const uint32_t SPI_DONE_FLAG = 2;
+    // Far longer than any DREQ low the chip has, so past it the chip is gone
+    static constexpr std::chrono::milliseconds DREQ_TIMEOUT = 100ms;
+
+    void onDreqRise();
+    void onTransferDone(int event);
+    bool waitForDreq(Kernel::Clock::duration_u32 timeout = DREQ_TIMEOUT);
+    void sendSdiChunk(const char* data, size_t n);
+    bool sendEndFill(size_t length);
+    bool waitCancelCleared();
+    void setBusFrequency(uint32_t writeHz, uint32_t readHz);
+    uint32_t measureDataRate();
+    bool writeReg(uint8_t, uint16_t);
     uint16_t readReg(uint8_t);
+    bool readReg(uint8_t, uint16_t&);
 };
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -0,0 +1,413 @@
+/**
+ *  player_bench.cpp
+ *  ===========================================================================
+ *  The player's links measured against the simulated card, decoder and
+ *  screen, so a change that costs headroom shows up as a number.
+ *       - Storage: the board benchmark's SD rows, with the stdio ones read
+ *         as FatFs would (FatReader), so that they and the direct reads
+ *         all go through the card model.
+ *       - The board benchmark's uLCD rows, at the screen's 9600 baud power
+ *         up rate and again at the negotiated rate.
+ *       - Feed rate: AudioStream, StreamFile and the VS1053 driver with a
+ *         decoder that takes data as fast as SDI delivers it, as a
+ *         multiple of a 320 kbit/s song.
+ *       - Starvation: 320 kbit/s songs played while the UI redraws, at
+ *         rising SD access latency, with the decoder's dry spells and how
+ *         low the ring ran.
+ *       - Track change: the hardware reset the player once did per song
+ *         against cancelling the stream, and how long a hung decoder
+ *         takes to come back.
+ *       - Library boot: cold scan, warm index load, the warm boot's check
+ *         of the card and a rebuild after a few songs changed, on a
+ *         generated card of BOOT_TRACKS songs in album folders. The walk
+ *         runs on host files; the sectors each path reads are then read
+ *         again through the card model, for what they cost on SPI.
+ */
+
+#include "AudioStream.h"
+#include "StreamFile.h"
+#include "Library.h"
+#include "LibraryScanner.h"
+#include "TrackIndex.h"  // ahead of uLCD_4DGL.h, whose command macros take its VERSION
+#include "Benchmark.h"
+#include "VS1053.h"
+#include "uLCD_4DGL.h"
+#include "Vs1053Sim.h"
+#include "DirectoryVolume.h"
+#include "FatReader.h"
+#include "GoldeloxSim.h"
+#include <cstdio>
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include <utime.h>
+
+static const uint32_t SONG_BYTES = 40000;  // per second at 320 kbit/s
+static const uint32_t SD_BYTES   = 256 * 1024;  // read by each storage row, as on the board
+static const uint32_t SD_START   = 1000;        // past an ID3 tag, inside a sector
+static const int BOOT_ARTISTS = 50;
+static const int BOOT_SONGS   = 20;       // per artist
+static const int BOOT_TRACKS  = BOOT_ARTISTS * BOOT_SONGS;
+static const int BOOT_CHANGED = 10;       // songs rewritten before the rebuild
+
+/** Write a made up song, nonzero bytes so the decoder counts it as playing. */
+static std::string writeSong(const std::string& dir, const char* name, size_t length) {
+    std::string path = dir + "/" + name;
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        perror(path.c_str());
+        exit(2);
+    }
+    unsigned seed = length;
+    for (size_t i = 0; i < length; i++) {
+        seed = seed * 1103515245 + 12345;
+        fputc((seed >> 16) % 255 + 1, f);
+    }
+    fclose(f);
+    return path;
+}
+
+/** Write a 128 kbit/s constant bitrate song of frames layer III frames, 417 bytes each. */
+static void writeFrames(const std::string& path, size_t frames) {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        perror(path.c_str());
+        exit(2);
+    }
+    for (size_t i = 0; i < frames; i++) {
+        fputc(0xff, f);
+        fputc(0xfb, f);
+        fputc(0x90, f);
+        fputc(0x00, f);
+        for (size_t j = 4; j < 417; j++) {
+            fputc((i + j) % 254 + 1, f);
+        }
+    }
+    fclose(f);
+}
+
+/** Read the first sectors of a file through the card model, one command per
+ *  sector as FatFs does for small stdio reads.
+ *  @return Microseconds the card held the caller.
+ */
+static uint64_t cardRead(DirectoryVolume& volume, const std::string& path, uint32_t sectors) {
+    SongVolume::Extent extent;
+    uint32_t size, sectorSize;
+    if (volume.mapFile(path.c_str(), &extent, 1, size, sectorSize) != 1) {
+        return 0;
+    }
+    sectors = std::min(sectors, (size + sectorSize - 1) / sectorSize);
+    char buffer[DirectoryVolume::SECTOR_SIZE];
+    volume.resetStats();
+    for (uint32_t i = 0; i < sectors; i++) {
+        volume.device()->read(buffer, (bd_addr_t)(extent.sector + i) * sectorSize, sectorSize);
+    }
+    return volume.score().busyUs;
+}
+
+static uint32_t elapsedUs(Timer& timer) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(timer.elapsed_time()).count();
+}
+
+/** Play one song to its end, redrawing the progress bar and time every 100 ms like the
+ *  player's UI, and finishing it as soon as the last byte is sent.
+ *  @return The fewest blocks left in the ring once playing and before the end of the file.
+ */
+static size_t playSong(AudioStream& stream, VS1053& audio, uLCD_4DGL& lcd, const std::string& path) {
+    const uint32_t ring = AudioStream::BLOCK_SIZE * AudioStream::BLOCK_COUNT;
+    size_t low = AudioStream::BLOCK_COUNT;
+    Timer redraw;
+    redraw.start();
+    stream.open(path.c_str());
+    while (!stream.finished()) {
+        uint32_t position = stream.position();
+        if (position >= AudioStream::BLOCK_SIZE && position + ring < stream.fileSize()) {
+            size_t blocks = stream.bufferedBlocks();
+            low = blocks < low ? blocks : low;
+        }
+        if (redraw.elapsed_time() >= 100ms) {
+            redraw.reset();
+            lcd.filled_rectangle(0, 68, (uint64_t)position * 127 / stream.fileSize(), 72, GREEN);
+            lcd.locate(6, 10);
+            lcd.printf("%2lu:%02lu", (unsigned long)(position / SONG_BYTES / 60),
+                       (unsigned long)(position / SONG_BYTES % 60));
+            lcd.wait_idle();
+        }
+        ThisThread::sleep_for(1ms);
+    }
+    audio.finishPlayback();
+    return low;
+}
+
+/** Read SD_BYTES of a file from an unaligned offset in chunk sized reads, timed as they go.
+ *  @return Sustained rate in bytes per second.
+ */
+template <typename File>
+static uint32_t timedReads(File& file, size_t chunk, uint32_t& worstUs) {
+    static char buffer[AudioStream::BLOCK_SIZE];
+    Timer total, one;
+    uint32_t bytes = 0;
+    worstUs = 0;
+    total.start();
+    while (bytes < SD_BYTES) {
+        one.reset();
+        one.start();
+        size_t n = file.read(buffer, chunk);
+        one.stop();
+        if (n == 0) {
+            break;
+        }
+        bytes += n;
+        worstUs = std::max(worstUs, elapsedUs(one));
+    }
+    total.stop();
+    uint32_t us = elapsedUs(total);
+    return us ? (uint64_t)bytes * 1000000 / us : 0;
+}
+
+/** The board benchmark's storage rows, with stdio's reads modelled as FatFs makes
+ *  them so that they go through the same card as the direct ones.
+ */
+static void storageBench(DirectoryVolume& volume, VS1053& audio, const std::string& path) {
+    uint32_t worstSmall, worstBlock, worstDirect;
+    FatReader fat(volume);
+    fat.open(path.c_str(), SD_START);
+    uint32_t small = timedReads(fat, 32, worstSmall);
+    fat.open(path.c_str(), SD_START);
+    uint32_t block = timedReads(fat, AudioStream::BLOCK_SIZE, worstBlock);
+    StreamFile direct;
+    direct.open(&volume, path.c_str(), SD_START);
+    uint32_t rate = timedReads(direct, AudioStream::BLOCK_SIZE, worstDirect);
+    direct.close();
+    uint32_t sdi = audio.dataRate() / 8;
+    uint32_t link = std::min(rate, sdi);
+    uint32_t ringMs = (uint64_t)AudioStream::BLOCK_SIZE * AudioStream::BLOCK_COUNT * 1000 / SONG_BYTES;
+
+    printf("Storage, %lu KB from offset %lu\n", (unsigned long)(SD_BYTES / 1024), (unsigned long)SD_START);
+    printf("  SD fread 32 B    %7lu B/s, worst %lu us\n", (unsigned long)small, (unsigned long)worstSmall);
+    printf("  SD fread %-4u    %7lu B/s, worst %lu us\n", (unsigned)AudioStream::BLOCK_SIZE,
+           (unsigned long)block, (unsigned long)worstBlock);
+    printf("  SD direct %-4u   %7lu B/s, worst %lu us\n", (unsigned)AudioStream::BLOCK_SIZE,
+           (unsigned long)rate, (unsigned long)worstDirect);
+    printf("  VS1053 SDI       %7lu B/s\n", (unsigned long)sdi);
+    printf("  Headroom at %lu kbit/s: %lu.%02lux, ring %lu ms vs worst read %lu ms\n",
+           (unsigned long)(SONG_BYTES * 8 / 1000), (unsigned long)(link / SONG_BYTES),
+           (unsigned long)(link % SONG_BYTES * 100 / SONG_BYTES), (unsigned long)ringMs,
+           (unsigned long)(worstDirect / 1000));
+}
+
+/** Boot paths of the library on a generated card. Song probes read the first
+ *  sector of an untagged song; the index is read whole. Directory and FAT
+ *  sectors, which the sector cache mostly holds, aren't counted.
+ */
+static void bootBench(DirectoryVolume& volume, const std::string& dir) {
+    std::string card = dir + "/card";
+    mkdir(card.c_str(), 0755);
+    std::vector<std::string> paths;
+    char name[64];
+    for (int a = 0; a < BOOT_ARTISTS; a++) {
+        snprintf(name, sizeof(name), "/Artist %02d", a);
+        std::string folder = card + name;
+        mkdir(folder.c_str(), 0755);
+        for (int s = 0; s < BOOT_SONGS; s++) {
+            snprintf(name, sizeof(name), "/%02d Song title number %d.mp3", s + 1, s + 1);
+            paths.push_back(folder + name);
+            writeFrames(paths.back(), 12);
+        }
+    }
+    std::string indexPath = card + "/.tracks.idx";
+    LibraryScanner scanner(card.c_str());
+    Library::setBudget(256 * 1024);
+    printf("Library boot, %d songs in %d folders\n", BOOT_TRACKS, BOOT_ARTISTS);
+
+    // Cold: walk and probe every song, then write the index
+    Library cold(card.c_str());
+    TrackIndex coldIndex(indexPath.c_str());
+    Timer timer;
+    timer.start();
+    scanner.scan(cold, &coldIndex);
+    coldIndex.save(cold);
+    timer.stop();
+    uint64_t cardUs = 0;
+    for (size_t i = 0; i < paths.size(); i++) {
+        cardUs += cardRead(volume, paths[i], 1);
+    }
+    printf("  Cold scan        %7lu us host, %7lu us card reads, %u probed, %u bytes per 1000 tracks\n",
+           (unsigned long)elapsedUs(timer), (unsigned long)cardUs, (unsigned)scanner.probed(),
+           (unsigned)(cold.memoryUsage() * 1000 / cold.trackCount()));
+
+    // Warm: the index alone
+    Library warm(card.c_str());
+    TrackIndex warmIndex(indexPath.c_str());
+    timer.reset();
+    timer.start();
+    warmIndex.load(warm);
+    timer.stop();
+    struct stat st;
+    stat(indexPath.c_str(), &st);
+    cardUs = cardRead(volume, indexPath, (st.st_size + 511) / 512);
+    printf("  Warm load        %7lu us host, %7lu us card reads, %u tracks from a %lu byte index\n",
+           (unsigned long)elapsedUs(timer), (unsigned long)cardUs, (unsigned)warm.trackCount(),
+           (unsigned long)st.st_size);
+
+    // The warm boot's background check: directories only
+    uint32_t hash;
+    timer.reset();
+    timer.start();
+    size_t listed = scanner.listing(hash, warmIndex.hashLimit());
+    timer.stop();
+    printf("  Warm check       %7lu us host, card unchanged: %s\n", (unsigned long)elapsedUs(timer),
+           warmIndex.matches(listed, hash) ? "yes" : "no");
+
+    // A few songs replaced, then rebuilt against the old index
+    for (int i = 0; i < BOOT_CHANGED; i++) {
+        const std::string& path = paths[i * BOOT_TRACKS / BOOT_CHANGED];
+        writeFrames(path, 24);
+        struct utimbuf later = { time(nullptr) + 60, time(nullptr) + 60 };
+        utime(path.c_str(), &later);
+    }
+    warm.clear();
+    timer.reset();
+    timer.start();
+    scanner.scan(warm, &warmIndex);
+    warmIndex.save(warm);
+    timer.stop();
+    cardUs = cardRead(volume, indexPath, (st.st_size + 511) / 512);
+    for (int i = 0; i < BOOT_CHANGED; i++) {
+        cardUs += cardRead(volume, paths[i * BOOT_TRACKS / BOOT_CHANGED], 1);
+    }
+    printf("  Rebuild          %7lu us host, %7lu us card reads, %u probed\n", (unsigned long)elapsedUs(timer),
+           (unsigned long)cardUs, (unsigned)scanner.probed());
+
+    for (size_t i = 0; i < paths.size(); i++) {
+        remove(paths[i].c_str());
+    }
+    for (int a = 0; a < BOOT_ARTISTS; a++) {
+        snprintf(name, sizeof(name), "/Artist %02d", a);
+        rmdir((card + name).c_str());
+    }
+    remove(indexPath.c_str());
+    rmdir(card.c_str());
+}
+
+int main() {
+    char dirName[] = "/tmp/player-bench-XXXXXX";
+    if (!mkdtemp(dirName)) {
+        perror("mkdtemp");
+        return 2;
+    }
+    std::string dir = dirName;
+    std::string longSong = writeSong(dir, "long.mp3", 512 * 1024);
+    std::string song = writeSong(dir, "song.mp3", 4 * SONG_BYTES);
+
+    // Wired as main.cpp wires the board
+    Vs1053Sim decoder(p13, p14, p15, p16, p17);
+    VS1053 audio(p11, p12, p13, p14, p15, p16, p17);
+    DirectoryVolume volume;
+    GoldeloxSim screen;
+    uLCD_4DGL* lcd = new uLCD_4DGL(screen);  // the stream's threads outlive main, so neither is deleted
+    AudioStream* stream = new AudioStream();
+
+    audio.hardwareReset();
+    ThisThread::sleep_for(100ms);
+    audio.modeSwitch();
+    audio.clockUp();
+
+    printf("Host benchmark, simulated SD card (%d us access), VS1053 and uLCD\n", 500);
+    storageBench(volume, audio, longSong);
+    Benchmark bench(audio, *lcd, &volume);
+    bench.runDisplay();
+    lcd->auto_baudrate();
+    bench.runDisplay();
+
+    // Feed rate: the decoder drains instantly, so SD, the ring and SDI set the pace
+    stream->start(audio, &volume);
+    decoder.setByteRate(100000000);
+    decoder.resetStats();
+    volume.resetStats();
+    Timer fed;
+    fed.start();
+    stream->open(longSong.c_str());
+    while (!stream->finished()) {
+        ThisThread::sleep_for(1ms);
+    }
+    fed.stop();
+    audio.finishPlayback();
+    uint32_t us = elapsedUs(fed);
+    uint32_t rate = us ? (uint64_t)decoder.score().bytes * 1000000 / us : 0;
+    printf("Feed path\n");
+    printf("  Sustained        %7lu B/s, %lu.%02lux a %lu kbit/s song, SD busy %lu%%\n", (unsigned long)rate,
+           (unsigned long)(rate / SONG_BYTES), (unsigned long)(rate % SONG_BYTES * 100 / SONG_BYTES),
+           (unsigned long)(SONG_BYTES * 8 / 1000),
+           (unsigned long)(us ? volume.score().busyUs * 100 / us : 0));
+
+    // Starvation: real playback pace while the UI draws, the card slowing down
+    static const int accessUs[] = { 500, 5000, 20000, 45000 };
+    decoder.setByteRate(SONG_BYTES);
+    printf("Decoder FIFO at %lu kbit/s with UI redraws every 100 ms, uLCD at %d baud\n",
+           (unsigned long)(SONG_BYTES * 8 / 1000), lcd->current_baudrate());
+    for (size_t i = 0; i < sizeof(accessUs) / sizeof(accessUs[0]); i++) {
+        volume.setAccessTime(accessUs[i]);
+        decoder.resetStats();
+        size_t low = playSong(*stream, audio, *lcd, song);
+        Vs1053Sim::Score heard = decoder.score();
+        printf("  SD access %5d us: %2lu underruns, worst dry %6lu us, total dry %7lu us, ring low %u/%u\n",
+               accessUs[i], (unsigned long)heard.underruns, (unsigned long)heard.worstDryUs,
+               (unsigned long)heard.dryUs, (unsigned)low,
+               (unsigned)AudioStream::BLOCK_COUNT);
+    }
+
+    // Track change: the decoder reset the player used to do against the cancel it does now
+    volume.setAccessTime(500);
+    printf("Track change, decoder mid-song\n");
+    Timer change;
+    stream->open(song.c_str());
+    ThisThread::sleep_for(300ms);
+    stream->close();
+    change.start();
+    audio.hardwareReset();
+    ThisThread::sleep_for(100ms);
+    audio.modeSwitch();
+    audio.clockUp();
+    change.stop();
+    printf("  Hardware reset   %7lu us (reset pin, 100 ms settle, modeSwitch, clockUp)\n",
+           (unsigned long)elapsedUs(change));
+    stream->open(song.c_str());
+    ThisThread::sleep_for(300ms);
+    stream->close();
+    change.reset();
+    change.start();
+    bool clean = audio.cancelPlayback();
+    change.stop();
+    printf("  Cancel           %7lu us%s\n", (unsigned long)elapsedUs(change), clean ? "" : ", fell back to soft reset");
+    change.reset();
+    change.start();
+    clean = audio.softReset();
+    change.stop();
+    printf("  Soft reset       %7lu us%s\n", (unsigned long)elapsedUs(change), clean ? "" : ", no answer");
+    stream->open(song.c_str());
+    ThisThread::sleep_for(300ms);
+    decoder.hang();
+    change.reset();
+    change.start();
+    while (stream->decoderResets() == 0 && change.elapsed_time() < 5s) {
+        ThisThread::sleep_for(1ms);
+    }
+    change.stop();
+    stream->close();
+    printf("  Hung decoder     %7lu us until the feeder had it back\n", (unsigned long)elapsedUs(change));
+
+    bootBench(volume, dir);
+
+    GoldeloxSim::Score drawn = screen.score();
+    printf("uLCD: %lu commands, %lu NAKs, %lu bytes lost to FIFO overrun, %lu garbled\n",
+           (unsigned long)drawn.commands, (unsigned long)drawn.naks, (unsigned long)drawn.overrunBytes,
+           (unsigned long)drawn.garbledBytes);
+    remove(song.c_str());
+    remove(longSong.c_str());
+    rmdir(dir.c_str());
+    return 0;
+}
@@ -0,0 +1,58 @@
+/**
+ *  HostPins.h
+ *  ===========================================================================
+ *  The host's stand-in for the board's wiring.
+ *       - Every pin has a level (and an analog value). Whoever changes a
+ *         level, a driver's DigitalOut or a simulated part, calls the
+ *         pin's edge handlers and the parts watching it right away.
+ *       - An SPI bus is named by its SCLK pin; the part attached to it is
+ *         handed every byte and answers the MISO byte.
+ *       - Simulated parts and the timer "interrupt" run their threads at
+ *         nice 0, ahead of every mbed Thread and main().
+ */
+
+#ifndef HOST_PINS_H_
+#define HOST_PINS_H_
+
+#include "mbed.h"
+
+/** Class PinListener. A simulated part told about level changes on pins it watches. */
+class PinListener {
+public:
+    virtual ~PinListener() {}
+    virtual void pinChanged(PinName pin, int level) = 0;
+};
+
+/** Class SpiDevice. A simulated part on an SPI bus. */
+class SpiDevice {
+public:
+    virtual ~SpiDevice() {}
+
+    /** Clock one byte through the part at hz. @return The byte it drove on MISO. */
+    virtual uint8_t transfer(uint8_t mosi, int hz) = 0;
+
+    /** Told when the next length bytes come from one block write, as a DMA transfer would send them. */
+    virtual void block(int /*length*/) {}
+};
+
+/** Class HostPins. Global pin table. Safe from any thread; nothing is locked
+ *  while handlers run, so they may drive pins themselves.
+ */
+class HostPins {
+public:
+    static void drive(PinName pin, int level);
+    static int level(PinName pin);
+    static void pull(PinName pin, int level);
+    static void setAnalog(PinName pin, float value);
+    static float analog(PinName pin);
+    static void onEdge(PinName pin, bool rising, Callback<void()> handler, const void* owner);
+    static void removeEdges(const void* owner);
+    static void watch(PinName pin, PinListener* listener);
+    static void unwatch(PinListener* listener);
+    static void attachSpi(PinName sclk, SpiDevice* device);
+    static SpiDevice* spiDevice(PinName sclk);
+    static void busy(std::chrono::nanoseconds time);
+    static std::thread startThread(std::function<void()> body, int nice = 0);
+};
+
+#endif
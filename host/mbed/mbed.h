@@ -0,0 +1,466 @@
+/**
+ *  mbed.h (host)
+ *  ===========================================================================
+ *  Just enough of mbed OS 6 to build the player's code on Linux.
+ *       - RTOS objects are std::thread and std::mutex underneath. Thread
+ *         priorities and stack sizes are accepted and ignored.
+ *       - Pins are entries in a table (see HostPins.h). DigitalOut,
+ *         InterruptIn and AnalogIn read and drive them, and simulated parts
+ *         watch and drive their own, so drivers run unchanged against them.
+ *       - SPI hands each byte to the part attached to its SCLK pin and
+ *         holds the caller for 8 bit times at the set clock.
+ *       - "Interrupts" run on the thread that changed the pin, or on one
+ *         timer thread for every Ticker and Timeout.
+ *       - DWT->CYCCNT counts SystemCoreClock cycles of real time, so the
+ *         Stats probes report host timings in the board's units.
+ */
+
+#ifndef HOST_MBED_H_
+#define HOST_MBED_H_
+
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <sys/types.h>
+
+using namespace std::chrono_literals;
+
+enum PinName {
+    NC = -1,
+    p5 = 5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20,
+    p21, p22, p23, p24, p25, p26, p27, p28, p29, p30,
+    USBTX, USBRX,
+    PIN_COUNT
+};
+
+enum PinMode { PullNone, PullUp, PullDown };
+
+enum osPriority {
+    osPriorityIdle, osPriorityLow, osPriorityBelowNormal, osPriorityNormal,
+    osPriorityAboveNormal, osPriorityHigh, osPriorityRealtime
+};
+
+#define OS_STACK_SIZE      4096
+#define osWaitForever      0xFFFFFFFFu
+#define osFlagsError       0x80000000u
+#define osFlagsErrorTimeout 0xFFFFFFFEu
+#define MBED_ASSERT(expr)  assert(expr)
+
+extern uint32_t SystemCoreClock;
+
+/** Busy wait like the board does, for short delays; longer ones sleep. */
+void wait_us(int us);
+
+namespace mbed {
+
+template <typename F> class Callback;
+
+/** Class Callback. std::function with mbed's constructors. */
+template <typename R, typename... A>
+class Callback<R(A...)> {
+public:
+    Callback() {}
+    Callback(std::nullptr_t) {}
+    Callback(R (*func)(A...)) {
+        if (func) {
+            fn = func;
+        }
+    }
+    template <typename T, typename U>
+    Callback(U* obj, R (T::*method)(A...))
+    :
+        fn([obj, method](A... args) { return (obj->*method)(args...); })
+    {
+    }
+    template <typename F, typename = typename std::enable_if<
+                  !std::is_same<typename std::decay<F>::type, Callback>::value>::type>
+    Callback(F func)
+    :
+        fn(std::move(func))
+    {
+    }
+
+    R operator()(A... args) const {
+        return fn(args...);
+    }
+    explicit operator bool() const {
+        return static_cast<bool>(fn);
+    }
+
+private:
+    std::function<R(A...)> fn;
+};
+
+template <typename T, typename U, typename R, typename... A>
+Callback<R(A...)> callback(U* obj, R (T::*method)(A...)) {
+    return Callback<R(A...)>(obj, method);
+}
+
+template <typename R, typename... A>
+Callback<R(A...)> callback(R (*func)(A...)) {
+    return Callback<R(A...)>(func);
+}
+
+/** Class Timer. Stopwatch on the steady clock. */
+class Timer {
+public:
+    Timer();
+    void start();
+    void stop();
+    void reset();
+    std::chrono::microseconds elapsed_time() const;
+
+private:
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::duration   banked;
+    bool                                  running;
+};
+
+/** Class Timeout. One shot callback from the timer thread. */
+class Timeout {
+public:
+    Timeout();
+    virtual ~Timeout();
+    void attach(Callback<void()> func, std::chrono::microseconds delay);
+    void detach();
+
+protected:
+    uint32_t id;  // of the scheduled call, 0 when none
+    bool     periodic;
+};
+
+/** Class Ticker. Periodic callback from the timer thread. */
+class Ticker : public Timeout {
+public:
+    Ticker();
+};
+
+/** Class DigitalOut. Drives a pin in the host pin table. */
+class DigitalOut {
+public:
+    DigitalOut(PinName pin, int value = 0);
+    void write(int value);
+    int read();
+    DigitalOut& operator=(int value) {
+        write(value);
+        return *this;
+    }
+    operator int() {
+        return read();
+    }
+
+private:
+    PinName pin;
+};
+
+/** Class DigitalIn. Reads a pin in the host pin table. */
+class DigitalIn {
+public:
+    DigitalIn(PinName pin, PinMode mode = PullNone);
+    int read();
+    operator int() {
+        return read();
+    }
+
+private:
+    PinName pin;
+};
+
+/** Class InterruptIn. Pin with edge handlers, called on the thread that drove the edge. */
+class InterruptIn {
+public:
+    InterruptIn(PinName pin, PinMode mode = PullNone);
+    ~InterruptIn();
+    int read();
+    operator int() {
+        return read();
+    }
+    void rise(Callback<void()> func);
+    void fall(Callback<void()> func);
+
+private:
+    PinName pin;
+};
+
+/** Class AnalogIn. Reads a pin's analog value, 0.0 to 1.0. */
+class AnalogIn {
+public:
+    AnalogIn(PinName pin);
+    float read();
+
+private:
+    PinName pin;
+};
+
+/** Class SPI. Master on a simulated bus, see host::SpiDevice. */
+class SPI {
+public:
+    SPI(PinName mosi, PinName miso, PinName sclk, PinName ssel = NC);
+    void format(int bits, int mode = 0);
+    void frequency(int hz);
+    int write(int value);
+    int write(const char* tx, int txLength, char* rx, int rxLength);
+    void lock();
+    void unlock();
+
+private:
+    PinName sclk;
+    int     hz;
+};
+
+/** Class Stream. printf() through _putc(), as mbed's. */
+class Stream {
+public:
+    Stream(const char* name = nullptr);
+    virtual ~Stream() {}
+    int printf(const char* format, ...);
+
+protected:
+    virtual int _putc(int c) = 0;
+    virtual int _getc() = 0;
+};
+
+/** Class CircularBuffer. Fixed size ring, locked where mbed's masks interrupts. */
+template <typename T, uint32_t BufferSize>
+class CircularBuffer {
+public:
+    CircularBuffer()
+    :
+        head(0),
+        tail(0),
+        count(0)
+    {
+    }
+    /** Add data, overwriting the oldest element when full. */
+    void push(const T& data) {
+        std::lock_guard<std::mutex> guard(mutex);
+        buffer[head] = data;
+        head = (head + 1) % BufferSize;
+        if (count == BufferSize) {
+            tail = head;
+        } else {
+            count++;
+        }
+    }
+    /** @return Zero when empty. */
+    bool pop(T& data) {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (count == 0) {
+            return false;
+        }
+        data = buffer[tail];
+        tail = (tail + 1) % BufferSize;
+        count--;
+        return true;
+    }
+    bool empty() const {
+        std::lock_guard<std::mutex> guard(mutex);
+        return count == 0;
+    }
+    bool full() const {
+        std::lock_guard<std::mutex> guard(mutex);
+        return count == BufferSize;
+    }
+    uint32_t size() const {
+        std::lock_guard<std::mutex> guard(mutex);
+        return count;
+    }
+    void reset() {
+        std::lock_guard<std::mutex> guard(mutex);
+        head = tail = count = 0;
+    }
+
+private:
+    mutable std::mutex mutex;
+    T                  buffer[BufferSize];
+    uint32_t           head;
+    uint32_t           tail;
+    uint32_t           count;
+};
+
+} // namespace mbed
+
+namespace rtos {
+
+/** Class Mutex. Recursive, as mbed's. */
+class Mutex {
+public:
+    void lock() {
+        mutex.lock();
+    }
+    void unlock() {
+        mutex.unlock();
+    }
+    bool trylock() {
+        return mutex.try_lock();
+    }
+
+private:
+    friend class ConditionVariable;
+    std::recursive_mutex mutex;
+};
+
+/** Class ConditionVariable. Bound to one Mutex, as mbed's. */
+class ConditionVariable {
+public:
+    ConditionVariable(Mutex& mutex)
+    :
+        mutex(mutex)
+    {
+    }
+    void wait() {
+        cv.wait(mutex.mutex);
+    }
+    /** @return Non-zero when the wait timed out. */
+    bool wait_for(std::chrono::milliseconds timeout) {
+        return cv.wait_for(mutex.mutex, timeout) == std::cv_status::timeout;
+    }
+    void notify_one() {
+        cv.notify_one();
+    }
+    void notify_all() {
+        cv.notify_all();
+    }
+
+private:
+    Mutex&                      mutex;
+    std::condition_variable_any cv;
+};
+
+/** Class Semaphore. Counting semaphore with a ceiling. */
+class Semaphore {
+public:
+    Semaphore(int32_t count = 0, uint16_t maxCount = 0xffff);
+    void acquire();
+    bool try_acquire();
+    bool try_acquire_for(std::chrono::milliseconds timeout);
+    int release();
+
+private:
+    std::mutex              mutex;
+    std::condition_variable cv;
+    int32_t                 count;
+    uint16_t                maxCount;
+};
+
+/** Class EventFlags. 31 flags with wait any semantics. */
+class EventFlags {
+public:
+    EventFlags();
+    uint32_t set(uint32_t flags);
+    uint32_t clear(uint32_t flags = 0x7fffffff);
+    uint32_t get() const;
+    uint32_t wait_any(uint32_t flags, uint32_t millisec = osWaitForever, bool clear = true);
+    template <typename Rep, typename Period>
+    uint32_t wait_any_for(uint32_t flags, std::chrono::duration<Rep, Period> timeout, bool clear = true) {
+        return waitFor(flags, std::chrono::duration_cast<std::chrono::microseconds>(timeout), clear);
+    }
+
+private:
+    uint32_t waitFor(uint32_t flags, std::chrono::microseconds timeout, bool clear);
+
+    mutable std::mutex      mutex;
+    std::condition_variable cv;
+    uint32_t                bits;
+};
+
+/** Class Thread. A std::thread started on demand; detached if never joined.
+ *  Linux shares the CPU by nice value rather than running the highest
+ *  priority thread, so the priority becomes a nice value: on a single core
+ *  the feeder still gets in well ahead of the reader and the UI.
+ */
+class Thread {
+public:
+    Thread(osPriority priority = osPriorityNormal, uint32_t stackSize = OS_STACK_SIZE,
+           unsigned char* stackMem = nullptr, const char* name = nullptr);
+    ~Thread();
+    int start(mbed::Callback<void()> task);
+    int join();
+
+private:
+    osPriority  priority;
+    std::thread thread;
+};
+
+namespace ThisThread {
+template <typename Rep, typename Period>
+void sleep_for(std::chrono::duration<Rep, Period> delay) {
+    std::this_thread::sleep_for(delay);
+}
+inline void yield() {
+    std::this_thread::yield();
+}
+} // namespace ThisThread
+
+struct Kernel {
+    /** The RTOS tick clock, milliseconds since the program started. */
+    struct Clock {
+        typedef std::chrono::milliseconds                  duration;
+        typedef std::chrono::duration<uint32_t, std::milli> duration_u32;
+        typedef duration::rep                              rep;
+        typedef duration::period                           period;
+        typedef std::chrono::time_point<Clock>             time_point;
+        static const bool is_steady = true;
+        static time_point now();
+    };
+    static const Clock::duration_u32 wait_for_u32_forever;
+};
+
+} // namespace rtos
+
+using namespace mbed;
+using namespace rtos;
+
+inline uint32_t core_util_atomic_incr_u32(volatile uint32_t* value, uint32_t delta) {
+    return __atomic_add_fetch(value, delta, __ATOMIC_SEQ_CST);
+}
+
+inline uint32_t core_util_atomic_decr_u32(volatile uint32_t* value, uint32_t delta) {
+    return __atomic_sub_fetch(value, delta, __ATOMIC_SEQ_CST);
+}
+
+inline uint32_t core_util_atomic_load_u32(const volatile uint32_t* value) {
+    return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+}
+
+inline bool core_util_atomic_cas_u32(volatile uint32_t* value, uint32_t* expected, uint32_t desired) {
+    return __atomic_compare_exchange_n(value, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+/** The Cortex-M3 cycle counter, counting SystemCoreClock cycles of host time. */
+class HostCycleCounter {
+public:
+    operator uint32_t() const;
+    HostCycleCounter& operator=(uint32_t value);
+
+private:
+    uint64_t zero = 0;  // nanoseconds of the steady clock at count 0
+};
+
+struct DWT_Type {
+    uint32_t         CTRL;
+    HostCycleCounter CYCCNT;
+};
+
+struct CoreDebug_Type {
+    uint32_t DEMCR;
+};
+
+extern DWT_Type*       DWT;
+extern CoreDebug_Type* CoreDebug;
+
+#define CoreDebug_DEMCR_TRCENA_Msk (1u << 24)
+#define DWT_CTRL_CYCCNTENA_Msk     1u
+
+#include "HostPins.h"
+
+#endif
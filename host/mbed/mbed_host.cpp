@@ -0,0 +1,763 @@
+/**
+ *  mbed_host.cpp
+ *  ===========================================================================
+ *  Just enough of mbed OS 6 to build the player's code on Linux.
+ *
+ *  Timeouts and Tickers share one timer thread, which plays the part of
+ *  the board's timer interrupt: their callbacks run there one at a time,
+ *  and detach() waits for a callback that is running on another thread.
+ *
+ *  Without privileges a thread can only lower its own priority (raise its
+ *  nice value), so every thread is started by one that kept the nice
+ *  value the program began with, and main() steps down to what
+ *  osPriorityNormal maps to before it runs.
+ */
+
+#include "mbed.h"
+#include <algorithm>
+#include <deque>
+#include <vector>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+typedef std::chrono::steady_clock SteadyClock;
+
+uint32_t SystemCoreClock = 96000000;  // the LPC1768 at full speed
+
+static DWT_Type       dwt;
+static CoreDebug_Type coreDebug;
+DWT_Type*       DWT = &dwt;
+CoreDebug_Type* CoreDebug = &coreDebug;
+
+static const SteadyClock::time_point programStart = SteadyClock::now();
+
+static uint64_t steadyNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(SteadyClock::now() - programStart).count();
+}
+
+/** @return Cycles of a SystemCoreClock CPU since the counter was zeroed. */
+HostCycleCounter::operator uint32_t() const {
+    return (uint32_t)((steadyNs() - zero) * SystemCoreClock / 1000000000);
+}
+
+/** Set the cycle count, as writing CYCCNT does. */
+HostCycleCounter& HostCycleCounter::operator=(uint32_t value) {
+    zero = steadyNs() - (uint64_t)value * 1000000000 / SystemCoreClock;
+    return *this;
+}
+
+/** Spin for short delays, as the board does, and sleep for long ones. */
+void wait_us(int us) {
+    if (us > 2000) {
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+    } else {
+        HostPins::busy(std::chrono::microseconds(us));
+    }
+}
+
+rtos::Kernel::Clock::time_point rtos::Kernel::Clock::now() {
+    return time_point(std::chrono::duration_cast<duration>(SteadyClock::now() - programStart));
+}
+
+const rtos::Kernel::Clock::duration_u32 rtos::Kernel::wait_for_u32_forever(osWaitForever);
+
+// Thread priorities ----------------------------------------------------------
+
+namespace {
+
+const int NICE_NORMAL = 10;  // osPriorityNormal, and main()
+
+/** @return How far below the simulated hardware a thread of this priority runs. */
+int niceFor(osPriority priority) {
+    switch (priority) {
+    case osPriorityRealtime:
+        return 1;
+    case osPriorityHigh:
+        return 2;
+    case osPriorityAboveNormal:
+        return 5;
+    case osPriorityNormal:
+        return NICE_NORMAL;
+    case osPriorityBelowNormal:
+        return 13;
+    case osPriorityLow:
+        return 16;
+    default:
+        return 19;
+    }
+}
+
+/** Lower the calling thread by nice steps. Other systems keep one priority for all. */
+void lowerThread(int nice) {
+#ifdef __linux__
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    setpriority(PRIO_PROCESS, tid, getpriority(PRIO_PROCESS, tid) + nice);
+#endif
+}
+
+/** Starts every thread, from the nice value the program began with. */
+class Spawner {
+public:
+    Spawner()
+    :
+        thread(&Spawner::run, this)
+    {
+        thread.detach();
+    }
+
+    std::thread start(std::function<void()> body, int nice) {
+        Request request;
+        request.body = [body, nice] {
+            lowerThread(nice);
+            body();
+        };
+        request.done = false;
+        std::unique_lock<std::mutex> guard(mutex);
+        requests.push_back(&request);
+        cv.notify_all();
+        cv.wait(guard, [&request] { return request.done; });
+        return std::move(request.thread);
+    }
+
+private:
+    struct Request {
+        std::function<void()> body;
+        std::thread           thread;
+        bool                  done;
+    };
+
+    void run() {
+        std::unique_lock<std::mutex> guard(mutex);
+        while (true) {
+            cv.wait(guard, [this] { return !requests.empty(); });
+            Request* request = requests.front();
+            requests.pop_front();
+            request->thread = std::thread(request->body);
+            request->done = true;
+            cv.notify_all();
+        }
+    }
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+    std::deque<Request*>    requests;
+    std::thread             thread;
+};
+
+Spawner& spawner() {
+    static Spawner* service = new Spawner();
+    return *service;
+}
+
+/** Runs before main(): the spawner keeps the program's priority, main() gives it up. */
+bool lowerMain() {
+    spawner();
+    lowerThread(NICE_NORMAL);
+    return true;
+}
+
+const bool mainLowered = lowerMain();
+
+} // namespace
+
+/** Start a thread nice steps below the simulated hardware, 0 for a part's own thread. */
+std::thread HostPins::startThread(std::function<void()> body, int nice) {
+    return spawner().start(body, nice);
+}
+
+// Timer thread ---------------------------------------------------------------
+
+namespace {
+
+/** Pending Timeout and Ticker calls, run in due order on one thread. */
+class TimerService {
+public:
+    TimerService()
+    :
+        nextId(1),
+        running(0),
+        thread(HostPins::startThread([this] { run(); }))
+    {
+        thread.detach();
+    }
+
+    uint32_t add(Callback<void()> func, std::chrono::microseconds delay, bool periodic) {
+        std::lock_guard<std::mutex> guard(mutex);
+        Entry entry;
+        entry.id = nextId++;
+        entry.when = SteadyClock::now() + delay;
+        entry.period = periodic ? delay : std::chrono::microseconds(0);
+        entry.func = func;
+        entries.push_back(entry);
+        cv.notify_all();
+        return entry.id;
+    }
+
+    void remove(uint32_t id) {
+        std::unique_lock<std::mutex> guard(mutex);
+        entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                     [id](const Entry& e) { return e.id == id; }), entries.end());
+        // A callback may detach itself; anyone else waits until it has returned
+        while (running == id && std::this_thread::get_id() != threadId) {
+            cv.wait(guard);
+        }
+    }
+
+private:
+    struct Entry {
+        uint32_t                 id;
+        SteadyClock::time_point  when;
+        std::chrono::microseconds period;  // 0 for a one shot call
+        Callback<void()>         func;
+    };
+
+    void run() {
+        std::unique_lock<std::mutex> guard(mutex);
+        threadId = std::this_thread::get_id();
+        while (true) {
+            if (entries.empty()) {
+                cv.wait(guard);
+                continue;
+            }
+            auto next = std::min_element(entries.begin(), entries.end(),
+                                         [](const Entry& a, const Entry& b) { return a.when < b.when; });
+            if (next->when > SteadyClock::now()) {
+                cv.wait_until(guard, next->when);
+                continue;
+            }
+            Entry entry = *next;
+            if (entry.period.count() > 0) {
+                next->when += entry.period;
+            } else {
+                entries.erase(next);
+            }
+            running = entry.id;
+            guard.unlock();
+            entry.func();
+            guard.lock();
+            running = 0;
+            cv.notify_all();
+        }
+    }
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+    std::vector<Entry>      entries;
+    uint32_t                nextId;
+    uint32_t                running;  // id of the call in progress, 0 when idle
+    std::thread::id         threadId;
+    std::thread             thread;
+};
+
+/** @return The timer thread, started on first use and never stopped. */
+TimerService& timers() {
+    static TimerService* service = new TimerService();
+    return *service;
+}
+
+} // namespace
+
+// mbed drivers ---------------------------------------------------------------
+
+namespace mbed {
+
+/** Constructor of class Timer. Stopped at zero. */
+Timer::Timer()
+:
+    banked(0),
+    running(false)
+{
+}
+
+void Timer::start() {
+    if (!running) {
+        started = SteadyClock::now();
+        running = true;
+    }
+}
+
+void Timer::stop() {
+    if (running) {
+        banked += SteadyClock::now() - started;
+        running = false;
+    }
+}
+
+void Timer::reset() {
+    banked = SteadyClock::duration(0);
+    started = SteadyClock::now();
+}
+
+std::chrono::microseconds Timer::elapsed_time() const {
+    SteadyClock::duration total = banked;
+    if (running) {
+        total += SteadyClock::now() - started;
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(total);
+}
+
+/** Constructor of class Timeout. */
+Timeout::Timeout()
+:
+    id(0),
+    periodic(false)
+{
+}
+
+/** Destructor of class Timeout. Waits out a callback that is running. */
+Timeout::~Timeout() {
+    detach();
+}
+
+/** Call func once after delay (every delay for a Ticker), replacing any earlier attach. */
+void Timeout::attach(Callback<void()> func, std::chrono::microseconds delay) {
+    detach();
+    id = timers().add(func, delay, periodic);
+}
+
+/** Cancel the pending call. */
+void Timeout::detach() {
+    if (id) {
+        timers().remove(id);
+        id = 0;
+    }
+}
+
+/** Constructor of class Ticker. */
+Ticker::Ticker() {
+    periodic = true;
+}
+
+DigitalOut::DigitalOut(PinName pin, int value)
+:
+    pin(pin)
+{
+    HostPins::drive(pin, value);
+}
+
+void DigitalOut::write(int value) {
+    HostPins::drive(pin, value ? 1 : 0);
+}
+
+int DigitalOut::read() {
+    return HostPins::level(pin);
+}
+
+DigitalIn::DigitalIn(PinName pin, PinMode mode)
+:
+    pin(pin)
+{
+    if (mode != PullNone) {
+        HostPins::pull(pin, mode == PullUp);
+    }
+}
+
+int DigitalIn::read() {
+    return HostPins::level(pin);
+}
+
+InterruptIn::InterruptIn(PinName pin, PinMode mode)
+:
+    pin(pin)
+{
+    if (mode != PullNone) {
+        HostPins::pull(pin, mode == PullUp);
+    }
+}
+
+InterruptIn::~InterruptIn() {
+    HostPins::removeEdges(this);
+}
+
+int InterruptIn::read() {
+    return HostPins::level(pin);
+}
+
+void InterruptIn::rise(Callback<void()> func) {
+    HostPins::onEdge(pin, true, func, this);
+}
+
+void InterruptIn::fall(Callback<void()> func) {
+    HostPins::onEdge(pin, false, func, this);
+}
+
+AnalogIn::AnalogIn(PinName pin)
+:
+    pin(pin)
+{
+}
+
+float AnalogIn::read() {
+    return HostPins::analog(pin);
+}
+
+/** Constructor of class SPI. The bus is found by its SCLK pin on every transfer. */
+SPI::SPI(PinName /*mosi*/, PinName /*miso*/, PinName sclk, PinName /*ssel*/)
+:
+    sclk(sclk),
+    hz(1000000)
+{
+}
+
+void SPI::format(int /*bits*/, int /*mode*/) {
+}
+
+void SPI::frequency(int hz) {
+    this->hz = hz;
+}
+
+/** Clock one byte out and one in. @return The byte read. */
+int SPI::write(int value) {
+    HostPins::busy(std::chrono::nanoseconds(8000000000LL / hz));
+    SpiDevice* device = HostPins::spiDevice(sclk);
+    return device ? device->transfer((uint8_t)value, hz) : 0xff;
+}
+
+/** Clock out txLength bytes, then 0xff fill, while reading rxLength. @return Bytes clocked. */
+int SPI::write(const char* tx, int txLength, char* rx, int rxLength) {
+    int total = std::max(txLength, rxLength);
+    HostPins::busy(std::chrono::nanoseconds(8000000000LL * total / hz));
+    SpiDevice* device = HostPins::spiDevice(sclk);
+    if (device) {
+        device->block(total);
+    }
+    for (int i = 0; i < total; i++) {
+        uint8_t out = i < txLength ? (uint8_t)tx[i] : 0xff;
+        uint8_t in = device ? device->transfer(out, hz) : 0xff;
+        if (i < rxLength) {
+            rx[i] = (char)in;
+        }
+    }
+    return total;
+}
+
+static std::recursive_mutex spiBusLock;
+
+void SPI::lock() {
+    spiBusLock.lock();
+}
+
+void SPI::unlock() {
+    spiBusLock.unlock();
+}
+
+Stream::Stream(const char* /*name*/) {
+}
+
+/** Format into a buffer and hand it to _putc() a character at a time. @return Characters written. */
+int Stream::printf(const char* format, ...) {
+    char small[128];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(small, sizeof(small), format, args);
+    va_end(args);
+    if (length < 0) {
+        return length;
+    }
+    std::vector<char> large;
+    const char* text = small;
+    if ((size_t)length >= sizeof(small)) {
+        large.resize(length + 1);
+        va_start(args, format);
+        vsnprintf(large.data(), large.size(), format, args);
+        va_end(args);
+        text = large.data();
+    }
+    for (int i = 0; i < length; i++) {
+        _putc(text[i]);
+    }
+    return length;
+}
+
+} // namespace mbed
+
+// RTOS -----------------------------------------------------------------------
+
+namespace rtos {
+
+Semaphore::Semaphore(int32_t count, uint16_t maxCount)
+:
+    count(count),
+    maxCount(maxCount)
+{
+}
+
+void Semaphore::acquire() {
+    std::unique_lock<std::mutex> guard(mutex);
+    cv.wait(guard, [this] { return count > 0; });
+    count--;
+}
+
+bool Semaphore::try_acquire() {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (count == 0) {
+        return false;
+    }
+    count--;
+    return true;
+}
+
+bool Semaphore::try_acquire_for(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> guard(mutex);
+    if (!cv.wait_for(guard, timeout, [this] { return count > 0; })) {
+        return false;
+    }
+    count--;
+    return true;
+}
+
+/** @return 0, or -1 when the count is already at its ceiling. */
+int Semaphore::release() {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (count >= maxCount) {
+        return -1;
+    }
+    count++;
+    cv.notify_one();
+    return 0;
+}
+
+EventFlags::EventFlags()
+:
+    bits(0)
+{
+}
+
+/** @return The flags after setting. */
+uint32_t EventFlags::set(uint32_t flags) {
+    std::lock_guard<std::mutex> guard(mutex);
+    bits |= flags;
+    cv.notify_all();
+    return bits;
+}
+
+/** @return The flags before clearing. */
+uint32_t EventFlags::clear(uint32_t flags) {
+    std::lock_guard<std::mutex> guard(mutex);
+    uint32_t before = bits;
+    bits &= ~flags;
+    return before;
+}
+
+uint32_t EventFlags::get() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    return bits;
+}
+
+uint32_t EventFlags::wait_any(uint32_t flags, uint32_t millisec, bool clear) {
+    if (millisec == osWaitForever) {
+        return waitFor(flags, std::chrono::microseconds::max(), clear);
+    }
+    return waitFor(flags, std::chrono::milliseconds(millisec), clear);
+}
+
+/** @return The flags when one of flags was set, osFlagsErrorTimeout otherwise. */
+uint32_t EventFlags::waitFor(uint32_t flags, std::chrono::microseconds timeout, bool clear) {
+    std::unique_lock<std::mutex> guard(mutex);
+    auto isSet = [this, flags] { return (bits & flags) != 0; };
+    if (timeout == std::chrono::microseconds::max() || timeout >= Kernel::wait_for_u32_forever) {
+        cv.wait(guard, isSet);
+    } else if (!cv.wait_for(guard, timeout, isSet)) {
+        return osFlagsErrorTimeout;
+    }
+    uint32_t result = bits;
+    if (clear) {
+        bits &= ~flags;
+    }
+    return result;
+}
+
+Thread::Thread(osPriority priority, uint32_t /*stackSize*/, unsigned char* /*stackMem*/, const char* /*name*/)
+:
+    priority(priority)
+{
+}
+
+/** Destructor of class Thread. A thread still running is left to finish on its own. */
+Thread::~Thread() {
+    if (thread.joinable()) {
+        thread.detach();
+    }
+}
+
+/** @return 0, or -1 when the thread was already started. */
+int Thread::start(mbed::Callback<void()> task) {
+    if (thread.joinable()) {
+        return -1;
+    }
+    thread = HostPins::startThread([task] { task(); }, niceFor(priority));
+    return 0;
+}
+
+int Thread::join() {
+    if (thread.joinable()) {
+        thread.join();
+    }
+    return 0;
+}
+
+} // namespace rtos
+
+// Pins -----------------------------------------------------------------------
+
+namespace {
+
+struct Edge {
+    Callback<void()> handler;
+    const void*      owner;
+    bool             rising;
+};
+
+struct Pin {
+    int                       level;
+    bool                      driven;  // set by drive(), a pull no longer decides the level
+    float                     analog;
+    std::vector<Edge>         edges;
+    std::vector<PinListener*> listeners;
+};
+
+std::mutex pinLock;
+Pin        pinTable[PIN_COUNT];
+SpiDevice* buses[PIN_COUNT];
+
+bool valid(PinName pin) {
+    return pin >= 0 && pin < PIN_COUNT;
+}
+
+} // namespace
+
+/** Set a pin's level, then tell its watchers and edge handlers about a change. */
+void HostPins::drive(PinName pin, int level) {
+    if (!valid(pin)) {
+        return;
+    }
+    std::vector<PinListener*> listeners;
+    std::vector<Edge> edges;
+    {
+        std::lock_guard<std::mutex> guard(pinLock);
+        Pin& p = pinTable[pin];
+        p.driven = true;
+        if (p.level == level) {
+            return;
+        }
+        p.level = level;
+        listeners = p.listeners;
+        edges = p.edges;
+    }
+    for (PinListener* listener : listeners) {
+        listener->pinChanged(pin, level);
+    }
+    for (const Edge& edge : edges) {
+        if (edge.rising == (level != 0)) {
+            edge.handler();
+        }
+    }
+}
+
+/** @return The pin's level, 0 or 1. */
+int HostPins::level(PinName pin) {
+    if (!valid(pin)) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> guard(pinLock);
+    return pinTable[pin].level;
+}
+
+/** Apply an input's pull resistor, unless something already drives the pin. */
+void HostPins::pull(PinName pin, int level) {
+    if (!valid(pin)) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(pinLock);
+    if (!pinTable[pin].driven) {
+        pinTable[pin].level = level;
+    }
+}
+
+void HostPins::setAnalog(PinName pin, float value) {
+    if (valid(pin)) {
+        std::lock_guard<std::mutex> guard(pinLock);
+        pinTable[pin].analog = value;
+    }
+}
+
+float HostPins::analog(PinName pin) {
+    if (!valid(pin)) {
+        return 0.0f;
+    }
+    std::lock_guard<std::mutex> guard(pinLock);
+    return pinTable[pin].analog;
+}
+
+/** Call handler on every rising (or falling) edge of pin until owner is removed. */
+void HostPins::onEdge(PinName pin, bool rising, Callback<void()> handler, const void* owner) {
+    if (!valid(pin)) {
+        return;
+    }
+    std::lock_guard<std::mutex> guard(pinLock);
+    std::vector<Edge>& edges = pinTable[pin].edges;
+    // One handler per edge and owner, as InterruptIn has
+    edges.erase(std::remove_if(edges.begin(), edges.end(),
+                               [=](const Edge& e) { return e.owner == owner && e.rising == rising; }),
+                edges.end());
+    if (handler) {
+        Edge edge;
+        edge.handler = handler;
+        edge.owner = owner;
+        edge.rising = rising;
+        edges.push_back(edge);
+    }
+}
+
+/** Drop every edge handler owner has on any pin. */
+void HostPins::removeEdges(const void* owner) {
+    std::lock_guard<std::mutex> guard(pinLock);
+    for (Pin& p : pinTable) {
+        p.edges.erase(std::remove_if(p.edges.begin(), p.edges.end(),
+                                     [=](const Edge& e) { return e.owner == owner; }),
+                      p.edges.end());
+    }
+}
+
+/** Tell listener about every level change of pin. */
+void HostPins::watch(PinName pin, PinListener* listener) {
+    if (valid(pin)) {
+        std::lock_guard<std::mutex> guard(pinLock);
+        pinTable[pin].listeners.push_back(listener);
+    }
+}
+
+/** Stop telling listener about any pin. */
+void HostPins::unwatch(PinListener* listener) {
+    std::lock_guard<std::mutex> guard(pinLock);
+    for (Pin& p : pinTable) {
+        p.listeners.erase(std::remove(p.listeners.begin(), p.listeners.end(), listener), p.listeners.end());
+    }
+}
+
+/** Put device on the SPI bus clocked by sclk, null to take it off. */
+void HostPins::attachSpi(PinName sclk, SpiDevice* device) {
+    if (valid(sclk)) {
+        std::lock_guard<std::mutex> guard(pinLock);
+        buses[sclk] = device;
+    }
+}
+
+/** @return The part on the bus clocked by sclk, null when there is none. */
+SpiDevice* HostPins::spiDevice(PinName sclk) {
+    if (!valid(sclk)) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> guard(pinLock);
+    return buses[sclk];
+}
+
+/** Hold the calling thread for a bus or busy wait time, without sleeping. */
+void HostPins::busy(std::chrono::nanoseconds time) {
+    SteadyClock::time_point until = SteadyClock::now() + time;
+    while (SteadyClock::now() < until) {
+    }
+}
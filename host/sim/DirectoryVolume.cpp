@@ -0,0 +1,221 @@
+/**
+ *  DirectoryVolume.cpp
+ *  ===========================================================================
+ *  Host files as a SongVolume, behind a simulated SD card.
+ */
+
+#include "DirectoryVolume.h"
+#include <cstdio>
+#include <cstring>
+
+static const uint32_t GAP = 1;  // sectors between the pieces of a fragmented file
+
+/** Constructor of class DirectoryVolume. spiHz is the card's clock for data reads. */
+DirectoryVolume::DirectoryVolume(int spiHz, int accessUs)
+:
+    card(*this),
+    spiHz(spiHz),
+    accessUs(accessUs),
+    fragments(1),
+    nextSector(8192)  // past where a FAT would be, like real data sectors
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+DirectoryVolume::~DirectoryVolume() {
+}
+
+/** Lay files mapped from now on out in this many pieces (1 for contiguous). */
+void DirectoryVolume::setFragments(int pieces) {
+    std::lock_guard<std::mutex> guard(mutex);
+    fragments = pieces > 0 ? pieces : 1;
+}
+
+/** Access latency of every read command from now on. */
+void DirectoryVolume::setAccessTime(int us) {
+    std::lock_guard<std::mutex> guard(mutex);
+    accessUs = us;
+}
+
+/** @return What the card did since resetStats(). */
+DirectoryVolume::Score DirectoryVolume::score() {
+    std::lock_guard<std::mutex> guard(mutex);
+    return stats;
+}
+
+void DirectoryVolume::resetStats() {
+    std::lock_guard<std::mutex> guard(mutex);
+    memset(&stats, 0, sizeof(stats));
+}
+
+/** Find the sectors of a host file, giving it some the first time or when its size changed.
+ *  @return Number of extents filled in, 0 when the file can't be opened or has more pieces than max.
+ */
+size_t DirectoryVolume::mapFile(const char* path, Extent* extents, size_t max, uint32_t& size,
+                                uint32_t& sectorSize) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fclose(f);
+    if (length < 0) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> guard(mutex);
+    std::map<std::string, Layout>::iterator known = files.find(path);
+    if (known == files.end() || known->second.size != (uint32_t)length) {
+        uint32_t sectors = ((uint32_t)length + SECTOR_SIZE - 1) / SECTOR_SIZE;
+        Layout layout;
+        layout.path = path;
+        layout.size = length;
+        layout.first = nextSector;
+        layout.perPiece = sectors > 0 ? (sectors + fragments - 1) / fragments : 1;
+        layout.pieces = sectors > 0 ? (sectors + layout.perPiece - 1) / layout.perPiece : 1;
+        nextSector += layout.pieces * (layout.perPiece + GAP);
+        if (known != files.end()) {
+            bySector.erase(known->second.first);
+        }
+        files[path] = layout;
+        bySector[layout.first] = path;
+        known = files.find(path);
+    }
+
+    const Layout& layout = known->second;
+    if (layout.pieces > max) {
+        return 0;
+    }
+    uint32_t sectors = (layout.size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    for (uint32_t i = 0; i < layout.pieces; i++) {
+        extents[i].sector = layout.first + i * (layout.perPiece + GAP);
+        extents[i].sectors = i + 1 < layout.pieces ? layout.perPiece : sectors - i * layout.perPiece;
+    }
+    size = layout.size;
+    sectorSize = SECTOR_SIZE;
+    return layout.pieces;
+}
+
+/** @return The simulated card the extents are on. */
+BlockDevice* DirectoryVolume::device() {
+    return &card;
+}
+
+/** Find which file holds a sector. Caller holds mutex.
+ *  @return Zero when the sector is in a gap or belongs to no file.
+ */
+bool DirectoryVolume::locate(uint32_t sector, const Layout*& file, uint32_t& offset) {
+    std::map<uint32_t, std::string>::iterator owner = bySector.upper_bound(sector);
+    if (owner == bySector.begin()) {
+        return false;
+    }
+    --owner;
+    const Layout& layout = files[owner->second];
+    uint32_t relative = sector - layout.first;
+    uint32_t piece = relative / (layout.perPiece + GAP);
+    uint32_t within = relative % (layout.perPiece + GAP);
+    if (piece >= layout.pieces || within >= layout.perPiece) {
+        return false;
+    }
+    offset = (piece * layout.perPiece + within) * SECTOR_SIZE;
+    if (offset >= layout.size) {
+        return false;
+    }
+    file = &layout;
+    return true;
+}
+
+/** Read sectors as one SD command and hold the caller for as long as the card would.
+ *  @return 0 at success, -1 when a sector is outside every mapped file.
+ */
+int DirectoryVolume::readSectors(char* buffer, uint32_t sector, uint32_t count) {
+    std::chrono::nanoseconds hold;
+    int result = 0;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        hold = std::chrono::microseconds(accessUs) +
+               std::chrono::nanoseconds(8000000000LL * count * (SECTOR_SIZE + SECTOR_EXTRA) / spiHz);
+        stats.reads++;
+        stats.sectorsRead += count;
+        stats.busyUs += std::chrono::duration_cast<std::chrono::microseconds>(hold).count();
+
+        FILE* f = nullptr;
+        const Layout* open = nullptr;
+        for (uint32_t i = 0; i < count && result == 0; i++) {
+            const Layout* file;
+            uint32_t offset;
+            char* out = buffer + i * SECTOR_SIZE;
+            memset(out, 0, SECTOR_SIZE);
+            if (!locate(sector + i, file, offset)) {
+                stats.failures++;
+                result = -1;
+                break;
+            }
+            if (file != open) {
+                if (f) {
+                    fclose(f);
+                }
+                f = fopen(file->path.c_str(), "rb");
+                open = file;
+            }
+            if (!f || fseek(f, offset, SEEK_SET) != 0) {
+                stats.failures++;
+                result = -1;
+                break;
+            }
+            fread(out, 1, SECTOR_SIZE, f);
+        }
+        if (f) {
+            fclose(f);
+        }
+    }
+    // The board's driver spins on the SPI bus for all of it
+    HostPins::busy(hold);
+    return result;
+}
+
+// Card -----------------------------------------------------------------------
+
+DirectoryVolume::Card::Card(DirectoryVolume& owner)
+:
+    owner(owner)
+{
+}
+
+int DirectoryVolume::Card::init() {
+    return 0;
+}
+
+int DirectoryVolume::Card::deinit() {
+    return 0;
+}
+
+/** @return 0 at success, -1 for a read that isn't whole sectors of mapped files. */
+int DirectoryVolume::Card::read(void* buffer, bd_addr_t addr, bd_size_t size) {
+    if (addr % SECTOR_SIZE || size % SECTOR_SIZE) {
+        return -1;
+    }
+    return owner.readSectors(static_cast<char*>(buffer), addr / SECTOR_SIZE, size / SECTOR_SIZE);
+}
+
+/** Songs are never written through the card. @return -1 always. */
+int DirectoryVolume::Card::program(const void* /*buffer*/, bd_addr_t /*addr*/, bd_size_t /*size*/) {
+    return -1;
+}
+
+bd_size_t DirectoryVolume::Card::get_read_size() const {
+    return SECTOR_SIZE;
+}
+
+bd_size_t DirectoryVolume::Card::get_program_size() const {
+    return SECTOR_SIZE;
+}
+
+bd_size_t DirectoryVolume::Card::size() const {
+    return (bd_size_t)4 << 30;
+}
+
+const char* DirectoryVolume::Card::get_type() const {
+    return "SD";
+}
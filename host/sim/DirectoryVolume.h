@@ -0,0 +1,91 @@
+/**
+ *  DirectoryVolume.h
+ *  ===========================================================================
+ *  Host files as a SongVolume, behind a simulated SD card.
+ *       - Paths are the host's own, so the scanner, the index files and
+ *         StreamFile's stdio fallback find the same files with no mapping.
+ *       - A file gets its sectors on the card the first time it is mapped,
+ *         in as many pieces as setFragments() asks for, so a file in too
+ *         many pieces can be made to fall back to stdio.
+ *       - Every card read holds the caller for what it would take on the
+ *         board: the command's access latency, then the data at the SPI
+ *         clock with a little overhead for each sector's token and CRC.
+ */
+
+#ifndef DIRECTORY_VOLUME_H_
+#define DIRECTORY_VOLUME_H_
+
+#include "mbed.h"
+#include "SongVolume.h"
+#include <map>
+#include <mutex>
+#include <string>
+
+/** Class DirectoryVolume. SongVolume over host files with SD card timing. */
+class DirectoryVolume : public SongVolume {
+public:
+    static const uint32_t SECTOR_SIZE   = 512;
+    static const int      SECTOR_EXTRA  = 10;  // start token, CRC and gap, in bytes
+
+    /** What the card did since resetStats(). */
+    struct Score {
+        uint32_t reads;        // block device read calls, one SD command each
+        uint64_t sectorsRead;
+        uint64_t busyUs;       // time the callers were held
+        uint32_t failures;     // reads outside any mapped file
+    };
+
+    DirectoryVolume(int spiHz = 25000000, int accessUs = 500);
+    ~DirectoryVolume();
+
+    void setFragments(int pieces);
+    void setAccessTime(int us);
+    Score score();
+    void resetStats();
+
+    virtual size_t mapFile(const char* path, Extent* extents, size_t max, uint32_t& size,
+                           uint32_t& sectorSize);
+    virtual BlockDevice* device();
+
+private:
+    /** The simulated card, reading whichever file owns the sectors asked for. */
+    class Card : public BlockDevice {
+    public:
+        Card(DirectoryVolume& owner);
+        virtual int init();
+        virtual int deinit();
+        virtual int read(void* buffer, bd_addr_t addr, bd_size_t size);
+        virtual int program(const void* buffer, bd_addr_t addr, bd_size_t size);
+        virtual bd_size_t get_read_size() const;
+        virtual bd_size_t get_program_size() const;
+        virtual bd_size_t size() const;
+        virtual const char* get_type() const;
+
+    private:
+        DirectoryVolume& owner;
+    };
+
+    /** A file laid out on the card: pieces of sectors separated by a gap. */
+    struct Layout {
+        std::string path;
+        uint32_t    size;
+        uint32_t    first;     // sector of the first piece
+        uint32_t    pieces;
+        uint32_t    perPiece;  // sectors in each piece but the last
+    };
+
+    bool locate(uint32_t sector, const Layout*& file, uint32_t& offset);
+    int readSectors(char* buffer, uint32_t sector, uint32_t count);
+
+    std::mutex                      mutex;
+    Card                            card;
+    int                             spiHz;
+    int                             accessUs;
+    int                             fragments;
+    uint32_t                        nextSector;  // bump allocator for new layouts
+    std::map<std::string, Layout>   files;
+    std::map<uint32_t, std::string> bySector;    // first sector to path
+    Score                           stats;
+};
+
+#endif
@@ -0,0 +1,105 @@
+/**
+ *  FatReader.cpp
+ *  ===========================================================================
+ *  A song read through stdio on the board, as FatFs reads it from the card.
+ */
+
+#include "FatReader.h"
+#include <cstring>
+
+static const uint32_t SECTOR = DirectoryVolume::SECTOR_SIZE;
+
+/** Constructor of class FatReader. */
+FatReader::FatReader(DirectoryVolume& volume)
+:
+    volume(volume),
+    fileSize(0),
+    position(0),
+    windowIndex(NO_SECTOR)
+{
+}
+
+/** Open path on the volume at offset. @return Zero when it can't be mapped. */
+bool FatReader::open(const char* path, uint32_t offset) {
+    close();
+    extents.resize(MAX_PIECES);
+    uint32_t sectorSize;
+    size_t pieces = volume.mapFile(path, extents.data(), extents.size(), fileSize, sectorSize);
+    extents.resize(pieces);
+    if (pieces == 0 || sectorSize != SECTOR) {
+        close();
+        return false;
+    }
+    position = offset < fileSize ? offset : fileSize;
+    return true;
+}
+
+void FatReader::close() {
+    extents.clear();
+    fileSize = 0;
+    position = 0;
+    windowIndex = NO_SECTOR;
+}
+
+/** @return Length of the open file in bytes. */
+uint32_t FatReader::size() {
+    return fileSize;
+}
+
+/** Find the card sector of file sector index and how many follow it on the card.
+ *  @return Zero when index is past the file.
+ */
+bool FatReader::locate(uint32_t index, uint32_t& sector, uint32_t& run) {
+    for (size_t i = 0; i < extents.size(); i++) {
+        if (index < extents[i].sectors) {
+            sector = extents[i].sector + index;
+            run = extents[i].sectors - index;
+            return true;
+        }
+        index -= extents[i].sectors;
+    }
+    return false;
+}
+
+/** Read up to length bytes at the current position, as one f_read.
+ *  @return Bytes read, less than length only at the end of the file or on a card error.
+ */
+size_t FatReader::read(char* buffer, size_t length) {
+    size_t done = 0;
+    while (done < length && position < fileSize) {
+        uint32_t index = position / SECTOR;
+        uint32_t within = position % SECTOR;
+        uint32_t left = fileSize - position;
+        uint32_t want = length - done < left ? length - done : left;
+        uint32_t sector, run;
+        if (!locate(index, sector, run)) {
+            break;
+        }
+        uint32_t n;
+        if (within == 0 && want >= SECTOR) {
+            // Whole sectors, up to the end of the cluster
+            uint32_t sectors = want / SECTOR;
+            uint32_t inCluster = CLUSTER_SECTORS - index % CLUSTER_SECTORS;
+            sectors = sectors < inCluster ? sectors : inCluster;
+            sectors = sectors < run ? sectors : run;
+            n = sectors * SECTOR;
+            if (volume.device()->read(buffer + done, (bd_addr_t)sector * SECTOR, n) != 0) {
+                break;
+            }
+        } else {
+            // Part of a sector, through the window
+            if (windowIndex != index) {
+                if (volume.device()->read(window, (bd_addr_t)sector * SECTOR, SECTOR) != 0) {
+                    windowIndex = NO_SECTOR;
+                    break;
+                }
+                windowIndex = index;
+            }
+            n = SECTOR - within < want ? SECTOR - within : want;
+            memcpy(buffer + done, window + within, n);
+        }
+        position += n;
+        done += n;
+    }
+    return done;
+}
@@ -0,0 +1,48 @@
+/**
+ *  FatReader.h
+ *  ===========================================================================
+ *  A song read through stdio on the board, as FatFs reads it from the card,
+ *  so stdio and StreamFile's direct reads can be compared on the same card
+ *  model.
+ *       - Each read is one f_read: whole sectors go straight into the
+ *         caller's buffer as one multi block read, cut at the end of the
+ *         cluster, where FatFs looks up the next one.
+ *       - The rest of a sector goes through the file's one sector window,
+ *         which is read from the card when it moves to another sector.
+ *       - FAT sectors are left out, as the volume's window or the sector
+ *         cache holds them for hundreds of clusters.
+ */
+
+#ifndef FAT_READER_H_
+#define FAT_READER_H_
+
+#include "mbed.h"
+#include "DirectoryVolume.h"
+#include <vector>
+
+/** Class FatReader. FatFs style reads of a file on a DirectoryVolume. */
+class FatReader {
+public:
+    static const uint32_t CLUSTER_SECTORS = 64;   // 32 KB clusters, as FAT32 formats a card of a few GB
+    static const size_t   MAX_PIECES      = 256;
+
+    FatReader(DirectoryVolume& volume);
+    bool open(const char* path, uint32_t offset = 0);
+    void close();
+    size_t read(char* buffer, size_t length);
+    uint32_t size();
+
+private:
+    static const uint32_t NO_SECTOR = 0xffffffff;
+
+    bool locate(uint32_t index, uint32_t& sector, uint32_t& run);
+
+    DirectoryVolume&                volume;
+    std::vector<SongVolume::Extent> extents;
+    uint32_t                        fileSize;
+    uint32_t                        position;
+    uint32_t                        windowIndex;  // file sector in window, NO_SECTOR for none
+    char                            window[DirectoryVolume::SECTOR_SIZE];
+};
+
+#endif
@@ -0,0 +1,662 @@
+/**
+ *  GoldeloxSim.cpp
+ *  ===========================================================================
+ *  A uLCD-144-G2 (Goldelox, 4DGL serial commands) at the end of a DisplayLink.
+ *
+ *  Every call first plays the wire, FIFO and drawing forward to the
+ *  present, from the arrival times recorded when the bytes were written.
+ *  Only the receive interrupt behind sigio() runs in the background.
+ */
+
+#include "GoldeloxSim.h"
+#include <algorithm>
+#include <cstdio>
+
+// 5x7 glyphs for ' ' to '~', one byte per column, bit 0 at the top
+static const uint8_t FONT[95][5] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x5f, 0x00, 0x00 }, { 0x00, 0x07, 0x00, 0x07, 0x00 },
+    { 0x14, 0x7f, 0x14, 0x7f, 0x14 }, { 0x24, 0x2a, 0x7f, 0x2a, 0x12 }, { 0x23, 0x13, 0x08, 0x64, 0x62 },
+    { 0x36, 0x49, 0x55, 0x22, 0x50 }, { 0x00, 0x05, 0x03, 0x00, 0x00 }, { 0x00, 0x1c, 0x22, 0x41, 0x00 },
+    { 0x00, 0x41, 0x22, 0x1c, 0x00 }, { 0x08, 0x2a, 0x1c, 0x2a, 0x08 }, { 0x08, 0x08, 0x3e, 0x08, 0x08 },
+    { 0x00, 0x50, 0x30, 0x00, 0x00 }, { 0x08, 0x08, 0x08, 0x08, 0x08 }, { 0x00, 0x60, 0x60, 0x00, 0x00 },
+    { 0x20, 0x10, 0x08, 0x04, 0x02 }, { 0x3e, 0x51, 0x49, 0x45, 0x3e }, { 0x00, 0x42, 0x7f, 0x40, 0x00 },
+    { 0x42, 0x61, 0x51, 0x49, 0x46 }, { 0x21, 0x41, 0x45, 0x4b, 0x31 }, { 0x18, 0x14, 0x12, 0x7f, 0x10 },
+    { 0x27, 0x45, 0x45, 0x45, 0x39 }, { 0x3c, 0x4a, 0x49, 0x49, 0x30 }, { 0x01, 0x71, 0x09, 0x05, 0x03 },
+    { 0x36, 0x49, 0x49, 0x49, 0x36 }, { 0x06, 0x49, 0x49, 0x29, 0x1e }, { 0x00, 0x36, 0x36, 0x00, 0x00 },
+    { 0x00, 0x56, 0x36, 0x00, 0x00 }, { 0x08, 0x14, 0x22, 0x41, 0x00 }, { 0x14, 0x14, 0x14, 0x14, 0x14 },
+    { 0x00, 0x41, 0x22, 0x14, 0x08 }, { 0x02, 0x01, 0x51, 0x09, 0x06 }, { 0x32, 0x49, 0x79, 0x41, 0x3e },
+    { 0x7e, 0x11, 0x11, 0x11, 0x7e }, { 0x7f, 0x49, 0x49, 0x49, 0x36 }, { 0x3e, 0x41, 0x41, 0x41, 0x22 },
+    { 0x7f, 0x41, 0x41, 0x22, 0x1c }, { 0x7f, 0x49, 0x49, 0x49, 0x41 }, { 0x7f, 0x09, 0x09, 0x09, 0x01 },
+    { 0x3e, 0x41, 0x49, 0x49, 0x7a }, { 0x7f, 0x08, 0x08, 0x08, 0x7f }, { 0x00, 0x41, 0x7f, 0x41, 0x00 },
+    { 0x20, 0x40, 0x41, 0x3f, 0x01 }, { 0x7f, 0x08, 0x14, 0x22, 0x41 }, { 0x7f, 0x40, 0x40, 0x40, 0x40 },
+    { 0x7f, 0x02, 0x0c, 0x02, 0x7f }, { 0x7f, 0x04, 0x08, 0x10, 0x7f }, { 0x3e, 0x41, 0x41, 0x41, 0x3e },
+    { 0x7f, 0x09, 0x09, 0x09, 0x06 }, { 0x3e, 0x41, 0x51, 0x21, 0x5e }, { 0x7f, 0x09, 0x19, 0x29, 0x46 },
+    { 0x46, 0x49, 0x49, 0x49, 0x31 }, { 0x01, 0x01, 0x7f, 0x01, 0x01 }, { 0x3f, 0x40, 0x40, 0x40, 0x3f },
+    { 0x1f, 0x20, 0x40, 0x20, 0x1f }, { 0x3f, 0x40, 0x38, 0x40, 0x3f }, { 0x63, 0x14, 0x08, 0x14, 0x63 },
+    { 0x07, 0x08, 0x70, 0x08, 0x07 }, { 0x61, 0x51, 0x49, 0x45, 0x43 }, { 0x00, 0x7f, 0x41, 0x41, 0x00 },
+    { 0x02, 0x04, 0x08, 0x10, 0x20 }, { 0x00, 0x41, 0x41, 0x7f, 0x00 }, { 0x04, 0x02, 0x01, 0x02, 0x04 },
+    { 0x40, 0x40, 0x40, 0x40, 0x40 }, { 0x00, 0x01, 0x02, 0x04, 0x00 }, { 0x20, 0x54, 0x54, 0x54, 0x78 },
+    { 0x7f, 0x48, 0x44, 0x44, 0x38 }, { 0x38, 0x44, 0x44, 0x44, 0x20 }, { 0x38, 0x44, 0x44, 0x48, 0x7f },
+    { 0x38, 0x54, 0x54, 0x54, 0x18 }, { 0x08, 0x7e, 0x09, 0x01, 0x02 }, { 0x0c, 0x52, 0x52, 0x52, 0x3e },
+    { 0x7f, 0x08, 0x04, 0x04, 0x78 }, { 0x00, 0x44, 0x7d, 0x40, 0x00 }, { 0x20, 0x40, 0x44, 0x3d, 0x00 },
+    { 0x7f, 0x10, 0x28, 0x44, 0x00 }, { 0x00, 0x41, 0x7f, 0x40, 0x00 }, { 0x7c, 0x04, 0x18, 0x04, 0x78 },
+    { 0x7c, 0x08, 0x04, 0x04, 0x78 }, { 0x38, 0x44, 0x44, 0x44, 0x38 }, { 0x7c, 0x14, 0x14, 0x14, 0x08 },
+    { 0x08, 0x14, 0x14, 0x18, 0x7c }, { 0x7c, 0x08, 0x04, 0x04, 0x08 }, { 0x48, 0x54, 0x54, 0x54, 0x20 },
+    { 0x04, 0x3f, 0x44, 0x40, 0x20 }, { 0x3c, 0x40, 0x40, 0x20, 0x7c }, { 0x1c, 0x20, 0x40, 0x20, 0x1c },
+    { 0x3c, 0x40, 0x30, 0x40, 0x3c }, { 0x44, 0x28, 0x10, 0x28, 0x44 }, { 0x0c, 0x50, 0x50, 0x50, 0x3c },
+    { 0x44, 0x64, 0x54, 0x4c, 0x44 }, { 0x00, 0x08, 0x36, 0x41, 0x00 }, { 0x00, 0x00, 0x7f, 0x00, 0x00 },
+    { 0x00, 0x41, 0x36, 0x08, 0x00 }, { 0x08, 0x04, 0x08, 0x10, 0x08 },
+};
+
+// Cell size of each font number the driver sends with SETFONT
+static const int CELL_W[5] = { 7, 8, 8, 12, 6 };
+static const int CELL_H[5] = { 8, 8, 12, 16, 8 };
+
+const int GoldeloxSim::COMMAND_US;
+constexpr std::chrono::milliseconds GoldeloxSim::BOOT_TIME;
+constexpr std::chrono::milliseconds GoldeloxSim::BAUD_ANSWER;
+
+/** Constructor of class GoldeloxSim. Powered up at 9600 baud with a blank screen. */
+GoldeloxSim::GoldeloxSim(int maxBaud)
+:
+    maxBaud(maxBaud),
+    hostBaud(9600),
+    inReset(false),
+    refusals(0),
+    delays(0),
+    late(0),
+    stopping(false)
+{
+    memset(&stats, 0, sizeof(stats));
+    powerUp();
+    bootDone = txFree = busyUntil = Clock::now();
+}
+
+/** Destructor of class GoldeloxSim. Stops the receive interrupt. */
+GoldeloxSim::~GoldeloxSim() {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        stopping = true;
+    }
+    if (receiver.joinable()) {
+        receiver.join();
+    }
+}
+
+/** Power up state: 9600 baud, black screen, default text settings. */
+void GoldeloxSim::powerUp() {
+    baud = 9600;
+    wire.clear();
+    fifo.clear();
+    answers.clear();
+    command.clear();
+    background = 0;
+    textColor = 0xffff;
+    textBackground = 0;
+    cursorCol = cursorRow = 0;
+    font = 0;
+    textWidth = textHeight = 1;
+    opaque = false;
+    for (int y = 0; y < HEIGHT; y++) {
+        for (int x = 0; x < WIDTH; x++) {
+            frame[y][x] = 0;
+        }
+    }
+}
+
+/** @return How long one byte (start, 8 data, stop bits) takes at baud. */
+GoldeloxSim::Clock::duration GoldeloxSim::byteTime(int rate) {
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(10000000000LL / rate));
+}
+
+/** @return Non-zero when two UARTs are close enough in rate to understand each other. */
+bool GoldeloxSim::sameRate(int a, int b) {
+    return a > 0 && b > 0 && std::abs(a - b) * 100 < b * 3;
+}
+
+/** Queue bytes on the host UART; blocks while its transmit buffer is full. */
+ssize_t GoldeloxSim::write(const void* data, size_t length) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    std::unique_lock<std::mutex> guard(mutex);
+    for (size_t i = 0; i < length; i++) {
+        Clock::duration each = byteTime(hostBaud);
+        Clock::time_point now = Clock::now();
+        // The buffer holds whatever hasn't started on the wire yet
+        if (txFree > now + each * (Clock::rep)TX_BUFFER) {
+            Clock::time_point room = txFree - each * (Clock::rep)(TX_BUFFER - 1);
+            guard.unlock();
+            std::this_thread::sleep_until(room);
+            guard.lock();
+            now = Clock::now();
+        }
+        WireByte b;
+        b.value = bytes[i];
+        b.baud = hostBaud;
+        txFree = std::max(txFree, now) + each;
+        b.arrival = txFree;
+        wire.push_back(b);
+    }
+    return length;
+}
+
+/** Read answers, blocking until at least one byte has arrived. */
+ssize_t GoldeloxSim::read(void* data, size_t length) {
+    uint8_t* bytes = static_cast<uint8_t*>(data);
+    size_t n = 0;
+    while (n == 0 && length > 0) {
+        std::unique_lock<std::mutex> guard(mutex);
+        Clock::time_point now = Clock::now();
+        advance(now);
+        while (n < length && !answers.empty() && answers.front().arrival <= now) {
+            const WireByte& b = answers.front();
+            if (sameRate(b.baud, hostBaud) && !inReset) {
+                bytes[n] = b.value;
+            } else {
+                bytes[n] = 0xff;  // framing garbage
+            }
+            answers.pop_front();
+            n++;
+        }
+        if (n == 0) {
+            guard.unlock();
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+    return n;
+}
+
+/** @return Non-zero when an answer byte has arrived. */
+bool GoldeloxSim::readable() {
+    std::lock_guard<std::mutex> guard(mutex);
+    Clock::time_point now = Clock::now();
+    advance(now);
+    return !answers.empty() && answers.front().arrival <= now;
+}
+
+/** Have func called while an answer byte is waiting, as the UART's receive interrupt would. */
+void GoldeloxSim::sigio(Callback<void()> func) {
+    std::lock_guard<std::mutex> guard(mutex);
+    notify = func;
+    if (!receiver.joinable()) {
+        receiver = std::thread(&GoldeloxSim::receiveTask, this);
+    }
+}
+
+/** The receive interrupt: every 50 us, call notify if an answer byte has arrived. */
+void GoldeloxSim::receiveTask() {
+    for (;;) {
+        Callback<void()> func;
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            if (stopping) {
+                return;
+            }
+            Clock::time_point now = Clock::now();
+            advance(now);
+            if (!answers.empty() && answers.front().arrival <= now) {
+                func = notify;
+            }
+        }
+        if (func) {
+            func();
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+}
+
+/** Change the host side rate. Bytes already queued keep the rate they were sent at. */
+void GoldeloxSim::set_baud(int rate) {
+    std::lock_guard<std::mutex> guard(mutex);
+    hostBaud = rate;
+}
+
+/** Wait until every queued byte is on the wire. */
+int GoldeloxSim::sync() {
+    Clock::time_point done;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        done = txFree;
+    }
+    std::this_thread::sleep_until(done);
+    return 0;
+}
+
+/** The reset pin: low holds the screen in reset, high boots it afresh. */
+void GoldeloxSim::reset_line(int level) {
+    std::lock_guard<std::mutex> guard(mutex);
+    Clock::time_point now = Clock::now();
+    if (level == 0) {
+        inReset = true;
+        powerUp();
+    } else if (inReset) {
+        inReset = false;
+        bootDone = busyUntil = now + BOOT_TIME;
+    }
+}
+
+/** Play the wire, FIFO and drawing forward to now. Caller holds mutex. */
+void GoldeloxSim::advance(Clock::time_point now) {
+    while (!wire.empty()) {
+        WireByte b = wire.front();
+        Clock::time_point until = std::min(now, b.arrival);
+        // Bytes held in the FIFO are read as soon as the screen is free
+        while (!fifo.empty() && busyUntil <= until) {
+            uint8_t value = fifo.front();
+            fifo.pop_front();
+            consume(value, busyUntil);
+        }
+        if (b.arrival > now) {
+            break;
+        }
+        wire.pop_front();
+        if (inReset || b.arrival < bootDone || !sameRate(b.baud, baud) || baud > maxBaud) {
+            stats.garbledBytes++;
+        } else if (b.arrival >= busyUntil && fifo.empty()) {
+            consume(b.value, b.arrival);
+        } else if (fifo.size() < RECEIVE_FIFO) {
+            fifo.push_back(b.value);
+        } else {
+            stats.overrunBytes++;
+        }
+    }
+    while (!fifo.empty() && busyUntil <= now) {
+        uint8_t value = fifo.front();
+        fifo.pop_front();
+        consume(value, busyUntil);
+    }
+}
+
+/** The screen reads one byte at time at. Caller holds mutex. */
+void GoldeloxSim::consume(uint8_t value, Clock::time_point at) {
+    command.push_back(value);
+    int length = commandLength();
+    if (length == 0) {
+        // Not a command it knows: refuse it and start over
+        command.clear();
+        stats.naks++;
+        answer(0x15, at);
+    } else if ((size_t)length == command.size()) {
+        execute(at);
+        command.clear();
+    }
+}
+
+/** @return Length of the command being received, -1 while that isn't known yet,
+ *  0 for an unknown command.
+ */
+int GoldeloxSim::commandLength() {
+    if (command.size() < 2) {
+        return command[0] == 0xff || command[0] == 0x00 ? -1 : 0;
+    }
+    uint8_t op = command[1];
+    if (command[0] == 0x00) {
+        switch (op) {
+        case 0x0b:  // baud rate
+            return 4;
+        case 0x08:  // version
+            return 2;
+        case 0x06:  // text string, null terminated
+            return command.size() > 2 && command.back() == 0 ? (int)command.size() : -1;
+        case 0x0a:  // BLIT: x, y, w, h then the pixels
+            if (command.size() < 10) {
+                return -1;
+            }
+            return 10 + 2 * word(6) * word(8);
+        default:
+            return 0;
+        }
+    }
+    switch (op) {
+    case 0xd7: case 0xb1: case 0xb7: case 0xb6: case 0xb2:
+        return 2;
+    case 0xd8:
+        return 3;
+    case 0x6e: case 0x7e: case 0x68: case 0x66: case 0x76: case 0x7d: case 0x77: case 0x75:
+    case 0x74: case 0x73: case 0x7c: case 0x7b: case 0xfe: case 0x7f: case 0xb5: case 0xb4:
+        return 4;
+    case 0xe4: case 0xca: case 0xb9: case 0xb8: case 0xb3: case 0xbb:
+        return 6;
+    case 0xcb: case 0xba:
+        return 8;
+    case 0xcd: case 0xcc:
+        return 10;
+    case 0xd2: case 0xcf: case 0xce:
+        return 12;
+    case 0xc9:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+/** @return The big endian word at command[at]. */
+uint16_t GoldeloxSim::word(size_t at) {
+    return (uint16_t)(command[at] << 8 | command[at + 1]);
+}
+
+/** Queue one answer byte, readable once it has crossed the wire. Caller holds mutex. */
+void GoldeloxSim::answer(uint8_t value, Clock::time_point at) {
+    WireByte b;
+    b.value = value;
+    b.baud = baud;
+    b.arrival = at + byteTime(baud);
+    if (!answers.empty() && b.arrival < answers.back().arrival) {
+        b.arrival = answers.back().arrival;  // one wire, nothing overtakes a late answer
+    }
+    answers.push_back(b);
+}
+
+/** Draw a complete command, stay busy for as long as it takes, then answer. */
+void GoldeloxSim::execute(Clock::time_point at) {
+    uint8_t op = command[1];
+    pixels = 0;
+    stats.commands++;
+    int extra = 0;           // answer bytes after the ACK
+    uint16_t extraWord = 0;
+    Clock::duration delay(0);
+
+    if (refusals > 0) {
+        refusals--;
+        stats.naks++;
+        answer(0x15, at);
+        return;
+    }
+
+    if (command[0] == 0x00) {
+        switch (op) {
+        case 0x0b: {
+            // The divisor is of 3 MHz; the answer comes at the new rate
+            int divisor = word(2);
+            baud = 3000000 / (divisor + 1);
+            delay = BAUD_ANSWER;
+            break;
+        }
+        case 0x06:
+            for (size_t i = 2; i + 1 < command.size(); i++) {
+                drawChar((char)command[i]);
+            }
+            break;
+        case 0x0a: {
+            int x = word(2), y = word(4), w = word(6), h = word(8);
+            for (int i = 0; i < w * h; i++) {
+                plot(x + i % w, y + i / w, word(10 + 2 * i));
+            }
+            break;
+        }
+        case 0x08:
+            extra = 2;
+            extraWord = 0x0100;
+            break;
+        }
+    } else {
+        switch (op) {
+        case 0xd7:  // clear screen
+            fill(0, 0, WIDTH - 1, HEIGHT - 1, background);
+            cursorCol = cursorRow = 0;
+            break;
+        case 0x6e:
+            background = word(2);
+            break;
+        case 0x7e:
+            textBackground = word(2);
+            break;
+        case 0xce:
+            fill(word(2), word(4), word(6), word(8), word(10));
+            break;
+        case 0xcf: {
+            int x1 = word(2), y1 = word(4), x2 = word(6), y2 = word(8);
+            uint16_t color = word(10);
+            drawLine(x1, y1, x2, y1, color);
+            drawLine(x2, y1, x2, y2, color);
+            drawLine(x2, y2, x1, y2, color);
+            drawLine(x1, y2, x1, y1, color);
+            break;
+        }
+        case 0xd2:
+            drawLine(word(2), word(4), word(6), word(8), word(10));
+            break;
+        case 0xcb:
+            plot(word(2), word(4), word(6));
+            break;
+        case 0xcd:
+        case 0xcc:
+            drawCircle(word(2), word(4), word(6), word(8), op == 0xcc);
+            break;
+        case 0xc9: {
+            uint16_t color = word(14);
+            drawLine(word(2), word(4), word(6), word(8), color);
+            drawLine(word(6), word(8), word(10), word(12), color);
+            drawLine(word(10), word(12), word(2), word(4), color);
+            break;
+        }
+        case 0xca:
+            extra = 2;
+            extraWord = pixel(word(2), word(4));
+            break;
+        case 0x7d:
+            font = command[3] <= 4 ? command[3] : 0;
+            break;
+        case 0x77:
+            opaque = command[3] != 0;
+            break;
+        case 0x7c:
+            textWidth = std::max(1, (int)command[3]);
+            break;
+        case 0x7b:
+            textHeight = std::max(1, (int)command[3]);
+            break;
+        case 0xe4:
+            cursorRow = word(2);
+            cursorCol = word(4);
+            break;
+        case 0x7f:
+            textColor = word(2);
+            break;
+        case 0xfe:
+            drawChar((char)command[3]);
+            break;
+        case 0xb1: case 0xb6:
+            extra = 2;  // no card in the screen's slot
+            break;
+        case 0xb7:
+            extra = 1;
+            break;
+        default:
+            break;  // accepted, nothing to draw
+        }
+    }
+
+    Clock::duration cost = std::chrono::microseconds(COMMAND_US) +
+                           std::chrono::nanoseconds((int64_t)pixels * PIXEL_NS);
+    stats.busyUs += std::chrono::duration_cast<std::chrono::microseconds>(cost).count();
+    busyUntil = at + cost + delay;
+    Clock::time_point answered = busyUntil;
+    if (delays > 0) {
+        delays--;
+        answered += late;
+    }
+    answer(0x06, answered);
+    if (extra == 2) {
+        answer(extraWord >> 8, answered);
+        answer(extraWord & 0xff, answered);
+    } else if (extra == 1) {
+        answer(extraWord & 0xff, answered);
+    }
+}
+
+/** Fill a rectangle, corners in any order. */
+void GoldeloxSim::fill(int x1, int y1, int x2, int y2, uint16_t color) {
+    if (x1 > x2) {
+        std::swap(x1, x2);
+    }
+    if (y1 > y2) {
+        std::swap(y1, y2);
+    }
+    for (int y = y1; y <= y2; y++) {
+        for (int x = x1; x <= x2; x++) {
+            plot(x, y, color);
+        }
+    }
+}
+
+/** Write one pixel; off screen ones still cost time. */
+void GoldeloxSim::plot(int x, int y, uint16_t color) {
+    pixels++;
+    if (x >= 0 && x < WIDTH && y >= 0 && y < HEIGHT) {
+        frame[y][x] = color;
+    }
+}
+
+void GoldeloxSim::drawLine(int x1, int y1, int x2, int y2, uint16_t color) {
+    int dx = std::abs(x2 - x1), dy = -std::abs(y2 - y1);
+    int sx = x1 < x2 ? 1 : -1, sy = y1 < y2 ? 1 : -1;
+    int err = dx + dy;
+    while (true) {
+        plot(x1, y1, color);
+        if (x1 == x2 && y1 == y2) {
+            break;
+        }
+        int e2 = 2 * err;
+        if (e2 >= dy) {
+            err += dy;
+            x1 += sx;
+        }
+        if (e2 <= dx) {
+            err += dx;
+            y1 += sy;
+        }
+    }
+}
+
+void GoldeloxSim::drawCircle(int cx, int cy, int r, uint16_t color, bool filled) {
+    for (int y = -r; y <= r; y++) {
+        for (int x = -r; x <= r; x++) {
+            int d = x * x + y * y;
+            if (d <= r * r && (filled || d > (r - 1) * (r - 1))) {
+                plot(cx + x, cy + y, color);
+            }
+        }
+    }
+}
+
+/** Draw a character at the text cursor and move it on, wrapping at the right edge. */
+void GoldeloxSim::drawChar(char c) {
+    int w = CELL_W[font] * textWidth, h = CELL_H[font] * textHeight;
+    if ((cursorCol + 1) * w > WIDTH) {
+        cursorCol = 0;
+        cursorRow++;
+    }
+    int x0 = cursorCol * w, y0 = cursorRow * h;
+    const uint8_t* glyph = c >= ' ' && c <= '~' ? FONT[c - ' '] : FONT[0];
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            int gx = x / textWidth - 1, gy = y / textHeight;
+            bool on = gx >= 0 && gx < 5 && gy < 7 && (glyph[gx] >> gy & 1);
+            if (on) {
+                plot(x0 + x, y0 + y, textColor);
+            } else if (opaque) {
+                plot(x0 + x, y0 + y, textBackground);
+            }
+        }
+    }
+    cursorCol++;
+}
+
+/** @return What the screen has counted since resetStats(). */
+GoldeloxSim::Score GoldeloxSim::score() {
+    std::lock_guard<std::mutex> guard(mutex);
+    advance(Clock::now());
+    return stats;
+}
+
+void GoldeloxSim::resetStats() {
+    std::lock_guard<std::mutex> guard(mutex);
+    advance(Clock::now());
+    memset(&stats, 0, sizeof(stats));
+}
+
+/** Refuse the next count commands: NAK without drawing them. */
+void GoldeloxSim::refuseNext(int count) {
+    std::lock_guard<std::mutex> guard(mutex);
+    advance(Clock::now());
+    refusals = count;
+}
+
+/** Draw the next count commands as usual but answer each of them late after it is done. */
+void GoldeloxSim::delayNext(int count, std::chrono::milliseconds late) {
+    std::lock_guard<std::mutex> guard(mutex);
+    advance(Clock::now());
+    delays = count;
+    this->late = late;
+}
+
+/** @return The rate the screen itself is on. */
+int GoldeloxSim::screenBaud() {
+    std::lock_guard<std::mutex> guard(mutex);
+    advance(Clock::now());
+    return baud;
+}
+
+/** @return RGB565 colour of a pixel, with everything sent so far drawn. */
+uint16_t GoldeloxSim::pixel(int x, int y) {
+    if (x < 0 || x >= WIDTH || y < 0 || y >= HEIGHT) {
+        return 0;
+    }
+    return frame[y][x];
+}
+
+/** @return The character shown in a cell of the 7x8 font, ' ' for an empty one,
+ *  '?' when the cell holds something else.
+ */
+char GoldeloxSim::charAt(int col, int row) {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        advance(Clock::now());
+    }
+    int x0 = col * CELL_W[0], y0 = row * CELL_H[0];
+    uint16_t paper = pixel(x0, y0 + 7);  // the row under every glyph
+    for (int c = 0; c < 95; c++) {
+        bool match = true;
+        for (int x = 0; x < 5 && match; x++) {
+            for (int y = 0; y < 7 && match; y++) {
+                bool ink = pixel(x0 + 1 + x, y0 + y) != paper;
+                match = ink == (bool)(FONT[c][x] >> y & 1);
+            }
+        }
+        if (match) {
+            return (char)(' ' + c);
+        }
+    }
+    return '?';
+}
+
+/** @return A row of text cells, trailing blanks dropped. */
+std::string GoldeloxSim::textRow(int row) {
+    std::string text;
+    for (int col = 0; col < WIDTH / CELL_W[0]; col++) {
+        text += charAt(col, row);
+    }
+    return text.erase(text.find_last_not_of(' ') + 1);
+}
+
+/** Save the screen as a binary PPM. @return Zero when the file can't be written. */
+bool GoldeloxSim::savePpm(const char* path) {
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        advance(Clock::now());
+    }
+    fprintf(f, "P6\n%d %d\n255\n", WIDTH, HEIGHT);
+    for (int y = 0; y < HEIGHT; y++) {
+        for (int x = 0; x < WIDTH; x++) {
+            uint16_t c = frame[y][x];
+            uint8_t rgb[3] = { (uint8_t)((c >> 11) * 255 / 31), (uint8_t)((c >> 5 & 0x3f) * 255 / 63),
+                               (uint8_t)((c & 0x1f) * 255 / 31) };
+            fwrite(rgb, 1, 3, f);
+        }
+    }
+    return fclose(f) == 0;
+}
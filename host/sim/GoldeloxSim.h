@@ -0,0 +1,128 @@
+/**
+ *  GoldeloxSim.h
+ *  ===========================================================================
+ *  A uLCD-144-G2 (Goldelox, 4DGL serial commands) at the end of a DisplayLink.
+ *       - Bytes take 10 bit times each at the host's rate to arrive, and
+ *         only arrive intact when the screen is on the same rate.
+ *       - The screen reads its 16 byte receive FIFO only between commands;
+ *         what arrives while it is drawing and doesn't fit is lost.
+ *       - Each command is drawn into a 128x128 RGB565 frame, takes a time
+ *         that grows with the pixels it touches, and is answered with ACK
+ *         (NAK for a command it doesn't know) once it is done.
+ *       - The frame can be saved as a PPM image, and text cells read back
+ *         by matching them against the font.
+ *       - refuseNext() and delayNext() fault the answers to the next few
+ *         commands, for the driver's handling of NAKs and late ACKs.
+ *       - Once sigio() is set, a thread stands in for the receive
+ *         interrupt and calls it while an answer byte is waiting.
+ */
+
+#ifndef GOLDELOX_SIM_H_
+#define GOLDELOX_SIM_H_
+
+#include "mbed.h"
+#include "DisplayLink.h"
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** Class GoldeloxSim. 4DGL screen model behind a simulated UART. */
+class GoldeloxSim : public DisplayLink {
+public:
+    static const int WIDTH     = 128;
+    static const int HEIGHT    = 128;
+    static const size_t RECEIVE_FIFO = 16;   // screen side
+    static const size_t TX_BUFFER    = 256;  // BufferedSerial's, host side
+
+    // Drawing times, rough figures for the Goldelox at 128x128
+    static const int COMMAND_US = 40;   // decoding a command
+    static const int PIXEL_NS   = 250;  // per pixel written
+    static constexpr std::chrono::milliseconds BOOT_TIME = std::chrono::milliseconds(1500);
+    static constexpr std::chrono::milliseconds BAUD_ANSWER = std::chrono::milliseconds(100);
+
+    /** What the screen saw since resetStats(). */
+    struct Score {
+        uint32_t commands;
+        uint32_t naks;
+        uint32_t overrunBytes;  // arrived with the FIFO full, lost
+        uint32_t garbledBytes;  // arrived at the wrong rate or during boot, lost
+        uint64_t busyUs;        // drawing
+    };
+
+    GoldeloxSim(int maxBaud = 1500000);
+    ~GoldeloxSim();
+
+    virtual ssize_t write(const void* data, size_t length);
+    virtual ssize_t read(void* data, size_t length);
+    virtual bool readable();
+    virtual void sigio(Callback<void()> func);
+    virtual void set_baud(int baud);
+    virtual int sync();
+    virtual void reset_line(int level);
+
+    Score score();
+    void resetStats();
+    void refuseNext(int count);
+    void delayNext(int count, std::chrono::milliseconds late);
+    int screenBaud();
+    uint16_t pixel(int x, int y);
+    char charAt(int col, int row);
+    std::string textRow(int row);
+    bool savePpm(const char* path);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct WireByte {
+        uint8_t           value;
+        int               baud;
+        Clock::time_point arrival;
+    };
+
+    void advance(Clock::time_point now);
+    void receiveTask();
+    void consume(uint8_t value, Clock::time_point at);
+    int commandLength();
+    void execute(Clock::time_point at);
+    void answer(uint8_t value, Clock::time_point at);
+    void powerUp();
+    void fill(int x1, int y1, int x2, int y2, uint16_t color);
+    void plot(int x, int y, uint16_t color);
+    void drawLine(int x1, int y1, int x2, int y2, uint16_t color);
+    void drawCircle(int cx, int cy, int r, uint16_t color, bool filled);
+    void drawChar(char c);
+    Clock::duration byteTime(int baud);
+    static bool sameRate(int a, int b);
+    uint16_t word(size_t at);
+
+    std::mutex             mutex;
+    int                    maxBaud;     // faster than this the screen's UART makes errors
+    int                    hostBaud;
+    int                    baud;        // the screen's
+    bool                   inReset;
+    Clock::time_point      bootDone;
+    Clock::time_point      txFree;      // when our last queued byte is on the wire
+    Clock::time_point      busyUntil;   // when the screen finishes the command it is drawing
+    std::deque<WireByte>   wire;        // sent, not yet read by the screen
+    std::deque<uint8_t>    fifo;        // arrived while drawing, waiting
+    std::deque<WireByte>   answers;     // from the screen, arrival is when it can be read
+    std::vector<uint8_t>   command;     // bytes of the command being received
+    uint64_t               pixels;      // written by the command being executed
+    uint16_t               frame[HEIGHT][WIDTH];
+    uint16_t               background, textColor, textBackground;
+    int                    cursorCol, cursorRow;
+    int                    font;
+    int                    textWidth, textHeight;
+    bool                   opaque;
+    int                    refusals;    // commands still to answer with NAK, see refuseNext()
+    int                    delays;      // answers still to hold back by late, see delayNext()
+    Clock::duration        late;
+    Score                  stats;
+    Callback<void()>       notify;      // see sigio()
+    std::thread            receiver;    // calls notify, started by sigio()
+    bool                   stopping;
+};
+
+#endif
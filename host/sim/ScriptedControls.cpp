@@ -0,0 +1,55 @@
+/**
+ *  ScriptedControls.cpp
+ *  ===========================================================================
+ *  Controls driven by a test or benchmark instead of switches.
+ */
+
+#include "ScriptedControls.h"
+
+/** Constructor of class ScriptedControls. Knob at full volume, nothing attached. */
+ScriptedControls::ScriptedControls()
+:
+    knob(0.0f),
+    count(0)
+{
+}
+
+void ScriptedControls::attach(Callback<void(const Event&)> handler) {
+    lock.lock();
+    this->handler = handler;
+    lock.unlock();
+}
+
+/** @return The knob position last set. */
+float ScriptedControls::volume() {
+    return knob;
+}
+
+/** Deliver one event now. Dropped when nothing is attached, as with Buttons. */
+void ScriptedControls::post(Key key, Action action, bool held) {
+    Event event;
+    event.key = key;
+    event.action = action;
+    event.held = held;
+    lock.lock();
+    if (handler) {
+        handler(event);
+        count++;
+    }
+    lock.unlock();
+}
+
+/** A short press: PRESS then RELEASE. */
+void ScriptedControls::tap(Key key) {
+    post(key, PRESS);
+    post(key, RELEASE);
+}
+
+void ScriptedControls::setVolume(float position) {
+    knob = position;
+}
+
+/** @return Events delivered to a handler so far. */
+uint32_t ScriptedControls::posted() {
+    return count;
+}
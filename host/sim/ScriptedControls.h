@@ -0,0 +1,36 @@
+/**
+ *  ScriptedControls.h
+ *  ===========================================================================
+ *  Controls driven by a test or benchmark instead of switches.
+ *       - Events go to the attached handler on the caller's thread as they
+ *         are posted, the way Buttons delivers them from its interrupts.
+ *       - The knob is a plain value the script sets.
+ */
+
+#ifndef SCRIPTED_CONTROLS_H_
+#define SCRIPTED_CONTROLS_H_
+
+#include "mbed.h"
+#include "Controls.h"
+
+/** Class ScriptedControls. Key events and a knob position set by hand. */
+class ScriptedControls : public Controls {
+public:
+    ScriptedControls();
+
+    virtual void attach(Callback<void(const Event&)> handler);
+    virtual float volume();
+
+    void post(Key key, Action action, bool held = false);
+    void tap(Key key);
+    void setVolume(float position);
+    uint32_t posted();
+
+private:
+    Mutex                        lock;
+    Callback<void(const Event&)> handler;
+    float                        knob;
+    uint32_t                     count;  // events delivered
+};
+
+#endif
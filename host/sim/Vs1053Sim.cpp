@@ -0,0 +1,398 @@
+/**
+ *  Vs1053Sim.cpp
+ *  ===========================================================================
+ *  A VS1053 on the simulated pins, for the real VS1053 driver to talk to.
+ *
+ *  The FIFO level is brought up to date whenever someone looks at it; a
+ *  decoder thread only wakes at the moments something visible happens
+ *  (DREQ may rise, the FIFO runs dry, a reset ends) to drive the DREQ pin.
+ */
+
+#include "Vs1053Sim.h"
+#include <algorithm>
+
+static const uint8_t SCI_MODE        = 0x00;
+static const uint8_t SCI_STATUS      = 0x01;
+static const uint8_t SCI_CLOCKF      = 0x03;
+static const uint8_t SCI_DECODE_TIME = 0x04;
+static const uint8_t SCI_AUDATA      = 0x05;
+static const uint8_t SCI_WRAM        = 0x06;
+static const uint8_t SCI_WRAMADDR    = 0x07;
+static const uint8_t SCI_HDAT0       = 0x08;
+static const uint8_t SCI_HDAT1       = 0x09;
+static const uint16_t SM_RESET       = 1 << 2;
+static const uint16_t SM_CANCEL      = 1 << 3;
+static const uint16_t MODE_DEFAULT   = 0x4800;  // SM_SDINEW | SM_LINE1
+static const uint16_t STATUS_DEFAULT = 0x0040;  // SS_VER 4, a VS1053
+static const uint16_t PARA_ENDFILL   = 0x1e06;
+static const uint16_t PARA_BYTERATE  = 0x1e05;
+static const uint32_t END_OF_STREAM  = 2048;    // endFillBytes that finish a stream
+
+// CLKI as a multiple of XTALI for each SC_MULT setting, in halves (datasheet 9.6.4)
+static const uint8_t CLOCK_MULT_HALVES[8] = { 2, 4, 5, 6, 7, 8, 9, 10 };
+
+constexpr std::chrono::microseconds Vs1053Sim::RESET_TIME;
+
+/** Constructor of class Vs1053Sim. Comes out of reset with DREQ high. */
+Vs1053Sim::Vs1053Sim(PinName sclk, PinName cs, PinName dcs, PinName dreq, PinName rst)
+:
+    cs(cs),
+    dcs(dcs),
+    dreqPin(dreq),
+    rstPin(rst),
+    sclkPin(sclk),
+    quit(false),
+    csLow(false),
+    dcsLow(false),
+    inReset(false),
+    hung(false),
+    byteRate(40000)
+{
+    memset(&stats, 0, sizeof(stats));
+    lastUpdate = Clock::now();
+    reset();
+    readyAt = lastUpdate;
+    stats.resets = 0;
+    csLow = HostPins::level(cs) == 0;
+    dcsLow = HostPins::level(dcs) == 0;
+    HostPins::watch(cs, this);
+    HostPins::watch(dcs, this);
+    HostPins::watch(rst, this);
+    HostPins::attachSpi(sclk, this);
+    HostPins::drive(dreqPin, 1);
+    decoder = HostPins::startThread([this] { decoderTask(); });
+}
+
+/** Destructor of class Vs1053Sim. Leaves the bus and the pins. */
+Vs1053Sim::~Vs1053Sim() {
+    HostPins::attachSpi(sclkPin, nullptr);
+    HostPins::unwatch(this);
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        quit = true;
+        wake.notify_all();
+    }
+    decoder.join();
+}
+
+/** Set the rate the decoder takes data at, bytes per second of the stream. */
+void Vs1053Sim::setByteRate(uint32_t bytesPerSecond) {
+    std::lock_guard<std::mutex> guard(mutex);
+    advance(Clock::now());
+    byteRate = bytesPerSecond;
+    wake.notify_all();
+}
+
+/** Lock up as after a brown-out: DREQ low, SCI and SDI ignored, the FIFO
+ *  frozen. Only the reset pin brings the chip back.
+ */
+void Vs1053Sim::hang() {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        advance(Clock::now());
+        hung = true;
+    }
+    updateDreq();
+}
+
+/** Start counting afresh, e.g. once a stream is under way. */
+void Vs1053Sim::resetStats() {
+    std::lock_guard<std::mutex> guard(mutex);
+    Clock::time_point now = Clock::now();
+    advance(now);
+    memset(&stats, 0, sizeof(stats));
+    dryStart = now;
+}
+
+/** @return The score so far, with a dry spell still going counted up to now. */
+Vs1053Sim::Score Vs1053Sim::score() {
+    std::lock_guard<std::mutex> guard(mutex);
+    Clock::time_point now = Clock::now();
+    advance(now);
+    Score s = stats;
+    if (dry) {
+        uint32_t us = std::chrono::duration_cast<std::chrono::microseconds>(now - dryStart).count();
+        s.dryUs += us;
+        s.worstDryUs = std::max(s.worstDryUs, us);
+    }
+    return s;
+}
+
+/** @return Bytes waiting in the FIFO. */
+uint32_t Vs1053Sim::fifoLevel() {
+    std::lock_guard<std::mutex> guard(mutex);
+    advance(Clock::now());
+    return (uint32_t)(level + 0.5);
+}
+
+/** @return An SCI register as the driver would read it. */
+uint16_t Vs1053Sim::reg(uint8_t addr) {
+    std::lock_guard<std::mutex> guard(mutex);
+    advance(Clock::now());
+    return readReg(addr);
+}
+
+/** Drain the FIFO up to now, noting when it runs dry. Caller holds mutex. */
+void Vs1053Sim::advance(Clock::time_point now) {
+    if (now <= lastUpdate) {
+        return;
+    }
+    double seconds = std::chrono::duration<double>(now - lastUpdate).count();
+    if (!inReset && !hung && level > 0) {
+        double drained = std::min(level, seconds * byteRate);
+        if (drained >= level && playing && !dry) {
+            // Dry from the moment the last byte went, not from when we noticed
+            dry = true;
+            dryStart = lastUpdate + std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(level / byteRate));
+            stats.underruns++;
+        }
+        level -= drained;
+        decodedBytes += drained;
+    }
+    lastUpdate = now;
+}
+
+/** Registers and FIFO back to power up, DREQ low for RESET_TIME. Caller holds mutex. */
+void Vs1053Sim::reset() {
+    memset(regs, 0, sizeof(regs));
+    regs[SCI_MODE] = MODE_DEFAULT;
+    regs[SCI_STATUS] = STATUS_DEFAULT;
+    wramAddr = 0;
+    level = 0;
+    playing = false;
+    dry = false;
+    cancelCountdown = 0;
+    zeroRun = 0;
+    decodedBytes = 0;
+    decodeBase = 0;
+    sciStep = 0;
+    hung = false;
+    readyAt = Clock::now() + RESET_TIME;
+    stats.resets++;
+}
+
+/** @return CLKI in Hz for the current CLOCKF. */
+uint32_t Vs1053Sim::clki() {
+    return (uint64_t)XTALI * CLOCK_MULT_HALVES[regs[SCI_CLOCKF] >> 13] / 2;
+}
+
+/** Register read side effects and computed registers. Caller holds mutex. */
+uint16_t Vs1053Sim::readReg(uint8_t addr) {
+    switch (addr) {
+    case SCI_DECODE_TIME:
+        return decodeBase + (uint16_t)(decodedBytes / byteRate);
+    case SCI_AUDATA:
+        return playing ? 44101 : 8000;
+    case SCI_HDAT0:
+        return playing ? 0x9064 : 0;
+    case SCI_HDAT1:
+        return playing ? 0xfffb : 0;  // MP3 frame sync
+    case SCI_WRAM: {
+        uint16_t value = 0;
+        if (wramAddr == PARA_BYTERATE) {
+            value = playing ? byteRate : 0;
+        } else if (wramAddr == PARA_ENDFILL) {
+            value = 0;  // MP3 ends with zeros
+        }
+        wramAddr++;
+        return value;
+    }
+    default:
+        return regs[addr & 0x0f];
+    }
+}
+
+/** Register write side effects. Caller holds mutex. */
+void Vs1053Sim::writeReg(uint8_t addr, uint16_t value) {
+    switch (addr) {
+    case SCI_MODE:
+        if (value & SM_RESET) {
+            reset();
+            return;
+        }
+        if ((value & SM_CANCEL) && !(regs[SCI_MODE] & SM_CANCEL)) {
+            cancelCountdown = CANCEL_BYTES;
+        }
+        regs[SCI_MODE] = value;
+        break;
+    case SCI_DECODE_TIME:
+        decodeBase = value;
+        decodedBytes = 0;
+        break;
+    case SCI_WRAMADDR:
+        wramAddr = value;
+        break;
+    case SCI_WRAM:
+        wramAddr++;
+        break;
+    default:
+        regs[addr & 0x0f] = value;
+        break;
+    }
+}
+
+/** One byte into the FIFO. Caller holds mutex. */
+void Vs1053Sim::sdiByte(uint8_t value) {
+    stats.bytes++;
+    if (level + 1 > FIFO_SIZE) {
+        stats.overflowBytes++;
+        return;
+    }
+    level += 1;
+    if (dry) {
+        uint32_t us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - dryStart).count();
+        stats.dryUs += us;
+        stats.worstDryUs = std::max(stats.worstDryUs, us);
+        dry = false;
+    }
+    if (value != 0) {
+        playing = true;
+        zeroRun = 0;
+    } else if (++zeroRun >= END_OF_STREAM) {
+        playing = false;  // the stream has been filled out to its end
+    }
+    if (cancelCountdown > 0 && --cancelCountdown == 0) {
+        // The decoder dropped the rest of the stream and is ready for the next
+        regs[SCI_MODE] &= ~SM_CANCEL;
+        playing = false;
+        level = 0;
+    }
+}
+
+/** @return DREQ as the chip drives it. Caller holds mutex. */
+bool Vs1053Sim::dreqLevel(Clock::time_point now) {
+    return !inReset && !hung && now >= readyAt && level <= FIFO_SIZE - DREQ_ROOM;
+}
+
+/** Bring the DREQ pin in line with the model. Called without mutex held. */
+void Vs1053Sim::updateDreq() {
+    // Serialised, so two threads can't drive the pin in the wrong order
+    static std::mutex driveLock;
+    std::lock_guard<std::mutex> order(driveLock);
+    bool high;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        Clock::time_point now = Clock::now();
+        advance(now);
+        high = dreqLevel(now);
+    }
+    HostPins::drive(dreqPin, high);
+
+    // Only now, so the decoder thread can't look at the pin before a stale level lands
+    std::lock_guard<std::mutex> guard(mutex);
+    wake.notify_all();
+}
+
+/** xCS, xDCS and the reset pin. */
+void Vs1053Sim::pinChanged(PinName pin, int value) {
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        advance(Clock::now());
+        if (pin == cs) {
+            csLow = value == 0;
+            sciStep = 0;
+        } else if (pin == dcs) {
+            dcsLow = value == 0;
+        } else if (pin == rstPin) {
+            inReset = value == 0;
+            if (!inReset) {
+                reset();
+            }
+        }
+    }
+    if (pin == rstPin) {
+        updateDreq();
+    }
+}
+
+/** One SPI byte: part of an SCI instruction on xCS or audio data on xDCS. */
+uint8_t Vs1053Sim::transfer(uint8_t mosi, int hz) {
+    uint8_t miso = 0xff;
+    bool changed = false;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        advance(Clock::now());
+        if (inReset || hung) {
+            return miso;
+        }
+        if (csLow) {
+            // SCI reads are good to CLKI/7, writes to CLKI/4
+            bool reading = sciStep >= 2 && sciOp == 0x03;
+            bool tooFast = (uint32_t)hz > clki() / (reading ? 7 : 4);
+            if (tooFast) {
+                stats.clockFaults++;
+            }
+            switch (sciStep) {
+            case 0:
+                sciOp = mosi;
+                break;
+            case 1:
+                sciAddr = mosi & 0x0f;
+                if (sciOp == 0x03) {
+                    sciWord = readReg(sciAddr);
+                }
+                break;
+            case 2:
+                if (sciOp == 0x03) {
+                    miso = tooFast ? 0xff : sciWord >> 8;
+                } else {
+                    sciWord = mosi << 8;
+                }
+                break;
+            case 3:
+                if (sciOp == 0x03) {
+                    miso = tooFast ? 0xff : sciWord & 0xff;
+                } else if (sciOp == 0x02 && !tooFast) {
+                    writeReg(sciAddr, sciWord | mosi);
+                }
+                break;
+            default:
+                break;
+            }
+            if (sciStep < 4) {
+                sciStep++;
+                changed = sciStep == 4;  // may have been SM_RESET
+            }
+        } else if (dcsLow) {
+            if ((uint32_t)hz > clki() / 4) {
+                stats.clockFaults++;
+            }
+            sdiByte(mosi);
+            changed = true;
+        }
+    }
+    // A full FIFO or a reset drops DREQ as the byte goes in
+    if (changed) {
+        updateDreq();
+    }
+    return miso;
+}
+
+/** Drive DREQ at the moments the model changes it without any bus traffic. */
+void Vs1053Sim::decoderTask() {
+    std::unique_lock<std::mutex> guard(mutex);
+    while (!quit) {
+        Clock::time_point now = Clock::now();
+        advance(now);
+        if (dreqLevel(now) != (HostPins::level(dreqPin) != 0)) {
+            // Checked before sleeping too, a wakeup sent while we drove the pin is gone
+            guard.unlock();
+            updateDreq();
+            guard.lock();
+            continue;
+        }
+        Clock::time_point next = now + std::chrono::seconds(1);
+        if (!inReset && readyAt > now) {
+            next = std::min(next, readyAt);
+        }
+        if (!inReset && !hung && level > 0 && byteRate > 0) {
+            // DREQ rises once enough has drained; the FIFO runs dry after that
+            double room = level - (FIFO_SIZE - DREQ_ROOM);
+            double untilEvent = room > 0 ? room / byteRate : level / byteRate;
+            next = std::min(next, now + std::chrono::duration_cast<Clock::duration>(
+                                            std::chrono::duration<double>(untilEvent)));
+        }
+        wake.wait_until(guard, next);
+    }
+}
@@ -0,0 +1,97 @@
+/**
+ *  Vs1053Sim.h
+ *  ===========================================================================
+ *  A VS1053 on the simulated pins, for the real VS1053 driver to talk to.
+ *       - SCI: the read (03h) and write (02h) instructions on xCS, with the
+ *         registers the driver uses, SM_RESET, SM_CANCEL, the decode time
+ *         and the endFillByte and byteRate parameters in XRAM.
+ *       - SDI: bytes on xDCS go into a 2048 byte FIFO that drains at the
+ *         stream's byte rate, and DREQ is high whenever 32 more bytes fit.
+ *       - hang() locks the chip up until its reset pin is pulsed, for the
+ *         driver's DREQ timeouts and recovery.
+ *       - Keeps score of what the player cares about: bytes that overflowed
+ *         the FIFO, times it ran dry mid-stream and the longest dry spell,
+ *         and SPI clocks above what the chip's CLKI allows.
+ */
+
+#ifndef VS1053_SIM_H_
+#define VS1053_SIM_H_
+
+#include "mbed.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/** Class Vs1053Sim. Decoder model, fed by the driver over SPI. */
+class Vs1053Sim : public PinListener, public SpiDevice {
+public:
+    static const uint32_t FIFO_SIZE  = 2048;
+    static const uint32_t DREQ_ROOM  = 32;     // DREQ high when this much fits
+    static const uint32_t XTALI      = 12288000;
+    static constexpr std::chrono::microseconds RESET_TIME = std::chrono::microseconds(1800);  // SM_RESET to DREQ
+    static const uint32_t CANCEL_BYTES = 64;    // SDI bytes before SM_CANCEL clears
+
+    /** What the decoder saw since resetStats(). */
+    struct Score {
+        uint64_t bytes;          // SDI bytes received
+        uint64_t overflowBytes;  // sent while the FIFO was full, lost
+        uint32_t underruns;      // FIFO ran dry while a stream was playing
+        uint32_t worstDryUs;     // longest time it stayed dry
+        uint64_t dryUs;          // total time dry
+        uint32_t clockFaults;    // SPI transfers faster than CLKI allows
+        uint32_t resets;         // SM_RESET writes and reset pin pulses
+    };
+
+    Vs1053Sim(PinName sclk, PinName cs, PinName dcs, PinName dreq, PinName rst);
+    ~Vs1053Sim();
+
+    void setByteRate(uint32_t bytesPerSecond);
+    void hang();
+    void resetStats();
+    Score score();
+    uint32_t fifoLevel();
+    uint16_t reg(uint8_t addr);
+
+    virtual void pinChanged(PinName pin, int level);
+    virtual uint8_t transfer(uint8_t mosi, int hz);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    void advance(Clock::time_point now);
+    void reset();
+    uint16_t readReg(uint8_t addr);
+    void writeReg(uint8_t addr, uint16_t value);
+    void sdiByte(uint8_t value);
+    uint32_t clki();
+    bool dreqLevel(Clock::time_point now);
+    void updateDreq();
+    void decoderTask();
+
+    PinName                 cs, dcs, dreqPin, rstPin, sclkPin;
+    std::mutex              mutex;
+    std::condition_variable wake;
+    std::thread             decoder;
+    bool                    quit;
+    bool                    csLow, dcsLow, inReset;
+    bool                    hung;       // ignores the bus until the reset pin, see hang()
+    Clock::time_point       readyAt;    // DREQ stays low until then after a reset
+    Clock::time_point       lastUpdate;
+    double                  level;      // bytes in the FIFO, fractional while draining
+    uint32_t                byteRate;
+    bool                    playing;    // non-zero data since the last reset or cancel
+    bool                    dry;
+    Clock::time_point       dryStart;
+    uint32_t                cancelCountdown;  // SDI bytes left until SM_CANCEL clears
+    uint32_t                zeroRun;          // consecutive endFillBytes
+    double                  decodedBytes;     // since DECODE_TIME was last written
+    uint16_t                decodeBase;
+    uint8_t                 sciStep;    // byte of the SCI instruction being clocked
+    uint8_t                 sciOp, sciAddr;
+    uint16_t                sciWord;
+    uint16_t                regs[16];
+    uint16_t                wramAddr;
+    Score                   stats;
+};
+
+#endif
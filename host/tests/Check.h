@@ -0,0 +1,99 @@
+/**
+ *  Check.h
+ *  ===========================================================================
+ *  Just enough of a test harness for the host tests.
+ *       - CHECK() reports a failed condition with its line and carries on,
+ *         so one run shows every failure; CHECK_EQ() also prints both values.
+ *       - TEST_RESULT() is main()'s return value: non-zero when anything failed.
+ *       - tempDir() makes a fresh directory for files a test writes, and
+ *         writeSong() and writeFrames() fill songs in it.
+ */
+
+#ifndef CHECK_H_
+#define CHECK_H_
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+static int checkFailures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            checkFailures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(actual, expected) \
+    do { \
+        long long a_ = (long long)(actual), e_ = (long long)(expected); \
+        if (a_ != e_) { \
+            printf("%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, a_, e_); \
+            checkFailures++; \
+        } \
+    } while (0)
+
+#define TEST_RESULT() (printf(checkFailures ? "%d check(s) failed\n" : "all checks passed\n", checkFailures), \
+                       checkFailures ? 1 : 0)
+
+/** @return A new empty directory under /tmp, without the trailing slash. */
+static inline std::string tempDir() {
+    char name[] = "/tmp/player-test-XXXXXX";
+    if (!mkdtemp(name)) {
+        perror("mkdtemp");
+        exit(2);
+    }
+    return name;
+}
+
+/** Write length bytes of a made up song: nonzero, so the decoder counts it as playing.
+ *  @return Zero when the file can't be written.
+ */
+static inline bool writeSong(const std::string& path, size_t length, unsigned seed = 1) {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++) {
+        seed = seed * 1103515245 + 12345;
+        fputc((seed >> 16) % 255 + 1, f);
+    }
+    return fclose(f) == 0;
+}
+
+// A 128 kbit/s, 44.1 kHz stereo MPEG1 layer III frame: 417 bytes, 1152 samples
+static const unsigned char CBR_HEADER[4] = { 0xff, 0xfb, 0x90, 0x00 };
+static const size_t CBR_FRAME = 417;
+
+/** @return frames CBR_HEADER frames, 26.1 ms each. The bodies never hold a sync byte. */
+static inline std::string cbrFrames(size_t frames) {
+    std::string data;
+    for (size_t i = 0; i < frames; i++) {
+        data.append((const char*)CBR_HEADER, sizeof(CBR_HEADER));
+        for (size_t j = sizeof(CBR_HEADER); j < CBR_FRAME; j++) {
+            data += (char)((i + j) % 254 + 1);
+        }
+    }
+    return data;
+}
+
+/** Write data to a new file. @return Zero when the file can't be written. */
+static inline bool writeFile(const std::string& path, const std::string& data) {
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    bool written = fwrite(data.data(), 1, data.size(), f) == data.size();
+    return fclose(f) == 0 && written;
+}
+
+/** Write a constant bitrate song of frames CBR_HEADER frames, with no tag or Xing header.
+ *  @return Zero when the file can't be written.
+ */
+static inline bool writeFrames(const std::string& path, size_t frames) {
+    return writeFile(path, cbrFrames(frames));
+}
+
+#endif
@@ -0,0 +1,87 @@
+/**
+ *  audio_pipeline.cpp
+ *  ===========================================================================
+ *  The reader/feeder ring between a file and the decoder at a 320 kbit/s
+ *  song's pace: every byte arrives in order from the card or through stdio,
+ *  a card slower per read than the ring lasts is reported as underruns,
+ *  and one that keeps up isn't, however slow each access, since feeding
+ *  only starts once the ring has primed.
+ */
+
+#include "Check.h"
+#include "AudioStream.h"
+#include "VS1053.h"
+#include "Vs1053Sim.h"
+#include "DirectoryVolume.h"
+
+static const uint32_t SONG_BYTES = 40000;  // a second at 320 kbit/s
+// A feeder the host schedules late can leave the FIFO empty for a moment with the
+// ring still full; a ring that ran dry leaves it empty for a block's 51 ms or more
+static const uint32_t MAX_BLIP_US = 10000;
+
+// Play path to its end at the decoder's pace. @return Zero if it didn't finish in time.
+static bool play(AudioStream& stream, const std::string& path, std::chrono::seconds limit) {
+    if (!stream.open(path.c_str())) {
+        return false;
+    }
+    Timer played;
+    played.start();
+    while (!stream.finished() && played.elapsed_time() < limit) {
+        ThisThread::sleep_for(10ms);
+    }
+    return stream.finished();
+}
+
+int main() {
+    std::string dir = tempDir();
+    std::string song = dir + "/song.mp3";
+    CHECK(writeSong(song, 2 * SONG_BYTES));
+
+    Vs1053Sim decoder(p13, p14, p15, p16, p17);
+    VS1053 audio(p11, p12, p13, p14, p15, p16, p17);
+    audio.hardwareReset();
+    audio.modeSwitch();
+    CHECK(audio.clockUp());
+    decoder.setByteRate(SONG_BYTES);
+
+    // A slow card, 20 ms a command, still fills 2 KB blocks faster than they play
+    DirectoryVolume volume(25000000, 20000);
+    AudioStream* stream = new AudioStream();  // its threads never stop, so none of these are deleted
+    stream->start(audio, &volume);
+    decoder.resetStats();
+    CHECK(play(*stream, song, 10s));
+    Vs1053Sim::Score heard = decoder.score();
+    CHECK_EQ(heard.bytes, 2 * SONG_BYTES);
+    CHECK(heard.worstDryUs < MAX_BLIP_US);
+    CHECK_EQ(heard.overflowBytes, 0);
+    CHECK_EQ(stream->underruns(), 0);
+    CHECK(stream->minBufferedBlocks() >= 1);
+    CHECK(volume.score().reads >= 2 * SONG_BYTES / AudioStream::BLOCK_SIZE);
+
+    // Too slow: 150 ms for each 51 ms block. Both sides see the ring run dry
+    std::string shortSong = dir + "/short.mp3";
+    CHECK(writeSong(shortSong, SONG_BYTES / 2, 2));
+    volume.setAccessTime(150000);
+    decoder.resetStats();
+    CHECK(play(*stream, shortSong, 10s));
+    heard = decoder.score();
+    CHECK_EQ(heard.bytes, SONG_BYTES / 2);
+    CHECK(stream->underruns() > 0);
+    CHECK(heard.underruns > 0);
+    CHECK_EQ(stream->minBufferedBlocks(), 0);
+    printf("slow card: %lu underruns, decoder dry %lu us\n", (unsigned long)stream->underruns(),
+           (unsigned long)heard.dryUs);
+
+    // Through stdio, as for a song in too many pieces to map: same bytes, no gaps
+    AudioStream* stdioStream = new AudioStream();
+    stream->close();
+    stdioStream->start(audio);
+    decoder.resetStats();
+    CHECK(play(*stdioStream, song, 10s));
+    heard = decoder.score();
+    CHECK_EQ(heard.bytes, 2 * SONG_BYTES);
+    CHECK(heard.worstDryUs < MAX_BLIP_US);
+    CHECK_EQ(stdioStream->underruns(), 0);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,74 @@
+/**
+ *  block_cache.cpp
+ *  ===========================================================================
+ *  The sector cache over the simulated card: a single sector walk fetches
+ *  ahead, reads through uncached() never do, and a long read past the
+ *  cache doesn't hold up a cached one on another thread.
+ */
+
+#include "Check.h"
+#include "BlockCache.h"
+#include "DirectoryVolume.h"
+
+static BlockCache*  cache;
+static uint32_t     first;
+static int          longRead;
+
+static void readLong() {
+    static char buffer[8 * BlockCache::SECTOR];
+    longRead = cache->read(buffer, (bd_addr_t)(first + 64) * BlockCache::SECTOR, sizeof(buffer));
+}
+
+int main() {
+    std::string dir = tempDir();
+    std::string song = dir + "/song.mp3";
+    CHECK(writeSong(song, 64 * 1024));
+    DirectoryVolume volume;
+    SongVolume::Extent extents[4];
+    uint32_t size, sectorSize;
+    CHECK(volume.mapFile(song.c_str(), extents, 4, size, sectorSize) == 1);
+    first = extents[0].sector;
+    cache = new BlockCache(volume.device());
+    CHECK_EQ(cache->init(), 0);
+    char sector[BlockCache::SECTOR];
+
+    // FatFs style: one sector after another is taken as a walk and fetched ahead
+    CHECK_EQ(cache->read(sector, (bd_addr_t)first * BlockCache::SECTOR, BlockCache::SECTOR), 0);
+    CHECK_EQ(cache->read(sector, (bd_addr_t)(first + 1) * BlockCache::SECTOR, BlockCache::SECTOR), 0);
+    CHECK_EQ(cache->misses(), 2);
+    CHECK_EQ(cache->prefetched(), BlockCache::READ_AHEAD - 1);
+    CHECK_EQ(cache->read(sector, (bd_addr_t)(first + 2) * BlockCache::SECTOR, BlockCache::SECTOR), 0);
+    CHECK_EQ(cache->hits(), 1);
+
+    // Song style: the same walk past the cache reads only what is asked for
+    cache->resetCounters();
+    volume.resetStats();
+    BlockDevice* songs = cache->uncached();
+    for (uint32_t i = 16; i < 20; i++) {
+        CHECK_EQ(songs->read(sector, (bd_addr_t)(first + i) * BlockCache::SECTOR, BlockCache::SECTOR), 0);
+    }
+    CHECK_EQ(cache->bypassed(), 4);
+    CHECK_EQ(cache->misses(), 0);
+    CHECK_EQ(cache->prefetched(), 0);
+    CHECK_EQ(volume.score().sectorsRead, 4);
+    CHECK_EQ(songs->read(sector, (bd_addr_t)first * BlockCache::SECTOR, 3), -1);  // still whole sectors only
+
+    // A slow read past the cache on one thread, a cached sector on another meanwhile
+    volume.setAccessTime(300000);
+    Thread reader;
+    Timer slow;
+    slow.start();
+    reader.start(readLong);
+    ThisThread::sleep_for(20ms);
+    Timer quick;
+    quick.start();
+    CHECK_EQ(cache->read(sector, (bd_addr_t)(first + 3) * BlockCache::SECTOR, BlockCache::SECTOR), 0);
+    quick.stop();
+    reader.join();
+    CHECK_EQ(longRead, 0);
+    CHECK(quick.elapsed_time() < 50ms);
+    CHECK(slow.elapsed_time() >= 300ms);
+    CHECK_EQ(cache->hits(), 1);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,127 @@
+/**
+ *  buttons.cpp
+ *  ===========================================================================
+ *  The switch debouncer on the shimmed pins: contact bounce on press and
+ *  release gives one PRESS and one RELEASE, DEBOUNCE after the last edge;
+ *  a switch held down sends HOLD after HOLD_TIME and REPEAT every
+ *  REPEAT_TIME; a glitch shorter than DEBOUNCE sends nothing.
+ */
+
+#include "Check.h"
+#include "Buttons.h"
+#include "HostPins.h"
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Heard {
+    Controls::Event   event;
+    Clock::time_point at;
+};
+
+static std::mutex         mutex;
+static std::vector<Heard> heard;
+
+static void onKey(const Controls::Event& event) {
+    std::lock_guard<std::mutex> guard(mutex);
+    Heard h = { event, Clock::now() };
+    heard.push_back(h);
+}
+
+static std::vector<Heard> take() {
+    std::lock_guard<std::mutex> guard(mutex);
+    std::vector<Heard> events;
+    events.swap(heard);
+    return events;
+}
+
+static long ms(Clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+}
+
+// Toggle pin every 2 ms for about length, ending on level. @return When the last edge was.
+static Clock::time_point bounce(PinName pin, int level, std::chrono::milliseconds length) {
+    int toggles = (int)(length / 2ms) | 1;  // odd, so the train ends where it started from
+    for (int i = 0; i + 1 < toggles; i++) {
+        HostPins::drive(pin, i % 2 ? !level : level);
+        ThisThread::sleep_for(2ms);
+    }
+    HostPins::drive(pin, level);
+    return Clock::now();
+}
+
+// True when d is at least expected, and late by no more than the host's timer slack
+static bool onTime(Clock::duration d, std::chrono::milliseconds expected) {
+    return d >= expected - 1ms && d < expected + 30ms;
+}
+
+int main() {
+    Buttons buttons(p24, p25, p26, p29, p30, p21, p19);
+    buttons.attach(onKey);
+    const PinName right = p29;
+
+    // A glitch: nothing
+    HostPins::drive(right, 0);
+    ThisThread::sleep_for(5ms);
+    HostPins::drive(right, 1);
+    ThisThread::sleep_for(100ms);
+    CHECK(take().empty());
+
+    // A tap with bounce both ways: PRESS and RELEASE, each DEBOUNCE after its last edge
+    Clock::time_point pressed = bounce(right, 0, 10ms);
+    ThisThread::sleep_for(100ms);
+    Clock::time_point released = bounce(right, 1, 10ms);
+    ThisThread::sleep_for(100ms);
+    std::vector<Heard> events = take();
+    CHECK_EQ(events.size(), 2);
+    if (events.size() == 2) {
+        CHECK_EQ(events[0].event.key, Controls::NAV_RIGHT);
+        CHECK_EQ(events[0].event.action, Controls::PRESS);
+        CHECK(onTime(events[0].at - pressed, Buttons::DEBOUNCE));
+        CHECK_EQ(events[1].event.action, Controls::RELEASE);
+        CHECK(!events[1].event.held);
+        CHECK(onTime(events[1].at - released, Buttons::DEBOUNCE));
+    }
+
+    // Bounce that goes on for longer than DEBOUNCE, but never quiet for that long: still one press
+    pressed = bounce(right, 0, 60ms);
+    ThisThread::sleep_for(100ms);
+    events = take();
+    CHECK_EQ(events.size(), 1);
+    if (events.size() == 1) {
+        CHECK_EQ(events[0].event.action, Controls::PRESS);
+        CHECK(onTime(events[0].at - pressed, Buttons::DEBOUNCE));
+    }
+    bounce(right, 1, 10ms);
+    ThisThread::sleep_for(100ms);
+    events = take();
+    CHECK_EQ(events.size(), 1);
+
+    // Held: HOLD after HOLD_TIME, REPEAT every REPEAT_TIME, RELEASE marked held
+    pressed = bounce(right, 0, 10ms);
+    ThisThread::sleep_for(Buttons::DEBOUNCE + Buttons::HOLD_TIME + 3 * Buttons::REPEAT_TIME + 50ms);
+    released = bounce(right, 1, 10ms);
+    ThisThread::sleep_for(100ms);
+    events = take();
+    const Controls::Action expected[] = {
+        Controls::PRESS, Controls::HOLD, Controls::REPEAT, Controls::REPEAT, Controls::REPEAT, Controls::RELEASE
+    };
+    CHECK_EQ(events.size(), 6);
+    for (size_t i = 0; i < events.size() && i < 6; i++) {
+        CHECK_EQ(events[i].event.key, Controls::NAV_RIGHT);
+        CHECK_EQ(events[i].event.action, expected[i]);
+    }
+    if (events.size() == 6) {
+        CHECK(onTime(events[0].at - pressed, Buttons::DEBOUNCE));
+        CHECK(onTime(events[1].at - events[0].at, Buttons::HOLD_TIME));
+        for (int i = 2; i < 5; i++) {
+            CHECK(onTime(events[i].at - events[i - 1].at, Buttons::REPEAT_TIME));
+        }
+        CHECK(events[5].event.held);
+        CHECK(onTime(events[5].at - released, Buttons::DEBOUNCE));
+        printf("press %ld ms after the last edge, hold %ld ms after it, first repeat %ld ms after that\n",
+               ms(events[0].at - pressed), ms(events[1].at - events[0].at), ms(events[2].at - events[1].at));
+    }
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,65 @@
+/**
+ *  decoder_recovery.cpp
+ *  ===========================================================================
+ *  A VS1053 that locks up mid-song: the driver gives up on DREQ instead of
+ *  clocking data into it, AudioStream resets it through recover(), and the
+ *  song plays on to its end.
+ */
+
+#include "Check.h"
+#include "AudioStream.h"
+#include "VS1053.h"
+#include "Vs1053Sim.h"
+#include "DirectoryVolume.h"
+
+int main() {
+    std::string dir = tempDir();
+    std::string song = dir + "/song.mp3";
+    CHECK(writeSong(song, 200000));
+
+    Vs1053Sim decoder(p13, p14, p15, p16, p17);
+    VS1053 audio(p11, p12, p13, p14, p15, p16, p17);
+    audio.hardwareReset();
+    audio.modeSwitch();
+    CHECK(audio.clockUp());
+    decoder.setByteRate(200000);  // a second of song, so the test stays short
+    decoder.resetStats();
+
+    // A hung chip: nothing is sent and the caller hears about it
+    decoder.hang();
+    Timer waited;
+    waited.start();
+    CHECK(!audio.sendDataByte(0));
+    CHECK(waited.elapsed_time() < 300ms);
+    CHECK_EQ(audio.dreqTimeouts(), 1);
+    CHECK(audio.recover());
+    // The SM_RESET went nowhere, the reset pin and modeSwitch()'s SM_RESET after it did
+    CHECK_EQ(decoder.score().resets, 2);
+    CHECK(audio.sendDataByte(0));
+
+    // Hung again partway through a song
+    DirectoryVolume volume;
+    AudioStream* stream = new AudioStream();  // its threads never stop, so it is never deleted
+    stream->start(audio, &volume);
+    decoder.resetStats();
+    CHECK(stream->open(song.c_str()));
+    while (stream->position() < 50000) {
+        ThisThread::sleep_for(1ms);
+    }
+    decoder.hang();
+    Timer played;
+    played.start();
+    while (!stream->finished() && played.elapsed_time() < 10s) {
+        ThisThread::sleep_for(10ms);
+    }
+    CHECK(stream->finished());
+    CHECK_EQ(stream->decoderResets(), 1);
+    Vs1053Sim::Score heard = decoder.score();
+    CHECK_EQ(heard.resets, 2);
+    CHECK_EQ(heard.overflowBytes, 0);
+    CHECK_EQ(heard.clockFaults, 0);
+    // Whatever was in the FIFO when it hung is lost, the rest arrives
+    CHECK(heard.bytes >= 200000 - Vs1053Sim::FIFO_SIZE);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,82 @@
+/**
+ *  dreq_feed.cpp
+ *  ===========================================================================
+ *  The driver's DREQ waits against the decoder model: a block bigger than
+ *  the FIFO goes in as it drains, with the sending thread asleep between
+ *  windows rather than spinning, and nothing sent while the FIFO is full;
+ *  waitForData() wakes on the rising edge, gives up at its timeout on a
+ *  hung chip, and recover() brings the chip back.
+ */
+
+#include "Check.h"
+#include "VS1053.h"
+#include "Vs1053Sim.h"
+#include <time.h>
+
+static const uint32_t BYTE_RATE = 16000;  // 128 kbit/s
+
+static std::chrono::microseconds threadCpu() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return std::chrono::microseconds((int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+int main() {
+    Vs1053Sim decoder(p13, p14, p15, p16, p17);
+    VS1053 audio(p11, p12, p13, p14, p15, p16, p17);
+    audio.hardwareReset();
+    audio.modeSwitch();
+    CHECK(audio.clockUp());
+    decoder.setByteRate(BYTE_RATE);
+    decoder.resetStats();
+
+    // Twice the FIFO: the second half waits on the drain, 128 ms of it, asleep
+    static char data[2 * Vs1053Sim::FIFO_SIZE];
+    memset(data, 0x55, sizeof(data));
+    Timer wall;
+    wall.start();
+    std::chrono::microseconds cpu = threadCpu();
+    CHECK_EQ(audio.sendDataBlock(data, sizeof(data)), sizeof(data));
+    cpu = threadCpu() - cpu;
+    wall.stop();
+    Vs1053Sim::Score heard = decoder.score();
+    CHECK_EQ(heard.bytes, sizeof(data));
+    CHECK_EQ(heard.overflowBytes, 0);
+    CHECK(wall.elapsed_time() >= 100ms);
+    CHECK(cpu * 4 < wall.elapsed_time());
+    printf("%u bytes in %lld ms, %lld ms of it on the CPU\n", (unsigned)sizeof(data),
+           (long long)(wall.elapsed_time().count() / 1000), (long long)(cpu.count() / 1000));
+
+    // Filled to the brim at 1000 B/s: DREQ rises once a window has drained, within 32 ms
+    decoder.setByteRate(1000);
+    while (audio.readyForData()) {
+        CHECK_EQ(audio.sendDataBlock(data, Vs1053Sim::DREQ_ROOM), Vs1053Sim::DREQ_ROOM);
+    }
+    Timer woke;
+    woke.start();
+    CHECK(audio.waitForData(100ms));
+    woke.stop();
+    CHECK(woke.elapsed_time() < 60ms);
+    CHECK_EQ(decoder.score().overflowBytes, 0);
+
+    // Hung: the wait runs to its timeout, a send stops at the first window
+    ThisThread::sleep_for(200ms);
+    decoder.hang();
+    uint32_t timeouts = audio.dreqTimeouts();
+    Timer waited;
+    waited.start();
+    CHECK(!audio.waitForData(50ms));
+    waited.stop();
+    CHECK(waited.elapsed_time() >= 50ms && waited.elapsed_time() < 100ms);
+    CHECK_EQ(audio.sendDataBlock(data, 64), 0);
+    CHECK_EQ(audio.dreqTimeouts(), timeouts + 1);
+
+    // Recovered: data is taken again
+    uint32_t resets = decoder.score().resets;
+    CHECK(audio.recover());
+    CHECK(decoder.score().resets > resets);
+    CHECK(audio.waitForData(100ms));
+    CHECK_EQ(audio.sendDataBlock(data, 64), 64);
+
+    return TEST_RESULT();
+}
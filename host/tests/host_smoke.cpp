@@ -0,0 +1,83 @@
+/**
+ *  host_smoke.cpp
+ *  ===========================================================================
+ *  The four seams with their stand-ins: a song streamed through the real
+ *  VS1053 driver from a host directory, text drawn through the real uLCD
+ *  driver, and a key event delivered.
+ */
+
+#include "Check.h"
+#include "AudioStream.h"
+#include "VS1053.h"
+#include "uLCD_4DGL.h"
+#include "Vs1053Sim.h"
+#include "DirectoryVolume.h"
+#include "GoldeloxSim.h"
+#include "ScriptedControls.h"
+
+static int keyEvents = 0;
+
+static void onKey(const Controls::Event& /*event*/) {
+    keyEvents++;
+}
+
+int main() {
+    std::string dir = tempDir();
+    std::string song = dir + "/song.mp3";
+    CHECK(writeSong(song, 60000));
+
+    // Codec: board pins as main.cpp wires them
+    Vs1053Sim decoder(p13, p14, p15, p16, p17);
+    VS1053 audio(p11, p12, p13, p14, p15, p16, p17);
+    audio.hardwareReset();
+    audio.modeSwitch();
+    CHECK(audio.clockUp());
+    decoder.resetStats();
+
+    // Storage: the song is read from its sectors, not through stdio
+    DirectoryVolume volume;
+    AudioStream* stream = new AudioStream();  // its threads never stop, so it is never deleted
+    stream->start(audio, &volume);
+    CHECK(stream->open(song.c_str()));
+    Timer played;
+    played.start();
+    while (!stream->finished() && played.elapsed_time() < 10s) {
+        ThisThread::sleep_for(20ms);
+    }
+    CHECK(stream->finished());
+    Vs1053Sim::Score heard = decoder.score();
+    CHECK(heard.bytes >= 60000);
+    CHECK_EQ(heard.overflowBytes, 0);
+    CHECK_EQ(heard.clockFaults, 0);
+    CHECK(heard.worstDryUs < 10000);  // a late host thread, not a ring that ran dry
+    CHECK(volume.score().sectorsRead >= 60000 / 512);
+
+    // Display: what the driver drew is on the emulated glass
+    GoldeloxSim screen;
+    uLCD_4DGL* lcd = new uLCD_4DGL(screen);
+    lcd->locate(2, 3);
+    lcd->printf("Hello");
+    lcd->wait_idle();
+    CHECK(screen.textRow(3) == "  Hello");
+    // A line filled to the last column hasn't wrapped yet, the next character does
+    lcd->locate(0, 5);
+    lcd->printf("%s", "abcdefghijklmnopqr");
+    CHECK_EQ(lcd->wraps, 0);
+    lcd->printf("s");
+    CHECK_EQ(lcd->wraps, 1);
+    lcd->wait_idle();
+    CHECK(screen.textRow(5) == "abcdefghijklmnopqr");
+    CHECK(screen.textRow(6) == "s");
+    CHECK_EQ(screen.score().naks, 0);
+    CHECK(screen.savePpm((dir + "/screen.ppm").c_str()));
+
+    // Inputs
+    ScriptedControls controls;
+    controls.setVolume(0.25f);
+    controls.attach(onKey);
+    controls.tap(Controls::NAV_CENTER);
+    CHECK_EQ(keyEvents, 2);
+    CHECK(controls.volume() == 0.25f);
+
+    return TEST_RESULT();
+}
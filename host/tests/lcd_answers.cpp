@@ -0,0 +1,70 @@
+/**
+ *  lcd_answers.cpp
+ *  ===========================================================================
+ *  The uLCD driver against a screen that refuses commands or answers them
+ *  late: failures reach wait_idle(), a refused command's text is sent again,
+ *  and an ACK that comes after the driver gave up on it isn't taken for the
+ *  answer to a later command.
+ */
+
+#include "Check.h"
+#include "uLCD_4DGL.h"
+#include "GoldeloxSim.h"
+
+int main() {
+    GoldeloxSim screen;
+    uLCD_4DGL* lcd = new uLCD_4DGL(screen);
+    lcd->auto_baudrate();
+    lcd->locate(0, 2);
+    lcd->printf("abc");
+    CHECK_EQ(lcd->wait_idle(), 1);
+    CHECK_EQ(lcd->naks, 0);
+
+    // Refused: the caller hears of it and the driver no longer trusts what it drew
+    screen.refuseNext(1);
+    lcd->cls();
+    CHECK_EQ(lcd->wait_idle(), -1);
+    CHECK_EQ(lcd->naks, 1);
+    CHECK_EQ(lcd->wait_idle(), 1);  // reported once
+    uint32_t sent = screen.score().commands;
+    lcd->locate(0, 2);
+    lcd->printf("abc");
+    CHECK_EQ(lcd->wait_idle(), 1);
+    CHECK(screen.score().commands > sent);
+    CHECK(screen.textRow(2) == "abc");
+    sent = screen.score().commands;
+    lcd->locate(0, 2);
+    lcd->printf("abc");  // now known to be on the glass
+    CHECK_EQ(lcd->wait_idle(), 1);
+    CHECK_EQ(screen.score().commands, sent);
+
+    // Late, but within ACK_TIMEOUT: nothing lost
+    screen.delayNext(2, 200ms);
+    lcd->locate(0, 3);
+    lcd->printf("slow");
+    CHECK_EQ(lcd->wait_idle(), 1);
+    CHECK_EQ(lcd->lost, 0);
+    CHECK(screen.textRow(3) == "slow");
+
+    // Later than that: reported lost, and the late ACK with the window's others is
+    // collected then, so the next command's NAK is still its own
+    screen.delayNext(1, 700ms);
+    lcd->locate(0, 4);
+    lcd->printf("late");
+    Timer waited;
+    waited.start();
+    CHECK_EQ(lcd->wait_idle(), 0);
+    CHECK(waited.elapsed_time() < 2s);
+    CHECK_EQ(lcd->lost, 1);
+    screen.refuseNext(1);
+    lcd->cls();
+    CHECK_EQ(lcd->wait_idle(), -1);
+    CHECK_EQ(lcd->naks, 2);
+    lcd->locate(0, 5);
+    lcd->printf("after");
+    CHECK_EQ(lcd->wait_idle(), 1);
+    CHECK(screen.textRow(5) == "after");
+    CHECK_EQ(lcd->lost, 1);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,55 @@
+/**
+ *  lcd_throughput.cpp
+ *  ===========================================================================
+ *  Commands per second from the uLCD driver to the screen model, at the
+ *  9600 baud the screen powers up at and at the rate auto_baudrate() picks.
+ *  Nothing is lost to the screen's receive FIFO at either, and the rate of
+ *  single pixel commands stays close to what the line itself allows.
+ */
+
+#include "Check.h"
+#include "uLCD_4DGL.h"
+#include "GoldeloxSim.h"
+
+static const int PIXEL_BYTES = 7;
+
+// Draw pixels for about a second and wait for every answer. @return Commands a second.
+static double pixelsPerSecond(uLCD_4DGL& lcd, GoldeloxSim& screen, int count) {
+    lcd.wait_idle();  // whatever was posted before isn't counted
+    screen.resetStats();
+    Timer drawing;
+    drawing.start();
+    for (int i = 0; i < count; i++) {
+        lcd.pixel(i % GoldeloxSim::WIDTH, i / GoldeloxSim::WIDTH % GoldeloxSim::HEIGHT, 0xff0000 + i);
+    }
+    CHECK_EQ(lcd.wait_idle(), 1);
+    drawing.stop();
+    GoldeloxSim::Score seen = screen.score();
+    CHECK_EQ(seen.commands, count);
+    CHECK_EQ(seen.overrunBytes, 0);
+    CHECK_EQ(seen.garbledBytes, 0);
+    CHECK_EQ(seen.naks, 0);
+    return count / (drawing.elapsed_time().count() / 1e6);
+}
+
+int main() {
+    GoldeloxSim screen;
+    uLCD_4DGL* lcd = new uLCD_4DGL(screen);
+
+    // 9600 baud: the line is the limit, 137 pixels a second at most
+    double lineLimit = 9600 / 10.0 / PIXEL_BYTES;
+    double slow = pixelsPerSecond(*lcd, screen, 120);
+    CHECK(slow > 0.8 * lineLimit && slow <= 1.05 * lineLimit);
+    printf("9600 baud: %.0f pixels/s of %.0f the line allows\n", slow, lineLimit);
+
+    // The fastest rate that answers: the ACK round trips and drawing take their share too
+    int baud = lcd->auto_baudrate();
+    CHECK_EQ(baud, 1500000);
+    lineLimit = baud / 10.0 / PIXEL_BYTES;
+    double fast = pixelsPerSecond(*lcd, screen, 5000);
+    CHECK(fast > 0.25 * lineLimit);
+    CHECK(fast > 20 * slow);
+    printf("%d baud: %.0f pixels/s of %.0f the line allows\n", baud, fast, lineLimit);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,70 @@
+/**
+ *  library_formats.cpp
+ *  ===========================================================================
+ *  A scan of a card with every format the scanner lists: MP3 durations come
+ *  from the first frame, WAV ones from the RIFF header whatever the name,
+ *  and the rest are left unknown even when their bytes look like MPEG
+ *  frames.
+ */
+
+#include "Check.h"
+#include "LibraryScanner.h"
+
+static const int SONG_FRAMES = 400;          // 10 s at 128 kbit/s
+static const uint32_t WAV_RATE = 176400;     // 44.1 kHz 16 bit stereo
+
+static std::string le32(uint32_t v) {
+    char b[4] = { (char)v, (char)(v >> 8), (char)(v >> 16), (char)(v >> 24) };
+    return std::string(b, 4);
+}
+
+// PCM WAV of seconds, with an odd length LIST chunk between fmt and data
+static std::string wav(uint32_t seconds) {
+    std::string fmt = std::string("\x01\x00\x02\x00", 4) + le32(44100) + le32(WAV_RATE) +
+                      std::string("\x04\x00\x10\x00", 4);
+    std::string list = std::string("INFOISFT\x05\x00\x00\x00host", 16) + '\0';  // 17 bytes
+    std::string body = "WAVE";
+    body += "fmt " + le32(fmt.size()) + fmt;
+    body += "LIST" + le32(list.size()) + list + '\0';
+    body += "data" + le32(seconds * WAV_RATE) + std::string(seconds * WAV_RATE, '\0');
+    return "RIFF" + le32(body.size()) + body;
+}
+
+static uint32_t duration(Library& library, const char* name) {
+    int i = library.findTrack(name);
+    CHECK(i >= 0);
+    return i >= 0 ? library.trackDuration(i) : 0xffffffff;
+}
+
+int main() {
+    std::string dir = tempDir();
+    CHECK(writeFrames(dir + "/plain.mp3", SONG_FRAMES));
+    std::string tag = std::string("ID3\x03\x00\x00\x00\x00\x01\x00", 10) + std::string(128, '\0');
+    CHECK(writeFile(dir + "/tagged.mp3", tag + cbrFrames(SONG_FRAMES)));
+    CHECK(writeFile(dir + "/pcm.wav", wav(3)));
+    CHECK(writeFile(dir + "/riff.mp3", wav(2)));
+    CHECK(writeFile(dir + "/song.ogg", "OggS" + cbrFrames(SONG_FRAMES)));
+    CHECK(writeFile(dir + "/song.m4a", std::string("\0\0\0\x20" "ftypM4A ", 12) + cbrFrames(SONG_FRAMES)));
+    CHECK(writeFile(dir + "/song.wma", cbrFrames(SONG_FRAMES)));
+    CHECK(writeFile(dir + "/tune.mid", "MThd" + cbrFrames(10)));
+    CHECK(writeFile(dir + "/cut.wav", "RIFF" + le32(4) + "WAVE"));
+    CHECK(writeFile(dir + "/notes.txt", cbrFrames(10)));
+
+    Library::setBudget(64 * 1024);
+    Library library(dir.c_str());
+    LibraryScanner scanner(dir.c_str());
+    CHECK_EQ(scanner.scan(library), 9);
+    CHECK_EQ(library.findTrack("notes.txt"), -1);
+
+    CHECK_EQ(duration(library, "plain.mp3"), SONG_FRAMES * CBR_FRAME / 16000);
+    CHECK_EQ(duration(library, "tagged.mp3"), SONG_FRAMES * CBR_FRAME / 16000);
+    CHECK_EQ(duration(library, "pcm.wav"), 3);
+    CHECK_EQ(duration(library, "riff.mp3"), 2);
+    CHECK_EQ(duration(library, "song.ogg"), 0);
+    CHECK_EQ(duration(library, "song.m4a"), 0);
+    CHECK_EQ(duration(library, "song.wma"), 0);
+    CHECK_EQ(duration(library, "tune.mid"), 0);
+    CHECK_EQ(duration(library, "cut.wav"), 0);
+
+    return TEST_RESULT();
+}
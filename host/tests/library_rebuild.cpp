@@ -0,0 +1,81 @@
+/**
+ *  library_rebuild.cpp
+ *  ===========================================================================
+ *  A library rebuilt after the card changed: songs with the size and
+ *  modification stamp the old index holds keep their duration without being
+ *  opened, new, grown and touched songs are probed, removed ones drop out.
+ */
+
+#include "Check.h"
+#include "LibraryScanner.h"
+#include "TrackIndex.h"
+#include <sys/stat.h>
+#include <utime.h>
+
+static const int SONG_FRAMES = 2000;  // 52 s at 128 kbit/s
+
+int main() {
+    std::string dir = tempDir();
+    CHECK_EQ(mkdir((dir + "/Artist").c_str(), 0755), 0);
+    CHECK_EQ(mkdir((dir + "/Artist/Album").c_str(), 0755), 0);
+    const char* const songs[] = {
+        "one.mp3", "two.mp3", "Artist/three.mp3", "Artist/Album/four.mp3", "Artist/Album/five.mp3"
+    };
+    const int SONGS = 5;
+    for (int i = 0; i < SONGS; i++) {
+        CHECK(writeFrames(dir + "/" + songs[i], SONG_FRAMES));
+    }
+    Library::setBudget(64 * 1024);
+    std::string indexPath = dir + "/.tracks.idx";
+
+    // Cold boot: no index, every song is opened
+    LibraryScanner scanner(dir.c_str());
+    Library library(dir.c_str());
+    TrackIndex index(indexPath.c_str());
+    CHECK(!index.load(library));
+    CHECK_EQ(scanner.scan(library, &index), SONGS);
+    CHECK_EQ(scanner.probed(), SONGS);
+    CHECK(index.save(library));
+
+    // Warm boot
+    Library warm(dir.c_str());
+    TrackIndex warmIndex(indexPath.c_str());
+    CHECK(warmIndex.load(warm));
+    CHECK_EQ(warm.trackCount(), SONGS);
+
+    // The card changes: one song grows, one is rewritten at the same size,
+    // one is removed and one is added
+    CHECK(writeFrames(dir + "/two.mp3", 2 * SONG_FRAMES));
+    CHECK(writeFrames(dir + "/Artist/three.mp3", SONG_FRAMES));
+    struct utimbuf later = { time(nullptr) + 60, time(nullptr) + 60 };
+    CHECK_EQ(utime((dir + "/Artist/three.mp3").c_str(), &later), 0);
+    CHECK_EQ(remove((dir + "/Artist/Album/four.mp3").c_str()), 0);
+    CHECK(writeFrames(dir + "/Artist/Album/six.mp3", SONG_FRAMES / 2));
+
+    // Rebuild: only the grown, rewritten and new songs are opened
+    warm.clear();
+    CHECK_EQ(scanner.scan(warm, &warmIndex), SONGS);
+    CHECK_EQ(scanner.probed(), 3);
+    CHECK_EQ(warm.findTrack("Artist/Album/four.mp3"), -1);
+    int two = warm.findTrack("two.mp3");
+    int five = warm.findTrack("Artist/Album/five.mp3");
+    int six = warm.findTrack("Artist/Album/six.mp3");
+    CHECK(two >= 0 && five >= 0 && six >= 0);
+    uint32_t songSeconds = SONG_FRAMES * CBR_FRAME / 16000;
+    CHECK_EQ(warm.trackDuration(five), songSeconds);
+    CHECK_EQ(warm.trackDuration(two), 2 * SONG_FRAMES * CBR_FRAME / 16000);
+    CHECK_EQ(warm.trackSize(two), 2 * SONG_FRAMES * CBR_FRAME);
+    CHECK_EQ(warm.trackDuration(six), SONG_FRAMES / 2 * CBR_FRAME / 16000);
+    CHECK(warmIndex.save(warm));
+
+    // Nothing changed since: nothing is opened
+    Library again(dir.c_str());
+    TrackIndex againIndex(indexPath.c_str());
+    CHECK(againIndex.load(again));
+    again.clear();
+    CHECK_EQ(scanner.scan(again, &againIndex), SONGS);
+    CHECK_EQ(scanner.probed(), 0);
+    CHECK_EQ(again.listingHash(), warm.listingHash());
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,258 @@
+/**
+ *  player_states.cpp
+ *  ===========================================================================
+ *  The player's state machine on the simulated decoder, screen and switches:
+ *  menu to playing to paused to scrubbing and back to the menu, then key,
+ *  stream and library events that arrive while it changes songs, tags that
+ *  come in after the menu went up with file names, and songs that won't
+ *  open.
+ */
+
+#include "Check.h"
+#include "Player.h"
+#include "Vs1053Sim.h"
+#include "DirectoryVolume.h"
+#include "GoldeloxSim.h"
+#include "ScriptedControls.h"
+
+static const int SONG_FRAMES  = 800;  // 20.9 s
+static const int SHORT_FRAMES = 20;   // half a second
+static const char* const NAMES[] = { "a.mp3", "b.mp3", "c.mp3", "d.mp3", "e.mp3" };
+static const int TRACKS = 5;
+static const int SHORT_TRACK = 3;     // d.mp3
+static const int TAGGED_TRACK = 4;    // e.mp3, with an ID3v1 tag
+static const size_t V1_SIZE = 128;
+
+static Player*       player;
+static GoldeloxSim*  screen;
+static uLCD_4DGL*    lcd;
+static Library*      library;
+static TrackTags*    tags;
+static std::string   dir;
+
+// Handle events until none has come for a while
+static void settle() {
+    while (player->step(50ms)) {
+    }
+}
+
+// Handle events, ticks included, for a while
+static void runFor(std::chrono::milliseconds duration) {
+    Timer elapsed;
+    elapsed.start();
+    while (elapsed.elapsed_time() < duration) {
+        player->step(50ms);
+    }
+}
+
+static std::string row(int r) {
+    lcd->wait_idle();
+    return screen->textRow(r);
+}
+
+static bool shows(int r, const char* text) {
+    return row(r).find(text) != std::string::npos;
+}
+
+static void tap(ScriptedControls& controls, Controls::Key key) {
+    controls.post(key, Controls::PRESS);
+    controls.post(key, Controls::RELEASE);
+}
+
+static void addTracks() {
+    for (int i = 0; i < TRACKS; i++) {
+        int frames = i == SHORT_TRACK ? SHORT_FRAMES : SONG_FRAMES;
+        size_t size = frames * CBR_FRAME + (i == TAGGED_TRACK ? V1_SIZE : 0);
+        library->addTrack(NAMES[i], Library::ROOT, size, frames * 26 / 1000);
+    }
+}
+
+// Stands in for main.cpp's scanThread once the library is up to date
+static void serveTags() {
+    tags->serve(*library);
+}
+
+// Stands in for main.cpp's refreshLibrary(): the card changed under a playing song
+static void rescan() {
+    player->replaceLibrary();
+    addTracks();
+    player->setLibraryReady(true);
+}
+
+int main() {
+    dir = tempDir();
+    for (int i = 0; i < TRACKS; i++) {
+        CHECK(writeFrames(dir + "/" + NAMES[i], i == SHORT_TRACK ? SHORT_FRAMES : SONG_FRAMES));
+    }
+    std::string v1(V1_SIZE, '\0');
+    v1.replace(0, 7, "TAGEcho");  // "TAG", then the 30 byte title field
+    CHECK(writeFile(dir + "/" + NAMES[TAGGED_TRACK], cbrFrames(SONG_FRAMES) + v1));
+    Library::setBudget(64 * 1024);
+    library = new Library(dir.c_str());
+    addTracks();
+    tags = new TrackTags((dir + "/.tags.db").c_str());
+    Thread tagThread;
+    tagThread.start(serveTags);
+
+    Vs1053Sim decoder(p13, p14, p15, p16, p17);
+    VS1053 audio(p11, p12, p13, p14, p15, p16, p17);
+    audio.hardwareReset();
+    audio.modeSwitch();
+    CHECK(audio.clockUp());
+    decoder.setByteRate(16000);  // 128 kbit/s, so the decode time is the song's
+
+    screen = new GoldeloxSim();
+    lcd = new uLCD_4DGL(*screen);
+    lcd->auto_baudrate();
+    ScriptedControls controls;
+    controls.setVolume(0.5f);
+
+    DirectoryVolume volume;
+    AudioStream* stream = new AudioStream();  // its threads never stop, so none of these are deleted
+    stream->start(audio, &volume);
+    player = new Player(controls, audio, *lcd, *stream, *library, *tags);
+    player->setLibraryReady(true);
+    player->start();
+    settle();
+
+    // Menu: file names until the tags are read, then the titles they name
+    ThisThread::sleep_for(100ms);
+    settle();
+    CHECK_EQ(player->state(), Player::MENU);
+    CHECK(shows(6, "  Echo"));
+
+    // Down moves the highlight, center plays it
+    CHECK(shows(2, "> a.mp3"));
+    tap(controls, Controls::NAV_DOWN);
+    settle();
+    CHECK_EQ(player->selection(), 1);
+    CHECK(shows(3, "> b.mp3"));
+    tap(controls, Controls::NAV_CENTER);
+    settle();
+    CHECK_EQ(player->state(), Player::PLAYING);
+    CHECK_EQ(player->currentTrack(), 1);
+    CHECK(shows(6, "b.mp3"));
+    CHECK(shows(0, "Playing"));
+    CHECK_EQ(lcd->wraps, 0);  // "Playing" ends on the last column without wrapping
+
+    // Paused: the decoder gets nothing more
+    tap(controls, Controls::NAV_CENTER);
+    settle();
+    CHECK_EQ(player->state(), Player::PAUSED);
+    CHECK(shows(0, "Paused"));
+    uint64_t heard = decoder.score().bytes;
+    ThisThread::sleep_for(300ms);
+    CHECK_EQ(decoder.score().bytes, heard);
+
+    // Scrubbing from pause: two steps forward, shown on the time line, then the seek
+    int from = audio.decodeTime();
+    controls.post(Controls::NAV_RIGHT, Controls::PRESS);
+    controls.post(Controls::NAV_RIGHT, Controls::HOLD);
+    controls.post(Controls::NAV_RIGHT, Controls::REPEAT);
+    settle();
+    CHECK_EQ(player->state(), Player::SCRUBBING);
+    int target = from + 2 * Player::SEEK_STEP;
+    char time[8];
+    snprintf(time, sizeof(time), "%2d:%02d", target / 60, target % 60);
+    CHECK(shows(10, time));
+    CHECK(shows(0, "Paused"));
+    controls.post(Controls::NAV_RIGHT, Controls::RELEASE, true);
+    settle();
+    CHECK_EQ(player->state(), Player::PAUSED);
+    // 16000 bytes a second, moved on to the next frame start; the stream waits there unfed
+    uint32_t expected = target * 16000;
+    CHECK(stream->position() >= expected && stream->position() < expected + CBR_FRAME);
+    CHECK_EQ(stream->position() % CBR_FRAME, 0);
+    CHECK_EQ(audio.decodeTime(), target);
+    heard = decoder.score().bytes;
+    ThisThread::sleep_for(300ms);
+    CHECK_EQ(decoder.score().bytes, heard);
+
+    // Back to the menu, which starts over at the top
+    controls.post(Controls::MENU_BUTTON, Controls::PRESS);
+    settle();
+    CHECK_EQ(player->state(), Player::MENU);
+    CHECK(shows(2, "> a.mp3"));
+
+    // Skips queued faster than songs open: each is taken in turn and the last one plays
+    tap(controls, Controls::NAV_CENTER);
+    tap(controls, Controls::NAV_RIGHT);
+    tap(controls, Controls::NAV_RIGHT);
+    tap(controls, Controls::NAV_RIGHT);
+    tap(controls, Controls::NAV_LEFT);
+    settle();
+    CHECK_EQ(player->state(), Player::PLAYING);
+    CHECK_EQ(player->currentTrack(), 2);
+    CHECK(shows(6, "c.mp3"));
+    heard = decoder.score().bytes;
+    ThisThread::sleep_for(300ms);
+    CHECK(decoder.score().bytes > heard);
+
+    // A skip queued behind the stream's report of running into the next song:
+    // the report moves the screen on to e.mp3 first, the skip then goes past it
+    tap(controls, Controls::NAV_RIGHT);
+    settle();
+    CHECK_EQ(player->currentTrack(), SHORT_TRACK);
+    ThisThread::sleep_for(1500ms);  // d.mp3 ends, the stream carries on into e.mp3
+    tap(controls, Controls::NAV_RIGHT);
+    settle();
+    CHECK_EQ(player->currentTrack(), 0);
+    CHECK(shows(6, "a.mp3"));
+
+    // The same with the menu button behind it: the menu, with nothing left playing
+    tap(controls, Controls::NAV_LEFT);
+    tap(controls, Controls::NAV_LEFT);
+    settle();
+    CHECK_EQ(player->currentTrack(), SHORT_TRACK);
+    ThisThread::sleep_for(1500ms);
+    controls.post(Controls::MENU_BUTTON, Controls::PRESS);
+    settle();
+    CHECK_EQ(player->state(), Player::MENU);
+    CHECK_EQ(player->currentTrack(), SHORT_TRACK + 1);
+    ThisThread::sleep_for(100ms);
+    heard = decoder.score().bytes;
+    ThisThread::sleep_for(300ms);
+    CHECK_EQ(decoder.score().bytes, heard);
+
+    // A rescan that changed the card while a song plays: the list stays until the menu
+    tap(controls, Controls::NAV_CENTER);
+    settle();
+    Thread scan;
+    scan.start(rescan);
+    ThisThread::sleep_for(100ms);
+    settle();
+    CHECK_EQ(player->state(), Player::PLAYING);
+    CHECK_EQ(library->trackCount(), TRACKS);
+    CHECK(shows(6, "a.mp3"));
+    controls.post(Controls::MENU_BUTTON, Controls::PRESS);
+    settle();
+    scan.join();
+    CHECK_EQ(player->state(), Player::MENU);
+    CHECK_EQ(library->trackCount(), TRACKS);
+    CHECK(player->libraryReady());
+    runFor(1500ms);  // the menu redraws on its next second once the list is back
+    CHECK(shows(2, "> a.mp3"));
+    CHECK(shows(15, "Page 1/1"));
+
+    // A song gone from the card is skipped for the next one
+    CHECK_EQ(remove((dir + "/b.mp3").c_str()), 0);
+    tap(controls, Controls::NAV_DOWN);
+    tap(controls, Controls::NAV_CENTER);
+    settle();
+    CHECK_EQ(player->state(), Player::PLAYING);
+    CHECK_EQ(player->currentTrack(), 2);
+    CHECK(shows(6, "c.mp3"));
+    controls.post(Controls::MENU_BUTTON, Controls::PRESS);
+    settle();
+
+    // and with nothing left that opens, the menu comes back with the error
+    for (int i = 0; i < TRACKS; i++) {
+        remove((dir + "/" + NAMES[i]).c_str());
+    }
+    tap(controls, Controls::NAV_CENTER);
+    settle();
+    CHECK_EQ(player->state(), Player::MENU);
+    CHECK(shows(15, "Can't open song"));
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,88 @@
+/**
+ *  sd_reads.cpp
+ *  ===========================================================================
+ *  StreamFile's direct reads against stdio's FatFs reads on the same card
+ *  model: the same bytes from an unaligned start, stdio's small reads one
+ *  card command a sector, its long ones cut at each cluster, direct ring
+ *  blocks that read no sector twice, faster than the 32 byte freads the
+ *  player once made.
+ */
+
+#include "Check.h"
+#include "StreamFile.h"
+#include "AudioStream.h"
+#include "DirectoryVolume.h"
+#include "FatReader.h"
+#include <vector>
+
+static const uint32_t SONG_SIZE = 256 * 1024;
+static const uint32_t START     = 1000;  // past an ID3 tag, inside a sector
+
+// Read the rest of a file in chunk sized reads. @return Bytes a second, going by the card's time.
+template <typename File>
+static uint32_t readAll(File& file, size_t chunk, DirectoryVolume& volume, std::vector<char>& out) {
+    std::vector<char> buffer(chunk);
+    out.clear();
+    volume.resetStats();
+    size_t n;
+    while ((n = file.read(buffer.data(), chunk)) > 0) {
+        out.insert(out.end(), buffer.begin(), buffer.begin() + n);
+    }
+    uint64_t us = volume.score().busyUs;
+    return us ? out.size() * 1000000 / us : 0;
+}
+
+int main() {
+    std::string dir = tempDir();
+    std::string song = dir + "/song.mp3";
+    CHECK(writeSong(song, SONG_SIZE));
+    std::vector<char> expected(SONG_SIZE - START);
+    FILE* f = fopen(song.c_str(), "rb");
+    CHECK(f && fseek(f, START, SEEK_SET) == 0 && fread(expected.data(), 1, expected.size(), f) == expected.size());
+    if (f) {
+        fclose(f);
+    }
+
+    DirectoryVolume volume;
+    std::vector<char> got;
+    uint32_t sectors = (SONG_SIZE - START / 512 * 512) / 512;
+
+    // stdio, 32 bytes at a time: each sector comes through the window once
+    FatReader fat(volume);
+    CHECK(fat.open(song.c_str(), START));
+    uint32_t small = readAll(fat, 32, volume, got);
+    CHECK(got == expected);
+    CHECK_EQ(volume.score().reads, sectors);
+    CHECK_EQ(volume.score().sectorsRead, sectors);
+
+    // stdio, 48 KB at a time: multi block reads, never across a cluster
+    CHECK(fat.open(song.c_str(), START));
+    readAll(fat, 48 * 1024, volume, got);
+    CHECK(got == expected);
+    CHECK_EQ(volume.score().sectorsRead, sectors);
+    uint32_t clusters = SONG_SIZE / 512 / FatReader::CLUSTER_SECTORS;
+    CHECK(volume.score().reads >= clusters + 1);
+
+    // Direct, a ring block at a time: every sector read once, a multi block read
+    // per block and one for the sector it ends in, which the next block starts from
+    uint32_t blocks = (SONG_SIZE - START + AudioStream::BLOCK_SIZE - 1) / AudioStream::BLOCK_SIZE;
+    StreamFile direct;
+    CHECK(direct.open(&volume, song.c_str(), START));
+    CHECK(direct.isDirect());
+    uint32_t block = readAll(direct, AudioStream::BLOCK_SIZE, volume, got);
+    CHECK(got == expected);
+    CHECK_EQ(volume.score().sectorsRead, sectors);
+    CHECK(volume.score().reads <= 2 * blocks + 1);
+
+    // From a sector boundary, one read per block
+    CHECK(direct.open(&volume, song.c_str(), 0));
+    readAll(direct, AudioStream::BLOCK_SIZE, volume, got);
+    CHECK_EQ(got.size(), SONG_SIZE);
+    CHECK_EQ(volume.score().reads, SONG_SIZE / AudioStream::BLOCK_SIZE);
+    direct.close();
+
+    CHECK(block > 3 * small / 2);
+    printf("stdio 32 B %.2f MB/s, direct %u B %.2f MB/s\n", small / 1e6, (unsigned)AudioStream::BLOCK_SIZE,
+           block / 1e6);
+    return TEST_RESULT();
+}
@@ -0,0 +1,120 @@
+/**
+ *  seek_table.cpp
+ *  ===========================================================================
+ *  Seek offsets for a plain CBR song, one whose Xing table of contents puts
+ *  the middle of the song a quarter of the way in, a VBRI one, and files
+ *  with no frames at all. Every offset is on a frame header, times past the
+ *  end give the last frame, and a song gone from the card gives none.
+ */
+
+#include "Check.h"
+#include "SeekTable.h"
+
+static const int SONG_FRAMES = 1000;
+static const int TAG_SIZE    = 256;
+
+static std::string be32(uint32_t v) {
+    char b[4] = { (char)(v >> 24), (char)(v >> 16), (char)(v >> 8), (char)v };
+    return std::string(b, 4);
+}
+
+static std::string be16(uint16_t v) {
+    char b[2] = { (char)(v >> 8), (char)v };
+    return std::string(b, 2);
+}
+
+// An ID3v2 tag of TAG_SIZE bytes after its header, size syncsafe
+static std::string id3() {
+    return std::string("ID3\x03\x00\x00\x00\x00\x02\x00", 10) + std::string(TAG_SIZE, '\0');
+}
+
+// A CBR_HEADER frame carrying info at the offset a header of its kind sits at
+static std::string infoFrame(size_t at, const std::string& info) {
+    std::string frame((const char*)CBR_HEADER, sizeof(CBR_HEADER));
+    frame.append(at - frame.size(), '\0');
+    frame += info;
+    frame.append(CBR_FRAME - frame.size(), '\x01');
+    return frame;
+}
+
+// Start of the frame at or after offset, in a file whose frames start at first
+static bool onFrame(uint32_t offset, uint32_t first) {
+    return offset >= first && (offset - first) % CBR_FRAME == 0;
+}
+
+int main() {
+    std::string dir = tempDir();
+    SeekTable table;
+    uint32_t offset;
+
+    // CBR: no table of contents, the first frame's bitrate it is
+    std::string cbr = dir + "/cbr.mp3";
+    CHECK(writeFile(cbr, cbrFrames(SONG_FRAMES) + "TAG" + std::string(125, ' ')));
+    CHECK(table.load(cbr.c_str()));
+    CHECK(!table.hasToc());
+    CHECK_EQ(table.duration(), (SONG_FRAMES * CBR_FRAME + 128) * 8 / 128);
+    CHECK(table.offsetFor(cbr.c_str(), 0, offset));
+    CHECK_EQ(offset, 0);
+    CHECK(table.offsetFor(cbr.c_str(), 10000, offset));
+    CHECK(onFrame(offset, 0) && offset >= 160000 && offset < 160000 + CBR_FRAME);
+    // At and past the end: the last frame, not the ID3v1 tag after it or the end of the file
+    CHECK(table.offsetFor(cbr.c_str(), table.duration(), offset));
+    CHECK_EQ(offset, (SONG_FRAMES - 1) * CBR_FRAME);
+    CHECK(table.offsetFor(cbr.c_str(), 3600000, offset));
+    CHECK_EQ(offset, (SONG_FRAMES - 1) * CBR_FRAME);
+
+    // Xing behind an ID3 tag: the first half of the song is a quarter of its bytes
+    std::string toc;
+    for (int i = 0; i < 100; i++) {
+        toc += (char)(i < 50 ? i * 64 / 50 : 64 + (i - 50) * 192 / 50);
+    }
+    uint32_t dataBytes = (SONG_FRAMES + 1) * CBR_FRAME;
+    std::string xing = dir + "/xing.mp3";
+    CHECK(writeFile(xing, id3() + infoFrame(36, "Xing" + be32(7) + be32(SONG_FRAMES) + be32(dataBytes) + toc) +
+                              cbrFrames(SONG_FRAMES)));
+    CHECK(table.load(xing.c_str()));
+    CHECK(table.hasToc());
+    uint32_t totalMs = (uint64_t)SONG_FRAMES * 1152 * 1000 / 44100;
+    CHECK_EQ(table.duration(), totalMs);
+    uint32_t dataStart = 10 + TAG_SIZE;
+    CHECK(table.offsetFor(xing.c_str(), 0, offset));
+    CHECK_EQ(offset, dataStart);
+    CHECK(table.offsetFor(xing.c_str(), totalMs / 2, offset));
+    uint32_t quarter = dataStart + dataBytes / 4;
+    CHECK(onFrame(offset, dataStart) && offset + CBR_FRAME > quarter && offset < quarter + CBR_FRAME);
+    CHECK(table.offsetFor(xing.c_str(), totalMs, offset));
+    CHECK_EQ(offset, dataStart + SONG_FRAMES * CBR_FRAME);
+
+    // VBRI: four slices of equal time holding 10, 20, 30 and 40% of the bytes, in units of 4
+    uint16_t slices[4] = { 0, 0, 0, 0 };
+    std::string vbriToc;
+    for (int i = 0; i < 4; i++) {
+        slices[i] = dataBytes * (i + 1) / 10 / 4;
+        vbriToc += be16(slices[i]);
+    }
+    std::string vbri = dir + "/vbri.mp3";
+    std::string header = "VBRI" + be16(1) + be16(0) + be16(75) + be32(dataBytes) + be32(SONG_FRAMES) +
+                         be16(4) + be16(4) + be16(2) + be16(SONG_FRAMES / 4) + vbriToc;
+    CHECK(writeFile(vbri, infoFrame(36, header) + cbrFrames(SONG_FRAMES)));
+    CHECK(table.load(vbri.c_str()));
+    CHECK(table.hasToc());
+    CHECK_EQ(table.duration(), totalMs);
+    CHECK(table.offsetFor(vbri.c_str(), totalMs / 2 + 10, offset));
+    uint32_t thirty = (slices[0] + slices[1]) * 4;  // 10 ms into the third slice, then on to a frame
+    CHECK(onFrame(offset, 0) && offset >= thirty && offset < thirty + 2 * CBR_FRAME);
+
+    // Gone from the card since it was loaded: no offset rather than an unaligned one
+    CHECK_EQ(remove(vbri.c_str()), 0);
+    CHECK(!table.offsetFor(vbri.c_str(), 1000, offset));
+
+    // No frame header anywhere: not seekable
+    std::string none = dir + "/none.mp3";
+    CHECK(writeFile(none, std::string(20000, 'x')));
+    CHECK(!table.load(none.c_str()));
+    CHECK(!table.offsetFor(none.c_str(), 1000, offset));
+    CHECK(writeFile(none, id3()));
+    CHECK(!table.load(none.c_str()));
+    CHECK(!table.offsetFor(none.c_str(), 0, offset));
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,147 @@
+/**
+ *  spi_frames.cpp
+ *  ===========================================================================
+ *  The VS1053 driver's bytes on a mock bus, frame by frame: SCI writes are
+ *  02h, address, high, low under xCS; reads are 03h, address and two FFh
+ *  fills; SDI data goes under xDCS in one block write per 32 byte DREQ
+ *  window, the same bytes as the byte at a time path; and xCS and xDCS
+ *  are never low together.
+ */
+
+#include "Check.h"
+#include "VS1053.h"
+#include "HostPins.h"
+#include <vector>
+
+static const PinName SCLK = p13, XCS = p14, XDCS = p15, DREQ = p16, XRST = p17;
+
+/** What the bus carried between a select going low and high again. */
+struct Frame {
+    bool                 data;    // under xDCS rather than xCS
+    std::vector<uint8_t> bytes;
+    int                  blocks;  // block writes the bytes came in
+};
+
+/** Class MockBus. Records frames, DREQ held high, answers reads with answer. */
+class MockBus : public PinListener, public SpiDevice {
+public:
+    std::vector<Frame> frames;
+    uint16_t           answer;
+    int                overlaps;  // xCS and xDCS low at once
+
+    MockBus()
+    :
+        answer(0),
+        overlaps(0),
+        open(nullptr)
+    {
+        HostPins::drive(DREQ, 1);
+        HostPins::watch(XCS, this);
+        HostPins::watch(XDCS, this);
+        HostPins::attachSpi(SCLK, this);
+    }
+
+    virtual void pinChanged(PinName pin, int level) {
+        if (HostPins::level(XCS) == 0 && HostPins::level(XDCS) == 0) {
+            overlaps++;
+        }
+        if (level == 0) {
+            Frame frame = { pin == XDCS, std::vector<uint8_t>(), 0 };
+            frames.push_back(frame);
+            open = &frames.back();
+        } else {
+            open = nullptr;
+        }
+    }
+
+    virtual uint8_t transfer(uint8_t mosi, int /*hz*/) {
+        if (!open) {
+            return 0xff;
+        }
+        open->bytes.push_back(mosi);
+        size_t at = open->bytes.size() - 1;
+        if (!open->data && open->bytes[0] == 0x03 && at >= 2) {
+            return at == 2 ? answer >> 8 : answer & 0xff;
+        }
+        return 0xff;
+    }
+
+    virtual void block(int /*length*/) {
+        if (open) {
+            open->blocks++;
+        }
+    }
+
+    std::vector<Frame> take() {
+        std::vector<Frame> taken;
+        taken.swap(frames);
+        return taken;
+    }
+
+private:
+    Frame* open;
+};
+
+static bool sci(const Frame& frame, uint8_t op, uint8_t addr, uint16_t word) {
+    std::vector<uint8_t> expected = { op, addr, (uint8_t)(word >> 8), (uint8_t)word };
+    return !frame.data && frame.bytes == expected;
+}
+
+int main() {
+    MockBus bus;
+    VS1053 audio(p11, p12, SCLK, XCS, XDCS, DREQ, XRST);
+    audio.hardwareReset();
+    bus.take();
+
+    // Writes: one frame each, high byte first
+    audio.setVolume(0x20);
+    std::vector<Frame> frames = bus.take();
+    CHECK_EQ(frames.size(), 1);
+    CHECK(frames.size() == 1 && sci(frames[0], 0x02, VS1053::SCI_VOL, 0x2020));
+
+    // Reads: FFh fills, the answer's high byte first
+    bus.answer = 0x0123;
+    CHECK_EQ(audio.decodeTime(), 0x0123);
+    frames = bus.take();
+    CHECK(frames.size() == 1 && sci(frames[0], 0x03, VS1053::SCI_DECODE_TIME, 0xffff));
+
+    // XRAM: the address write, then the read of SCI_WRAM, in two frames
+    bus.answer = 16000;
+    CHECK_EQ(audio.byteRate(), 16000);
+    frames = bus.take();
+    CHECK_EQ(frames.size(), 2);
+    CHECK(frames.size() == 2 && sci(frames[0], 0x02, VS1053::SCI_WRAMADDR, VS1053::PARA_BYTERATE) &&
+          sci(frames[1], 0x03, VS1053::SCI_WRAM, 0xffff));
+
+    // SDI: 100 bytes as windows of 32, 32, 32 and 4, each one block write
+    char data[100];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (char)i;
+    }
+    CHECK_EQ(audio.sendDataBlock(data, sizeof(data)), sizeof(data));
+    std::vector<Frame> bulk = bus.take();
+    const size_t windows[] = { 32, 32, 32, 4 };
+    CHECK_EQ(bulk.size(), 4);
+    std::vector<uint8_t> sent;
+    for (size_t i = 0; i < bulk.size() && i < 4; i++) {
+        CHECK(bulk[i].data);
+        CHECK_EQ(bulk[i].bytes.size(), windows[i]);
+        CHECK_EQ(bulk[i].blocks, 1);
+        sent.insert(sent.end(), bulk[i].bytes.begin(), bulk[i].bytes.end());
+    }
+    CHECK(sent == std::vector<uint8_t>(data, data + sizeof(data)));
+
+    // Byte at a time: the same windows and bytes, no block writes
+    audio.setBulkTransfer(false);
+    CHECK_EQ(audio.sendDataBlock(data, sizeof(data)), sizeof(data));
+    frames = bus.take();
+    CHECK_EQ(frames.size(), bulk.size());
+    for (size_t i = 0; i < frames.size() && i < bulk.size(); i++) {
+        CHECK(frames[i].data);
+        CHECK(frames[i].bytes == bulk[i].bytes);
+        CHECK_EQ(frames[i].blocks, 0);
+    }
+
+    CHECK_EQ(bus.overlaps, 0);
+    return TEST_RESULT();
+}
@@ -1,158 +1,140 @@
 #include "mbed.h"
 #include "SDBlockDevice.h"
-#include "FATFileSystem.h"
+#include "BlockCache.h"
 #include "VS1053.h"
+#include "AudioStream.h"
+#include "StreamFileSystem.h"
+#include "SdClock.h"
+#include "Library.h"
+#include "LibraryScanner.h"
+#include "TrackIndex.h"
+#include "TrackTags.h"
+#include "Buttons.h"
+#include "Player.h"
+#include "Stats.h"
+#if MBED_CONF_APP_BENCHMARK
+#include "Benchmark.h"
+#endif
 #include "uLCD_4DGL.h"
-#include <vector>
-#include <string>
+#include "UartLink.h"
 #include <cstdio> // for std namespace functions in file system
 #include <cstdint> // for more integer types
-#include <algorithm> // for min and max functions
 
 // Pinouts
 VS1053 audio(p11, p12, p13, p14, p15, p16, p17); // mosi, miso, sclk, cs, bsync, dreq, rst
-SDBlockDevice sd(p5, p6, p7, p8); // mosi, miso, sck, cs
-FATFileSystem fs("sd");
-uLCD_4DGL uLCD(p28, p27, p20);  // TX, RX, RESET
+// CRCs on, so clock training catches a clock too fast for the card, and playback a bad transfer
+SDBlockDevice sd(p5, p6, p7, p8, MBED_CONF_SD_TRX_FREQUENCY, MBED_CONF_SD_CRC_ENABLED); // mosi, miso, sck, cs, Hz, crc
+BlockCache sdCache(&sd);  // FAT and directory sectors, with read-ahead, in AHB SRAM
+StreamFileSystem fs("sd");  // FAT, plus sector maps for direct song reads
+AudioStream stream; // SD reader thread + ring buffer feeding the VS1053
+UartLink lcdLink(p28, p27, p20);  // TX, RX, RESET
+uLCD_4DGL uLCD(lcdLink);
 
 // User Controls
-AnalogIn volumeKnob(p19);
-DigitalIn navUp(p24, PullUp);      // Menu up
-DigitalIn navDown(p25, PullUp);    // Menu down
-DigitalIn navLeft(p26, PullUp);    // Previous track
-DigitalIn navRight(p29, PullUp);   // Next track
-DigitalIn navCenter(p30, PullUp);  // Menu select + Play/Pause
-DigitalIn menuButton(p21, PullUp); // Dedicated button to return to menu
-
-// Some variables for the song progress
-std::vector<std::string> tracks;
-int currentTrack = 0;
-bool trackChanged = true;
-bool isPaused = false;
-// The key behind play and pause functionality
-uint32_t resumePosition = 0;
-
-// Constants for progress bar and song menu pages
-// change these for ulcd debugging
-const int BAR_WIDTH = 128;
-const int BAR_HEIGHT = 4;
-const int BAR_Y = 72;
-static const int ITEMS_PER_PAGE = 10;  // number of songs per page in menu
-
-// Repeatedly called progress bar function
-void drawProgressBar(float percent) {
-    int filled = static_cast<int>(percent * BAR_WIDTH);
-    uLCD.filled_rectangle(0, BAR_Y - BAR_HEIGHT, BAR_WIDTH, BAR_Y, BLACK);
-    uLCD.filled_rectangle(0, BAR_Y - BAR_HEIGHT, filled, BAR_Y, GREEN);
+// Up/down: menu, left/right: previous/next track (hold to scrub),
+// center: menu select + play/pause, menu: dedicated button to return to menu
+Buttons buttons(p24, p25, p26, p29, p30, p21, p19);  // up, down, left, right, center, menu, volume knob
+
+// Music library (Artist/Album folders and their songs) and its on-card cache
+// Warm boots load the cache, cold boots walk the card in the background
+Library library("/sd");
+LibraryScanner scanner("/sd");
+TrackIndex trackIndex("/sd/.tracks.idx");
+Thread scanThread(osPriorityLow, OS_STACK_SIZE, nullptr, "scan");
+
+// Artist and title from each song's ID3 tag, read on scanThread the first time the song is shown
+TrackTags trackTags("/sd/.tags.db");
+
+// Menu and playback screens, everything after boot happens on its event thread (main())
+Player player(buttons, audio, uLCD, stream, library, trackTags);
+
+// SD clock for mounting, before training finds what the card can really do
+const uint32_t SD_SAFE_HZ = 4000000;
+// Heap the library leaves free: stacks of the scan, reader and feeder threads,
+// which start after it is loaded, plus open files, paths and tags while playing
+const size_t HEAP_RESERVE = 2 * OS_STACK_SIZE + 1024 + 4096;
+
+// Hit rate of the sector cache since the last reset, on the USB serial console
+void printCacheStats(const char* what) {
+    uint32_t hits = sdCache.hits();
+    uint32_t reads = hits + sdCache.misses();
+    printf("%s: %lu sector reads, %lu%% cached, %lu read ahead, %lu bypassed\r\n", what, (unsigned long)reads,
+           (unsigned long)(reads ? hits * 100 / reads : 0), (unsigned long)sdCache.prefetched(),
+           (unsigned long)sdCache.bypassed());
 }
 
-// Call when user scrolls through songs
-void updateTrackCountDisplay() {
-    uLCD.locate(0, 0);
-    uLCD.color(WHITE);
-    uLCD.printf("Song %d/%d", currentTrack + 1, tracks.size());
-}
-
-// Simple text for play/pause in top right of lcd
-void updatePlayPauseStatus() {
-    uLCD.locate(11, 0);
-    uLCD.color(WHITE);
-    if (isPaused) {
-        uLCD.printf("Paused ");
-    } else {
-        uLCD.printf("Playing");
+// Say what a scan had to leave out of the library, if anything; the menu footer shows "full" too
+void reportLimits(Library& scanned, const char* what) {
+    if (scanned.full()) {
+        printf("%s: library memory (%u bytes) full after %u tracks\r\n", what, (unsigned)Library::budget(),
+               (unsigned)scanned.trackCount());
     }
-}
-
-// Find the song title and display it
-void displayTrackTitle(const std::string& path) {
-    uLCD.cls();
-    std::string title = path.substr(path.find_last_of("/") + 1);
-    if (title.length() > 20) {
-        title = title.substr(0, 20);
+    if (scanned.skipped() > 0) {
+        printf("%s: %u names skipped, path over %u bytes\r\n", what, (unsigned)scanned.skipped(),
+               (unsigned)Library::MAX_PATH - 1);
     }
-    // fit the song title on the center of the screen
-    int xPos = std::max(0, 8 - static_cast<int>(title.length() / 2));
-    uLCD.locate(xPos, 6);
-    uLCD.color(WHITE);
-    uLCD.printf("%s", title.c_str());
-
-    // draw the progress bar and track info when new song plays
-    drawProgressBar(0.0f);
-    updateTrackCountDisplay();
-    updatePlayPauseStatus();
 }
 
-// Song menu with control for multiple pages
-// Theres 10 songs in a page, which fits well on the lcd
-void displayMenu(int selectedIndex) {
-    uLCD.cls();
-    uLCD.color(WHITE);
-    uLCD.locate(1, 0);
-    uLCD.printf("Select a song:");
-
-    int page = selectedIndex / ITEMS_PER_PAGE;
-    int start = page * ITEMS_PER_PAGE;
-    int end = std::min(start + ITEMS_PER_PAGE, (int)tracks.size());
+// Runs on scanThread after a cold boot, or after a warm one found the index stale
+// Songs show up in the menu as the walker finds them, the cache is written at the end
+// After a warm boot only new or changed songs are opened, the rest keep what the old index says
+void scanLibrary() {
+    Timer scanTimer;
+    scanTimer.start();
+    scanner.scan(library, &trackIndex);
+    scanTimer.stop();
+    player.setLibraryReady(true);
+    printf("Scan: %u tracks, %u probed, %lu ms\r\n", (unsigned)library.trackCount(), (unsigned)scanner.probed(),
+           (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(scanTimer.elapsed_time()).count());
+    printCacheStats("Scan");
+    reportLimits(library, "Scan");
+    trackIndex.save(library);
+    trackTags.prepare();
+}
 
-    for (int i = start; i < end; i++) {
-        std::string name = tracks[i].substr(tracks[i].find_last_of("/") + 1);
-        if (name.length() > 12){ 
-            name = name.substr(0, 12);
-        }
-        int row = (i - start) + 2;  // first entry at row 2
-        uLCD.locate(1, row);
-        // Highlight the selected song in green, every other song in white
-        if (i == selectedIndex) {
-            uLCD.color(GREEN);
-            uLCD.printf("> %s", name.c_str());
-        } else {
-            uLCD.color(WHITE);
-            uLCD.printf("  %s", name.c_str());
-        }
+// Runs on scanThread after a warm boot
+// Walks the card against the index without a second copy of the library; when they differ,
+// the menu drops the list once nothing plays from it and it is built again from the card
+void refreshLibrary() {
+    Timer scanTimer;
+    scanTimer.start();
+    uint32_t hash;
+    size_t tracks = scanner.listing(hash, trackIndex.hashLimit());
+    scanTimer.stop();
+    printf("Rescan: %u tracks, %lu ms\r\n", (unsigned)tracks,
+           (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(scanTimer.elapsed_time()).count());
+    printCacheStats("Rescan");
+    trackTags.prepare();
+    if (trackIndex.matches(tracks, hash) || tracks == 0) {
+        return;
     }
+    player.replaceLibrary();
+    scanLibrary();
+}
 
-    // Track which page we're on in the bottom left of the screen
-    int totalPages = (tracks.size() + ITEMS_PER_PAGE - 1) / ITEMS_PER_PAGE;
-    uLCD.locate(0, 15);
-    uLCD.color(WHITE);
-    uLCD.printf("Page %d/%d", page + 1, totalPages);
+// scanThread's entry points: bring the library up to date, then stay to read the tags the menu and
+// song screens ask for, so no ID3 parse or tag cache access holds up the event thread
+void scanTask() {
+    scanLibrary();
+    trackTags.serve(library);
 }
 
-// Nav switch controls for scrubbing through the menu
-void selectTrackMenu() {
-    int selection = 0;
-    displayMenu(selection);
+void refreshTask() {
+    refreshLibrary();
+    trackTags.serve(library);
+}
 
-    while (true) {
-        if (!navUp) {
-            selection = (selection - 1 + tracks.size()) % tracks.size();
-            displayMenu(selection);
-            // Call some sleeps so the mbed can keep up
-            // This makes the menu display a bit slow as it goes through all 10 songs
-            ThisThread::sleep_for(200ms);
-            // Some delay to avoid double-inputs
-            while (!navUp) ThisThread::sleep_for(20ms);
-        }
-        if (!navDown) {
-            selection = (selection + 1) % tracks.size();
-            displayMenu(selection);
-            ThisThread::sleep_for(200ms);
-            while (!navDown) ThisThread::sleep_for(20ms);
-        }
-        if (!navCenter) {
-            currentTrack = selection;
-            trackChanged = true;
-            isPaused = false;
-            while (!navCenter) ThisThread::sleep_for(20ms);
-            break;
-        }
-        ThisThread::sleep_for(50ms);
-    }
+void tagTask() {
+    trackTags.serve(library);
 }
 
 // On reset, put up a simple loading screen and initialize with function calls
 void initializePlayer() {
+#if PLAYER_STATS
+    Stats::begin();
+#endif
+    // The screen powers up at 9600 baud, where a full menu takes hundreds of ms to draw
+    printf("LCD link: %d baud\r\n", uLCD.auto_baudrate());
     uLCD.cls();
     uLCD.color(WHITE);
     uLCD.locate(4, 6);
@@ -162,163 +144,111 @@ void initializePlayer() {
     // Delay a little after reset so that the VS1053 initializes properly
     ThisThread::sleep_for(100ms);
     audio.modeSwitch();
-    audio.clockUp();
+    // clockUp() also raises the SPI clock to match the PLL, report what the bus achieved
+    // A 320 kbps MP3 needs well under 1 Mbit/s, so this is our streaming headroom
+    if (!audio.clockUp()) {
+        printf("VS1053 clock readback failed, staying on slow SPI\r\n");
+    }
+    printf("VS1053 SDI rate: %lu bit/s\r\n", (unsigned long)audio.dataRate());
 
-    uint8_t vol = static_cast<uint8_t>(255 * (1.0f - volumeKnob.read()));
+    uint8_t vol = static_cast<uint8_t>(255 * (1.0f - buttons.volume()));
     audio.setVolume(vol); // initial volume reading from potentiometer
 
     // Attempt to mount the sd with the file system so we can start reading song files
-    sd.frequency(4000000);
-    if (fs.mount(&sd)) {
+    // Mount at a clock every card handles, then move up to the fastest one this card reads cleanly at
+    // FatFs goes through the sector cache, songs past it; clock training talks to the card itself
+    sd.frequency(SD_SAFE_HZ);
+    if (fs.mount(&sdCache, sdCache.uncached())) {
         uLCD.cls();
         uLCD.locate(2, 6);
         uLCD.printf("SD Fail");
+        player.setLibraryReady(true);  // nothing more is coming
         return;
     }
-
-    // Once mounted, create the directory that the mbed can read
-    DIR *dir = opendir("/sd");
-    if (dir) {
-        // file system entry
-        struct dirent *ent;
-        while ((ent = readdir(dir)) != nullptr) {
-            std::string filename = ent->d_name;
-            // Check the file name and ensure it is a type mp3 before continuing
-            if (filename.length() > 4 && filename.substr(filename.length() - 4) == ".mp3") {
-                tracks.push_back("/sd/" + filename);
-            }
-        }
-        // Close the directory once read
-        closedir(dir);
+    SdClock sdClock(sd, "/sd/.sdclock");
+    Timer clockTimer;
+    clockTimer.start();
+    uint32_t sdHz = sdClock.tune(SD_SAFE_HZ);
+    clockTimer.stop();
+    printf("SD clock: %lu Hz, %s in %lu ms\r\n", (unsigned long)sdHz, sdClock.wasTrained() ? "trained" : "saved",
+           (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(clockTimer.elapsed_time()).count());
+
+    // The library may have whatever heap is left once the rest of the player has its share
+    mbed_stats_heap_t heap;
+    mbed_stats_heap_get(&heap);
+    size_t freeHeap = heap.reserved_size - heap.current_size - heap.overhead_size;
+    Library::setBudget(freeHeap > HEAP_RESERVE ? freeHeap - HEAP_RESERVE : 0);
+    printf("Library: %u bytes of %u free heap\r\n", (unsigned)Library::budget(), (unsigned)freeHeap);
+
+    // Warm boot: take the library straight from the index file, then check it in the background
+    // Cold boot (or no index yet): walk the card in the background and fill the menu as we go
+    Timer bootTimer;
+    bootTimer.start();
+    bool warm = trackIndex.load(library) && library.trackCount() > 0;
+    bootTimer.stop();
+    printf("Library: %u tracks, %s boot, %lu ms\r\n", (unsigned)library.trackCount(), warm ? "warm" : "cold",
+           (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(bootTimer.elapsed_time()).count());
+    if (library.trackCount() > 0) {
+        printf("Library: %u bytes, %u per 1000 tracks\r\n", (unsigned)library.memoryUsage(),
+               (unsigned)(library.memoryUsage() * 1000 / library.trackCount()));
     }
-}
-
-// Playback
-void playCurrentTrack() {
-    if (tracks.empty()) {
-        return;
+    player.setLibraryReady(warm);
+#if MBED_CONF_APP_BENCHMARK
+    // Measure the card before the scanner and the audio reader start sharing it,
+    // a cold boot walks the card in the foreground first so there is a song to read
+    if (!warm) {
+        scanLibrary();
     }
-
-    FILE *file = fopen(tracks[currentTrack].c_str(), "rb");
-    if (!file) {
-        return;
+    if (library.trackCount() > 0) {
+        Benchmark(audio, uLCD, &fs).run(library.trackPath(0).c_str());
     }
+    scanThread.start(warm ? refreshTask : tagTask);
+#else
+    scanThread.start(warm ? refreshTask : scanTask);
+#endif
+
+    // Start the background reader that keeps the audio ring buffer full
+    // and the feeder that drains it into the VS1053 on every DREQ rising edge
+    stream.start(audio, &fs);
+}
 
-    // File seek functionality with SDBlockDevice API
-    // It lets us keep track of which chunk of the song we're in
-    // This is the core of the play and pause functionality.
-    fseek(file, 0, SEEK_END);
-    long totalBytes = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    /* The resume position variable, initialized to zero at the beginning, is maintained through the
-    program to let us go back to a certain point in songs
-    */
-    fseek(file, resumePosition, SEEK_SET);
-
-    // An array that holds 32 bytes of audio data
-    // We will play our songs in chunks at a time
-    char buffer[32];
-    // The amount of bytes read by the buffer
-    // Should be 32 bytes up until near the end of a song, where it can fill with less
-    size_t bytesRead;
-    // A counter that serves essentially lets us poll volume changes
-    uint32_t counter = 0;
-
-    while (true) {
-        // Return to menu
-        if (!menuButton) {
-            ThisThread::sleep_for(200ms);
-            fclose(file);
-            while (!menuButton) ThisThread::sleep_for(20ms);
-            selectTrackMenu();
-            resumePosition = 0;
-            break;
-        }
-
-        // Pause/Resume
-        if (!navCenter) {
-            ThisThread::sleep_for(200ms);
-            isPaused = !isPaused;
-            resumePosition = ftell(file);
-            updatePlayPauseStatus();
-            while (!navCenter) ThisThread::sleep_for(50ms);
-        }
-
-        if (!isPaused) {
-            // Skip tracks
-            if (!navRight) {
-                ThisThread::sleep_for(200ms);
-                currentTrack = (currentTrack + 1) % tracks.size();
-                trackChanged = true;
-                fclose(file);
-                while (!navRight) ThisThread::sleep_for(50ms);
-                break;
-            } else if (!navLeft) {
-                ThisThread::sleep_for(200ms);
-                currentTrack = (currentTrack - 1 + tracks.size()) % tracks.size();
-                trackChanged = true;
-                fclose(file);
-                while (!navLeft) ThisThread::sleep_for(50ms);
-                break;
-            }
-            // This is where we fill the buffer with song data
-            bytesRead = fread(buffer, 1, sizeof(buffer), file);
-            if (bytesRead == 0) {
-                break;
-            }
-            // Send the song data to the VS1053 for decoding
-            audio.sendDataBlock(buffer, bytesRead);
-        }
-
-        // Only check potentiometer and update progess bar every 200 iterations
-        /* This reduces strain on the mbed and should ensure that updating volume/progress doesn't hurt
-        audio quality. An issue that persisted when we tried to display volume.
-        */
-        if (++counter % 200 == 0) {
-            uint8_t vol = static_cast<uint8_t>(255 * (1.0f - volumeKnob.read()));
-            audio.setVolume(vol);
-
-            long currentPos = ftell(file);
-            float progress = static_cast<float>(currentPos) / totalBytes;
-            drawProgressBar(progress);
+#if PLAYER_STATS
+// Type 's' on the USB serial console for the timing table, 'r' to zero it
+void checkConsole() {
+    FileHandle* console = mbed_file_handle(STDIN_FILENO);
+    char c;
+    while (console && console->readable() && console->read(&c, 1) == 1) {
+        if (c == 's') {
+            Stats::dump();
+            printCacheStats("SD cache");
+        } else if (c == 'r') {
+            Stats::reset();
+            sdCache.resetCounters();
         }
     }
-    // Close the current song file
-    fclose(file);
-    // Reset the track position to the beginning when a new song starts.
-    if (!trackChanged) {
-        resumePosition = 0;
-    }
 }
+#endif
 
 // The main program
 int main() {
     initializePlayer();
+    // On a cold boot give the scanner a chance to find the first song
+    while (library.trackCount() == 0 && !player.libraryReady()) {
+        ThisThread::sleep_for(50ms);
+    }
     // If the SD card goes unread, throw up some text on the lcd
-    if (tracks.empty()) {
+    if (library.trackCount() == 0) {
         uLCD.cls();
         uLCD.locate(2, 6);
         uLCD.printf("No MP3s");
         return 1;
     }
 
-    // Load the song menu
-    selectTrackMenu();
-
-    // Program loop to initialize audio. Contingent on song changes.
-    while (true) {
-        if (trackChanged) {
-            audio.hardwareReset();
-            ThisThread::sleep_for(100ms);
-            audio.modeSwitch();
-            audio.clockUp();
-            displayTrackTitle(tracks[currentTrack]);
-            updatePlayPauseStatus();  
-            resumePosition = 0;
-            trackChanged = false;
-        }
-
-        playCurrentTrack();
-        ThisThread::sleep_for(50ms);
-    }
+    // From here on everything happens in response to an event: buttons and the UI ticker
+    // post them from interrupts, the stream and the scanner from their own threads
+#if PLAYER_STATS
+    player.attachTick(checkConsole);
+#endif
+    player.start();
+    player.run();
 }
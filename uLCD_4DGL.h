@@ -21,6 +21,7 @@
 // @author Stephane Rochon
 
 #include "mbed.h"
+#include "DisplayLink.h"
 #ifndef _uLCD
 #define _uLCD 0
 // Debug Verbose off - SGE commands echoed to USB serial for debugmode=1
@@ -31,6 +32,17 @@
 // Common WAIT value in milliseconds between commands
 #define TEMPO 0
 
+// Goldelox receive FIFO in bytes; longer commands are sent in bursts of this size
+#define RX_FIFO 16
+
+// Commands posted ahead of their ACK, and how long to wait for one before giving up
+#define LCD_WINDOW 4
+#define ACK_TIMEOUT 500ms
+
+// Text shadow: one cell per character of the 8 pixel high fonts at size 1
+#define SHADOW_COLS 21
+#define SHADOW_ROWS 16
+
 // 4DGL SGE Function values for Goldelox Processor
 #define CLS          '\xD7'
 #define BAUDRATE     '\x0B' //null prefix
@@ -182,15 +194,17 @@
 
 //**************************************************************************
 // \class uLCD_4DGL uLCD_4DGL.h
-// \brief This is the main class. It shoud be used like this : uLCD_4GDL myLCD(p9,p10,p11);
+// \brief This is the main class. It shoud be used like this : UartLink link(p9,p10,p11); uLCD_4GDL myLCD(link);
 /**
 Example:
 * @code
 * // Display a white circle on the screen
 * #include "mbed.h"
 * #include " uLCD_4DGL.h"
+* #include "UartLink.h"
 *
-* uLCD_4GDL myLCD(p9,p10,p11);
+* UartLink link(p9,p10,p11);  // TX, RX, RESET
+* uLCD_4GDL myLCD(link);
 *
 * int main() {
 *     myLCD.circle(120, 160, 80, WHITE);
@@ -203,7 +217,7 @@ class uLCD_4DGL : public Stream
 
 public :
 
-    uLCD_4DGL(PinName tx, PinName rx, PinName rst);
+    uLCD_4DGL(DisplayLink& link);
 
 // General Commands *******************************************************************************
 
@@ -217,7 +231,13 @@ public :
     /** Set serial Baud rate (both sides : screen and mbed)
     * @param Speed Correct BAUD value (see uLCD_4DGL.h)
     */
-    void baudrate(int speed);
+    int  baudrate(int speed);
+    /** Raise the link to the fastest rate that still answers reliably
+    * Steps down the rate table from max_speed on NAK or timeout
+    * @param max_speed Fastest rate to try, must be in the baud table
+    * @return The rate in use afterwards
+    */
+    int  auto_baudrate(int max_speed = 1500000);
 
     /** Set background colour to the specified value
     * @param color in HEX RGB like 0xFF00FF
@@ -240,6 +260,8 @@ public :
     * @param value Correct range is 8 - 127
     */
     void set_volume(char value);
+    /** @return Current baud rate of the link */
+    int  current_baudrate() { return _baud; }
 
 // Graphics Commands *******************************************************************************
 
@@ -296,6 +318,15 @@ public :
     int firmware;
     int reserved1;
     int reserved2;
+    int commands;       // commands sent since power up, for throughput measurements
+    int naks;           // commands the screen answered with NAK
+    int lost;           // commands whose answer didn't come within ACK_TIMEOUT
+    int bytes;          // bytes sent to the screen since power up
+    int wraps;          // text lines that ran past the right edge since power up
+    /** Block until the screen has answered every posted command
+    * @return 1 if every answer since the last report was ACK, -1 if one was NAK, 0 if one never came
+    */
+    int  wait_idle();
 
 // Text data
     char current_col;
@@ -312,8 +343,27 @@ public :
 
 protected :
 
-    mbed::BufferedSerial _cmd;
-    DigitalOut _rst;
+    DisplayLink& _cmd;            // the UART on the board, an emulator on a host
+    int _baud;
+    Timer _pace;                  // since the last burst went to the UART
+    int _paceUs;                  // how long the screen needs before the next one
+    int _pending;                 // commands sent but not yet answered
+    int _inflight;                // their bytes still possibly in the screen FIFO
+    char _window[LCD_WINDOW];     // FIFO bytes of each pending command, oldest first
+    int _oldest;
+    int _answers;                 // worst answer collected since wait_idle last reported
+    EventFlags _received;         // set by the link's receive interrupt, waitANSWER sleeps on it
+    // What the glass already shows, so printf only sends characters that change
+    char  _shadow_char[SHADOW_ROWS][SHADOW_COLS];   // 0 = unknown
+    short _shadow_color[SHADOW_ROWS][SHADOW_COLS];  // RGB565, 0 for blanks
+    int   _glass_col, _glass_row;                   // screen's own text cursor, -1 = unknown
+    int   _glass_color;                             // screen's text colour, -1 = unknown
+    bool  _opaque;
+    bool shadowACTIVE(void);
+    void shadowCLEAR (char);
+    void shadowDIRTY (int, int, int, int);
+    void syncCURSOR  (void);
+    void syncCOLOR   (void);
     //used by printf
     virtual int _putc(int c) {
         putc(c);
@@ -326,8 +376,17 @@ protected :
     void freeBUFFER  (void);
     void writeBYTE   (char);
     void writeBYTEfast   (char);
+    void writeBLOCK  (const char *, int);
+    bool waitANSWER  (void);
+    bool waitANSWER  (Kernel::Clock::time_point);
+    void onRECEIVE   (void);
+    void forgetGLASS (void);
+    int  readACK     (void);
+    int  writeFRAME  (char, char *, int);
+    int  writeCOMMANDsync(char *, int);
     int  writeCOMMAND(char *, int);
     int  writeCOMMANDnull(char *, int);
+    bool probeLINK   (int);
     int  readVERSION (char *, int);
     int  getSTATUS   (char *, int);
     int  version     (void);
@@ -19,6 +19,7 @@
 
 #include "mbed.h"
 #include "uLCD_4DGL.h"
+#include <algorithm>
 
 #define ARRAY_SIZE(X) sizeof(X)/sizeof(X[0])
 
@@ -45,6 +46,7 @@ void uLCD_4DGL :: circle(int x, int y , int radius, int color)     // draw a cir
     command[7] = ((red5 << 3)   + (green6 >> 3)) & 0xFF;  // first part of 16 bits color
     command[8] = ((green6 << 5) + (blue5 >>  0)) & 0xFF;  // second part of 16 bits color
 
+    shadowDIRTY(x - radius, y - radius, x + radius, y + radius);
     writeCOMMAND(command, 9);
 }
 //****************************************************************************************************
@@ -70,6 +72,7 @@ void uLCD_4DGL :: filled_circle(int x, int y , int radius, int color)     // dra
     command[7] = ((red5 << 3)   + (green6 >> 3)) & 0xFF;  // first part of 16 bits color
     command[8] = ((green6 << 5) + (blue5 >>  0)) & 0xFF;  // second part of 16 bits color
 
+    shadowDIRTY(x - radius, y - radius, x + radius, y + radius);
     writeCOMMAND(command, 9);
 }
 
@@ -105,6 +108,8 @@ void uLCD_4DGL :: triangle(int x1, int y1 , int x2, int y2, int x3, int y3, int
     command[13] = ((red5 << 3)   + (green6 >> 3)) & 0xFF;  // first part of 16 bits color
     command[14] = ((green6 << 5) + (blue5 >>  0)) & 0xFF;  // second part of 16 bits color
 
+    shadowDIRTY(std::min(x1, std::min(x2, x3)), std::min(y1, std::min(y2, y3)),
+                std::max(x1, std::max(x2, x3)), std::max(y1, std::max(y2, y3)));
     writeCOMMAND(command, 15);
 }
 
@@ -134,6 +139,7 @@ void uLCD_4DGL :: line(int x1, int y1 , int x2, int y2, int color)     // draw a
     command[9] = ((red5 << 3)   + (green6 >> 3)) & 0xFF;   // first part of 16 bits color
     command[10] = ((green6 << 5) + (blue5 >>  0)) & 0xFF;  // second part of 16 bits color
 
+    shadowDIRTY(std::min(x1, x2), std::min(y1, y2), std::max(x1, x2), std::max(y1, y2));
     writeCOMMAND(command, 11);
 }
 
@@ -163,6 +169,7 @@ void uLCD_4DGL :: rectangle(int x1, int y1 , int x2, int y2, int color)     // d
     command[9] = ((red5 << 3)   + (green6 >> 3)) & 0xFF;   // first part of 16 bits color
     command[10] = ((green6 << 5) + (blue5 >>  0)) & 0xFF;  // second part of 16 bits color
 
+    shadowDIRTY(x1, y1, x2, y2);
     writeCOMMAND(command, 11);
 }
 
@@ -192,6 +199,7 @@ void uLCD_4DGL :: filled_rectangle(int x1, int y1 , int x2, int y2, int color)
     command[9] = ((red5 << 3)   + (green6 >> 3)) & 0xFF;   // first part of 16 bits color
     command[10] = ((green6 << 5) + (blue5 >>  0)) & 0xFF;  // second part of 16 bits color
 
+    shadowDIRTY(x1, y1, x2, y2);
     writeCOMMAND(command, 11);
 }
 
@@ -217,48 +225,43 @@ void uLCD_4DGL :: pixel(int x, int y, int color)     // draw a pixel
     command[5] = ((red5 << 3)   + (green6 >> 3)) & 0xFF;  // first part of 16 bits color
     command[6] = ((green6 << 5) + (blue5 >>  0)) & 0xFF;  // second part of 16 bits color
 
+    shadowDIRTY(x, y, x, y);
     writeCOMMAND(command, 7);
 }
 //****************************************************************************************************
 void uLCD_4DGL :: BLIT(int x, int y, int w, int h, int *colors)     // draw a block of pixels
 {
     int red5, green6, blue5;
-    writeBYTEfast('\x00');
-    writeBYTEfast(BLITCOM);
-    writeBYTEfast((x >> 8) & 0xFF);
-    writeBYTEfast(x & 0xFF);
-    writeBYTEfast((y >> 8) & 0xFF);
-    writeBYTEfast(y & 0xFF);
-    writeBYTEfast((w >> 8) & 0xFF);
-    writeBYTE(w & 0xFF);
-    writeBYTE((h >> 8) & 0xFF);
-    writeBYTE(h & 0xFF);
+    char header[10], pixels[RX_FIFO];
+    header[0] = '\x00';
+    header[1] = BLITCOM;
+    header[2] = (x >> 8) & 0xFF;
+    header[3] = x & 0xFF;
+    header[4] = (y >> 8) & 0xFF;
+    header[5] = y & 0xFF;
+    header[6] = (w >> 8) & 0xFF;
+    header[7] = w & 0xFF;
+    header[8] = (h >> 8) & 0xFF;
+    header[9] = h & 0xFF;
+    freeBUFFER();
+    shadowDIRTY(x, y, x + w - 1, y + h - 1);
+    writeBLOCK(header, 10);
     wait_us(1000);
+    int n = 0;
     for (int i=0; i<w*h; i++) {
         red5   = (colors[i] >> (16 + 3)) & 0x1F;              // get red on 5 bits
         green6 = (colors[i] >> (8 + 2))  & 0x3F;              // get green on 6 bits
         blue5  = (colors[i] >> (0 + 3))  & 0x1F;              // get blue on 5 bits
-        writeBYTEfast(((red5 << 3)   + (green6 >> 3)) & 0xFF);  // first part of 16 bits color
-        writeBYTEfast(((green6 << 5) + (blue5 >> 0)) & 0xFF);  // second part of 16 bits color
-    }
-    int resp=0;
-    while (!_cmd.readable()) wait_us(TEMPO);              // wait for screen answer
-    if (_cmd.readable()) _cmd.read(&resp, 1);           // read response if any
-    switch (resp) {
-        case ACK :                                     // if OK return   1
-            resp =  1;
-            break;
-        case NAK :                                     // if NOK return -1
-            resp = -1;
-            break;
-        default :
-            resp =  0;                                 // else return   0
-            break;
+        pixels[n++] = ((red5 << 3)   + (green6 >> 3)) & 0xFF;  // first part of 16 bits color
+        pixels[n++] = ((green6 << 5) + (blue5 >> 0)) & 0xFF;  // second part of 16 bits color
+        if (n == RX_FIFO) {                                    // one paced burst of pixels
+            writeBLOCK(pixels, n);
+            n = 0;
+        }
     }
-#if DEBUGMODE
-    printf("   Answer received : %d\n",resp);
-#endif
-
+    if (n > 0) writeBLOCK(pixels, n);
+    commands++;
+    readACK();
 }
 //******************************************************************************************************
 int uLCD_4DGL :: read_pixel(int x, int y)   // read screen info and populate data
@@ -274,14 +277,12 @@ int uLCD_4DGL :: read_pixel(int x, int y)   // read screen info and populate dat
     command[4] = (y >> 8) & 0xFF;
     command[5] = y & 0xFF;
 
-    int i, temp = 0, color = 0, resp = 0;
+    int temp = 0, color = 0, resp = 0;
     char response[3] = "";
 
     freeBUFFER();
 
-    for (i = 0; i < 6; i++) {                   // send all chars to serial port
-        writeBYTE(command[i]);
-    }
+    writeBLOCK(command, 6);                     // send all chars to serial port
 
     while (!_cmd.readable()) wait_us(TEMPO);    // wait a bit for screen answer
 
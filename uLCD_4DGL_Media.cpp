@@ -29,7 +29,7 @@ int uLCD_4DGL :: media_init()
     int resp = 0;
     char command[1] = "";
     command[0] = MINIT;
-    writeCOMMAND(command, 1);
+    writeCOMMANDsync(command, 1);
     while (!_cmd.readable()) wait_us(TEMPO);              // wait for screen answer
     if (_cmd.readable()) _cmd.read(&resp, 2);
     return resp;
@@ -70,7 +70,7 @@ char uLCD_4DGL :: read_byte()
     char resp = 0;
     char command[1] = "";
     command[0] = READBYTE;
-    writeCOMMAND(command, 1);
+    writeCOMMANDsync(command, 1);
     while (!_cmd.readable()) wait_us(TEMPO);              // wait for screen answer
     if (_cmd.readable()) _cmd.read(&resp, 1);
     return resp;
@@ -82,7 +82,7 @@ int  uLCD_4DGL :: read_word()
     int resp=0;
     char command[1] = "";
     command[0] = READWORD;
-    writeCOMMAND(command, 1);
+    writeCOMMANDsync(command, 1);
     while (!_cmd.readable()) wait_us(TEMPO);              // wait for screen answer
     if (_cmd.readable()) _cmd.read(&resp, 2);
     return resp;
@@ -132,6 +132,7 @@ void uLCD_4DGL :: display_image(int x, int y)
     command[3] = (y >> 8) & 0xFF;
     command[4] = y & 0xFF;
     writeCOMMAND(command, 5);
+    shadowCLEAR(0);
 }
 
 //******************************************************************************************************
@@ -146,6 +147,7 @@ void uLCD_4DGL :: display_video(int x, int y)
     command[3] = (y >> 8) & 0xFF;
     command[4] = y & 0xFF;
     writeCOMMAND(command, 5);
+    shadowCLEAR(0);
 }
 
 //******************************************************************************************************
@@ -164,5 +166,6 @@ void uLCD_4DGL :: display_frame(int x, int y, int w)
     command[5] = (w >> 8) & 0xFF;
     command[6] = w & 0xFF;
     writeCOMMAND(command,7);
+    shadowCLEAR(0);
 }
 
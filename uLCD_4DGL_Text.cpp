@@ -19,6 +19,8 @@
 
 #include "mbed.h"
 #include "uLCD_4DGL.h"
+#include <algorithm>
+#include <cstring>
 
 //****************************************************************************************************
 void uLCD_4DGL :: set_font_size(char width, char height)     // set font size
@@ -44,6 +46,7 @@ void uLCD_4DGL :: set_font(char mode)     // set font - system or SD media
     command[2] = mode;
 
     current_font = mode;
+    int old_fx = current_fx, old_fy = current_fy;
 
     if (current_orientation == IS_PORTRAIT) {
         current_w = SIZE_X;
@@ -84,6 +87,7 @@ void uLCD_4DGL :: set_font(char mode)     // set font - system or SD media
     max_row = current_h / (current_fy*current_hf);
 
     writeCOMMAND(command, 3);
+    if (current_fx != old_fx || current_fy != old_fy) shadowCLEAR(0);   // cells moved
 }
 
 
@@ -96,6 +100,7 @@ void uLCD_4DGL :: text_mode(char mode)     // set text mode
     command[0] = TEXTMODE;
     command[1] = 0;
     command[2] = mode;
+    _opaque = mode == OPAQUE;               // transparent text can't overwrite in place
 
     writeCOMMAND(command, 3);
 }
@@ -156,6 +161,7 @@ void uLCD_4DGL :: text_width(char width)     // set text width
     command[0] = TEXTWIDTH;
     command[1] = 0;
     command[2] = width;
+    if (current_wf != width) shadowCLEAR(0);
     current_wf = width;
     max_col = current_w / (current_fx*current_wf);
     writeCOMMAND(command, 3);
@@ -169,6 +175,7 @@ void uLCD_4DGL :: text_height(char height)     // set text height
     command[0] = TEXTHEIGHT;
     command[1] = 0;
     command[2] = height;
+    if (current_hf != height) shadowCLEAR(0);
     current_hf = height;
     max_row = current_h / (current_fy*current_hf);
     writeCOMMAND(command, 3);
@@ -200,6 +207,9 @@ void uLCD_4DGL :: text_char(char c, char col, char row, int color)     // draw a
     command[1] = 0;
     command[2] = c;
     writeCOMMAND(command, 3);
+    _glass_col = _glass_row = -1;
+    _glass_color = color;
+    if (row < SHADOW_ROWS && col < SHADOW_COLS) _shadow_char[(int)row][(int)col] = 0;
 
 }
 
@@ -234,6 +244,9 @@ void uLCD_4DGL :: text_string(char *s, char col, char row, char font, int color)
     for (i=0; i<size; i++) command[1+i] = s[i];
     command[1+size] = 0;
     writeCOMMANDnull(command, 2 + size);
+    _glass_col = _glass_row = -1;
+    _glass_color = color;
+    shadowCLEAR(0);                         // may have used another font
 }
 
 
@@ -241,31 +254,74 @@ void uLCD_4DGL :: text_string(char *s, char col, char row, char font, int color)
 //****************************************************************************************************
 void uLCD_4DGL :: locate(char col, char row)     // place text curssor at col, row
 {
-    char command[5] = "";
+    // Only remembered here, the screen's cursor follows when a character is actually drawn
     current_col = col;
     current_row = row;
+}
+
+//****************************************************************************************************
+void uLCD_4DGL :: color(int color)     // set text color
+{
+    current_color = color;                  // sent with the next character that needs it
+}
+
+//****************************************************************************************************
+void uLCD_4DGL :: syncCURSOR(void)     // move the screen's text cursor to ours if it isn't there
+{
+    char command[5] = "";
+    if (_glass_col == current_col && _glass_row == current_row) return;
     command[0] = MOVECURSOR; //move cursor
     command[1] = 0;
     command[2] = current_row;
     command[3] = 0;
     command[4] = current_col;
     writeCOMMAND(command, 5);
+    _glass_col = current_col;
+    _glass_row = current_row;
 }
 
 //****************************************************************************************************
-void uLCD_4DGL :: color(int color)     // set text color
+void uLCD_4DGL :: syncCOLOR(void)     // send the text color if the screen has another one
 {
-    char command[5] = "";
-    current_color = color;
+    char command[3] = "";
+    if (_glass_color == current_color) return;
     command[0] = 0x7F;  //set color
 
-    int red5   = (color >> (16 + 3)) & 0x1F;              // get red on 5 bits
-    int green6 = (color >> (8 + 2))  & 0x3F;              // get green on 6 bits
-    int blue5  = (color >> (0 + 3))  & 0x1F;              // get blue on 5 bits
+    int red5   = (current_color >> (16 + 3)) & 0x1F;      // get red on 5 bits
+    int green6 = (current_color >> (8 + 2))  & 0x3F;      // get green on 6 bits
+    int blue5  = (current_color >> (0 + 3))  & 0x1F;      // get blue on 5 bits
 
     command[1] = ((red5 << 3)   + (green6 >> 3)) & 0xFF;  // first part of 16 bits color
     command[2] = ((green6 << 5) + (blue5 >>  0)) & 0xFF;  // second part of 16 bits color
     writeCOMMAND(command, 3);
+    _glass_color = current_color;
+}
+
+//****************************************************************************************************
+bool uLCD_4DGL :: shadowACTIVE(void)     // can cells be compared against the shadow
+{
+    return _opaque && current_wf == 1 && current_hf == 1 && current_fy == 8 &&
+           max_col <= SHADOW_COLS && max_row <= SHADOW_ROWS;
+}
+
+//****************************************************************************************************
+void uLCD_4DGL :: shadowCLEAR(char c)     // set every cell to blank (' ') or unknown (0)
+{
+    memset(_shadow_char, c, sizeof(_shadow_char));
+    memset(_shadow_color, 0, sizeof(_shadow_color));
+}
+
+//****************************************************************************************************
+void uLCD_4DGL :: shadowDIRTY(int x1, int y1, int x2, int y2)     // forget cells under a drawing
+{
+    int w = current_fx * current_wf, h = current_fy * current_hf;
+    if (x1 > x2) std::swap(x1, x2);
+    if (y1 > y2) std::swap(y1, y2);
+    int c1 = std::max(x1, 0) / w, c2 = std::min(x2 / w, SHADOW_COLS - 1);
+    int r1 = std::max(y1, 0) / h, r2 = std::min(y2 / h, SHADOW_ROWS - 1);
+    for (int r = r1; r <= r2; r++) {
+        for (int c = c1; c <= c2; c++) _shadow_char[r][c] = 0;
+    }
 }
 
 //****************************************************************************************************
@@ -275,52 +331,49 @@ void uLCD_4DGL :: putc(char c)      // place char at current cursor position
     char command[6] ="";
     if(c<0x20) {
         if(c=='\n') {
-            current_col = 0;
+            current_col = 0;                //cursor to start of next line, moved lazily
             current_row++;
-            command[0] = MOVECURSOR; //move cursor to start of next line
-            command[1] = 0;
-            command[2] = current_row;
-            command[3] = 0;
-            command[4] = current_col;
-            writeCOMMAND(command, 5);
         }
         if(c=='\r') {
-            current_col = 0;
-            command[0] = MOVECURSOR; //move cursor to start of line
-            command[1] = 0;
-            command[2] = current_row;
-            command[3] = 0;
-            command[4] = current_col;
-            writeCOMMAND(command, 5);
+            current_col = 0;                //cursor to start of line
         }
         if(c=='\f') {
             uLCD_4DGL::cls(); //clear screen on form feed
         }
     } else {
-        command[0] = PUTCHAR;
-        command[1] = 0x00;
-        command[2] = c;
-        writeCOMMAND(command,3);
-        current_col++;
-    }
-    if (current_col == max_col) {
-        current_col = 0;
-        current_row++;
-        command[0] = MOVECURSOR; //move cursor to next line
-        command[1] = 0;
-        command[2] = current_row;
-        command[3] = 0;
-        command[4] = current_col;
-        writeCOMMAND(command, 5);
+        if (current_col >= max_col) {
+            current_col = 0;                //only a character past the last column moves to the next line
+            current_row++;
+            wraps++;                        //lets callers repaint graphics the text may have run into
+            if (current_row >= max_row) current_row = 0;
+        }
+        int row = current_row, col = current_col;
+        bool tracked = shadowACTIVE() && row < SHADOW_ROWS && col < SHADOW_COLS;
+        int red5   = (current_color >> (16 + 3)) & 0x1F;
+        int green6 = (current_color >> (8 + 2))  & 0x3F;
+        int blue5  = (current_color >> (0 + 3))  & 0x1F;
+        short shade = c == ' ' ? 0 : (short)((red5 << 11) | (green6 << 5) | blue5);
+        // Skip characters the glass already shows; the screen's cursor then lags ours
+        if (!tracked || _shadow_char[row][col] != c || _shadow_color[row][col] != shade) {
+            syncCURSOR();
+            syncCOLOR();
+            command[0] = PUTCHAR;
+            command[1] = 0x00;
+            command[2] = c;
+            writeCOMMAND(command,3);
+            _glass_col++;
+            if (_glass_col >= max_col) {
+                _glass_col = _glass_row = -1;   // the screen wrapped its own cursor, resend ours
+            }
+            if (tracked) {
+                _shadow_char[row][col] = c;
+                _shadow_color[row][col] = shade;
+            }
+        }
+        current_col++;                      //may now be max_col, wrapped by the next character
     }
     if (current_row == max_row) {
-        current_row = 0;
-        command[0] = MOVECURSOR; //move cursor back to start
-        command[1] = 0;
-        command[2] = current_row;
-        command[3] = 0;
-        command[4] = current_col;
-        writeCOMMAND(command, 5);
+        current_row = 0;                    //cursor back to start
     }
 }
 
@@ -19,21 +19,39 @@
 
 #include "mbed.h"
 #include "uLCD_4DGL.h"
+#include "Stats.h"
 
 #define ARRAY_SIZE(X) sizeof(X)/sizeof(X[0])
 
+static const uint32_t ANSWER_FLAG = 1;   // _received: the link has a byte for us
+
 //Serial pc(USBTX,USBRX);
 
 
 //******************************************************************************************************
-uLCD_4DGL :: uLCD_4DGL(PinName tx, PinName rx, PinName rst) : _cmd(tx, rx),
-    _rst(rst)
+uLCD_4DGL :: uLCD_4DGL(DisplayLink& link) : _cmd(link)
 #if DEBUGMODE
     ,pc(USBTX, USBRX)
 #endif // DEBUGMODE
 {
     // Constructor
     _cmd.set_baud(9600);
+    _baud = 9600;
+    _paceUs = 0;
+    _pace.start();
+    _cmd.sigio(callback(this, &uLCD_4DGL::onRECEIVE));
+    commands = 0;
+    naks = 0;
+    lost = 0;
+    _pending = 0;
+    _inflight = 0;
+    _oldest = 0;
+    _answers = 1;
+    bytes = 0;
+    wraps = 0;
+    _glass_col = _glass_row = -1;
+    _glass_color = -1;
+    _opaque = false;
 #if DEBUGMODE
     pc.baud(115200);
 
@@ -43,7 +61,7 @@ uLCD_4DGL :: uLCD_4DGL(PinName tx, PinName rx, PinName rst) : _cmd(tx, rx),
     printf("*********************\n");
 #endif
 
-    _rst = 1;    // put RESET pin to high to start TFT screen
+    _cmd.reset_line(1);    // put RESET pin to high to start TFT screen
     reset();
     cls();       // clear screen
     current_col         = 0;            // initial cursor col
@@ -53,15 +71,15 @@ uLCD_4DGL :: uLCD_4DGL(PinName tx, PinName rx, PinName rst) : _cmd(tx, rx),
     current_hf = 1;
     current_wf = 1;
     set_font(FONT_7X8);                 // initial font
-//   text_mode(OPAQUE);                  // initial texr mode
+    text_mode(OPAQUE);                  // initial text mode, lets the shadow overwrite text in place
+    shadowCLEAR(' ');
 }
 
 //******************************************************************************************************
 void uLCD_4DGL :: writeBYTE(const char c)   // send a BYTE command to screen
 {
 
-    _cmd.write(&c, 1);
-    wait_us(500);  //mbed is too fast for LCD at high baud rates in some long commands
+    writeBLOCK(&c, 1);
 
 #if DEBUGMODE
     printf("   Char sent : 0x%02X\n",c);
@@ -74,50 +92,108 @@ void uLCD_4DGL :: writeBYTEfast(const char c)   // send a BYTE command to screen
 {
 
     _cmd.write(&c, 1);
-    //wait_us(0.0);  //mbed is too fast for LCD at high baud rates - but not in short commands
 
 #if DEBUGMODE
     printf("   Char sent : 0x%02X\n",c);
 #endif
 
 }
+
+//******************************************************************************************************
+void uLCD_4DGL :: writeBLOCK(const char *data, int number)   // send several BYTES without overrunning the screen
+{
+    // The screen only holds RX_FIFO bytes while it is busy drawing, so send at
+    // most that much in one burst. The one before must have left our TX buffer,
+    // and the screen gets as long again as it spent on the wire to empty its FIFO
+    while (number > 0) {
+        int burst = number < RX_FIFO ? number : RX_FIFO;
+        _cmd.sync();
+        // Sleep through whole ticks of the gap, only the last part of a tick is waited out
+        for (auto left = std::chrono::microseconds(_paceUs) - _pace.elapsed_time(); left.count() > 0;
+             left = std::chrono::microseconds(_paceUs) - _pace.elapsed_time()) {
+            if (left >= 1ms) ThisThread::sleep_for(std::chrono::duration_cast<std::chrono::milliseconds>(left));
+            else wait_us(left.count());
+        }
+        _cmd.write(data, burst);
+        _pace.reset();
+        _paceUs = 2 * burst * 10000000 / _baud;        // 10 bits a byte with start and stop
+        bytes += burst;
+        data += burst;
+        number -= burst;
+    }
+}
+
 //******************************************************************************************************
 void uLCD_4DGL :: freeBUFFER(void)         // Clear serial buffer before writing command
 {
 
-    while (_cmd.readable()) _cmd.truncate(0);
+    while (_pending > 0) readACK();         // collect the answers still owed to posted commands first
+    char junk;
+    while (_cmd.readable()) _cmd.read(&junk, 1);
 }
 
 //******************************************************************************************************
-int uLCD_4DGL :: writeCOMMAND(char *command, int number)   // send several BYTES making a command and return an answer
+bool uLCD_4DGL :: waitANSWER(void)   // wait up to ACK_TIMEOUT for an answer byte
 {
+    return waitANSWER(Kernel::Clock::now() + ACK_TIMEOUT);
+}
 
-#if DEBUGMODE
-    printf("\n");
-    printf("New COMMAND : 0x%02X\n", command[0]);
-#endif
-    int i, resp = 0;
-    freeBUFFER();
-    writeBYTE(0xFF);
-    for (i = 0; i < number; i++) {
-        if (i<16)
-            writeBYTEfast(command[i]); // send command to serial port
-        else
-            writeBYTE(command[i]); // send command to serial port but slower
+//******************************************************************************************************
+bool uLCD_4DGL :: waitANSWER(Kernel::Clock::time_point deadline)   // wait until deadline for an answer byte
+{
+    while (!_cmd.readable()) {
+        Kernel::Clock::time_point now = Kernel::Clock::now();
+        if (now >= deadline) return false;
+        // Asleep until the receive interrupt, so the audio, SD and scan threads run meanwhile
+        _received.wait_any_for(ANSWER_FLAG, deadline - now);
+    }
+    return true;
+}
+
+//******************************************************************************************************
+void uLCD_4DGL :: onRECEIVE(void)   // link's receive interrupt: wake waitANSWER
+{
+    _received.set(ANSWER_FLAG);
+}
+
+//******************************************************************************************************
+int uLCD_4DGL :: readACK(void)   // wait for the oldest posted command's answer
+{
+    int resp = 0;
+    if (!waitANSWER()) {
+        // The oldest answer is late or lost. Collect what the window still owes, the
+        // late one included, so none of it is taken for a command posted after this
+        lost++;
+        for (int owed = _pending; owed > 0 && waitANSWER(); owed--) {
+            _cmd.read(&resp, 1);
+            if (resp == NAK) naks++;
+        }
+        _pending = 0;
+        _inflight = 0;
+        if (_answers > 0) _answers = 0;
+        forgetGLASS();
+        return 0;
+    }
+    _cmd.read(&resp, 1);
+    if (_pending > 0) {
+        _inflight -= _window[_oldest];
+        _oldest = (_oldest + 1) % LCD_WINDOW;
+        _pending--;
     }
-    while (!_cmd.readable()) wait_us(TEMPO);              // wait for screen answer
-    if (_cmd.readable()) _cmd.read(&resp, 1);
     switch (resp) {
         case ACK :                                     // if OK return   1
             resp =  1;
             break;
         case NAK :                                     // if NOK return -1
             resp = -1;
+            naks++;
             break;
         default :
             resp =  0;                                 // else return   0
             break;
     }
+    if (resp < _answers) _answers = resp;
+    if (resp != 1) forgetGLASS();
 #if DEBUGMODE
     printf("   Answer received : %d\n",resp);
 #endif
@@ -125,52 +201,101 @@ int uLCD_4DGL :: writeCOMMAND(char *command, int number)   // send several BYTES
     return resp;
 }
 
-//**************************************************************************
-void uLCD_4DGL :: reset()    // Reset Screen
+//******************************************************************************************************
+void uLCD_4DGL :: forgetGLASS(void)   // a command was refused or went unanswered, the glass is unknown
 {
-    wait_us(5000);
-    _rst = 0;               // put RESET pin to low
-    wait_us(5000);         // wait a few milliseconds for command reception
-    _rst = 1;               // put RESET back to high
-    wait_us(3000000);
+    _glass_col = _glass_row = -1;
+    _glass_color = -1;
+    shadowCLEAR(0);                         // the next print sends every cell again
+}
 
-    freeBUFFER();           // clean buffer from possible garbage
+//******************************************************************************************************
+int uLCD_4DGL :: wait_idle(void)   // block until every posted command is answered
+{
+    while (_pending > 0) readACK();
+    int answers = _answers;
+    _answers = 1;
+    return answers;
 }
+
 //******************************************************************************************************
-int uLCD_4DGL :: writeCOMMANDnull(char *command, int number)   // send several BYTES making a command and return an answer
+int uLCD_4DGL :: writeFRAME(char prefix, char *command, int number)   // post prefix + command, return the worst answer not yet reported
 {
 
 #if DEBUGMODE
     printf("\n");
     printf("New COMMAND : 0x%02X\n", command[0]);
 #endif
-    int i, resp = 0;
-    freeBUFFER();
-    writeBYTE(0x00); //command has a null prefix byte
-    for (i = 0; i < number; i++) {
-        if (i<16) //don't overflow LCD UART buffer
-            writeBYTEfast(command[i]); // send command to serial port
-        else
-            writeBYTE(command[i]); // send command to serial port with delay
-    }
-    while (!_cmd.readable()) wait_us(TEMPO);              // wait for screen answer
-    if (_cmd.readable()) _cmd.read(&resp, 1);
-    switch (resp) {
-        case ACK :                                     // if OK return   1
-            resp =  1;
-            break;
-        case NAK :                                     // if NOK return -1
-            resp = -1;
-            break;
-        default :
-            resp =  0;                                 // else return   0
-            break;
+    STATS_BEGIN(frameStart);
+    char burst[RX_FIFO];
+    int i = 0, n = 0;
+    int size = number + 1 < RX_FIFO ? number + 1 : RX_FIFO;
+    bool paced = number + 1 > RX_FIFO;
+
+    if (paced) {
+        // Nothing answers part of a command, so a long one gets an idle screen
+        // and goes out in FIFO sized bursts paced on the line rate
+        while (_pending > 0) readACK();
+    } else {
+        // Pick up answers that already arrived, then block only while the window
+        // is full or the screen's FIFO can't take this command on top of the rest
+        while (_pending > 0 && _cmd.readable()) readACK();
+        while (_pending > 0 && (_pending >= LCD_WINDOW || _inflight + size > RX_FIFO)) readACK();
     }
-#if DEBUGMODE
-    printf("   Answer received : %d\n",resp);
-#endif
 
-    return resp;
+    burst[n++] = prefix;
+    // Assemble each burst locally so it goes out in a single write
+    do {
+        while (n < RX_FIFO && i < number) burst[n++] = command[i++];
+        if (paced) {
+            writeBLOCK(burst, n);
+        } else {
+            _cmd.write(burst, n);                      // fits the FIFO space the answers vouch for
+            bytes += n;
+        }
+        n = 0;
+    } while (i < number);
+
+    _window[(_oldest + _pending) % LCD_WINDOW] = size;
+    _inflight += size;
+    _pending++;
+    commands++;
+    STATS_END(LCD_COMMAND, frameStart);
+    return _answers;
+}
+
+//******************************************************************************************************
+int uLCD_4DGL :: writeCOMMANDsync(char *command, int number)   // send a command and wait for its answer
+{
+    while (_pending > 0) readACK();
+    writeFRAME(0xFF, command, number);
+    return readACK();
+}
+
+//******************************************************************************************************
+int uLCD_4DGL :: writeCOMMAND(char *command, int number)   // send a command, return the answers to earlier ones that came meanwhile
+{
+    return writeFRAME(0xFF, command, number);
+}
+
+//**************************************************************************
+void uLCD_4DGL :: reset()    // Reset Screen
+{
+    wait_us(5000);
+    _cmd.reset_line(0);     // put RESET pin to low
+    wait_us(5000);         // wait a few milliseconds for command reception
+    _cmd.reset_line(1);     // put RESET back to high
+    wait_us(3000000);
+    _pending = 0;           // answers to anything posted before the reset will never come
+    _inflight = 0;
+    _answers = 1;
+
+    freeBUFFER();           // clean buffer from possible garbage
+}
+//******************************************************************************************************
+int uLCD_4DGL :: writeCOMMANDnull(char *command, int number)   // send several BYTES making a command and return an answer
+{
+    return writeFRAME(0x00, command, number);   //command has a null prefix byte
 }
 
 //**************************************************************************
@@ -185,6 +310,8 @@ void uLCD_4DGL :: cls()    // clear screen
     current_hf = 1;
     current_wf = 1;
     set_font(FONT_7X8);                 // initial font
+    _glass_col = _glass_row = -1;
+    shadowCLEAR(' ');                   // glass is blank now
 }
 
 //**************************************************************************
@@ -198,9 +325,10 @@ int uLCD_4DGL :: version()    // get API version
 }
 
 //**************************************************************************
-void uLCD_4DGL :: baudrate(int speed)    // set screen baud rate
+int uLCD_4DGL :: baudrate(int speed)    // set screen baud rate, returns the screen's answer
 {
     char command[3]= "";
+    while (_pending > 0) readACK();      // posted commands answer at the old rate, before the prefix goes out
     writeBYTE(0x00);
     command[0] = BAUDRATE;
     command[1] = 0;
@@ -296,13 +424,10 @@ void uLCD_4DGL :: baudrate(int speed)    // set screen baud rate
     for (i = 0; i <3; i++) writeBYTEfast(command[i]);      // send command to serial port
     for (i = 0; i<10; i++) wait_us(1000);
     //dont change baud until all characters get sent out
+    //the answer comes back at the new rate, but only keep it once the screen agrees
     _cmd.set_baud(speed);
-    i=0;
-    while ((!_cmd.readable()) && (i<25000)) {
-        wait_us(TEMPO);           // wait for screen answer - comes 100ms after change
-        i++; //timeout if ack character missed by baud change
-    }
-    if (_cmd.readable()) _cmd.read(&resp, 1);
+    // wait for screen answer - comes 100ms after change, timeout if ack character missed by baud change
+    if (waitANSWER(Kernel::Clock::now() + 250ms)) _cmd.read(&resp, 1);
     switch (resp) {
         case ACK :                                     // if OK return   1
             resp =  1;
@@ -314,18 +439,72 @@ void uLCD_4DGL :: baudrate(int speed)    // set screen baud rate
             resp =  0;                                 // else return   0
             break;
     }
+    // The screen switches before it answers, so a lost or garbled answer may
+    // still mean it moved; only go back to the old rate if the new one is silent
+    if (resp != 1 && probeLINK(1)) resp = 1;
+    if (resp == 1) {
+        _baud = speed;
+    } else {
+        _cmd.set_baud(_baud);                          // back to the last rate the screen accepted
+    }
+    return resp;
+}
+
+//******************************************************************************************************
+bool uLCD_4DGL :: probeLINK(int tries)   // check the screen answers at our UART's rate
+{
+    // Moving the cursor to where it already is changes nothing on the glass
+    char command[5];
+    command[0] = MOVECURSOR;
+    command[1] = 0;
+    command[2] = current_row;
+    command[3] = 0;
+    command[4] = current_col < max_col ? current_col : max_col - 1;  // a full line waits to wrap at max_col
+    for (int i = 0; i < tries; i++) {
+        if (writeCOMMANDsync(command, 5) != 1) return false;
+    }
+    return true;
+}
+
+//******************************************************************************************************
+int uLCD_4DGL :: auto_baudrate(int max_speed)    // negotiate the fastest working baud rate
+{
+    // Rates the LPC1768 UART can hit from its 24MHz peripheral clock, fastest first
+    static const int speeds[] = { 1500000, 1000000, 750000, 600000, 375000, 256000, 115200, 57600, 9600 };
+    for (unsigned s = 0; s < ARRAY_SIZE(speeds); s++) {
+        if (speeds[s] > max_speed) continue;
+        // baudrate() leaves our UART on the new rate only when the screen answers
+        // there; otherwise the screen must still answer on the old one, or nothing
+        // sent from here on would reach it and only a reset helps
+        if (baudrate(speeds[s]) != 1) {
+            if (!probeLINK(1)) break;
+            continue;
+        }
+        // Prove the link with a few round trips before trusting it
+        if (probeLINK(3)) return _baud;
+    }
+    // Nothing answered, start over from the screen's power up rate
+    bool opaque = _opaque;
+    _cmd.set_baud(9600);
+    _baud = 9600;
+    reset();
+    // The reset blanked the glass and dropped the font and text mode, bring them and the shadow back
+    cls();
+    text_mode(opaque ? OPAQUE : TRANSPARENT);
+    _glass_color = -1;
+    return _baud;
 }
 
 //******************************************************************************************************
 int uLCD_4DGL :: readVERSION(char *command, int number)   // read screen info and populate data
 {
 
-    int i, temp = 0, resp = 0;
+    int temp = 0, resp = 0;
     char response[5] = "";
 
     freeBUFFER();
 
-    for (i = 0; i < number; i++) writeBYTE(command[i]);    // send all chars to serial port
+    writeBLOCK(command, number);                           // send all chars to serial port
 
     while (!_cmd.readable()) wait_us(TEMPO);               // wait for screen answer
 
@@ -377,6 +556,7 @@ void uLCD_4DGL :: textbackground_color(int color)              // set screen bac
     command[2] = ((green6 << 5) + (blue5 >>  0)) & 0xFF;  // second part of 16 bits color
 
     writeCOMMAND(command, 3);
+    shadowCLEAR(0);                                       // blanks on the glass keep the old colour
 }
 
 //****************************************************************************************************
@@ -406,6 +586,7 @@ void uLCD_4DGL :: display_control(char mode)     // set screen mode to value
     }
     writeCOMMAND(command, 3);
     set_font(current_font);
+    shadowCLEAR(0);
 }
 //****************************************************************************************************
 void uLCD_4DGL :: display_power(char mode)     // set screen mode to value
@@ -438,12 +619,12 @@ int uLCD_4DGL :: getSTATUS(char *command, int number)   // read screen info and
     printf("New COMMAND : 0x%02X\n", command[0]);
 #endif
 
-    int i, temp = 0, resp = 0;
+    int temp = 0, resp = 0;
     char response[5] = "";
 
     freeBUFFER();
 
-    for (i = 0; i < number; i++) writeBYTE(command[i]);    // send all chars to serial port
+    writeBLOCK(command, number);                           // send all chars to serial port
 
     while (!_cmd.readable()) wait_us(TEMPO);    // wait for screen answer
 